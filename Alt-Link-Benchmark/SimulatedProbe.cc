@@ -0,0 +1,475 @@
+#include "stdafx.h"
+#include "SimulatedProbe.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// CMSIS-DAP コマンド
+#define CMD_INFO			0x00
+#define CMD_LED				0x01
+#define CMD_CONNECT			0x02
+#define CMD_DISCONNECT		0x03
+#define CMD_TX_CONF			0x04
+#define CMD_TX				0x05
+#define CMD_TX_BLOCK		0x06
+#define CMD_WRITE_ABORT		0x08
+#define CMD_SWJ_PINS		0x10
+#define CMD_SWJ_CLOCK		0x11
+#define CMD_SWJ_SEQ			0x12
+#define CMD_SWD_CONF		0x13
+
+#define DAP_RES_OK			0x00
+#define DAP_RES_ERR			0xFF
+#define TX_ACK_OK			0x01
+
+// Transfer Request
+#define REQ_APnDP			(1 << 0)
+#define REQ_RnW				(1 << 1)
+#define REQ_A32				(3 << 2)
+#define REQ_VALUE_MATCH		(1 << 4)
+#define REQ_MATCH_MASK		(1 << 5)
+
+#define DP_IDCODE_VALUE		0x2BA01477	// SW-DP (Cortex-M4)
+#define AP_IDR_VALUE		0x24770011	// AHB-AP
+#define ROM_TABLE_BASE		0xE00FF000
+#define SCS_BASE			0xE000E000
+#define DWT_BASE			0xE0001000
+#define FPB_BASE			0xE0002000
+
+#define REG_CPUID			(SCS_BASE + 0xD00)
+#define REG_DHCSR			(SCS_BASE + 0xDF0)
+#define REG_DCRSR			(SCS_BASE + 0xDF4)
+#define REG_DCRDR			(SCS_BASE + 0xDF8)
+
+#define CID_CLASS_ROM_TABLE		0x1
+#define CID_CLASS_GENERIC_IP	0xE
+
+static void put32(std::vector<uint8_t>* rsp, uint32_t value)
+{
+	rsp->push_back((uint8_t)value);
+	rsp->push_back((uint8_t)(value >> 8));
+	rsp->push_back((uint8_t)(value >> 16));
+	rsp->push_back((uint8_t)(value >> 24));
+}
+
+static uint32_t get32(const uint8_t* buf)
+{
+	return (uint32_t)(buf[0] | buf[1] << 8 | buf[2] << 16 | buf[3] << 24);
+}
+
+SimulatedProbe::SimulatedProbe(const Config& _config)
+	: config(_config), packets(0), ctrlStat(0), select(0), rdbuff(0), csw(0), tar(0), dcrdr(0), ram(_config.ramSize)
+{
+	// ROM table から SCS, DWT, FPB を辿れるようにする
+	addComponent(ROM_TABLE_BASE, CID_CLASS_ROM_TABLE, 0x4C4);
+	addComponent(SCS_BASE, CID_CLASS_GENERIC_IP, 0x00C);
+	addComponent(DWT_BASE, CID_CLASS_GENERIC_IP, 0x002);
+	addComponent(FPB_BASE, CID_CLASS_GENERIC_IP, 0x003);
+
+	uint32_t entry = ROM_TABLE_BASE;
+	for (uint32_t base : { SCS_BASE, DWT_BASE, FPB_BASE })
+	{
+		io[entry] = ((base - ROM_TABLE_BASE) & 0xFFFFF000) | 0x3;	// FORMAT, PRESENT
+		entry += 4;
+	}
+	io[entry] = 0;
+	io[ROM_TABLE_BASE + 0xFCC] = 1;	// MEMTYPE: SYSMEM
+
+	io[REG_CPUID] = 0x410FC241;
+	io[DWT_BASE] = 0x40000000;		// NUMCOMP: 4
+	io[FPB_BASE] = 0x00000260;		// NUM_CODE: 6, NUM_LIT: 2
+
+	// 停止中のコアのレジスタ
+	for (uint32_t i = 0; i < 21; i++)
+		coreRegs[i] = i;
+	coreRegs[13] = config.ramBase + config.ramSize;
+	coreRegs[14] = 0xFFFFFFFF;
+	coreRegs[15] = 0x00000400;
+	coreRegs[16] = 0x01000000;
+}
+
+void SimulatedProbe::addComponent(uint32_t base, uint32_t cidClass, uint32_t part)
+{
+	// JEP106: ARM (continuation 4, identity 0x3B)
+	io[base + 0xFE0] = part & 0xFF;
+	io[base + 0xFE4] = ((part >> 8) & 0xF) | ((0x3B & 0xF) << 4);
+	io[base + 0xFE8] = ((0x3B >> 4) & 0x7) | 0x08;
+	io[base + 0xFEC] = 0;
+	io[base + 0xFD0] = 0x04;
+
+	io[base + 0xFF0] = 0x0D;
+	io[base + 0xFF4] = cidClass << 4;
+	io[base + 0xFF8] = 0x05;
+	io[base + 0xFFC] = 0xB1;
+}
+
+std::vector<HIDDevice::Info> SimulatedProbe::enumerate()
+{
+	return { { "sim", "Simulated CMSIS-DAP", "SIM0", L"Simulated CMSIS-DAP", L"SIM0", 0xC251, 0xF002 } };
+}
+
+bool SimulatedProbe::open(const Info&)
+{
+	return true;
+}
+
+void SimulatedProbe::close()
+{
+	responses.clear();
+}
+
+int SimulatedProbe::write(const uint8_t* data, size_t length)
+{
+	// data[0] は HID の report id
+	if (length < 2)
+		return -1;
+
+	Response response;
+	process(data + 1, length - 1, &response.data);
+	response.data.resize(PACKET_SIZE, 0);
+
+	// 応答は送信から latencyUs 後, かつ前の応答から intervalUs 後に届く
+	auto now = std::chrono::steady_clock::now();
+	response.ready = now + std::chrono::microseconds(config.latencyUs);
+	if (packets > 0)
+		response.ready = std::max(response.ready, lastReady + std::chrono::microseconds(config.intervalUs));
+	lastReady = response.ready;
+
+	responses.push_back(response);
+	packets++;
+	return (int)length;
+}
+
+int SimulatedProbe::read(uint8_t* data, size_t length)
+{
+	if (responses.empty())
+		return 0;	// timeout
+
+	// sleep では数十 us の誤差が出るので待ち合わせは spin で行う
+	Response& response = responses.front();
+	while (std::chrono::steady_clock::now() < response.ready)
+		std::this_thread::yield();
+
+	size_t n = std::min(length, response.data.size());
+	memcpy(data, response.data.data(), n);
+	responses.pop_front();
+	return (int)n;
+}
+
+void SimulatedProbe::process(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp)
+{
+	rsp->push_back(cmd[0]);
+
+	switch (cmd[0])
+	{
+	case CMD_INFO:
+		processInfo(length > 1 ? cmd[1] : 0, rsp);
+		break;
+	case CMD_CONNECT:
+		rsp->push_back(length > 1 && cmd[1] != 0 ? cmd[1] : 1);	// default: SWD
+		break;
+	case CMD_TX:
+		processTransfer(cmd, length, rsp);
+		break;
+	case CMD_TX_BLOCK:
+		processTransferBlock(cmd, length, rsp);
+		break;
+	case CMD_SWJ_PINS:
+		rsp->push_back(0xFF);
+		break;
+	case CMD_LED:
+	case CMD_DISCONNECT:
+	case CMD_TX_CONF:
+	case CMD_WRITE_ABORT:
+	case CMD_SWJ_CLOCK:
+	case CMD_SWJ_SEQ:
+	case CMD_SWD_CONF:
+		rsp->push_back(DAP_RES_OK);
+		break;
+	default:
+		rsp->back() = DAP_RES_ERR;	// DAP_Invalid
+		break;
+	}
+}
+
+void SimulatedProbe::processInfo(uint8_t id, std::vector<uint8_t>* rsp)
+{
+	auto putString = [rsp](const std::string& str)
+	{
+		rsp->push_back((uint8_t)(str.size() + 1));
+		rsp->insert(rsp->end(), str.begin(), str.end());
+		rsp->push_back(0);
+	};
+
+	switch (id)
+	{
+	case 0x01:	// Vendor
+		putString("Alt-Link");
+		break;
+	case 0x02:	// Product
+		putString("Simulated CMSIS-DAP");
+		break;
+	case 0x03:	// Serial Number
+		putString("SIM0");
+		break;
+	case 0x04:	// Firmware Version
+		putString("1.10");
+		break;
+	case 0xF0:	// Capabilities: SWD
+		rsp->push_back(1);
+		rsp->push_back(0x01);
+		break;
+	case 0xFE:	// Packet Count
+		rsp->push_back(1);
+		rsp->push_back(config.packetCount);
+		break;
+	case 0xFF:	// Packet Size
+		rsp->push_back(2);
+		rsp->push_back((uint8_t)PACKET_SIZE);
+		rsp->push_back((uint8_t)(PACKET_SIZE >> 8));
+		break;
+	default:
+		rsp->push_back(0);
+		break;
+	}
+}
+
+void SimulatedProbe::processTransfer(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp)
+{
+	// cmd: command, DAP index, transfer count, (request, [data])...
+	// rsp: command, transfer count, transfer response, [data]...
+	uint8_t count = length > 2 ? cmd[2] : 0;
+	std::vector<uint8_t> data;
+
+	size_t offset = 3;
+	uint8_t done = 0;
+	for (; done < count && offset < length; done++)
+	{
+		uint8_t request = cmd[offset++];
+		bool hasData = !(request & REQ_RnW) || (request & REQ_VALUE_MATCH);
+		uint32_t wdata = 0;
+		if (hasData)
+		{
+			if (offset + 4 > length)
+				break;
+			wdata = get32(&cmd[offset]);
+			offset += 4;
+		}
+
+		// value match の比較は常に一致したものとして扱う
+		uint32_t value = transfer(request, wdata);
+		if ((request & REQ_RnW) && !(request & REQ_VALUE_MATCH))
+			put32(&data, value);
+	}
+
+	rsp->push_back(done);
+	rsp->push_back(TX_ACK_OK);
+	rsp->insert(rsp->end(), data.begin(), data.end());
+}
+
+void SimulatedProbe::processTransferBlock(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp)
+{
+	// cmd: command, DAP index, transfer count (2), request, [data]...
+	// rsp: command, transfer count (2), transfer response, [data]...
+	if (length < 5)
+	{
+		rsp->push_back(0);
+		rsp->push_back(0);
+		rsp->push_back(0);
+		return;
+	}
+
+	uint32_t count = cmd[2] | (cmd[3] << 8);
+	uint8_t request = cmd[4];
+	std::vector<uint8_t> data;
+
+	uint32_t done = 0;
+	size_t offset = 5;
+	for (; done < count; done++)
+	{
+		if (request & REQ_RnW)
+		{
+			put32(&data, transfer(request, 0));
+		}
+		else
+		{
+			if (offset + 4 > length)
+				break;
+			transfer(request, get32(&cmd[offset]));
+			offset += 4;
+		}
+	}
+
+	rsp->push_back((uint8_t)done);
+	rsp->push_back((uint8_t)(done >> 8));
+	rsp->push_back(TX_ACK_OK);
+	rsp->insert(rsp->end(), data.begin(), data.end());
+}
+
+uint32_t SimulatedProbe::transfer(uint8_t request, uint32_t wdata)
+{
+	uint32_t a = request & REQ_A32;
+
+	// AP の読み出し結果はプローブが RDBUFF まで読んで返すので, ここでは直接値を返す
+	if (request & REQ_APnDP)
+	{
+		uint32_t reg = (select & 0xF0) | a;
+		if (request & REQ_RnW)
+			return rdbuff = apRead(reg);
+
+		apWrite(reg, wdata);
+		return 0;
+	}
+
+	if (request & REQ_RnW)
+	{
+		switch (a)
+		{
+		case 0x0:
+			return DP_IDCODE_VALUE;
+		case 0x4:
+			// 電源要求はすぐに ACK を返す
+			return ctrlStat | ((ctrlStat & (1UL << 28)) << 1) | ((ctrlStat & (1UL << 30)) << 1);
+		default:
+			return rdbuff;
+		}
+	}
+
+	switch (a)
+	{
+	case 0x4:
+		ctrlStat = wdata & ~0xA0000000;
+		break;
+	case 0x8:
+		select = wdata;
+		break;
+	}
+	return 0;
+}
+
+uint32_t SimulatedProbe::apRead(uint32_t reg)
+{
+	// AP-0 のみ
+	if ((select >> 24) != 0)
+		return 0;
+
+	switch (reg)
+	{
+	case 0x00:	// CSW
+		return csw | (1 << 6);	// DeviceEn
+	case 0x04:	// TAR
+		return tar;
+	case 0x0C:	// DRW
+	{
+		uint32_t value = memRead(tar & ~3);
+		advanceTAR();
+		return value;
+	}
+	case 0x10:	// BD0-3
+	case 0x14:
+	case 0x18:
+	case 0x1C:
+		return memRead((tar & ~0xF) | (reg & 0xC));
+	case 0xF8:	// BASE
+		return ROM_TABLE_BASE | 0x3;
+	case 0xFC:	// IDR
+		return AP_IDR_VALUE;
+	}
+	return 0;
+}
+
+void SimulatedProbe::apWrite(uint32_t reg, uint32_t value)
+{
+	if ((select >> 24) != 0)
+		return;
+
+	switch (reg)
+	{
+	case 0x00:
+		csw = value;
+		break;
+	case 0x04:
+		tar = value;
+		break;
+	case 0x0C:
+		memWrite(tar, value, csw & 0x7);
+		advanceTAR();
+		break;
+	case 0x10:
+	case 0x14:
+	case 0x18:
+	case 0x1C:
+		memWrite((tar & ~0xF) | (reg & 0xC), value, 2);
+		break;
+	}
+}
+
+void SimulatedProbe::advanceTAR()
+{
+	if (((csw >> 4) & 0x3) == 0)
+		return;
+
+	// auto increment は 1KB の境界で折り返す
+	uint32_t size = 1 << (csw & 0x7);
+	tar = (tar & ~0x3FF) | ((tar + size) & 0x3FF);
+}
+
+uint32_t SimulatedProbe::memRead(uint32_t addr)
+{
+	if (addr >= config.ramBase && addr - config.ramBase + 4 <= config.ramSize)
+		return get32(&ram[addr - config.ramBase]);
+
+	switch (addr)
+	{
+	case REG_DHCSR:
+		return 0x00030003;	// S_HALT, S_REGRDY, C_HALT, C_DEBUGEN
+	case REG_DCRDR:
+		return dcrdr;
+	}
+
+	auto it = io.find(addr);
+	return it != io.end() ? it->second : 0;
+}
+
+void SimulatedProbe::memWrite(uint32_t addr, uint32_t value, uint32_t size)
+{
+	// DRW のデータはアドレスに対応するバイトレーンに載っている
+	uint32_t bytes = size == 0 ? 1 : size == 1 ? 2 : 4;
+	addr &= ~(bytes - 1);
+	uint32_t shift = (addr & 3) * 8;
+
+	if (addr >= config.ramBase && addr - config.ramBase + bytes <= config.ramSize)
+	{
+		for (uint32_t i = 0; i < bytes; i++)
+			ram[addr - config.ramBase + i] = (uint8_t)(value >> (shift + i * 8));
+		return;
+	}
+
+	uint32_t aligned = addr & ~3;
+	switch (aligned)
+	{
+	case REG_DHCSR:
+		return;	// 常に停止しているものとして扱う
+	case REG_DCRSR:
+	{
+		uint32_t n = value & 0x1F;
+		if (n < 21)
+		{
+			if (value & (1 << 16))	// REGWnR
+				coreRegs[n] = dcrdr;
+			else
+				dcrdr = coreRegs[n];
+		}
+		return;
+	}
+	case REG_DCRDR:
+		dcrdr = value;
+		return;
+	}
+
+	uint32_t mask = bytes == 4 ? 0xFFFFFFFF : ((1UL << (bytes * 8)) - 1) << shift;
+	uint32_t& word = io[aligned];
+	word = (word & ~mask) | (value & mask);
+}
@@ -0,0 +1,84 @@
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "HIDDevice.h"
+
+// CMSIS-DAP プローブと Cortex-M4 相当のターゲット (SW-DP, AHB-AP, ROM table, SCS/DWT/FPB, RAM) を模擬する HID デバイス
+// write() で受け取ったコマンドはすぐに処理し, 応答は USB の往復時間を模して latencyUs 後に read() で返す
+class SimulatedProbe : public HIDDevice
+{
+public:
+	struct Config
+	{
+		uint32_t latencyUs;		// コマンドを送ってから応答が読めるまでの時間
+		uint32_t intervalUs;	// 応答どうしの最小間隔 (USB のフレーム間隔)
+		uint8_t packetCount;	// DAP_Info で返す Packet Count
+		uint32_t ramBase;
+		uint32_t ramSize;
+
+		Config() : latencyUs(125), intervalUs(0), packetCount(4), ramBase(0x20000000), ramSize(0x40000) {}
+	};
+
+	explicit SimulatedProbe(const Config& _config);
+
+	virtual std::vector<Info> enumerate();
+	virtual bool open(const Info& info);
+	virtual void close();
+	virtual int write(const uint8_t* data, size_t length);
+	virtual int read(uint8_t* data, size_t length);
+
+	const Config& getConfig() const { return config; }
+	uint64_t getPacketCount() const { return packets; }
+	// ARMv6MSCS::REGSEL の番号で指定する
+	void setCoreRegister(uint32_t n, uint32_t value) { coreRegs[n] = value; }
+
+	static const uint32_t PACKET_SIZE = 64;
+
+private:
+	struct Response
+	{
+		std::vector<uint8_t> data;
+		std::chrono::steady_clock::time_point ready;
+	};
+
+	Config config;
+	std::deque<Response> responses;
+	std::chrono::steady_clock::time_point lastReady;
+	uint64_t packets;
+
+	// DP
+	uint32_t ctrlStat;
+	uint32_t select;
+	uint32_t rdbuff;
+
+	// MEM-AP
+	uint32_t csw;
+	uint32_t tar;
+
+	// SCS
+	uint32_t dcrdr;
+	uint32_t coreRegs[21];
+
+	std::vector<uint8_t> ram;
+	std::map<uint32_t, uint32_t> io;	// RAM 以外 (ROM table, debug component)
+
+	void process(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp);
+	void processInfo(uint8_t id, std::vector<uint8_t>* rsp);
+	void processTransfer(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp);
+	void processTransferBlock(const uint8_t* cmd, size_t length, std::vector<uint8_t>* rsp);
+
+	uint32_t transfer(uint8_t request, uint32_t wdata);
+	uint32_t apRead(uint32_t reg);
+	void apWrite(uint32_t reg, uint32_t value);
+	void advanceTAR();
+
+	uint32_t memRead(uint32_t addr);
+	void memWrite(uint32_t addr, uint32_t value, uint32_t size);
+	void addComponent(uint32_t base, uint32_t cidClass, uint32_t part);
+};
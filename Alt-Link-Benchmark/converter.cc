@@ -0,0 +1,138 @@
+
+#include "stdafx.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Converter.h"
+
+// 比較用の旧実装 (stringstream / 1 文字ずつ)
+namespace reference
+{
+	std::string toHex(const std::vector<uint8_t>& array)
+	{
+		std::stringstream stream;
+		for (uint8_t data : array)
+			stream << std::setfill('0') << std::setw(2) << std::hex << (unsigned)data;
+		return stream.str();
+	}
+
+	std::vector<uint8_t> toByteArray(const std::string& hex)
+	{
+		std::vector<uint8_t> array;
+		std::stringstream stream;
+		for (size_t offset = 0; offset < hex.length(); offset += 2)
+		{
+			uint32_t data;
+			stream << std::hex << hex.substr(offset, 2);
+			stream >> std::hex >> data;
+			stream.clear();
+			array.push_back((uint8_t)data);
+		}
+		return array;
+	}
+
+	uint8_t checksum(const std::string& data)
+	{
+		uint32_t sum = 0;
+		for (char c : data)
+			sum = (sum + (uint8_t)c) % 256;
+		return (uint8_t)sum;
+	}
+
+	std::string escape(const std::string& data)
+	{
+		std::string escaped;
+		for (char c : data)
+		{
+			if (c == '#' || c == '$' || c == '}' || c == '*')
+			{
+				escaped.push_back('}');
+				escaped.push_back(c ^ 0x20);
+			}
+			else
+			{
+				escaped.push_back(c);
+			}
+		}
+		return escaped;
+	}
+}
+
+template <typename F>
+static void run(const char* name, size_t bytes, uint32_t iterations, F func)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+		func();
+	auto end = std::chrono::steady_clock::now();
+
+	double sec = std::chrono::duration<double>(end - start).count();
+	printf("%-24s %10.1f MB/s\n", name, (double)bytes * iterations / sec / (1024 * 1024));
+}
+
+static bool verify(const std::vector<uint8_t>& data, const std::string& text)
+{
+	bool ok = true;
+
+	std::string hex = Converter::toHex(data);
+	ok &= hex == reference::toHex(data);
+	ok &= Converter::toByteArray(hex) == data;
+	ok &= Converter::checksum(text.data(), text.length()) == reference::checksum(text);
+
+	std::string escaped, unescaped;
+	Converter::escape(text, &escaped);
+	ok &= escaped == reference::escape(text);
+	Converter::unescape(escaped, &unescaped);
+	ok &= unescaped == text;
+
+	return ok;
+}
+
+int main()
+{
+	const size_t SIZE = 64 * 1024;
+	const uint32_t ITERATIONS = 200;
+
+	std::mt19937 rand(0);
+	std::vector<uint8_t> data(SIZE);
+	for (auto& d : data)
+		d = (uint8_t)rand();
+	std::string text(data.begin(), data.end());
+
+	// SIMD 部分と端数処理の境界を含むサイズで検証する
+	for (size_t len = 0; len < 100; len++)
+	{
+		std::vector<uint8_t> sub(data.begin(), data.begin() + len);
+		if (!verify(sub, std::string(sub.begin(), sub.end())))
+		{
+			printf("verify failed (length %zu)\n", len);
+			return 1;
+		}
+	}
+	if (!verify(data, text) || !Converter::toByteArray("0g").empty())
+	{
+		printf("verify failed\n");
+		return 1;
+	}
+
+	std::string hex = Converter::toHex(data);
+	std::string escaped;
+	Converter::escape(text, &escaped);
+	std::string out;
+	volatile uint8_t sink = 0;
+
+	run("toHex (reference)", SIZE, ITERATIONS / 10, [&]() { sink += reference::toHex(data)[0]; });
+	run("toHex", SIZE, ITERATIONS, [&]() { sink += Converter::toHex(data)[0]; });
+	run("toByteArray (reference)", SIZE, ITERATIONS / 10, [&]() { sink += reference::toByteArray(hex)[0]; });
+	run("toByteArray", SIZE, ITERATIONS, [&]() { sink += Converter::toByteArray(hex)[0]; });
+	run("checksum (reference)", SIZE, ITERATIONS, [&]() { sink += reference::checksum(text); });
+	run("checksum", SIZE, ITERATIONS, [&]() { sink += Converter::checksum(text.data(), text.length()); });
+	run("escape (reference)", SIZE, ITERATIONS, [&]() { sink += reference::escape(text)[0]; });
+	run("escape", SIZE, ITERATIONS, [&]() { Converter::escape(text, &out); sink += out[0]; });
+	run("unescape", SIZE, ITERATIONS, [&]() { Converter::unescape(escaped, &out); sink += out[0]; });
+
+	return 0;
+}
@@ -0,0 +1,328 @@
+#include "stdafx.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Alt-Link.h"
+#include "RemoteSerialProtocol.h"
+#include "SimulatedProbe.h"
+
+// プローブもターゲットも繋がっていない環境で, 模擬 CMSIS-DAP を相手にスタック全体の性能を測る
+// usage: target-benchmark [--latency-us <n>] [--interval-us <n>] [--packet-count <n>] [--min-time-ms <n>] [--output <file>]
+
+struct Result
+{
+	std::string name;
+	std::string unit;
+	double value;
+	uint64_t iterations;
+	double packets;		// 1 回あたりの USB パケット数
+
+	template <class Archive>
+	void serialize(Archive & archive)
+	{
+		archive(CEREAL_NVP(name), CEREAL_NVP(unit), CEREAL_NVP(value), CEREAL_NVP(iterations), CEREAL_NVP(packets));
+	}
+};
+
+struct Options
+{
+	SimulatedProbe::Config probe;
+	uint32_t minTimeMs = 200;
+	std::string output = "target-benchmark.json";
+};
+
+// gdb からのパケットを流し込み, 応答は捨てる
+class BenchmarkRSP : public RemoteSerialProtocol
+{
+public:
+	explicit BenchmarkRSP(TargetInterface& ti) : RemoteSerialProtocol(ti), sent(0) {}
+
+	std::string packet(const std::string& payload) { return makePacket(payload).toString(); }
+	const std::string& getLastSent() const { return last; }
+	uint64_t getSentBytes() const { return sent; }
+
+private:
+	std::string last;
+	uint64_t sent;
+
+	int32_t send(const std::string& data)
+	{
+		last = data;
+		sent += data.size();
+		return (int32_t)data.size();
+	}
+};
+
+// パケットの切り出しと checksum の確認だけを行う
+class PacketCounter : public PacketTransfer
+{
+public:
+	PacketCounter() : received(0) {}
+
+	std::string packet(const std::string& payload) { return makePacket(payload).toString(); }
+	uint64_t getReceived() const { return received; }
+
+private:
+	uint64_t received;
+
+	void requestResend() {}
+	void errorPacketReceived() {}
+	void interruptReceived() {}
+	void packetReceived(const std::string&) { received++; }
+};
+
+class Benchmark
+{
+public:
+	Benchmark(const Options& _options, std::shared_ptr<SimulatedProbe> _probe) : options(_options), probe(_probe) {}
+
+	// 1 回の func で units だけ処理したとして毎秒の処理量を記録する
+	bool rate(const std::string& name, const std::string& unit, double units, std::function<errno_t()> func)
+	{
+		double sec;
+		uint64_t iterations;
+		double packets;
+		if (!run(name, func, &sec, &iterations, &packets))
+			return false;
+
+		results.push_back({ name, unit, units * iterations / sec, iterations, packets });
+		return true;
+	}
+
+	bool rateMB(const std::string& name, uint32_t bytes, std::function<errno_t()> func)
+	{
+		return rate(name, "MB/s", (double)bytes / (1024 * 1024), func);
+	}
+
+	// 1 回あたりの所要時間 (us) を記録する
+	bool latency(const std::string& name, std::function<errno_t()> func)
+	{
+		double sec;
+		uint64_t iterations;
+		double packets;
+		if (!run(name, func, &sec, &iterations, &packets))
+			return false;
+
+		results.push_back({ name, "us", sec * 1e6 / iterations, iterations, packets });
+		return true;
+	}
+
+	const std::vector<Result>& getResults() const { return results; }
+
+private:
+	const Options& options;
+	std::shared_ptr<SimulatedProbe> probe;
+	std::vector<Result> results;
+
+	bool run(const std::string& name, std::function<errno_t()> func, double* sec, uint64_t* iterations, double* packets)
+	{
+		uint64_t startPackets = probe->getPacketCount();
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::milliseconds(options.minTimeMs);
+
+		uint64_t n = 0;
+		auto now = start;
+		do
+		{
+			errno_t ret = func();
+			if (ret != OK)
+			{
+				_ERRPRT("%s failed. (0x%08x)\n", name.c_str(), ret);
+				return false;
+			}
+			n++;
+			now = std::chrono::steady_clock::now();
+		} while (now < end);
+
+		*sec = std::chrono::duration<double>(now - start).count();
+		*iterations = n;
+		*packets = (double)(probe->getPacketCount() - startPackets) / n;
+		return true;
+	}
+};
+
+static bool parseArgs(int argc, char* argv[], Options* options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+			return false;
+
+		std::string name = argv[i];
+		std::string value = argv[++i];
+		uint32_t n = (uint32_t)strtoul(value.c_str(), nullptr, 0);
+
+		if (name == "--latency-us")
+			options->probe.latencyUs = n;
+		else if (name == "--interval-us")
+			options->probe.intervalUs = n;
+		else if (name == "--packet-count")
+			options->probe.packetCount = (uint8_t)(n > 0 && n < 256 ? n : 1);
+		else if (name == "--min-time-ms")
+			options->minTimeMs = n;
+		else if (name == "--output")
+			options->output = value;
+		else
+			return false;
+	}
+	return true;
+}
+
+static std::vector<uint8_t> makePattern(uint32_t size, uint32_t seed)
+{
+	std::vector<uint8_t> data(size);
+	for (uint32_t i = 0; i < size; i++)
+		data[i] = (uint8_t)(i * 7 + seed);
+	return data;
+}
+
+// 端数や auto increment の境界をまたぐアクセスで書いた値が読み戻せることを確認する
+static bool verify(ADIv5TI& ti, uint32_t base)
+{
+	const uint32_t cases[][2] = { { 0, 4 }, { 0, 7 }, { 4, 2 }, { 8, 1 }, { 0x3FC, 8 }, { 0x100, 0x1001 } };
+	uint32_t seed = 0;
+	for (auto c : cases)
+	{
+		auto data = makePattern(c[1], seed++);
+		if (ti.writeMemory(base + c[0], c[1], data) != OK)
+			return false;
+
+		std::vector<uint8_t> read;
+		if (ti.readMemory(base + c[0], c[1], &read) != OK || read != data)
+		{
+			_ERRPRT("verify failed (offset 0x%x, length 0x%x)\n", c[0], c[1]);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!parseArgs(argc, argv, &options))
+	{
+		_ERRPRT("usage: target-benchmark [--latency-us <n>] [--interval-us <n>] [--packet-count <n>] [--min-time-ms <n>] [--output <file>]\n");
+		return EINVAL;
+	}
+
+	auto probe = std::make_shared<SimulatedProbe>(options.probe);
+	auto info = probe->enumerate()[0];
+	auto device = std::make_shared<AltLink::Device>(info, [probe]() { return probe; });
+
+	errno_t ret = device->open();
+	if (ret == OK)
+		ret = device->setConnectionType(CMSISDAP::SWJ_SWD);
+	if (ret == OK)
+		ret = device->scan();
+	if (ret != OK)
+	{
+		_ERRPRT("Failed to set up the simulated target. (0x%08x)\n", ret);
+		return ret;
+	}
+
+	auto dap = device->getDAP();
+	auto ti = device->getTI();
+	const uint32_t base = options.probe.ramBase;
+
+	if (!verify(*ti, base))
+		return EFAULT;
+
+	Benchmark bench(options, probe);
+	bool ok = true;
+
+	// DP/AP の転送. 単発は往復時間, まとめた場合はパケットへの詰め込みで決まる
+	uint32_t idcode;
+	ok = ok && bench.rate("transfer.single", "transfers/s", 1, [&]() { return dap->dpRead(0x0, &idcode); });
+
+	const uint32_t BATCH = 256;
+	std::vector<uint32_t> values(BATCH);
+	std::vector<DAP::Transfer> transfers;
+	for (uint32_t i = 0; i < BATCH; i++)
+		transfers.push_back({ false, true, 0x4, 0, &values[i] });	// CTRL/STAT
+	ok = ok && bench.rate("transfer.batched", "transfers/s", BATCH, [&]() { return dap->transfer(transfers); });
+
+	// ADIv5TI 経由のメモリアクセス
+	for (uint32_t size : { 4, 64, 1024, 16 * 1024, 64 * 1024 })
+	{
+		auto data = makePattern(size, 0);
+		std::vector<uint8_t> read;
+		ok = ok && bench.rateMB("memory.read." + std::to_string(size), size, [&]() { read.clear(); return ti->readMemory(base, size, &read); });
+		ok = ok && bench.rateMB("memory.write." + std::to_string(size), size, [&]() { return ti->writeMemory(base, size, data); });
+	}
+
+	std::vector<uint32_t> regs;
+	ok = ok && bench.latency("registers.fetch", [&]() { regs.clear(); return ti->readGenericRegisters(&regs); });
+
+	// AP の列挙から ROM table の走査, デバッグコンポーネントの初期化まで
+	ok = ok && bench.latency("scan", [&]()
+	{
+		auto adi = std::make_shared<ADIv5>(dap);
+		errno_t ret = adi->powerupDebug();
+		if (ret != OK)
+			return ret;
+		ret = adi->scanAPs();
+		if (ret != OK)
+			return ret;
+		ADIv5TI scanned(adi);
+		return (errno_t)OK;
+	});
+
+	// RSP のパケット処理を含めた gdb からの要求
+	BenchmarkRSP rsp(*ti);
+	std::string m = rsp.packet("m20000000,400");
+	ok = ok && bench.rateMB("rsp.m.1024", 1024, [&]() { rsp.push(m); return rsp.getLastSent().size() == 4 + 2048 ? (errno_t)OK : EFAULT; });
+
+	auto payload = makePattern(1024, 1);
+	std::string X = rsp.packet("X20000000,400:" + std::string(payload.begin(), payload.end()));
+	ok = ok && bench.rateMB("rsp.X.1024", 1024, [&]() { rsp.push(X); return rsp.getLastSent() == "$OK#9a" ? (errno_t)OK : EFAULT; });
+
+	std::string g = rsp.packet("g");
+	ok = ok && bench.rate("rsp.g", "packets/s", 1, [&]() { rsp.push(g); return rsp.getLastSent().size() == 4 + 128 ? (errno_t)OK : EFAULT; });
+
+	// ソケットから 256 byte ずつ届くパケット列の切り出し
+	PacketCounter counter;
+	std::string stream;
+	const uint32_t PACKETS = 256;
+	for (uint32_t i = 0; i < PACKETS; i++)
+		stream += counter.packet("m2000" + std::to_string(1000 + i) + ",4") + "+";
+	std::vector<std::string> chunks;
+	for (size_t offset = 0; offset < stream.size(); offset += 256)
+		chunks.push_back(stream.substr(offset, 256));
+	ok = ok && bench.rate("packet.push", "packets/s", PACKETS, [&]()
+	{
+		uint64_t before = counter.getReceived();
+		for (auto chunk : chunks)
+			counter.push(chunk);
+		return counter.getReceived() - before == PACKETS ? (errno_t)OK : EFAULT;
+	});
+
+	if (!ok)
+		return EFAULT;
+
+	std::ofstream file(options.output);
+	if (!file.is_open())
+	{
+		_ERRPRT("Failed to open %s\n", options.output.c_str());
+		return ENOENT;
+	}
+	{
+		uint32_t packetSize = SimulatedProbe::PACKET_SIZE;
+		cereal::JSONOutputArchive archive(file);
+		archive(cereal::make_nvp("latencyUs", options.probe.latencyUs),
+			cereal::make_nvp("intervalUs", options.probe.intervalUs),
+			cereal::make_nvp("packetCount", options.probe.packetCount),
+			cereal::make_nvp("packetSize", packetSize),
+			cereal::make_nvp("results", bench.getResults()));
+	}
+
+	for (auto& r : bench.getResults())
+		printf("%-24s %14.3f %-12s %8.1f packets\n", r.name.c_str(), r.value, r.unit.c_str(), r.packets);
+
+	return 0;
+}
@@ -6,11 +6,28 @@
 #include <Poco/Net/HTTPRequestHandler.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/HTTPServerRequestImpl.h>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/URI.h>
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <set>
 
 #include "Alt-Link.h"
+#include "ImageLoader.h"
+#include "CoreDump.h"
+#include "Trace.h"
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_SERVER
 
 extern AltLink altlink;
 
+static std::string fileDirectory;
+
 struct Response
 {
 	uint32_t ret;
@@ -46,14 +63,24 @@ class Handler: public Poco::Net::HTTPRequestHandler
 {
 private:
 	Poco::Net::HTTPServerResponse* _response;
+	std::ostream* _output = nullptr;
+	cereal::JSONInputArchive* _request = nullptr;
+	std::shared_ptr<AltLink::Device> batchDevice;	// batch の実行中のみ
+	int32_t pathIndex = -1;	// POST /device/<index> で送られた場合のデバイス
+
+	// batch では全ての応答を 1 つのストリームに続けて書く
+	std::ostream& output() {
+		if (_output == nullptr)
+			_output = &_response->send();
+		return *_output;
+	}
 
 	std::shared_ptr<cereal::JSONOutputArchive> sendResponse(errno_t ret, std::string message = "") {
 		Response res;
 		res.ret = ret;
 		res.message = message;
 		
-		std::ostream& rs = _response->send();
-		auto archive = std::make_shared<cereal::JSONOutputArchive>(rs);
+		auto archive = std::make_shared<cereal::JSONOutputArchive>(output());
 		res.save(*archive);
 		return archive;
 	}
@@ -64,127 +91,850 @@ private:
 		res.ret = ret;
 		res.message = message;
 
-		std::ostream& rs = _response->send();
-		cereal::JSONOutputArchive archive(rs);
+		cereal::JSONOutputArchive archive(output());
 		res.save(archive);
 	}
 
-	std::string getCommand(std::string request) {
-		std::string command;
-
-		std::stringstream ss(request);
-		cereal::JSONInputArchive archive(ss);
-		archive(CEREAL_NVP(command));
-
-		return command;
-	}
-
+	// 要求の JSON は 1 回だけ parse し, 各パラメータはこの archive から読む
+	// batch の実行中は commands の要素を指している
 	template <class Data>
-	void get(std::string request, std::string name, Data* data) {
-		std::stringstream ss(request);
-		cereal::JSONInputArchive archive(ss);
-		archive(::cereal::make_nvp(name.c_str(), *data));
+	void get(std::string name, Data* data) {
+		(*_request)(::cereal::make_nvp(name.c_str(), *data));
 	}
 
-	std::shared_ptr<AltLink::Device> getDevice(std::string request) {
+	// index を省略した場合は batch のデバイスか, URI で指定したデバイスを使う
+	std::shared_ptr<AltLink::Device> getDevice() {
 		uint32_t index = 0;
-		get(request, "index", &index);
+		try {
+			get("index", &index);
+		} catch (std::exception&) {
+			if (batchDevice != nullptr)
+				return batchDevice;
+			if (pathIndex < 0)
+				throw;
+			index = (uint32_t)pathIndex;
+		}
+		return getDevice(index);
+	}
 
+	std::shared_ptr<AltLink::Device> getDevice(uint32_t index) {
 		auto devices = altlink.getDevices();
 		if (devices.size() <= index) { throw std::exception("invalid index"); }
 		
 		return devices[index];
 	}
 
-public:
-	void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
-		_response = &response;
+	// クライアントが指定したファイル名を fileDirectory 以下のパスにする
+	// サーバーは認証なしで待ち受けるので, 絶対パスと ".." を含むものは受け付けない
+	static bool resolvePath(const std::string& name, std::string* path) {
+		if (fileDirectory.empty() || name.empty())
+			return false;
+		if (name[0] == '/' || name[0] == '\\' || name.find(':') != name.npos)
+			return false;
 
-		response.setChunkedTransferEncoding(true);
-		response.setContentType("application/json");
+		size_t pos = 0;
+		while (pos <= name.size())
+		{
+			size_t next = name.find_first_of("/\\", pos);
+			if (next == name.npos)
+				next = name.size();
+			if (name.compare(pos, next - pos, "..") == 0)
+				return false;
+			pos = next + 1;
+		}
 
-		if (request.getContentType() != "application/json")
+		*path = fileDirectory + "/" + name;
+		return true;
+	}
+
+	// プローブへのアクセスはデバイスの executor で行う
+	template <typename F>
+	auto execute(std::shared_ptr<AltLink::Device> device, Executor::Priority priority, F func) -> decltype(func())
+	{
+		return device->getExecutor()->execute(priority, func);
+	}
+
+	// 差分を 1 行 1 JSON で duration [ms] の間送り続ける
+	void streamCounters(std::shared_ptr<CounterMonitor> monitor) {
+		uint32_t duration = 10000;
+		try { get("duration", &duration); } catch (std::exception&) {}
+
+		if (!monitor->isRunning())
 		{
-			sendResponse(EINVAL);
+			sendResponse(EPERM, "counters are not started");
 			return;
 		}
 
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::deque<CounterMonitor::Sample> samples;
+
+		uint32_t id = monitor->subscribe([&](const CounterMonitor::Sample& sample)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			samples.push_back(sample);
+			cond.notify_one();
+		});
+
+		_response->setContentType("application/x-ndjson");
+		std::ostream& rs = output();
+
+		auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(duration);
 		try {
-			std::string requestString(std::istreambuf_iterator<char>(request.stream()), {});
-			std::string command = getCommand(requestString);
+			while (rs.good() && monitor->isRunning() && std::chrono::steady_clock::now() < end)
+			{
+				std::deque<CounterMonitor::Sample> pending;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.wait_until(lock, end, [&]() { return !samples.empty(); });
+					pending.swap(samples);
+				}
+				for (auto& sample : pending)
+				{
+					rs << "{\"timeUs\":" << sample.timeUs << ",\"cyc\":" << sample.cyc
+						<< ",\"cpi\":" << sample.cpi << ",\"exc\":" << sample.exc
+						<< ",\"sleep\":" << sample.sleep << ",\"lsu\":" << sample.lsu
+						<< ",\"fold\":" << sample.fold << ",\"valid\":" << (sample.valid ? "true" : "false") << "}\n";
+				}
+				rs.flush();
+			}
+		} catch (std::exception&) {
+			// クライアントが切断した
+		}
+		monitor->unsubscribe(id);
+	}
 
-			if (command == "enumerate")
+	// 購読を始めた時点の値を送り, 以降は変わった値だけを 1 行 1 JSON で duration [ms] の間送り続ける
+	void streamWatch(std::shared_ptr<Watch> watch) {
+		uint32_t duration = 10000;
+		try { get("duration", &duration); } catch (std::exception&) {}
+
+		if (!watch->isRunning())
+		{
+			sendResponse(EPERM, "watch is not started");
+			return;
+		}
+
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::deque<Watch::Sample> samples;
+
+		// 購読してから現在値を取るので, 間に変わった値は取りこぼさない (重複はありうる)
+		uint32_t id = watch->subscribe([&](const Watch::Sample& sample)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			samples.push_back(sample);
+			cond.notify_one();
+		});
+
+		auto writeValues = [](std::ostream& rs, const std::vector<Watch::Value>& values)
+		{
+			rs << "\"values\":[";
+			for (size_t i = 0; i < values.size(); i++)
+				rs << (i > 0 ? "," : "") << "{\"id\":" << values[i].id << ",\"value\":" << values[i].value << "}";
+			rs << "]}\n";
+		};
+
+		_response->setContentType("application/x-ndjson");
+		std::ostream& rs = output();
+
+		auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(duration);
+		try {
+			rs << "{";
+			writeValues(rs, watch->getValues());
+			rs.flush();
+
+			while (rs.good() && watch->isRunning() && std::chrono::steady_clock::now() < end)
 			{
-				sendResponse(altlink.enumerate());
+				std::deque<Watch::Sample> pending;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.wait_until(lock, end, [&]() { return !samples.empty(); });
+					pending.swap(samples);
+				}
+				for (auto& sample : pending)
+				{
+					rs << "{\"timeUs\":" << sample.timeUs << ",";
+					writeValues(rs, sample.values);
+				}
+				rs.flush();
 			}
-			else if (command == "devices")
+		} catch (std::exception&) {
+			// クライアントが切断した
+		}
+		watch->unsubscribe(id);
+	}
+
+	// メモリの読み書きはこの単位で executor に積む. 間に RSP の要求が割り込める
+	static const uint32_t MEMORY_CHUNK_SIZE = 0x8000;
+
+	// 通常の応答を返せなくなった後のエラーは, 最後の chunk を送らずに切断してクライアントに知らせる
+	void abortResponse(Poco::Net::HTTPServerRequest& request) {
+		try {
+			auto impl = dynamic_cast<Poco::Net::HTTPServerRequestImpl*>(&request);
+			if (impl != nullptr)
+				impl->socket().shutdown();
+		} catch (std::exception&) {}
+	}
+
+	// length バイトを application/octet-stream で送る. deflate を指定すると zlib で圧縮する
+	// 送信中に次のブロックを読むので, 全体をメモリに溜めることはない
+	void streamReadMemory(Poco::Net::HTTPServerRequest& request) {
+		auto device = getDevice();
+		uint64_t address;
+		uint32_t length;
+		bool deflate = false;
+		get("address", &address);
+		get("length", &length);
+		try { get("deflate", &deflate); } catch (std::exception&) {}
+
+		auto ti = device->getTI();
+		if (ti == nullptr)
+		{
+			sendResponse(ENODEV);
+			return;
+		}
+		if ((address & 0x3) != 0)
+		{
+			sendResponse(EINVAL, "address must be 4-byte aligned");
+			return;
+		}
+
+		auto executor = device->getExecutor();
+		auto read = [&](uint64_t addr, uint32_t len)
+		{
+			return executor->submit(Executor::PRIORITY_MEMORY, [ti, addr, len]()
+			{
+				std::vector<uint8_t> data;
+				errno_t ret = ti->readMemory(addr, len, &data);
+				return std::make_pair(ret, data);
+			});
+		};
+
+		uint32_t offset = 0;
+		uint32_t len = length < MEMORY_CHUNK_SIZE ? length : MEMORY_CHUNK_SIZE;
+		auto result = read(address, len).get();
+		if (result.first != OK)
+		{
+			// まだ何も送っていないので通常のエラー応答を返す
+			sendResponse(result.first);
+			return;
+		}
+
+		_response->setContentType("application/octet-stream");
+		if (deflate)
+			_response->set("Content-Encoding", "deflate");
+		std::ostream& rs = output();
+
+		std::shared_ptr<Poco::DeflatingOutputStream> deflater;
+		if (deflate)
+			deflater = std::make_shared<Poco::DeflatingOutputStream>(rs, Poco::DeflatingStreamBuf::STREAM_ZLIB);
+		std::ostream& out = deflate ? *deflater : rs;
+
+		try {
+			while (true)
 			{
-				auto archive = sendResponse(OK);
+				offset += len;
+				len = length - offset < MEMORY_CHUNK_SIZE ? length - offset : MEMORY_CHUNK_SIZE;
+
+				// 次のブロックを積んでから前のブロックを送る
+				std::future<std::pair<errno_t, std::vector<uint8_t>>> pending;
+				if (len > 0)
+					pending = read(address + offset, len);
+
+				out.write((const char*)result.second.data(), result.second.size());
+				out.flush();
+				if (!rs.good())
+					break;
+
+				if (len == 0)
+				{
+					if (deflater)
+						deflater->close();
+					return;
+				}
+
+				result = pending.get();
+				if (result.first != OK)
+				{
+					_ERRPRT("Failed to read memory at 0x%08x. (0x%08x)\n", (uint32_t)(address + offset), result.first);
+					break;
+				}
+			}
+		} catch (std::exception&) {
+			// クライアントが切断した
+		}
+		abortResponse(request);
+	}
+
+	// 本文 (application/octet-stream) をそのまま書き込む. パラメータは URI のクエリで渡す
+	//   POST /?command=writeMemory&index=0&address=0x20000000
+	// Content-Encoding: deflate の場合は展開しながら書き込む
+	void streamWriteMemory(Poco::Net::HTTPServerRequest& request) {
+		std::map<std::string, std::string> params;
+		for (auto& param : Poco::URI(request.getURI()).getQueryParameters())
+			params[param.first] = param.second;
 
-				archive->setNextName("data");
-				archive->startNode();
-				archive->makeArray();
+		if (params["command"] != "writeMemory" || params["address"].empty())
+		{
+			sendResponse(EINVAL);
+			return;
+		}
+
+		uint32_t index = pathIndex < 0 ? 0 : (uint32_t)pathIndex;
+		if (!params["index"].empty())
+			index = (uint32_t)strtoul(params["index"].c_str(), nullptr, 0);
+		auto device = getDevice(index);
+		uint64_t address = strtoull(params["address"].c_str(), nullptr, 0);
+
+		auto ti = device->getTI();
+		if (ti == nullptr)
+		{
+			sendResponse(ENODEV);
+			return;
+		}
+		if ((address & 0x3) != 0)
+		{
+			sendResponse(EINVAL, "address must be 4-byte aligned");
+			return;
+		}
 
-				for (auto item : altlink.getDevices())
-					(*archive)(item->getDeviceInfo());
+		std::shared_ptr<Poco::InflatingInputStream> inflater;
+		if (request.get("Content-Encoding", "") == "deflate")
+			inflater = std::make_shared<Poco::InflatingInputStream>(request.stream(), Poco::InflatingStreamBuf::STREAM_ZLIB);
+		std::istream& in = inflater ? *inflater : request.stream();
+
+		auto executor = device->getExecutor();
+		uint32_t written = 0;
+		errno_t ret = OK;
+		std::future<errno_t> pending;
+		uint32_t pendingSize = 0;
+		while (true)
+		{
+			// 前のブロックを書いている間に次のブロックを受信する
+			auto data = std::make_shared<std::vector<uint8_t>>(MEMORY_CHUNK_SIZE);
+			in.read((char*)data->data(), data->size());
+			uint32_t len = (uint32_t)in.gcount();
+			data->resize(len);
 
-				archive->finishNode();
+			if (pending.valid())
+			{
+				ret = pending.get();
+				if (ret != OK)
+					break;
+				written += pendingSize;
 			}
-			else if (command == "open")
+			if (len == 0)
+				break;
+
+			uint64_t addr = address + written;
+			pending = executor->submit(Executor::PRIORITY_MEMORY, [ti, addr, len, data]()
 			{
-				auto device = getDevice(requestString);
+				return ti->writeMemory(addr, len, *data);
+			});
+			pendingSize = len;
+		}
+
+		sendResponseWithData(ret, written);
+	}
+
+	void dispatch(const std::string& command, Poco::Net::HTTPServerRequest& request) {
+		if (command == "enumerate")
+		{
+			sendResponse(altlink.enumerate());
+		}
+		else if (command == "devices")
+		{
+			auto archive = sendResponse(OK);
+
+			archive->setNextName("data");
+			archive->startNode();
+			archive->makeArray();
+
+			for (auto item : altlink.getDevices())
+				(*archive)(item->getDeviceInfo());
+
+			archive->finishNode();
+		}
+		else if (command == "open")
+		{
+			auto device = getDevice();
 
-				sendResponse(device->open());
+			sendResponse(execute(device, Executor::PRIORITY_RUN_CONTROL, [&]() { return device->open(); }));
+		}
+		else if (command == "pin")
+		{
+			auto device = getDevice();
+			auto dap = device->getDAP();
+
+			CMSISDAP::PIN pin;
+			auto ret = execute(device, Executor::PRIORITY_BACKGROUND, [&]() { return dap->getPinStatus(&pin); });
+
+			if (ret == OK)
+				sendResponseWithData(OK, pin);
+			else
+				sendResponse(ret);
+		}
+		else if (command == "setConnectionType")
+		{
+			auto device = getDevice();
+
+			CMSISDAP::ConnectionType type;
+			get("type", &type);
+
+			sendResponse(execute(device, Executor::PRIORITY_RUN_CONTROL, [&]() { return device->setConnectionType(type); }));
+		}
+		else if (command == "scan")
+		{
+			auto device = getDevice();
+
+			sendResponse(execute(device, Executor::PRIORITY_RUN_CONTROL, [&]() { return device->scan(); }));
+		}
+		else if (command == "apTable")
+		{
+			auto device = getDevice();
+			auto adi = device->getADI();;
+
+			auto archive = sendResponse(OK);
+			archive->setNextName("data");
+			archive->startNode();
+			execute(device, Executor::PRIORITY_BACKGROUND, [&]() { adi->serializeApTable(*archive); });
+			archive->finishNode();
+		}
+		else if (command == "profileStart" || command == "profileStop" || command == "profileClear")
+		{
+			auto device = getDevice();
+			auto profiler = device->getProfiler();
+			if (profiler == nullptr)
+			{
+				sendResponse(ENODEV);
 			}
-			else if (command == "pin")
+			else if (command == "profileStart")
 			{
-				auto device = getDevice(requestString);
-				auto dap = device->getDAP();
+				sendResponse(profiler->start());
+			}
+			else
+			{
+				if (command == "profileStop")
+					profiler->stop();
+				else
+					profiler->clear();
+				sendResponse(OK);
+			}
+		}
+		else if (command == "profile")
+		{
+			auto device = getDevice();
+			auto profiler = device->getProfiler();
+			if (profiler == nullptr)
+			{
+				sendResponse(ENODEV);
+				return;
+			}
 
-				CMSISDAP::PIN pin;
-				auto ret = dap->getPinStatus(&pin);
+			// format: "json" (default), "folded", "pprof"
+			std::string format = "json";
+			try { get("format", &format); } catch (std::exception&) {}
 
+			if (batchDevice != nullptr && format != "json")
+			{
+				sendResponse(EINVAL, "only json format is allowed in batch");
+			}
+			else if (format == "folded")
+			{
+				_response->setContentType("text/plain");
+				output() << profiler->toFolded();
+			}
+			else if (format == "pprof")
+			{
+				_response->setContentType("application/octet-stream");
+				output() << profiler->toPprof();
+			}
+			else
+			{
+				sendResponseWithData(OK, *profiler);
+			}
+		}
+		else if (command == "traceStart" || command == "traceStop" || command == "traceClear")
+		{
+			if (command == "traceStart")
+				Trace::start();
+			else if (command == "traceStop")
+				Trace::stop();
+			else
+				Trace::clear();
+			sendResponse(OK);
+		}
+		else if (command == "trace")
+		{
+			// Chrome trace の JSON をそのまま返す (chrome://tracing や ui.perfetto.dev で開ける)
+			_response->setContentType("application/json");
+			Trace::dump(output());
+		}
+		else if (command.find("counters") == 0)
+		{
+			auto device = getDevice();
+			auto monitor = device->getCounterMonitor();
+			if (monitor == nullptr)
+			{
+				sendResponse(ENODEV);
+			}
+			else if (command == "countersStart")
+			{
+				uint32_t interval = 1000;	// us
+				try { get("interval", &interval); } catch (std::exception&) {}
+				sendResponse(monitor->start(interval));
+			}
+			else if (command == "countersStop")
+			{
+				monitor->stop();
+				sendResponse(OK);
+			}
+			else if (command == "countersRecord")
+			{
+				std::string name, path;
+				get("path", &name);
+				if (!resolvePath(name, &path))
+					sendResponse(EACCES, "path must be a relative path in the file directory");
+				else
+					sendResponse(monitor->startRecording(path));
+			}
+			else if (command == "countersRecordStop")
+			{
+				monitor->stopRecording();
+				sendResponse(OK);
+			}
+			else if (command == "countersStream")
+			{
+				streamCounters(monitor);
+			}
+			else if (command == "counters")
+			{
+				auto totals = monitor->getTotals();
+				sendResponseWithData(OK, totals);
+			}
+			else
+			{
+				sendResponse(ENOENT);
+			}
+		}
+		else if (command.find("rtt") == 0)
+		{
+			auto device = getDevice();
+			auto rtt = device->getRTT();
+			if (rtt == nullptr)
+			{
+				sendResponse(ENODEV);
+			}
+			else if (command == "rttFind")
+			{
+				uint64_t start;
+				uint32_t size;
+				get("start", &start);
+				get("size", &size);
+				rtt->setSearchRange(start, size);
+				sendResponse(rtt->start());
+			}
+			else if (command == "rttSetAddress")
+			{
+				uint64_t address;
+				get("address", &address);
+				rtt->setAddress(address);
+				sendResponse(rtt->start());
+			}
+			else if (command == "rttStop")
+			{
+				rtt->stop();
+				sendResponse(OK);
+			}
+			else if (command == "rttChannels")
+			{
+				auto channels = rtt->getChannels();
+				sendResponseWithData(rtt->isFound() ? OK : ENOENT, channels);
+			}
+			else
+			{
+				sendResponse(ENOENT);
+			}
+		}
+		else if (command.find("watch") == 0)
+		{
+			auto device = getDevice();
+			auto watch = device->getWatch();
+			if (watch == nullptr)
+			{
+				sendResponse(ENODEV);
+			}
+			else if (command == "watchAdd")
+			{
+				uint64_t address;
+				uint32_t size = 4;
+				get("address", &address);
+				try { get("size", &size); } catch (std::exception&) {}
+
+				uint32_t id = 0;
+				errno_t ret = watch->add(address, size, &id);
 				if (ret == OK)
-					sendResponseWithData(OK, pin);
+					sendResponseWithData(OK, id);
 				else
 					sendResponse(ret);
 			}
-			else if (command == "setConnectionType")
+			else if (command == "watchRemove")
 			{
-				auto device = getDevice(requestString);
-
-				CMSISDAP::ConnectionType type;
-				get(requestString, "type", &type);
-
-				sendResponse(device->setConnectionType(type));
+				uint32_t id;
+				get("id", &id);
+				sendResponse(watch->remove(id));
+			}
+			else if (command == "watchClear")
+			{
+				watch->clear();
+				sendResponse(OK);
+			}
+			else if (command == "watchStart")
+			{
+				uint32_t interval = Watch::MIN_INTERVAL_US;	// us
+				try { get("interval", &interval); } catch (std::exception&) {}
+				sendResponse(watch->start(interval));
+			}
+			else if (command == "watchStop")
+			{
+				watch->stop();
+				sendResponse(OK);
+			}
+			else if (command == "watchList")
+			{
+				auto vars = watch->getVariables();
+				sendResponseWithData(OK, vars);
+			}
+			else if (command == "watchValues")
+			{
+				auto values = watch->getValues();
+				sendResponseWithData(OK, values);
+			}
+			else if (command == "watchStream")
+			{
+				streamWatch(watch);
+			}
+			else if (command == "watch")
+			{
+				auto status = watch->getStatus();
+				sendResponseWithData(OK, status);
 			}
-			else if (command == "scan")
+			else
 			{
-				auto device = getDevice(requestString);
+				sendResponse(ENOENT);
+			}
+		}
+		else if (command == "readMemory")
+		{
+			streamReadMemory(request);
+		}
+		else if (command == "load")
+		{
+			auto device = getDevice();
+			auto ti = device->getTI();
+			if (ti == nullptr)
+			{
+				sendResponse(ENODEV);
+				return;
+			}
 
-				sendResponse(device->scan());
+			// path はサーバー側の fileDirectory からの相対パス
+			// format: "auto" (default), "elf", "hex", "bin", verify: "none" (default), "read", "crc"
+			// sync: true なら内容が変わったページだけを書き込む
+			std::string name, path;
+			std::string formatName = "auto";
+			std::string verifyName = "none";
+			uint64_t address = 0;	// bin の書き込み先
+			bool sync = false;
+			get("path", &name);
+			try { get("format", &formatName); } catch (std::exception&) {}
+			try { get("verify", &verifyName); } catch (std::exception&) {}
+			try { get("address", &address); } catch (std::exception&) {}
+			try { get("sync", &sync); } catch (std::exception&) {}
+
+			ImageLoader::Format format;
+			ImageLoader::Verify verify;
+			if (!ImageLoader::parseFormat(formatName, &format) || !ImageLoader::parseVerify(verifyName, &verify))
+			{
+				sendResponse(EINVAL);
+				return;
 			}
-			else if (command == "apTable")
+			if (!resolvePath(name, &path))
 			{
-				auto device = getDevice(requestString);
-				auto adi = device->getADI();;
+				sendResponse(EACCES, "path must be a relative path in the file directory");
+				return;
+			}
 
-				auto archive = sendResponse(OK);
-				archive->setNextName("data");
-				archive->startNode();
-				adi->serializeApTable(*archive);
-				archive->finishNode();
+			ImageLoader loader(ti, device->getExecutor());
+			ImageLoader::Result result = {};
+			errno_t ret = loader.open(path, format, address);
+			if (ret == OK)
+				ret = loader.load(verify, &result, sync);
+			sendResponseWithData(ret, result);
+		}
+		else if (command == "snapshot")
+		{
+			auto device = getDevice();
+			auto ti = device->getTI();
+			if (ti == nullptr)
+			{
+				sendResponse(ENODEV);
+				return;
 			}
-			else if (command == "testHaltAndRun")
+
+			// path はサーバー側の fileDirectory からの相対パス, regions: "<start>:<size>,..."
+			std::string name, path;
+			std::string regionStr;
+			get("path", &name);
+			get("regions", &regionStr);
+
+			if (!resolvePath(name, &path))
 			{
-				auto device = getDevice(requestString);
+				sendResponse(EACCES, "path must be a relative path in the file directory");
+				return;
+			}
 
-				sendResponse(device->getTI()->testHaltAndRun());
+			std::vector<CoreDump::Region> regions;
+			if (!CoreDump::parseRegions(regionStr, &regions))
+			{
+				sendResponse(EINVAL);
+				return;
 			}
-			else
+
+			CoreDump dump(*ti, device->getExecutor());
+			CoreDump::Result result = {};
+			errno_t ret = dump.save(path, regions, &result);
+			sendResponseWithData(ret, result);
+		}
+		else if (command == "testHaltAndRun")
+		{
+			auto device = getDevice();
+
+			sendResponse(execute(device, Executor::PRIORITY_RUN_CONTROL, [&]() { return device->getTI()->testHaltAndRun(); }));
+		}
+		else
+		{
+			sendResponse(ENOENT);
+		}
+	}
+
+	// commands の各要素を順に実行し, 応答を data の配列にまとめて返す
+	// 全体を index のデバイスの executor で 1 つのタスクとして実行するので,
+	// 他のクライアントの要求が間に入らない. index を省略した要素はこのデバイスを使う
+	void batch(Poco::Net::HTTPServerRequest& request) {
+		// 応答をストリームで返すものと, executor のスレッドの終了を待つものは実行できない
+		static const std::set<std::string> NOT_BATCHABLE = {
+			"batch", "enumerate", "readMemory", "countersStream", "profileStop", "countersStop", "rttStop", "load", "trace",
+			"watchStream", "watchStop"
+		};
+
+		// index が無ければデバイスを使わないコマンド (devices など) だけを実行する
+		std::shared_ptr<AltLink::Device> device;
+		try { device = getDevice(); } catch (std::exception&) {}
+
+		_request->setNextName("commands");
+		_request->startNode();
+		cereal::size_type size;
+		_request->loadSize(size);
+
+		std::ostream& rs = output();
+		rs << "{\"ret\":" << OK << ",\"data\":[";
+
+		auto run = [&]()
+		{
+			for (cereal::size_type i = 0; i < size; i++)
 			{
-				sendResponse(ENOENT);
+				if (i > 0)
+					rs << ",";
+
+				// 直前の要素で省略可能なパラメータの検索に失敗していると名前が残っている
+				_request->setNextName(nullptr);
+				_request->startNode();
+				try {
+					std::string command;
+					get("command", &command);
+
+					if (NOT_BATCHABLE.count(command) > 0)
+						sendResponse(EINVAL, command + " is not allowed in batch");
+					else
+						dispatch(command, request);
+				} catch (std::exception e) {
+					_DBGPRT("%s\n", e.what());
+					sendResponse(EINVAL);
+				}
+				_request->finishNode();
+			}
+		};
+
+		if (device != nullptr)
+		{
+			// サービスの作り直しは古いスレッドの終了を待つので, executor のタスクの外で済ませておく
+			device->resolveServices();
+			batchDevice = device;
+			execute(device, Executor::PRIORITY_MEMORY, run);
+			batchDevice = nullptr;
+		}
+		else
+		{
+			run();
+		}
+
+		rs << "]}";
+		_request->finishNode();
+	}
+
+public:
+	void handleRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+		_response = &response;
+
+		response.setChunkedTransferEncoding(true);
+		response.setContentType("application/json");
+
+		// プローブごとのパス (/device/<index>) に送られた要求は index を省略できる
+		std::vector<std::string> segments;
+		Poco::URI(request.getURI()).getPathSegments(segments);
+		if (segments.size() >= 2 && segments[0] == "device")
+		{
+			char* end;
+			unsigned long index = strtoul(segments[1].c_str(), &end, 10);
+			if (*end != '\0' || segments[1].empty())
+			{
+				sendResponse(EINVAL);
+				return;
 			}
+			pathIndex = (int32_t)index;
+		}
+
+		if (request.getContentType() == "application/octet-stream")
+		{
+			try {
+				streamWriteMemory(request);
+			} catch (std::exception e) {
+				_DBGPRT("%s\n", e.what());
+				sendResponse(EINVAL);
+			}
+			return;
+		}
+
+		if (request.getContentType() != "application/json")
+		{
+			sendResponse(EINVAL);
+			return;
+		}
+
+		try {
+			cereal::JSONInputArchive archive(request.stream());
+			_request = &archive;
+
+			std::string command;
+			get("command", &command);
+
+			if (command == "batch")
+				batch(request);
+			else
+				dispatch(command, request);
+
 			_DBGPRT("command: %s\n", command.c_str());
 		} catch (std::exception e) {
 			_DBGPRT("%s\n", e.what());
@@ -205,7 +955,9 @@ public:
 
 std::shared_ptr<Poco::Net::HTTPServer> server;
 
-void startHttpServer() {
+void startHttpServer(const std::string& _fileDirectory) {
+	fileDirectory = _fileDirectory;
+
 	static const uint16_t PORT = 8080;
 	Poco::Net::ServerSocket socket(PORT);
 
@@ -1,3 +1,6 @@
 #pragma once
 
-void startHttpServer();
\ No newline at end of file
+#include <string>
+
+// fileDirectory: クライアントがファイル名を指定するコマンドで読み書きできるディレクトリ. 空なら使えない
+void startHttpServer(const std::string& fileDirectory = "");
\ No newline at end of file
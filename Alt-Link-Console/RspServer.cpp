@@ -1,13 +1,33 @@
 
 #include "stdafx.h"
 #include <memory>
+#include <vector>
+#include <cstring>
 
 #include "RemoteSerialProtocol.h"
+#include "StopDetector.h"
 
 #include <Poco/Net/ServerSocket.h>
 #include <Poco/Net/TCPServer.h>
 #include <Poco/Net/TCPServerConnection.h>
 #include <Poco/Net/TCPServerConnectionFactory.h>
+#include <Poco/AutoPtr.h>
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_RSP
+
+class ReceivedNotification : public Poco::Notification
+{
+public:
+	explicit ReceivedNotification(const std::string& _data) : data(_data) {}
+
+	std::string data;	// empty: connection closed
+};
+
+// range step の続き
+class RangeStepNotification : public Poco::Notification
+{
+};
 
 class TCPConnection : public Poco::Net::TCPServerConnection
 {
@@ -20,41 +40,131 @@ private:
 
 		int32_t send(const std::string& packet)
 		{
-			printf("send (%s)\n", packet.c_str());
+			LOG_TRACE(LOG_SUBSYSTEM, "send (%s)\n", packet.c_str());
 			return connection.socket().sendBytes(packet.c_str(), packet.length());
 		}
 
+		void targetResumed()
+		{
+			connection.resumeGeneration = connection.detector->targetResumed();
+		}
+
+		void targetHalted()
+		{
+			connection.detector->targetHalted();
+		}
+
+		bool scheduleRangeStep()
+		{
+			connection.queue.enqueueNotification(new RangeStepNotification());
+			return true;
+		}
+
 	public:
 		RSPtoDAP(TCPConnection& outer, TargetInterface& ti)
 			: RemoteSerialProtocol(ti), connection(outer) {}
 	} rsp;
 
+	// ソケットからの受信をキューに流す
+	class Reader : public Poco::Runnable
+	{
+	private:
+		TCPConnection& connection;
+
+	public:
+		explicit Reader(TCPConnection& outer) : connection(outer) {}
+
+		void run()
+		{
+			const static uint32_t BUFFER_SIZE = 256;
+			char buffer[BUFFER_SIZE];
+
+			while (1)
+			{
+				int bytes = 0;
+				try
+				{
+					bytes = connection.socket().receiveBytes(buffer, BUFFER_SIZE);
+				}
+				catch (Poco::Exception&)
+				{
+					bytes = 0;
+				}
+
+				if (bytes <= 0)
+				{
+					connection.queue.enqueueNotification(new ReceivedNotification(""));
+					break;
+				}
+				// range step の実行中でも止められるよう, キューを待たずに知らせる
+				if (memchr(buffer, 0x03, bytes) != nullptr)
+					connection.rsp.requestInterrupt();
+				connection.queue.enqueueNotification(new ReceivedNotification(std::string(buffer, bytes)));
+			}
+		}
+	} reader;
+
+	std::shared_ptr<StopDetector> detector;
+	std::shared_ptr<Executor> executor;
+	Poco::NotificationQueue queue;
+	uint32_t resumeGeneration;	// executor のスレッドでのみ使う
+
+	static Executor::Priority getPriority(const std::string& data)
+	{
+		if (data.find('\x03') != data.npos)
+			return Executor::PRIORITY_INTERRUPT;
+		if (data.size() > 1 && data[0] == '$' &&
+			(data[1] == 'm' || data[1] == 'M' || data[1] == 'X' ||
+			 data.find("$qCRC:") == 0 || data.find("$qSearch:") == 0))
+			return Executor::PRIORITY_MEMORY;
+		return Executor::PRIORITY_RUN_CONTROL;
+	}
+
 public:
-	TCPConnection(const Poco::Net::StreamSocket &socket, std::shared_ptr<TargetInterface> ti)
-		: TCPServerConnection(socket), rsp(*this, *ti) {}
+	TCPConnection(const Poco::Net::StreamSocket &socket, std::shared_ptr<TargetInterface> ti,
+		std::shared_ptr<StopDetector> _detector, std::shared_ptr<Executor> _executor)
+		: TCPServerConnection(socket), rsp(*this, *ti), reader(*this), detector(_detector), executor(_executor), resumeGeneration(0) {}
 
 	void run(void)
 	{
-		const static uint32_t BUFFER_SIZE = 256;
-		char buffer[BUFFER_SIZE + 1] = { 0 };
-		uint32_t bytes = 1;
+		detector->subscribe(&queue);
+
+		Poco::Thread readerThread;
+		readerThread.start(reader);
 
-		while(bytes)
+		// 受信データと停止通知の両方をこのキューで待つ
+		while (1)
 		{
+			Poco::AutoPtr<Poco::Notification> notification(queue.waitDequeueNotification());
+
 			try
 			{
-				if (!rsp.isEmpty() || socket().poll(Poco::Timespan(0, 1), Poco::Net::Socket::SELECT_READ))
+				auto received = dynamic_cast<ReceivedNotification*>(notification.get());
+				if (received != nullptr)
 				{
-					bytes = socket().receiveBytes(buffer, BUFFER_SIZE);
-					if (bytes)
-					{
-						std::string str(buffer, bytes);
-						rsp.push(str);
-					}
+					if (received->data.empty())
+						break;
+
+					executor->execute(getPriority(received->data), [&]() { rsp.push(received->data); });
+					continue;
 				}
-				else
+
+				// 続きはメモリの要求と同じ優先度で積み, 間に他のクライアントの要求を通す
+				if (dynamic_cast<RangeStepNotification*>(notification.get()) != nullptr)
 				{
-					rsp.idle();
+					executor->execute(Executor::PRIORITY_MEMORY, [&]() { rsp.continueRangeStep(); });
+					continue;
+				}
+
+				auto stop = dynamic_cast<StopNotification*>(notification.get());
+				if (stop != nullptr)
+				{
+					// 前の resume に対する停止は, 後から来た continue に対する停止として返さない
+					executor->execute(Executor::PRIORITY_RUN_CONTROL, [&]()
+					{
+						if (!StopDetector::isStale(*stop, resumeGeneration))
+							rsp.stopDetected(stop->signal);
+					});
 				}
 			}
 			catch (Poco::Exception&)
@@ -62,29 +172,48 @@ public:
 				break;
 			}
 		}
+
+		detector->unsubscribe(&queue);
+
+		try
+		{
+			socket().shutdown();
+		}
+		catch (Poco::Exception&)
+		{
+		}
+		readerThread.join();
 	}
 };
 
 class ConnectionFactory : public Poco::Net::TCPServerConnectionFactory {
 public:
-	ConnectionFactory(std::shared_ptr<TargetInterface> _ti) : ti(_ti) {}
+	ConnectionFactory(std::shared_ptr<TargetInterface> _ti, std::shared_ptr<StopDetector> _detector, std::shared_ptr<Executor> _executor)
+		: ti(_ti), detector(_detector), executor(_executor) {}
 	virtual ~ConnectionFactory() {}
 
 	virtual Poco::Net::TCPServerConnection* createConnection(const Poco::Net::StreamSocket &socket)
 	{
-		return new TCPConnection(socket, ti);
+		return new TCPConnection(socket, ti, detector, executor);
 	}
 
 	std::shared_ptr<TargetInterface> ti;
+	std::shared_ptr<StopDetector> detector;
+	std::shared_ptr<Executor> executor;
 };
 
-std::shared_ptr<Poco::Net::TCPServer> server;
+static std::vector<std::shared_ptr<Poco::Net::TCPServer>> servers;
+static std::vector<std::shared_ptr<StopDetector>> detectors;
 
-void startRspServer(std::shared_ptr<TargetInterface> ti) {
-	static const uint16_t PORT = 1234;
-	Poco::Net::ServerSocket socket(PORT);
+void startRspServer(std::shared_ptr<TargetInterface> ti, std::shared_ptr<Executor> executor, uint16_t port) {
+	Poco::Net::ServerSocket socket(port);
 	socket.listen();
 
-	server = std::make_shared<Poco::Net::TCPServer>(new ConnectionFactory(ti), socket);
+	auto detector = std::make_shared<StopDetector>(ti, executor);
+	detector->start();
+	detectors.push_back(detector);
+
+	auto server = std::make_shared<Poco::Net::TCPServer>(new ConnectionFactory(ti, detector, executor), socket);
 	server->start();
-}
\ No newline at end of file
+	servers.push_back(server);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
 #include "TargetInterface.h"
+#include "Executor.h"
 
-void startRspServer(std::shared_ptr<TargetInterface> ti);
+// デバイスごとに別のポートで待ち受ける
+void startRspServer(std::shared_ptr<TargetInterface> ti, std::shared_ptr<Executor> executor, uint16_t port = 1234);
@@ -0,0 +1,107 @@
+
+#include "stdafx.h"
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "RttServer.h"
+
+#include <Poco/Thread.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/TCPServer.h>
+#include <Poco/Net/TCPServerConnection.h>
+#include <Poco/Net/TCPServerConnectionFactory.h>
+
+class RttConnection : public Poco::Net::TCPServerConnection
+{
+private:
+	static const long POLL_INTERVAL_US = 10000;
+
+	std::shared_ptr<RTT> rtt;
+	uint32_t channel;
+
+	std::mutex mutex;
+	std::vector<uint8_t> pending;	// up チャネルから受け取ってまだ送っていないデータ
+
+public:
+	RttConnection(const Poco::Net::StreamSocket &socket, std::shared_ptr<RTT> _rtt, uint32_t _channel)
+		: TCPServerConnection(socket), rtt(_rtt), channel(_channel) {}
+
+	void run(void)
+	{
+		uint32_t id = rtt->subscribe([this](uint32_t ch, const std::vector<uint8_t>& data)
+		{
+			if (ch != channel)
+				return;
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.insert(pending.end(), data.begin(), data.end());
+		});
+
+		const static uint32_t BUFFER_SIZE = 1024;
+		char buffer[BUFFER_SIZE];
+
+		try
+		{
+			while (1)
+			{
+				// ターゲットが読まずに down チャネルが一杯の間はソケットから読まず, TCP のフロー制御で送信側を待たせる
+				uint32_t space = rtt->getWriteSpace(channel);
+				if (space == 0)
+				{
+					Poco::Thread::sleep(POLL_INTERVAL_US / 1000);
+				}
+				else if (socket().poll(Poco::Timespan(POLL_INTERVAL_US), Poco::Net::Socket::SELECT_READ))
+				{
+					int bytes = socket().receiveBytes(buffer, space < BUFFER_SIZE ? space : BUFFER_SIZE);
+					if (bytes <= 0)
+						break;
+					rtt->write(channel, std::vector<uint8_t>(buffer, buffer + bytes));
+				}
+
+				std::vector<uint8_t> data;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					data.swap(pending);
+				}
+				if (data.size() > 0)
+					socket().sendBytes(data.data(), (int)data.size());
+			}
+		}
+		catch (Poco::Exception&)
+		{
+		}
+
+		rtt->unsubscribe(id);
+	}
+};
+
+class RttConnectionFactory : public Poco::Net::TCPServerConnectionFactory {
+public:
+	RttConnectionFactory(std::shared_ptr<RTT> _rtt, uint32_t _channel) : rtt(_rtt), channel(_channel) {}
+	virtual ~RttConnectionFactory() {}
+
+	virtual Poco::Net::TCPServerConnection* createConnection(const Poco::Net::StreamSocket &socket)
+	{
+		return new RttConnection(socket, rtt, channel);
+	}
+
+	std::shared_ptr<RTT> rtt;
+	uint32_t channel;
+};
+
+static std::vector<std::shared_ptr<Poco::Net::TCPServer>> servers;
+
+void startRttServer(std::shared_ptr<RTT> rtt, uint16_t basePort) {
+	for (uint32_t i = 0; i < RTT_SERVER_CHANNEL_NUM; i++)
+	{
+		Poco::Net::ServerSocket socket(basePort + i);
+		socket.listen();
+
+		auto server = std::make_shared<Poco::Net::TCPServer>(new RttConnectionFactory(rtt, i), socket);
+		server->start();
+		servers.push_back(server);
+	}
+
+	rtt->start();
+}
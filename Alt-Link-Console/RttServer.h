@@ -0,0 +1,11 @@
+#pragma once
+
+#include <memory>
+#include "RTT.h"
+
+// RTT の各チャネルを TCP ポート (basePort + チャネル番号) で公開する
+// 受信したデータは down チャネル, up チャネルのデータは接続中のクライアントへ送る
+// control block が見つかる前から待ち受けられるよう, チャネル数は固定で開く
+static const uint16_t RTT_SERVER_CHANNEL_NUM = 4;
+
+void startRttServer(std::shared_ptr<RTT> rtt, uint16_t basePort = 19021);
@@ -0,0 +1,99 @@
+#include "stdafx.h"
+#include "StopDetector.h"
+
+StopDetector::StopDetector(std::shared_ptr<TargetInterface> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), polling(false), generation(0), quit(false)
+{
+}
+
+StopDetector::~StopDetector()
+{
+	stop();
+}
+
+void StopDetector::start()
+{
+	if (!thread.isRunning())
+	{
+		quit = false;
+		thread.start(*this);
+	}
+}
+
+void StopDetector::stop()
+{
+	if (thread.isRunning())
+	{
+		quit = true;
+		wakeup.set();
+		thread.join();
+	}
+}
+
+void StopDetector::subscribe(Poco::NotificationQueue* queue)
+{
+	Poco::FastMutex::ScopedLock lock(queueMutex);
+	queues.insert(queue);
+}
+
+void StopDetector::unsubscribe(Poco::NotificationQueue* queue)
+{
+	Poco::FastMutex::ScopedLock lock(queueMutex);
+	queues.erase(queue);
+}
+
+uint32_t StopDetector::targetResumed()
+{
+	uint32_t current = ++generation;
+	polling = true;
+	wakeup.set();
+	return current;
+}
+
+void StopDetector::targetHalted()
+{
+	polling = false;
+}
+
+void StopDetector::post(uint8_t signal, uint32_t generation)
+{
+	Poco::FastMutex::ScopedLock lock(queueMutex);
+	for (auto queue : queues)
+		queue->enqueueNotification(new StopNotification(signal, generation));
+}
+
+void StopDetector::run()
+{
+	long interval = MIN_INTERVAL_MS;
+
+	while (!quit)
+	{
+		if (!polling)
+		{
+			wakeup.wait();
+			interval = MIN_INTERVAL_MS;
+			continue;
+		}
+
+		// 確認中に止められて再度 resume された場合に, 古い停止を新しい resume のものと区別する
+		uint32_t current = generation.load();
+		bool running = true;
+		uint8_t signal = 0;
+		errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]() {
+			return ti->isRunning(&running, &signal);
+		});
+
+		if (ret == OK && !running && polling)
+		{
+			polling = false;
+			post(signal, current);
+			continue;
+		}
+
+		// resume されるか終了要求があれば即座に起きる
+		if (wakeup.tryWait(interval))
+			interval = MIN_INTERVAL_MS;
+		else
+			interval = interval * 2 < MAX_INTERVAL_MS ? interval * 2 : MAX_INTERVAL_MS;
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <atomic>
+
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/Notification.h>
+#include <Poco/NotificationQueue.h>
+
+#include "TargetInterface.h"
+#include "Executor.h"
+
+class StopNotification : public Poco::Notification
+{
+public:
+	StopNotification(uint8_t _signal, uint32_t _generation) : signal(_signal), generation(_generation) {}
+
+	uint8_t signal;
+	uint32_t generation;	// 停止を確認し始めた時点の resume の世代
+};
+
+// resume 中のターゲットを監視して、停止したら登録されたキューに StopNotification を送る
+// 停止するまではポーリング間隔を MIN_INTERVAL_MS から MAX_INTERVAL_MS まで倍々に伸ばす
+class StopDetector : public Poco::Runnable
+{
+public:
+	StopDetector(std::shared_ptr<TargetInterface> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~StopDetector();
+
+	void start();
+	void stop();
+
+	void subscribe(Poco::NotificationQueue* queue);
+	void unsubscribe(Poco::NotificationQueue* queue);
+
+	// 戻り値は resume の世代. これより古い世代の StopNotification は前の resume に対するもの
+	uint32_t targetResumed();
+	// RSP の要求 (Ctrl-C など) で止めた場合はポーリングをやめる
+	void targetHalted();
+
+	static bool isStale(const StopNotification& stop, uint32_t generation) { return (int32_t)(stop.generation - generation) < 0; }
+
+	virtual void run();
+
+private:
+	static const long MIN_INTERVAL_MS = 1;
+	static const long MAX_INTERVAL_MS = 100;
+
+	std::shared_ptr<TargetInterface> ti;
+	std::shared_ptr<Executor> executor;
+	Poco::Thread thread;
+	Poco::Event wakeup;
+	Poco::FastMutex queueMutex;
+	std::set<Poco::NotificationQueue*> queues;
+	std::atomic<bool> polling;
+	std::atomic<uint32_t> generation;
+	std::atomic<bool> quit;
+
+	void post(uint8_t signal, uint32_t generation);
+};
@@ -3,6 +3,8 @@
 
 #include <thread>
 #include <chrono>
+#include <future>
+#include <vector>
 
 #include "Alt-Link.h"
 #include "CMSIS-DAP.h"
@@ -10,7 +12,10 @@
 #include "ADIv5TI.h"
 #include "RspServer.h"
 #include "HttpServer.h"
+#include "RttServer.h"
 #include "HIDDevice.h"
+#include "ImageLoader.h"
+#include "CoreDump.h"
 
 #if defined(_WIN32)
 #pragma comment(lib, "setupapi.lib")
@@ -64,17 +69,17 @@ public:
 		return ret;
 	};
 
+	// 同じ VID/PID のプローブを区別できるよう path で開く
 	virtual bool open(const Info& info) override {
-		hidHandle = hid_open(info.vid, info.pid, NULL);
+		hidHandle = hid_open_path(info.path.c_str());
 		return hidHandle != nullptr;
 	};
 
+	// 他のプローブが使用中なので hid_exit() は呼ばない
 	virtual void close() override {
-		hid_close(hidHandle);
-		if (hid_exit() != 0)
-		{
-			return;
-		}
+		if (hidHandle != nullptr)
+			hid_close(hidHandle);
+		hidHandle = nullptr;
 	};
 
 	virtual int write(const uint8_t* data, size_t length) override {
@@ -86,7 +91,7 @@ public:
 	};
 
 private:
-	hid_device* hidHandle;
+	hid_device* hidHandle = nullptr;
 };
 
 void dump(ADIv5TI& ti, uint64_t start, uint32_t len)
@@ -119,10 +124,150 @@ void dump(ADIv5TI& ti, uint64_t start, uint32_t len)
 
 AltLink altlink;
 
+// デバイス n は RSP を RSP_BASE_PORT + n, RTT を RTT_BASE_PORT + n * RTT_SERVER_CHANNEL_NUM から待ち受ける
+static const uint16_t RSP_BASE_PORT = 1234;
+static const uint16_t RTT_BASE_PORT = 19021;
+
+static errno_t setup(std::shared_ptr<AltLink::Device> device, CMSISDAP::ConnectionType type)
+{
+	errno_t ret = device->open();
+	if (ret != OK)
+		return ret;
+
+	ret = device->setConnectionType(type);
+	if (ret != OK)
+		return ret;
+
+	return device->scan();
+}
+
+// --load <file> [--format auto|elf|hex|bin] [--address <addr>] [--verify none|read|crc] [--sync]
+// --log <level> | <subsystem>=<level>,... (例: info,rsp=trace)
+// --http-dir <dir>: HTTP のクライアントがファイル名で読み書きできるディレクトリ (省略時は使えない)
+struct LoadOptions
+{
+	std::string path;
+	ImageLoader::Format format = ImageLoader::FORMAT_AUTO;
+	ImageLoader::Verify verify = ImageLoader::VERIFY_NONE;
+	uint64_t address = 0;	// bin の書き込み先
+	bool sync = false;		// 変化したページだけを書き込む
+};
+
+// --snapshot <file> --regions <start>:<size>[,...]
+struct SnapshotOptions
+{
+	std::string path;
+	std::vector<CoreDump::Region> regions;
+};
+
+static std::string toString(const _TCHAR* str)
+{
+#if defined(_UNICODE)
+	return std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t>().to_bytes(str);
+#else
+	return str;
+#endif
+}
+
+static bool parseArgs(int argc, _TCHAR* argv[], LoadOptions* load, SnapshotOptions* snapshot, std::string* httpDir)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string name = toString(argv[i]);
+		if (name == "--sync")
+		{
+			load->sync = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+			return false;
+		std::string value = toString(argv[++i]);
+
+		if (name == "--load")
+			load->path = value;
+		else if (name == "--format")
+		{
+			if (!ImageLoader::parseFormat(value, &load->format))
+				return false;
+		}
+		else if (name == "--verify")
+		{
+			if (!ImageLoader::parseVerify(value, &load->verify))
+				return false;
+		}
+		else if (name == "--address")
+			load->address = strtoull(value.c_str(), nullptr, 0);
+		else if (name == "--snapshot")
+			snapshot->path = value;
+		else if (name == "--regions")
+		{
+			if (!CoreDump::parseRegions(value, &snapshot->regions))
+				return false;
+		}
+		else if (name == "--log")
+		{
+			if (Log::configure(value) != OK)
+				return false;
+		}
+		else if (name == "--http-dir")
+			*httpDir = value;
+		else
+			return false;
+	}
+	return snapshot->path.empty() || snapshot->regions.size() > 0;
+}
+
+static errno_t saveSnapshot(std::shared_ptr<AltLink::Device> device, const std::string& path, const SnapshotOptions& options)
+{
+	CoreDump dump(*device->getTI(), device->getExecutor());
+	CoreDump::Result result;
+	errno_t ret = dump.save(path, options.regions, &result);
+	if (ret == OK)
+		_DBGPRT("snapshot %s: %u threads, %llu bytes in %llu ms\n", path.c_str(), result.threads,
+			(unsigned long long)result.bytes, (unsigned long long)(result.elapsedUs / 1000));
+	return ret;
+}
+
+// コアを止めてからイメージを書き込む
+static errno_t loadImage(std::shared_ptr<AltLink::Device> device, const LoadOptions& options)
+{
+	auto ti = device->getTI();
+	auto executor = device->getExecutor();
+
+	uint8_t signal;
+	errno_t ret = executor->execute(Executor::PRIORITY_RUN_CONTROL, [&]() { return ti->interrupt(&signal); });
+	if (ret != OK)
+		return ret;
+
+	ImageLoader loader(ti, executor);
+	ret = loader.open(options.path, options.format, options.address);
+	if (ret != OK)
+		return ret;
+
+	ImageLoader::Result result;
+	return loader.load(options.verify, &result, options.sync);
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
-	startHttpServer();
+	LoadOptions load;
+	SnapshotOptions snapshot;
+	std::string httpDir;
+	if (!parseArgs(argc, argv, &load, &snapshot, &httpDir))
+	{
+		_ERRPRT("usage: Alt-Link-Console [--snapshot <file> --regions <start>:<size>[,...]] "
+			"[--load <file> [--format auto|elf|hex|bin] [--address <addr>] [--verify none|read|crc] [--sync]] [--log <spec>] [--http-dir <dir>]\n");
+		return EINVAL;
+	}
+
+	startHttpServer(httpDir);
 
+	// hid_init() はスレッドセーフではないので, 並行して開く前に呼んでおく
+	if (hid_init() != 0)
+		return OK;
+
+	altlink.setHIDDeviceFactory([]() { return std::make_shared<HIDApi>(); });
 	if (altlink.enumerate() != OK)
 		return OK;
 
@@ -133,9 +278,6 @@ int _tmain(int argc, _TCHAR* argv[])
 		return OK;
 	}
 
-	if (devices[0]->open() != OK)
-		return OK;
-
 #if 0
 	{
 		auto dap = devices[0]->getDAP();
@@ -177,20 +319,84 @@ int _tmain(int argc, _TCHAR* argv[])
 	CMSISDAP::ConnectionType type = CMSISDAP::SWJ_SWD;
 #endif
 
-	if (devices[0]->setConnectionType(type) != OK)
-		return OK;
+	// 各プローブの executor のスレッドで並行して開く
+	std::vector<std::future<errno_t>> results;
+	for (auto device : devices)
+		results.push_back(device->getExecutor()->submit(Executor::PRIORITY_RUN_CONTROL, [device, type]() { return setup(device, type); }));
 
-	if (devices[0]->scan() != OK)
-		return OK;
+	std::vector<errno_t> setupResults;
+	for (auto& result : results)
+		setupResults.push_back(result.get());
+
+	// 接続した時点の状態を, イメージを書き込む前に保存する
+	// 複数のプローブがある場合はファイル名にデバイスの番号を付ける
+	if (!snapshot.path.empty())
+	{
+		std::vector<std::pair<size_t, std::future<errno_t>>> saves;
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			auto device = devices[i];
+			std::string path = devices.size() > 1 ? snapshot.path + "." + std::to_string(i) : snapshot.path;
+			if (setupResults[i] == OK)
+				saves.push_back({ i, std::async(std::launch::async, [device, path, &snapshot]() { return saveSnapshot(device, path, snapshot); }) });
+		}
+		for (auto& s : saves)
+		{
+			errno_t ret = s.second.get();
+			if (ret != OK)
+				_ERRPRT("Failed to save the snapshot of device %d. (0x%08x)\n", (int)s.first, ret);
+		}
+	}
 
-	auto ti = devices[0]->getTI();
+	// 全てのプローブに同じイメージを並行して書き込む
+	if (!load.path.empty())
+	{
+		std::vector<std::pair<size_t, std::future<errno_t>>> loads;
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			auto device = devices[i];
+			if (setupResults[i] == OK)
+				loads.push_back({ i, std::async(std::launch::async, [device, &load]() { return loadImage(device, load); }) });
+		}
+		for (auto& l : loads)
+		{
+			errno_t ret = l.second.get();
+			if (ret != OK)
+			{
+				_ERRPRT("Failed to load %s to device %d. (0x%08x)\n", load.path.c_str(), (int)l.first, ret);
+				setupResults[l.first] = ret;
+			}
+		}
+	}
+
+	uint32_t started = 0;
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		errno_t ret = setupResults[i];
+		if (ret != OK)
+		{
+			_ERRPRT("Failed to set up device %d (%s). (0x%08x)\n", (int)i, devices[i]->getDeviceInfo().serial.c_str(), ret);
+			continue;
+		}
+
+		auto ti = devices[i]->getTI();
 
-	//dump(ti, 0xFFFF0000, 0x80);
-	//dump(ti, 0xFFFF0000, 0x80);
-	//dump(ti, 0x1fefe000, 0x100);
-	//dump(ti, 0x3fefe000, 0x100);
+		//dump(ti, 0xFFFF0000, 0x80);
+		//dump(ti, 0xFFFF0000, 0x80);
+		//dump(ti, 0x1fefe000, 0x100);
+		//dump(ti, 0x3fefe000, 0x100);
 
-	startRspServer(ti);
+		uint16_t rspPort = (uint16_t)(RSP_BASE_PORT + i);
+		uint16_t rttPort = (uint16_t)(RTT_BASE_PORT + i * RTT_SERVER_CHANNEL_NUM);
+		startRspServer(ti, devices[i]->getExecutor(), rspPort);
+		startRttServer(devices[i]->getRTT(), rttPort);
+		_DBGPRT("device %d (%s): RSP port %d, RTT port %d-%d\n", (int)i, devices[i]->getDeviceInfo().serial.c_str(),
+			rspPort, rttPort, rttPort + RTT_SERVER_CHANNEL_NUM - 1);
+		started++;
+	}
+
+	if (started == 0)
+		return OK;
 
 	while (1)
 	{
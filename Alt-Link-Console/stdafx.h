@@ -13,5 +13,7 @@
 
 #define POCO_STATIC
 
-#define _DBGPRT printf
-#define _ERRPRT printf
+#include "Log.h"
+
+#define _DBGPRT(...) LOG_DEBUG(LOG_SUBSYSTEM, __VA_ARGS__)
+#define _ERRPRT(...) LOG_ERROR(LOG_SUBSYSTEM, __VA_ARGS__)
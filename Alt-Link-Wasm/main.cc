@@ -114,7 +114,7 @@ public:
 
 public:
 	int index = 0;
-} device;
+};
 
 void dump(ADIv5TI& ti, uint64_t start, uint32_t len)
 {
@@ -199,6 +199,17 @@ public:
 		current_ti->resume();
 	}
 
+	// 操作対象のプローブを切り替える
+	bool selectDevice(uint32_t index) {
+		auto devices = altlink.getDevices();
+		if (index >= devices.size() || devices[index]->getTI() == nullptr)
+			return false;
+
+		current_device = devices[index];
+		current_ti = current_device->getTI();
+		return true;
+	}
+
 	emscripten::val readRegister(const uint32_t n) {
 		uint32_t value = 0;
 		auto ret = current_ti->readRegister(n, &value);
@@ -220,6 +231,7 @@ EMSCRIPTEN_BINDINGS(target_binding_class) {
     .function("interrupt", &TargetBinding::interrupt)
     .function("resume", &TargetBinding::resume)
     .function("readRegister", &TargetBinding::readRegister)
+    .function("selectDevice", &TargetBinding::selectDevice)
     //.property("x", &MyClass::getX, &MyClass::setX)
     //.class_function("getStringFromInstance", &MyClass::getStringFromInstance)
     ;
@@ -227,7 +239,8 @@ EMSCRIPTEN_BINDINGS(target_binding_class) {
 
 int main(int argc, char* argv[])
 {
-	if (altlink.enumerate(&device) != OK)
+	altlink.setHIDDeviceFactory([]() { return std::make_shared<HIDApi>(); });
+	if (altlink.enumerate() != OK)
 		return OK;
 
 	auto devices = altlink.getDevices();
@@ -237,9 +250,6 @@ int main(int argc, char* argv[])
 		return OK;
 	}
 
-	if (devices[0]->open(&device) != OK)
-		return OK;
-
 #if 0
 	{
 		auto dap = devices[0]->getDAP();
@@ -281,15 +291,24 @@ int main(int argc, char* argv[])
 	CMSISDAP::ConnectionType type = CMSISDAP::SWJ_SWD;
 #endif
 
-	if (devices[0]->setConnectionType(type) != OK)
-		return OK;
+	// WebHID は非同期の呼び出しで待つので, 全てのプローブを順に開く
+	for (auto device : devices)
+	{
+		if (device->open() != OK)
+			continue;
 
-	if (devices[0]->scan() != OK)
-		return OK;
+		if (device->setConnectionType(type) != OK)
+			continue;
 
+		if (device->scan() != OK)
+			continue;
 
-	current_device = devices[0];
-	current_ti = devices[0]->getTI();
+		if (current_device == nullptr)
+		{
+			current_device = device;
+			current_ti = device->getTI();
+		}
+	}
 
 	return 0;
 }
@@ -2,10 +2,14 @@
 #include "stdafx.h"
 #include "ADIv5.h"
 #include "JEP106.h"
+#include "Trace.h"
 
 #include <thread>
 #include <chrono>
 
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_ADI
+
 #define AP_ABORT_DAPABORT 0x01     /* generate a DAP abort */
 #define AP_ABORT_STK_CMP_CLR 0x02  /* clear STICKYCMP sticky compare flag */
 #define AP_ABORT_STK_ERR_CLR 0x04  /* clear STICKYERR sticky error flag */
@@ -400,13 +404,15 @@ int32_t ADIv5::scanAPs()
 
 			if (!hasDebugEntry)
 			{
-				// Debug Entry なしの AHB bus は sysmem なので登録する
+				// Debug Entry なしの AHB/AXI bus は sysmem なので登録する
 				if (idr.isAHB())
-					ahbSysmemAps.push_back(std::make_shared<MEM_AP>(i, ap));
+					ahbSysmemAps.push_back(std::make_shared<MEM_AP>(i, ap, MEM_AP::BUS_AHB));
+				else if (idr.isAXI())
+					axiSysmemAps.push_back(std::make_shared<MEM_AP>(i, ap, MEM_AP::BUS_AXI));
 				continue;
 			}
 
-			std::shared_ptr<MEM_AP> memAp = std::make_shared<MEM_AP>(i, ap);
+			std::shared_ptr<MEM_AP> memAp = std::make_shared<MEM_AP>(i, ap, idr.getBusType());
 			std::shared_ptr<Component> component = std::make_shared<Component>(Memory(*memAp, base & 0xFFFFF000));
 
 			ret = component->readPidCid();
@@ -565,6 +571,10 @@ errno_t ADIv5::AP::checkStatus(uint32_t ap)
 
 int32_t ADIv5::AP::read(uint32_t ap, uint32_t reg, uint32_t *data)
 {
+	TRACE_SPAN(span, "ap", "AP::read");
+	TRACE_ARG(span, "reg", reg);
+	TRACE_ARG(span, "selectHit", ap == lastAp && (reg & 0xF0) == lastApBank);
+
 	int ret = select(ap, reg);
 	if (ret != OK)
 	{
@@ -589,6 +599,10 @@ int32_t ADIv5::AP::read(uint32_t ap, uint32_t reg, uint32_t *data)
 
 int32_t ADIv5::AP::write(uint32_t ap, uint32_t reg, uint32_t data)
 {
+	TRACE_SPAN(span, "ap", "AP::write");
+	TRACE_ARG(span, "reg", reg);
+	TRACE_ARG(span, "selectHit", ap == lastAp && (reg & 0xF0) == lastApBank);
+
 	int ret = select(ap, reg);
 	if (ret != OK)
 	{
@@ -613,7 +627,7 @@ int32_t ADIv5::AP::write(uint32_t ap, uint32_t reg, uint32_t data)
 
 bool ADIv5::MEM_AP::isSameTAR(uint32_t addr)
 {
-	if (lastTAR == addr)
+	if (lastTARValid && lastTAR == addr)
 		return true;
 	return false;
 }
@@ -623,7 +637,7 @@ bool ADIv5::MEM_AP::isSame32BitAlignedTAR(uint32_t addr, uint32_t* reg)
 	if (reg == nullptr)
 		return false;
 
-	if ((lastTAR & 0xFFFFFFF0) == (addr & 0xFFFFFFF0))
+	if (lastTARValid && (lastTAR & 0xFFFFFFF0) == (addr & 0xFFFFFFF0))
 	{
 		if ((addr & 0xF) == 0x0)
 			*reg = MEM_AP_REG_BD0;
@@ -652,14 +666,113 @@ bool ADIv5::MEM_AP::is16BitAligned(uint32_t addr)
 	return false;
 }
 
+int32_t ADIv5::AP::readBlock(uint32_t ap, uint32_t reg, uint32_t count, uint32_t *data)
+{
+	TRACE_SPAN(span, "ap", "AP::readBlock");
+	TRACE_ARG(span, "count", count);
+	TRACE_ARG(span, "selectHit", ap == lastAp && (reg & 0xF0) == lastApBank);
+
+	int ret = select(ap, reg);
+	if (ret != OK)
+	{
+		errno_t ret2 = checkStatus(ap);
+		if (ret2 != OK)
+			return ret;
+		ret = select(ap, reg);
+	}
+	if (ret != OK)
+		return ret;
+
+	// 途中まで転送されている可能性があるので、ここではリトライせずにエラーの解除だけ行う
+	ret = dap.apReadBlock(reg, count, data);
+	if (ret != OK)
+		(void)checkStatus(ap);
+	return ret;
+}
+
+int32_t ADIv5::AP::writeBlock(uint32_t ap, uint32_t reg, uint32_t count, const uint32_t *data)
+{
+	TRACE_SPAN(span, "ap", "AP::writeBlock");
+	TRACE_ARG(span, "count", count);
+	TRACE_ARG(span, "selectHit", ap == lastAp && (reg & 0xF0) == lastApBank);
+
+	int ret = select(ap, reg);
+	if (ret != OK)
+	{
+		errno_t ret2 = checkStatus(ap);
+		if (ret2 != OK)
+			return ret;
+		ret = select(ap, reg);
+	}
+	if (ret != OK)
+		return ret;
+
+	ret = dap.apWriteBlock(reg, count, data);
+	if (ret != OK)
+		(void)checkStatus(ap);
+	return ret;
+}
+
+int32_t ADIv5::AP::transfer(uint32_t ap, const std::vector<DAP::Transfer>& transfers)
+{
+	std::vector<DAP::Transfer> list;
+	list.reserve(transfers.size() + 1);
+
+	// bank が変わる箇所に SELECT の書き込みを挟む
+	uint32_t bank = lastApBank;
+	bool selected = (ap == lastAp);
+	for (auto& t : transfers)
+	{
+		if (t.ap && (!selected || (t.reg & 0xF0) != bank))
+		{
+			DP_SELECT select;
+			select.APSEL = ap;
+			select.Reserved[0] = 0;
+			select.Reserved[1] = 0;
+			select.APBANKSEL = (t.reg & 0xF0) >> 4;
+			select.DPBANKSEL = 0;
+
+			list.push_back({ false, false, DP_REG_SELECT, select.raw, nullptr });
+			bank = t.reg & 0xF0;
+			selected = true;
+		}
+		list.push_back(t);
+	}
+
+	TRACE_SPAN(span, "ap", "AP::transfer");
+	TRACE_ARG(span, "count", transfers.size());
+	TRACE_ARG(span, "selects", list.size() - transfers.size());
+
+	int ret = dap.transfer(list);
+	if (ret != OK)
+	{
+		// どこまで SELECT が反映されたか分からないので次回は必ず設定し直す
+		lastAp = 0xFFFFFFFF;
+		(void)checkStatus(ap);
+		return ret;
+	}
+
+	if (selected)
+	{
+		lastAp = ap;
+		lastApBank = bank;
+	}
+	return OK;
+}
+
 int32_t ADIv5::MEM_AP::read(uint32_t addr, uint32_t *data)
 {
+	TRACE_SPAN(span, "ap", "MEM_AP::read");
+	TRACE_ARG(span, "addr", addr);
+
 	uint32_t reg;
 	errno_t ret = setAccessSize(SIZE_32BIT);
 	if (ret != OK)
 		return ret;
 
-	if (is32BitAligned(lastTAR) && isSame32BitAlignedTAR(addr, &reg))
+	bool tarHit = is32BitAligned(lastTAR) && isSame32BitAlignedTAR(addr, &reg);
+	TRACE_ARG(span, "tarHit", tarHit);
+	if (tarHit)
 	{
 		ret = ap.read(index, reg, data);
 		if (ret != OK)
@@ -672,6 +785,7 @@ int32_t ADIv5::MEM_AP::read(uint32_t addr, uint32_t *data)
 			return ret;
 		}
 		lastTAR = addr;
+		lastTARValid = true;
 
 		ret = ap.read(index, MEM_AP_REG_DRW, data);
 		if (ret != OK) {
@@ -683,6 +797,9 @@ int32_t ADIv5::MEM_AP::read(uint32_t addr, uint32_t *data)
 
 int32_t ADIv5::MEM_AP::write(uint32_t addr, uint32_t val)
 {
+	TRACE_SPAN(span, "ap", "MEM_AP::write");
+	TRACE_ARG(span, "addr", addr);
+
 	uint32_t reg;
 	ASSERT_RELEASE(is32BitAligned(addr));
 
@@ -690,7 +807,9 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint32_t val)
 	if (ret != OK)
 		return ret;
 
-	if (is32BitAligned(lastTAR) && isSame32BitAlignedTAR(addr, &reg))
+	bool tarHit = is32BitAligned(lastTAR) && isSame32BitAlignedTAR(addr, &reg);
+	TRACE_ARG(span, "tarHit", tarHit);
+	if (tarHit)
 	{
 		ret = ap.write(index, reg, val);
 		if (ret != OK)
@@ -703,6 +822,7 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint32_t val)
 			return ret;
 		}
 		lastTAR = addr;
+		lastTARValid = true;
 
 		ret = ap.write(index, MEM_AP_REG_DRW, val);
 		if (ret != OK) {
@@ -714,12 +834,16 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint32_t val)
 
 int32_t ADIv5::MEM_AP::write(uint32_t addr, uint16_t val)
 {
+	TRACE_SPAN(span, "ap", "MEM_AP::write16");
+	TRACE_ARG(span, "addr", addr);
+
 	ASSERT_RELEASE(is16BitAligned(addr));
 
 	errno_t ret = setAccessSize(SIZE_16BIT);
 	if (ret != OK)
 		return ret;
 
+	TRACE_ARG(span, "tarHit", isSameTAR(addr));
 	if (!isSameTAR(addr))
 	{
 		ret = ap.write(index, MEM_AP_REG_TAR, addr);
@@ -727,6 +851,7 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint16_t val)
 			return ret;
 		}
 		lastTAR = addr;
+		lastTARValid = true;
 	}
 
 	ret = ap.write(index, MEM_AP_REG_DRW, (addr & 2) ? ((uint32_t)val) << 16 : val);
@@ -738,10 +863,14 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint16_t val)
 
 int32_t ADIv5::MEM_AP::write(uint32_t addr, uint8_t val)
 {
+	TRACE_SPAN(span, "ap", "MEM_AP::write8");
+	TRACE_ARG(span, "addr", addr);
+
 	errno_t ret = setAccessSize(SIZE_8BIT);
 	if (ret != OK)
 		return ret;
 
+	TRACE_ARG(span, "tarHit", isSameTAR(addr));
 	if (!isSameTAR(addr))
 	{
 		ret = ap.write(index, MEM_AP_REG_TAR, addr);
@@ -749,6 +878,7 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint8_t val)
 			return ret;
 		}
 		lastTAR = addr;
+		lastTARValid = true;
 	}
 
 	ret = ap.write(index, MEM_AP_REG_DRW,
@@ -760,27 +890,185 @@ int32_t ADIv5::MEM_AP::write(uint32_t addr, uint8_t val)
 
 	return OK;
 }
-errno_t ADIv5::MEM_AP::setAccessSize(ADIv5::MEM_AP::AccessSize size)
+errno_t ADIv5::MEM_AP::setAccessSize(ADIv5::MEM_AP::AccessSize size, ADIv5::MEM_AP::AddressIncrement inc)
 {
-	if (size != lastAccessSize)
+	if (size != lastAccessSize || inc != lastAddressIncrement)
 	{
 		MEM_AP_CSW csw;
 		errno_t ret = ap.read(index, MEM_AP_REG_CSW, &csw.raw);
 		if (ret != OK)
 			return ret;
 
-		if (size != csw.Size)
+		if (size != csw.Size || inc != csw.AddrInc)
 		{
 			csw.Size = size;
+			csw.AddrInc = inc;
 			ret = ap.write(index, MEM_AP_REG_CSW, csw.raw);
 			if (ret != OK)
 				return ret;
-			lastAccessSize = csw.Size;
 		}
+		lastAccessSize = size;
+		lastAddressIncrement = inc;
 	}
 	return OK;
 }
 
+const char* ADIv5::MEM_AP::getBusTypeName(BusType bus)
+{
+	return bus == BUS_AHB ? "AHB" :
+		bus == BUS_APB ? "APB" :
+		bus == BUS_AXI ? "AXI" : "UNKNOWN";
+}
+
+errno_t ADIv5::MEM_AP::readBlock(uint32_t addr, uint32_t count, uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	return transferBlock(true, addr, count, data, nullptr);
+}
+
+errno_t ADIv5::MEM_AP::writeBlock(uint32_t addr, uint32_t count, const uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	return transferBlock(false, addr, count, nullptr, data);
+}
+
+errno_t ADIv5::MEM_AP::readRepeat(uint32_t addr, uint32_t count, uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	return transferRepeat(true, addr, count, data, nullptr);
+}
+
+errno_t ADIv5::MEM_AP::writeRepeat(uint32_t addr, uint32_t count, const uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	return transferRepeat(false, addr, count, nullptr, data);
+}
+
+errno_t ADIv5::MEM_AP::transferRepeat(bool read, uint32_t addr, uint32_t count, uint32_t *rdata, const uint32_t *wdata)
+{
+	TRACE_SPAN(span, "ap", read ? "MEM_AP::readRepeat" : "MEM_AP::writeRepeat");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "count", count);
+	TRACE_ARG(span, "tarHit", lastTARValid && lastTAR == addr);
+
+	if (!is32BitAligned(addr))
+		return EINVAL;
+
+	errno_t ret = setAccessSize(SIZE_32BIT, INC_OFF);
+	if (ret != OK)
+		return ret;
+
+	if (!lastTARValid || lastTAR != addr)
+	{
+		ret = ap.write(index, MEM_AP_REG_TAR, addr);
+		if (ret != OK)
+		{
+			lastTARValid = false;
+			return ret;
+		}
+		lastTAR = addr;
+		lastTARValid = true;
+	}
+
+	if (read)
+		ret = ap.readBlock(index, MEM_AP_REG_DRW, count, rdata);
+	else
+		ret = ap.writeBlock(index, MEM_AP_REG_DRW, count, wdata);
+	if (ret != OK)
+		lastTARValid = false;
+	return ret;
+}
+
+errno_t ADIv5::MEM_AP::transferBlock(bool read, uint32_t addr, uint32_t count, uint32_t *rdata, const uint32_t *wdata)
+{
+	TRACE_SPAN(span, "ap", read ? "MEM_AP::readBlock" : "MEM_AP::writeBlock");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "count", count);
+
+	if (!is32BitAligned(addr))
+		return EINVAL;
+
+	errno_t ret = setAccessSize(SIZE_32BIT, INC_SINGLE);
+	if (ret != OK)
+		return ret;
+
+	while (count > 0)
+	{
+		// auto increment の境界で TAR を設定し直す
+		uint32_t n = (AUTO_INCREMENT_BOUNDARY - (addr & (AUTO_INCREMENT_BOUNDARY - 1))) / 4;
+		if (n > count)
+			n = count;
+
+		for (uint32_t retry = 0; retry < 2; retry++)
+		{
+			ret = ap.write(index, MEM_AP_REG_TAR, addr);
+			if (ret != OK)
+				break;
+
+			if (read)
+				ret = ap.readBlock(index, MEM_AP_REG_DRW, n, rdata);
+			else
+				ret = ap.writeBlock(index, MEM_AP_REG_DRW, n, wdata);
+			if (ret == OK)
+				break;
+		}
+		// TAR は auto increment で進んでいるので次のアクセスでは設定し直す
+		lastTARValid = false;
+		if (ret != OK)
+			return ret;
+
+		addr += n * 4;
+		count -= n;
+		if (read)
+			rdata += n;
+		else
+			wdata += n;
+	}
+	return OK;
+}
+
+errno_t ADIv5::MEM_AP::transfer(const std::vector<Access>& accesses)
+{
+	if (accesses.size() == 0)
+		return OK;
+
+	errno_t ret = setAccessSize(SIZE_32BIT);
+	if (ret != OK)
+		return ret;
+
+	std::vector<DAP::Transfer> transfers;
+	transfers.reserve(accesses.size() * 2);
+	for (auto& a : accesses)
+	{
+		if (!is32BitAligned(a.addr))
+			return EINVAL;
+
+		transfers.push_back({ true, false, MEM_AP_REG_TAR, a.addr, nullptr });
+		if (a.read)
+			transfers.push_back({ true, true, MEM_AP_REG_DRW, 0, a.data });
+		else
+			transfers.push_back({ true, false, MEM_AP_REG_DRW, a.value, nullptr });
+	}
+
+	ret = ap.transfer(index, transfers);
+	if (ret != OK)
+	{
+		lastTARValid = false;
+		return ret;
+	}
+	lastTAR = accesses.back().addr;
+	lastTARValid = true;
+	return OK;
+}
+
 int32_t ADIv5::ROM_TABLE::read()
 {
 	int ret;
@@ -934,5 +1222,20 @@ std::vector<std::shared_ptr<ADIv5::MEM_AP>> ADIv5::findSysmem()
 	}
 	for (auto ap : ahbSysmemAps)
 		v.push_back(ap);
+	for (auto ap : axiSysmemAps)
+		v.push_back(ap);
+	return v;
+}
+
+std::vector<std::shared_ptr<ADIv5::MEM_AP>> ADIv5::findMemAPs()
+{
+	std::vector<std::shared_ptr<MEM_AP>> v;
+
+	for (auto ap : memAps)
+		v.push_back(ap.first);
+	for (auto ap : ahbSysmemAps)
+		v.push_back(ap);
+	for (auto ap : axiSysmemAps)
+		v.push_back(ap);
 	return v;
 }
@@ -72,6 +72,9 @@ public:
 		AP(ADIv5& _adi, DAP& _dap) : adi(_adi), dap(_dap) {}
 		int32_t read(uint32_t ap, uint32_t reg, uint32_t *data);
 		int32_t write(uint32_t ap, uint32_t reg, uint32_t val);
+		int32_t readBlock(uint32_t ap, uint32_t reg, uint32_t count, uint32_t *data);
+		int32_t writeBlock(uint32_t ap, uint32_t reg, uint32_t count, const uint32_t *data);
+		int32_t transfer(uint32_t ap, const std::vector<DAP::Transfer>& transfers);
 
 	private:
 		ADIv5& adi;
@@ -97,19 +100,61 @@ public:
 			INVALID		= 0xFFFFFFFF
 		};
 
-		MEM_AP(uint32_t _index, AP& _ap) : index(_index), ap(_ap) {}
+		enum AddressIncrement
+		{
+			INC_OFF		= 0,
+			INC_SINGLE	= 1,
+			INC_PACKED	= 2,
+			INC_INVALID	= 0xFFFFFFFF
+		};
+
+		enum BusType
+		{
+			BUS_UNKNOWN,
+			BUS_AHB,
+			BUS_APB,
+			BUS_AXI
+		};
+
+		// TAR の auto increment が保証されるのは下位 10bit の範囲のみ
+		static const uint32_t AUTO_INCREMENT_BOUNDARY = 0x400;
+
+		MEM_AP(uint32_t _index, AP& _ap, BusType _bus = BUS_UNKNOWN) : index(_index), ap(_ap), bus(_bus) {}
 		errno_t read(uint32_t addr, uint32_t *data);
 		errno_t write(uint32_t addr, uint32_t val);
 		errno_t write(uint32_t addr, uint16_t val);
 		errno_t write(uint32_t addr, uint8_t val);
-		errno_t setAccessSize(AccessSize size);
+		errno_t readBlock(uint32_t addr, uint32_t count, uint32_t *data);	// count: number of 32-bit words
+		errno_t writeBlock(uint32_t addr, uint32_t count, const uint32_t *data);
+		errno_t readRepeat(uint32_t addr, uint32_t count, uint32_t *data);	// 同じアドレスを count 回読む (TAR 固定)
+		errno_t writeRepeat(uint32_t addr, uint32_t count, const uint32_t *data);	// 同じアドレスに count 回書く (TAR 固定)
+
+		// 複数アドレスへの 32bit アクセスを 1 回の転送にまとめる
+		struct Access
+		{
+			bool read;
+			uint32_t addr;
+			uint32_t value;		// write data
+			uint32_t *data;		// read data
+		};
+		errno_t transfer(const std::vector<Access>& accesses);
+
+		errno_t setAccessSize(AccessSize size, AddressIncrement inc = INC_OFF);
 		uint32_t getIndex() const { return index; };
+		BusType getBusType() const { return bus; }
+		static const char* getBusTypeName(BusType bus);
 
 	private:
 		uint32_t index;
 		AP& ap;
+		BusType bus;
 		uint32_t lastTAR = 0;
+		bool lastTARValid = false;
 		AccessSize lastAccessSize = INVALID;
+		AddressIncrement lastAddressIncrement = INC_INVALID;
+
+		errno_t transferBlock(bool read, uint32_t addr, uint32_t count, uint32_t *rdata, const uint32_t *wdata);
+		errno_t transferRepeat(bool read, uint32_t addr, uint32_t count, uint32_t *rdata, const uint32_t *wdata);
 
 		bool isSameTAR(uint32_t addr);
 		bool isSame32BitAlignedTAR(uint32_t addr, uint32_t* reg);
@@ -336,6 +381,7 @@ public:
 	std::vector<std::shared_ptr<Component>> findARMv6MBPU();
 	std::vector<std::shared_ptr<Component>> findARMv7MFPB();
 	std::vector<std::shared_ptr<MEM_AP>> findSysmem();
+	std::vector<std::shared_ptr<MEM_AP>> findMemAPs();
 
 	template <class Archive>
 	void serializeApTable(Archive& archive);
@@ -363,6 +409,7 @@ private:
 		bool isAHB() { return (Type == 0x01 && Class == MemoryAccessPort) ? true : false; }
 		bool isAPB() { return (Type == 0x02 && Class == MemoryAccessPort) ? true : false; }
 		bool isAXI() { return (Type == 0x04 && Class == MemoryAccessPort) ? true : false; }
+		MEM_AP::BusType getBusType() { return isAHB() ? MEM_AP::BUS_AHB : isAPB() ? MEM_AP::BUS_APB : isAXI() ? MEM_AP::BUS_AXI : MEM_AP::BUS_UNKNOWN; }
 		const char* getClassType() {
 			return Type == 0x00 && Class == AP_IDR::NoDefined ? "JTAG-AP" :
 			isAHB() ? "MEM-AP AMBA AHB bus" :
@@ -381,6 +428,7 @@ private:
 
 	std::vector<std::pair<std::shared_ptr<MEM_AP>, ROM_TABLE>> memAps;
 	std::vector<std::shared_ptr<MEM_AP>> ahbSysmemAps;
+	std::vector<std::shared_ptr<MEM_AP>> axiSysmemAps;
 	std::vector<std::pair<uint32_t, AP_IDR>> aps;
 	std::shared_ptr<DAP> dap;
 };
@@ -409,6 +457,12 @@ inline void ADIv5::serializeApTable(Archive& archive)
 				archive(::cereal::make_nvp("ahbSysmem", true));
 			}
 		}
+
+		for (auto memAp : axiSysmemAps) {
+			if (memAp->getIndex() == ap.first) {
+				archive(::cereal::make_nvp("axiSysmem", true));
+			}
+		}
 	}
 	archive.finishNode();
 }
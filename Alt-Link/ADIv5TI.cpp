@@ -1,8 +1,20 @@
 
 #include "stdafx.h"
 #include "ADIv5TI.h"
+#include "CRC32.h"
+#include "CoreDump.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_TARGET
 
 enum Signal
 {
@@ -10,6 +22,14 @@ enum Signal
 	SIGTRAP		= 5
 };
 
+// semihosting で 1 回に転送するバイト数の上限
+static const uint32_t MAX_SEMIHOSTING_TRANSFER = 0x10000;
+
+// ARMv7-A/R のレジスタ番号 (target.xml): r0-r15, cpsr, d0-d31, fpscr
+static const uint32_t V7AR_REG_CPSR = 16;
+static const uint32_t V7AR_REG_D0 = 17;
+static const uint32_t V7AR_REG_FPSCR = V7AR_REG_D0 + 32;
+
 ADIv5TI::ADIv5TI(std::shared_ptr<ADIv5> _adi) : adi(_adi)
 {
 	auto _v7dif = adi->findARMv7ARDIF();
@@ -71,6 +91,7 @@ ADIv5TI::ADIv5TI(std::shared_ptr<ADIv5> _adi) : adi(_adi)
 	{
 		dwt = std::make_shared<ARMv6MDWT>(*_dwt[0]);
 		_DBGPRT("ARMv6-M DWT\n");
+		dwt->init();
 		dwt->printPC();
 		dwt->printCtrl();
 	}
@@ -80,6 +101,7 @@ ADIv5TI::ADIv5TI(std::shared_ptr<ADIv5> _adi) : adi(_adi)
 	{
 		dwt = std::make_shared<ARMv7MDWT>(*_v7dwt[0]);
 		_DBGPRT("ARMv7-M DWT\n");
+		dwt->init();
 		dwt->printPC();
 		dwt->printCtrl();
 	}
@@ -106,7 +128,19 @@ ADIv5TI::ADIv5TI(std::shared_ptr<ADIv5> _adi) : adi(_adi)
 	auto _mem = adi->findSysmem();
 	if (_mem.size() > 0)
 	{
-		mem = _mem[0];
+		// 全体を見渡せて速い AXI-AP, 次に AHB-AP を既定にする. 範囲ごとの AP は monitor memap で指定する
+		auto best = _mem[0];
+		for (auto bus : { ADIv5::MEM_AP::BUS_AXI, ADIv5::MEM_AP::BUS_AHB })
+		{
+			auto it = std::find_if(_mem.begin(), _mem.end(), [bus](std::shared_ptr<ADIv5::MEM_AP> ap) { return ap->getBusType() == bus; });
+			if (it != _mem.end())
+			{
+				best = *it;
+				break;
+			}
+		}
+		mem = std::make_shared<MemoryRouter>(best);
+		_DBGPRT("System memory: AP-%d (%s)\n", best->getIndex(), ADIv5::MEM_AP::getBusTypeName(best->getBusType()));
 	}
 }
 
@@ -190,6 +224,11 @@ errno_t ADIv5TI::testHaltAndRun()
 
 int32_t ADIv5TI::attach()
 {
+	TRACE_SPAN(span, "ti", "attach");
+
+	if (v7dif.size() > 0)
+		return ARMv7ARDIF::haltAll(v7dif);
+
 	if (scs)
 		return scs->halt();
 
@@ -198,13 +237,82 @@ int32_t ADIv5TI::attach()
 
 void ADIv5TI::detach()
 {
-	if (scs)
+	if (v7dif.size() > 0)
+		ARMv7ARDIF::runAll(v7dif);
+	else if (scs)
 		scs->run();
 }
 
-void ADIv5TI::setTargetThreadId()
+int32_t ADIv5TI::getThreadCount()
 {
-	// TODO
+	if (v7dif.size() > 0)
+		return (int32_t)v7dif.size();
+	if (scs)
+		return 1;
+	return 0;
+}
+
+std::shared_ptr<ARMv7ARDIF> ADIv5TI::getRegisterDIF()
+{
+	if (registerThreadId > 0 && (size_t)registerThreadId <= v7dif.size())
+		return v7dif[registerThreadId - 1];
+	if (v7dif.size() > 0)
+		return v7dif[0];
+	return nullptr;
+}
+
+std::vector<std::shared_ptr<ARMv7ARDIF>> ADIv5TI::selectDIFs(int32_t threadId)
+{
+	if (threadId <= 0)
+		return v7dif;
+	if ((size_t)threadId <= v7dif.size())
+		return { v7dif[threadId - 1] };
+	return { };
+}
+
+void ADIv5TI::setResumedThreads(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs)
+{
+	resumedThreads.assign(v7dif.size(), false);
+	for (size_t i = 0; i < v7dif.size(); i++)
+	{
+		if (std::find(difs.begin(), difs.end(), v7dif[i]) != difs.end())
+			resumedThreads[i] = true;
+	}
+}
+
+void ADIv5TI::getThreadIds(std::vector<int32_t>* ids)
+{
+	ASSERT_RELEASE(ids != nullptr);
+
+	int32_t count = getThreadCount();
+	for (int32_t i = 1; i <= count; i++)
+		ids->push_back(i);
+}
+
+int32_t ADIv5TI::getCurrentThreadId()
+{
+	return registerThreadId;
+}
+
+errno_t ADIv5TI::setTargetThreadId(char op, int32_t threadId)
+{
+	if (threadId > getThreadCount() || threadId < -1)
+		return EINVAL;
+
+	if (op == 'g')
+	{
+		// any thread の場合は先頭のスレッドを使う
+		registerThreadId = threadId <= 0 ? 1 : threadId;
+	}
+	else if (op == 'c')
+	{
+		executionThreadId = threadId;
+	}
+	else
+	{
+		return EINVAL;
+	}
+	return OK;
 }
 
 void ADIv5TI::setCurrentPC(const uint64_t addr)
@@ -215,18 +323,39 @@ void ADIv5TI::setCurrentPC(const uint64_t addr)
 
 void ADIv5TI::resume()
 {
+	stopWatchPoint.valid = false;
+
 	// continue command
-	if (scs)
+	if (v7dif.size() > 0)
+	{
+		auto difs = selectDIFs(executionThreadId);
+		setResumedThreads(difs);
+		ARMv7ARDIF::runAll(difs);
+	}
+	else if (scs)
+	{
 		scs->run();
+	}
 
 	// [TODO] return error code
 }
 
 int32_t ADIv5TI::step(uint8_t* signal)
 {
+	TRACE_SPAN(span, "ti", "step");
+
 	ASSERT_RELEASE(signal != nullptr);
 
 	*signal = 0x05;	// SIGTRAP
+	stopWatchPoint.valid = false;
+
+	if (v7dif.size() > 0)
+	{
+		// 他のコアは止めたまま 1 つのコアだけ step する
+		auto difs = selectDIFs(executionThreadId);
+		auto dif = difs.size() == 1 ? difs[0] : getRegisterDIF();
+		return dif->step();
+	}
 
 	if (scs)
 		return scs->step();
@@ -236,48 +365,288 @@ int32_t ADIv5TI::step(uint8_t* signal)
 
 int32_t ADIv5TI::interrupt(uint8_t* signal)
 {
+	TRACE_SPAN(span, "ti", "interrupt");
+
 	ASSERT_RELEASE(signal != nullptr);
 
 	*signal = 0x05;	// SIGTRAP
 
+	if (v7dif.size() > 0)
+		return ARMv7ARDIF::haltAll(v7dif);
+
 	if (scs)
 		return scs->halt();
 
 	return ENODEV;
 }
 
-errno_t ADIv5TI::isRunning(bool* running, uint8_t* signal)
+errno_t ADIv5TI::resume(const std::map<int32_t, ResumeAction>& actions, bool* stopped, uint8_t* signal)
 {
-	ASSERT_RELEASE(running != nullptr);
+	TRACE_SPAN(span, "ti", "resume");
+
+	ASSERT_RELEASE(stopped != nullptr);
 	ASSERT_RELEASE(signal != nullptr);
 
+	stopWatchPoint.valid = false;
+
+	std::vector<int32_t> steps, continues, stops;
+	for (auto& action : actions)
+	{
+		if (action.first <= 0 || action.first > getThreadCount())
+			return EINVAL;
+
+		if (action.second == ACTION_STEP)
+			steps.push_back(action.first);
+		else if (action.second == ACTION_CONTINUE)
+			continues.push_back(action.first);
+		else if (action.second == ACTION_STOP)
+			stops.push_back(action.first);
+	}
+
+	// all-stop mode: step と continue が両方ある場合は, continue するコアを動かしてから step し,
+	// step が終わった時点で全コアを止めて step したスレッドの停止として返す
+	if (steps.size() > 0)
+	{
+		std::vector<std::shared_ptr<ARMv7ARDIF>> others;
+		if (v7dif.size() > 0)
+		{
+			for (auto id : continues)
+				others.push_back(v7dif[id - 1]);
+		}
+
+		int32_t ret = OK;
+		if (others.size() > 0)
+			ret = ARMv7ARDIF::runAll(others);
+
+		int32_t org = executionThreadId;
+		for (size_t i = 0; i < steps.size() && ret == OK; i++)
+		{
+			executionThreadId = steps[i];
+			ret = step(signal);
+		}
+		executionThreadId = org;
+
+		if (others.size() > 0)
+		{
+			errno_t r = ARMv7ARDIF::haltAll(others);
+			if (ret == OK)
+				ret = r;
+		}
+		if (ret != OK)
+			return ret;
+
+		registerThreadId = steps[0];
+		*stopped = true;
+		return OK;
+	}
+
+	if (continues.size() > 0)
+	{
+		errno_t ret;
+		if (v7dif.size() > 0)
+		{
+			std::vector<std::shared_ptr<ARMv7ARDIF>> difs;
+			for (auto id : continues)
+				difs.push_back(v7dif[id - 1]);
+			setResumedThreads(difs);
+			ret = ARMv7ARDIF::runAll(difs);
+		}
+		else
+		{
+			ret = scs->run();
+		}
+		if (ret != OK)
+			return ret;
+
+		*stopped = false;
+		return OK;
+	}
+
+	if (stops.size() > 0)
+	{
+		errno_t ret;
+		if (v7dif.size() > 0)
+		{
+			std::vector<std::shared_ptr<ARMv7ARDIF>> difs;
+			for (auto id : stops)
+				difs.push_back(v7dif[id - 1]);
+			ret = ARMv7ARDIF::haltAll(difs);
+		}
+		else
+		{
+			ret = scs->halt();
+		}
+		if (ret != OK)
+			return ret;
+
+		registerThreadId = stops[0];
+		*signal = 0;
+		*stopped = true;
+		return OK;
+	}
+	return EINVAL;
+}
+
+errno_t ADIv5TI::rangeStep(int32_t threadId, uint64_t start, uint64_t end, uint32_t maxSteps, bool* done, uint8_t* signal)
+{
+	TRACE_SPAN(span, "ti", "rangeStep");
+	TRACE_ARG(span, "start", start);
+	TRACE_ARG(span, "end", end);
+
+	ASSERT_RELEASE(done != nullptr && signal != nullptr);
+
+	*signal = 0x05;	// SIGTRAP
+	*done = true;
+	stopWatchPoint.valid = false;
+
+	if (threadId <= 0 || threadId > getThreadCount())
+		return EINVAL;
+
+	if (v7dif.size() > 0)
+	{
+		registerThreadId = threadId;
+		auto dif = v7dif[threadId - 1];
+
+		uint32_t steps = 0;
+		*done = false;
+		while (steps < maxSteps)
+		{
+			errno_t ret = dif->step();
+			if (ret != OK)
+				return ret;
+			steps++;
+
+			uint32_t pc;
+			ret = dif->getReg(ARMv7ARDIF::REG_PC, &pc);
+			if (ret != OK)
+				return ret;
+
+			if (dif->hasBreakPoint(pc) || pc < start || pc >= end)
+			{
+				*done = true;
+				break;
+			}
+		}
+
+		LOG_TRACE(LOG_SUBSYSTEM, "range step: %d steps (0x%08x - 0x%08x)\n", steps, (uint32_t)start, (uint32_t)end);
+		return OK;
+	}
+
 	if (!scs)
 		return ENODEV;
 
+	registerThreadId = threadId;
+
 	bool halt;
-	errno_t ret = scs->isHalt(&halt);
+	ARMv6MSCS::DFSR dfsr;
+	errno_t ret = scs->readHaltStatus(&halt, &dfsr);
 	if (ret != OK)
 		return ret;
-
 	if (!halt)
 	{
-		*running = true;
-		*signal = 0;
+		ret = scs->halt();
+		if (ret != OK)
+			return ret;
+	}
+
+	uint32_t steps = 0;
+	*done = false;
+	while (steps < maxSteps)
+	{
+		uint32_t pc;
+		ret = scs->stepAndReadPC(&pc, &dfsr);
+		if (ret != OK)
+			return ret;
+		steps++;
+
+		if (dfsr.BKPT || dfsr.DWTTRAP || dfsr.VCATCH || dfsr.EXTERNAL || pc < start || pc >= end)
+		{
+			*done = true;
+			break;
+		}
+	}
+
+	LOG_TRACE(LOG_SUBSYSTEM, "range step: %d steps (0x%08x - 0x%08x)\n", steps, (uint32_t)start, (uint32_t)end);
+	return OK;
+}
+
+errno_t ADIv5TI::isRunning(bool* running, uint8_t* signal)
+{
+	TRACE_SPAN(span, "ti", "isRunning");
+
+	ASSERT_RELEASE(running != nullptr);
+	ASSERT_RELEASE(signal != nullptr);
+
+	if (v7dif.size() > 0)
+	{
+		std::vector<bool> halted;
+		errno_t ret = ARMv7ARDIF::isHaltedAll(v7dif, &halted);
+		if (ret != OK)
+			return ret;
+
+		int32_t stoppedId = 0;
+		std::vector<std::shared_ptr<ARMv7ARDIF>> runnings;
+		for (size_t i = 0; i < halted.size(); i++)
+		{
+			// 動かしていないコア (scheduler-locking で止めたままのコアなど) は停止の要因にしない
+			bool resumed = resumedThreads.size() != halted.size() || resumedThreads[i];
+			if (halted[i] && resumed && stoppedId == 0)
+				stoppedId = (int32_t)i + 1;
+			else if (!halted[i])
+				runnings.push_back(v7dif[i]);
+		}
+
+		if (stoppedId == 0)
+		{
+			*running = true;
+			*signal = 0;
+			return OK;
+		}
+
+		// all-stop mode: 1 つのコアが止まったら残りのコアもまとめて止める
+		if (runnings.size() > 0)
+		{
+			ret = ARMv7ARDIF::haltAll(runnings);
+			if (ret != OK)
+				return ret;
+		}
+
+		registerThreadId = stoppedId;
+		*running = false;
+		*signal = SIGTRAP;
 		return OK;
 	}
 
+	if (!scs)
+		return ENODEV;
+
+	bool halt;
 	ARMv6MSCS::DFSR dfsr;
-	ret = scs->readDFSR(&dfsr);
+	errno_t ret = scs->readHaltStatus(&halt, &dfsr);
 	if (ret != OK)
 		return ret;
 
-	if (dfsr.raw == 0)
+	if (!halt || dfsr.raw == 0)
 	{
 		*running = true;
 		*signal = 0;
 	}
 	else
 	{
+		if (semihostingEnabled && dfsr.BKPT && !dfsr.EXTERNAL && !dfsr.VCATCH && !dfsr.DWTTRAP)
+		{
+			bool resumed;
+			ret = handleSemihosting(&resumed);
+			if (ret != OK)
+				return ret;
+			if (resumed)
+			{
+				*running = true;
+				*signal = 0;
+				return OK;
+			}
+		}
+
 		*running = false;
 
 		if (dfsr.EXTERNAL)
@@ -297,79 +666,511 @@ errno_t ADIv5TI::isRunning(bool* running, uint8_t* signal)
 	return OK;
 }
 
-errno_t ADIv5TI::setBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind)
+errno_t ADIv5TI::readString(uint64_t addr, uint32_t len, std::string* str)
 {
-	if (type == BreakPointType::HARDWARE)
-	{
-		if (bpu)
-			return bpu->addBreakPoint((uint32_t)addr);
-		else if (fpb)
-			return fpb->addBreakPoint((uint32_t)addr);
-	}
-	return ERSP_NOT_SUPPORTED;
-}
+	ASSERT_RELEASE(str != nullptr);
 
-int32_t ADIv5TI::unsetBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind)
-{
-	if (type == BreakPointType::HARDWARE)
-	{
-		if (bpu)
-			return bpu->delBreakPoint((uint32_t)addr);
-		else if (fpb)
-			return fpb->delBreakPoint((uint32_t)addr);
-	}
-	return ERSP_NOT_SUPPORTED;
-}
+	// readMemory はワード単位で読むので, 境界に揃えて読んでから切り出す
+	uint32_t offset = (uint32_t)(addr & 0x3);
+	std::vector<uint8_t> data;
+	errno_t ret = readMemory(addr - offset, (offset + len + 3) & ~0x3u, &data);
+	if (ret != OK)
+		return ret;
 
-int32_t ADIv5TI::setWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind)
-{
-	return ERSP_NOT_SUPPORTED;	// not supported
+	str->assign(data.begin() + offset, data.begin() + offset + len);
+	return OK;
 }
 
-int32_t ADIv5TI::unsetWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind)
+errno_t ADIv5TI::handleSemihosting(bool* resumed)
 {
-	return ERSP_NOT_SUPPORTED;	// not supported
-}
+	ASSERT_RELEASE(resumed != nullptr);
+	*resumed = false;
 
-errno_t ADIv5TI::readRegister(const uint32_t n, uint32_t* out)
-{
-	ASSERT_RELEASE(out != nullptr);
+	if (!scs || !mem)
+		return OK;
 
-	if (!scs)
-		return ENODEV;
+	// 1 回目: 操作番号 (R0), パラメータ (R1), PC
+	std::vector<uint32_t> regs;
+	errno_t ret = scs->readRegs({ ARMv6MSCS::R0, ARMv6MSCS::R1, ARMv6MSCS::DebugReturnAddress }, &regs);
+	if (ret != OK)
+		return ret;
 
-	ARMv6MSCS::REGSEL regsel = (ARMv6MSCS::REGSEL)n;
-	int32_t ret;
+	uint32_t op = regs[0];
+	uint32_t param = regs[1];
+	uint32_t pc = regs[2];
 
-	if (n == 19 || n == 20 || n == 21 || n == 22)
+	// 2 回目: 停止した命令とパラメータブロック (SYS_WRITEC は文字そのもの)
+	uint32_t insn;
+	std::vector<uint32_t> args(Semihosting::getParamCount(op));
+	std::vector<ADIv5::MEM_AP::Access> accesses = { { true, pc & ~0x3u, 0, &insn } };
+	if (op == Semihosting::SYS_WRITEC)
 	{
-		ret = scs->readReg(ARMv6MSCS::REGSEL::CONTROL_PRIMASK, out);
-		if (ret == OK)
-		{
-			if (n == 19)		// PRIMASK
-				*out = *out & 0xFF;
-			else if (n == 20)	// BASEPRI
-				*out = (*out >> 8) & 0xFF;
-			else if (n == 21)	// FAULTMASK
-				*out = (*out >> 16) & 0xFF;
-			else if (n == 22)	// CONTROL
-				*out = (*out >> 24) & 0xFF;
-		}
-		return ret;
+		args.resize(1);
+		accesses.push_back({ true, param & ~0x3u, 0, &args[0] });
 	}
-	return scs->readReg(regsel, out);
-}
-
-errno_t ADIv5TI::readRegister(const uint32_t n, uint64_t* out)
-{
-	ASSERT_RELEASE(out != nullptr);
-	uint32_t value;
-	int32_t result = readRegister(n, &value);
-	if (result == OK)
+	else if ((param & 0x3) == 0)
 	{
-		*out = value;
+		for (uint32_t i = 0; i < args.size(); i++)
+			accesses.push_back({ true, param + i * 4, 0, &args[i] });
 	}
-	return result;
+	else
+	{
+		args.clear();
+	}
+
+	ret = mem->transfer(accesses);
+	if (ret != OK)
+		return ret;
+
+	uint16_t bkpt = (uint16_t)((pc & 0x2) ? insn >> 16 : insn);
+	if (bkpt != Semihosting::BKPT_INSTRUCTION)
+		return OK;	// gdb のブレークポイント
+
+	// 3 回目: 必要に応じてバッファを転送する
+	int32_t result = -1;
+	bool exit = false;
+	switch (op)
+	{
+	case Semihosting::SYS_OPEN:
+	{
+		if (args.size() < 3)
+			break;
+		std::string name;
+		ret = readString(args[0], args[2], &name);
+		if (ret != OK)
+			return ret;
+		result = semihosting.open(name, args[1]);
+		break;
+	}
+	case Semihosting::SYS_CLOSE:
+		if (args.size() >= 1)
+			result = semihosting.close((int32_t)args[0]);
+		break;
+	case Semihosting::SYS_WRITEC:
+	{
+		uint8_t c = (uint8_t)(args[0] >> ((param & 0x3) * 8));
+		semihosting.writeConsole(&c, 1);
+		result = 0;
+		break;
+	}
+	case Semihosting::SYS_WRITE0:
+	{
+		// NUL が見つかるまでワード境界に揃えた単位で読む
+		const uint32_t CHUNK_SIZE = 256;
+		std::string str;
+		for (uint32_t addr = param; str.size() < MAX_SEMIHOSTING_TRANSFER;)
+		{
+			std::string chunk;
+			uint32_t len = CHUNK_SIZE - (addr & 0x3);
+			ret = readString(addr, len, &chunk);
+			if (ret != OK)
+				return ret;
+			size_t end = chunk.find('\0');
+			str += chunk.substr(0, end);
+			if (end != std::string::npos)
+				break;
+			addr += len;
+		}
+		semihosting.writeConsole((const uint8_t*)str.data(), (uint32_t)str.size());
+		result = 0;
+		break;
+	}
+	case Semihosting::SYS_WRITE:
+	{
+		if (args.size() < 3)
+			break;
+		int32_t handle = (int32_t)args[0];
+		uint32_t remain = args[2];
+		for (uint32_t addr = args[1]; remain > 0;)
+		{
+			uint32_t len = remain < MAX_SEMIHOSTING_TRANSFER ? remain : MAX_SEMIHOSTING_TRANSFER;
+			std::string data;
+			ret = readString(addr, len, &data);
+			if (ret != OK)
+				return ret;
+			int32_t left = semihosting.write(handle, (const uint8_t*)data.data(), len);
+			remain -= len - left;
+			addr += len;
+			if (left != 0)
+				break;
+		}
+		result = (int32_t)remain;
+		break;
+	}
+	case Semihosting::SYS_READ:
+	{
+		if (args.size() < 3)
+			break;
+		uint32_t len = args[2] < MAX_SEMIHOSTING_TRANSFER ? args[2] : MAX_SEMIHOSTING_TRANSFER;
+		std::vector<uint8_t> data(len);
+		uint32_t actual;
+		result = semihosting.read((int32_t)args[0], data.data(), len, &actual);
+		if (result < 0)
+			break;
+		result += args[2] - len;
+
+		// ワード境界までは 1 byte ずつ, 残りはブロック転送で書く
+		uint32_t addr = args[1];
+		uint32_t i = 0;
+		for (; i < actual && (addr & 0x3) != 0; i++, addr++)
+		{
+			ret = mem->write(addr, data[i]);
+			if (ret != OK)
+				return ret;
+		}
+		if (i < actual)
+		{
+			ret = writeMemory(addr, actual - i, std::vector<uint8_t>(data.begin() + i, data.begin() + actual));
+			if (ret != OK)
+				return ret;
+		}
+		break;
+	}
+	case Semihosting::SYS_ISTTY:
+		if (args.size() >= 1)
+			result = semihosting.isTTY((int32_t)args[0]);
+		break;
+	case Semihosting::SYS_SEEK:
+		if (args.size() >= 2)
+			result = semihosting.seek((int32_t)args[0], args[1]);
+		break;
+	case Semihosting::SYS_FLEN:
+		if (args.size() >= 1)
+			result = semihosting.getLength((int32_t)args[0]);
+		break;
+	case Semihosting::SYS_REMOVE:
+	{
+		if (args.size() < 2)
+			break;
+		std::string name;
+		ret = readString(args[0], args[1], &name);
+		if (ret != OK)
+			return ret;
+		result = semihosting.remove(name);
+		break;
+	}
+	case Semihosting::SYS_RENAME:
+	{
+		if (args.size() < 4)
+			break;
+		std::string from, to;
+		ret = readString(args[0], args[1], &from);
+		if (ret != OK)
+			return ret;
+		ret = readString(args[2], args[3], &to);
+		if (ret != OK)
+			return ret;
+		result = semihosting.rename(from, to);
+		break;
+	}
+	case Semihosting::SYS_CLOCK:
+		result = semihosting.getClock();
+		break;
+	case Semihosting::SYS_TIME:
+		result = semihosting.getTime();
+		break;
+	case Semihosting::SYS_ERRNO:
+		result = semihosting.getErrno();
+		break;
+	case Semihosting::SYS_GET_CMDLINE:
+	{
+		// コマンドラインは空
+		if (args.size() < 2 || args[1] == 0)
+			break;
+		ret = mem->write(args[0], (uint8_t)0);
+		if (ret != OK)
+			return ret;
+		ret = mem->write(param + 4, (uint32_t)0);
+		if (ret != OK)
+			return ret;
+		result = 0;
+		break;
+	}
+	case Semihosting::SYS_HEAPINFO:
+	{
+		// 全て 0 を返すと C ライブラリはリンカで決めた領域を使う
+		if (args.size() < 1 || (args[0] & 0x3) != 0)
+			break;
+		ret = mem->transfer({
+			{ false, args[0], 0, nullptr },
+			{ false, args[0] + 4, 0, nullptr },
+			{ false, args[0] + 8, 0, nullptr },
+			{ false, args[0] + 12, 0, nullptr } });
+		if (ret != OK)
+			return ret;
+		result = 0;
+		break;
+	}
+	case Semihosting::SYS_EXIT:
+	case Semihosting::SYS_EXIT_EXTENDED:
+		exit = true;
+		break;
+	default:
+		_DBGPRT("Unsupported semihosting operation 0x%02x\n", op);
+		break;
+	}
+
+	if (exit)
+	{
+		// 停止したまま gdb に報告する. continue すると BKPT の次から再開する
+		_DBGPRT("semihosting exit (reason: 0x%08x)\n", param);
+		semihosting.closeAll();
+		return scs->writeReg(ARMv6MSCS::DebugReturnAddress, pc + 2);
+	}
+
+	// 4 回目: 戻り値と PC を書いて再開する
+	stopWatchPoint.valid = false;
+	ret = scs->writeRegsAndRun({ { ARMv6MSCS::R0, (uint32_t)result }, { ARMv6MSCS::DebugReturnAddress, pc + 2 } });
+	if (ret != OK)
+		return ret;
+
+	*resumed = true;
+	return OK;
+}
+
+errno_t ADIv5TI::setBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind)
+{
+	TRACE_SPAN(span, "ti", "setBreakPoint");
+	TRACE_ARG(span, "addr", addr);
+
+	if (type == BreakPointType::HARDWARE)
+	{
+		if (v7dif.size() > 0)
+		{
+			// SMP のどのコアで実行されても止まるように全コアに設定する
+			for (size_t i = 0; i < v7dif.size(); i++)
+			{
+				errno_t ret = v7dif[i]->addBreakPoint((uint32_t)addr, kind);
+				if (ret != OK)
+				{
+					for (size_t j = 0; j < i; j++)
+						v7dif[j]->delBreakPoint((uint32_t)addr);
+					return ret;
+				}
+			}
+			return OK;
+		}
+		else if (bpu)
+			return bpu->addBreakPoint((uint32_t)addr);
+		else if (fpb)
+			return fpb->addBreakPoint((uint32_t)addr);
+	}
+	return ERSP_NOT_SUPPORTED;
+}
+
+int32_t ADIv5TI::unsetBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind)
+{
+	TRACE_SPAN(span, "ti", "unsetBreakPoint");
+	TRACE_ARG(span, "addr", addr);
+
+	if (type == BreakPointType::HARDWARE)
+	{
+		if (v7dif.size() > 0)
+		{
+			errno_t result = OK;
+			for (auto dif : v7dif)
+			{
+				errno_t ret = dif->delBreakPoint((uint32_t)addr);
+				if (ret != OK && result == OK)
+					result = ret;
+			}
+			return result;
+		}
+		else if (bpu)
+			return bpu->delBreakPoint((uint32_t)addr);
+		else if (fpb)
+			return fpb->delBreakPoint((uint32_t)addr);
+	}
+	return ERSP_NOT_SUPPORTED;
+}
+
+static ARMv6MDWT::WatchType toDWTWatchType(TargetInterface::WatchPointType type)
+{
+	switch (type)
+	{
+	case TargetInterface::WRITE:	return ARMv6MDWT::WATCH_WRITE;
+	case TargetInterface::READ:		return ARMv6MDWT::WATCH_READ;
+	default:						return ARMv6MDWT::WATCH_ACCESS;
+	}
+}
+
+static ARMv7ARDIF::WatchType toWRPWatchType(TargetInterface::WatchPointType type)
+{
+	switch (type)
+	{
+	case TargetInterface::WRITE:	return ARMv7ARDIF::WATCH_WRITE;
+	case TargetInterface::READ:		return ARMv7ARDIF::WATCH_READ;
+	default:						return ARMv7ARDIF::WATCH_ACCESS;
+	}
+}
+
+int32_t ADIv5TI::setWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind)
+{
+	if (v7dif.size() > 0)
+	{
+		// breakpoint と同様に全コアに設定する
+		for (size_t i = 0; i < v7dif.size(); i++)
+		{
+			errno_t ret = v7dif[i]->addWatchPoint(toWRPWatchType(type), (uint32_t)addr, kind);
+			if (ret != OK)
+			{
+				for (size_t j = 0; j < i; j++)
+					v7dif[j]->delWatchPoint(toWRPWatchType(type), (uint32_t)addr, kind);
+				return ret;
+			}
+		}
+		return OK;
+	}
+	else if (dwt)
+		return dwt->addWatchPoint(toDWTWatchType(type), (uint32_t)addr, kind);
+
+	return ERSP_NOT_SUPPORTED;
+}
+
+int32_t ADIv5TI::unsetWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind)
+{
+	if (v7dif.size() > 0)
+	{
+		errno_t result = OK;
+		for (auto dif : v7dif)
+		{
+			errno_t ret = dif->delWatchPoint(toWRPWatchType(type), (uint32_t)addr, kind);
+			if (ret != OK && result == OK)
+				result = ret;
+		}
+		return result;
+	}
+	else if (dwt)
+		return dwt->delWatchPoint(toDWTWatchType(type), (uint32_t)addr, kind);
+
+	return ERSP_NOT_SUPPORTED;
+}
+
+errno_t ADIv5TI::getStopWatchPoint(bool* hit, WatchPointType* type, uint64_t* addr)
+{
+	ASSERT_RELEASE(hit != nullptr && type != nullptr && addr != nullptr);
+
+	if (!stopWatchPoint.valid)
+	{
+		stopWatchPoint.hit = false;
+
+		for (auto dif : v7dif)
+		{
+			// 他のコアは停止要求で止めているので, watchpoint で止まったコアを探す
+			bool wrpHit;
+			ARMv7ARDIF::WatchType wrpType;
+			uint32_t wrpAddr;
+			errno_t ret = dif->findHit(&wrpHit, &wrpType, &wrpAddr);
+			if (ret != OK)
+				return ret;
+
+			if (wrpHit)
+			{
+				stopWatchPoint.hit = true;
+				stopWatchPoint.type = wrpType == ARMv7ARDIF::WATCH_WRITE ? WRITE :
+					wrpType == ARMv7ARDIF::WATCH_READ ? READ : ACCESS;
+				stopWatchPoint.addr = wrpAddr;
+				break;
+			}
+		}
+
+		if (dwt && scs)
+		{
+			ARMv6MSCS::DFSR dfsr;
+			errno_t ret = scs->readDFSR(&dfsr);
+			if (ret != OK)
+				return ret;
+
+			if (dfsr.DWTTRAP)
+			{
+				bool dwtHit;
+				ARMv6MDWT::WatchType dwtType;
+				uint32_t dwtAddr;
+				ret = dwt->findHit(&dwtHit, &dwtType, &dwtAddr);
+				if (ret != OK)
+					return ret;
+
+				if (dwtHit)
+				{
+					stopWatchPoint.hit = true;
+					stopWatchPoint.type = dwtType == ARMv6MDWT::WATCH_WRITE ? WRITE :
+						dwtType == ARMv6MDWT::WATCH_READ ? READ : ACCESS;
+					stopWatchPoint.addr = dwtAddr;
+				}
+
+				// 次の停止と区別するためクリアする (W1C)
+				ARMv6MSCS::DFSR clear;
+				clear.raw = 0;
+				clear.DWTTRAP = 1;
+				scs->writeDFSR(clear);
+			}
+		}
+		stopWatchPoint.valid = true;
+	}
+
+	*hit = stopWatchPoint.hit;
+	*type = stopWatchPoint.type;
+	*addr = stopWatchPoint.addr;
+	return OK;
+}
+
+errno_t ADIv5TI::readRegister(const uint32_t n, uint32_t* out)
+{
+	TRACE_SPAN(span, "ti", "readRegister");
+	TRACE_ARG(span, "n", n);
+
+	ASSERT_RELEASE(out != nullptr);
+
+	auto dif = getRegisterDIF();
+	if (dif)
+	{
+		if (n <= V7AR_REG_CPSR)
+			return dif->getReg(n, out);
+		else if (n == V7AR_REG_FPSCR)
+			return dif->readFPSCR(out);
+		return ERSP_NOT_SUPPORTED;
+	}
+
+	if (!scs)
+		return ENODEV;
+
+	ARMv6MSCS::REGSEL regsel = (ARMv6MSCS::REGSEL)n;
+	int32_t ret;
+
+	if (n == 19 || n == 20 || n == 21 || n == 22)
+	{
+		ret = scs->readReg(ARMv6MSCS::REGSEL::CONTROL_PRIMASK, out);
+		if (ret == OK)
+		{
+			if (n == 19)		// PRIMASK
+				*out = *out & 0xFF;
+			else if (n == 20)	// BASEPRI
+				*out = (*out >> 8) & 0xFF;
+			else if (n == 21)	// FAULTMASK
+				*out = (*out >> 16) & 0xFF;
+			else if (n == 22)	// CONTROL
+				*out = (*out >> 24) & 0xFF;
+		}
+		return ret;
+	}
+	return scs->readReg(regsel, out);
+}
+
+errno_t ADIv5TI::readRegister(const uint32_t n, uint64_t* out)
+{
+	ASSERT_RELEASE(out != nullptr);
+
+	auto dif = getRegisterDIF();
+	if (dif && n >= V7AR_REG_D0 && n < V7AR_REG_FPSCR)
+		return dif->readVFPReg(n - V7AR_REG_D0, out);
+
+	uint32_t value;
+	int32_t result = readRegister(n, &value);
+	if (result == OK)
+	{
+		*out = value;
+	}
+	return result;
 }
 
 errno_t ADIv5TI::readRegister(const uint32_t n, uint64_t* out1, uint64_t* out2)
@@ -387,6 +1188,19 @@ errno_t ADIv5TI::readRegister(const uint32_t n, uint64_t* out1, uint64_t* out2)
 
 errno_t ADIv5TI::writeRegister(const uint32_t n, const uint32_t data)
 {
+	TRACE_SPAN(span, "ti", "writeRegister");
+	TRACE_ARG(span, "n", n);
+
+	auto dif = getRegisterDIF();
+	if (dif)
+	{
+		if (n <= V7AR_REG_CPSR)
+			return dif->setReg(n, data);
+		else if (n == V7AR_REG_FPSCR)
+			return dif->writeFPSCR(data);
+		return ERSP_NOT_SUPPORTED;
+	}
+
 	if (!scs)
 		return ENODEV;
 
@@ -411,180 +1225,978 @@ errno_t ADIv5TI::writeRegister(const uint32_t n, const uint32_t data)
 		}
 		return ret;
 	}
-	return scs->writeReg(regsel, data);
+	return scs->writeReg(regsel, data);
+}
+
+errno_t ADIv5TI::writeRegister(const uint32_t n, const uint64_t data)
+{
+	auto dif = getRegisterDIF();
+	if (dif && n >= V7AR_REG_D0 && n < V7AR_REG_FPSCR)
+		return dif->writeVFPReg(n - V7AR_REG_D0, data);
+
+	// [TODO] support 64bit
+	return writeRegister(n, static_cast<uint32_t>(data));
+}
+
+uint32_t ADIv5TI::getRegisterSize(const uint32_t n)
+{
+	if (v7dif.size() > 0 && n >= V7AR_REG_D0 && n < V7AR_REG_FPSCR)
+		return 8;
+	return 4;
+}
+
+errno_t ADIv5TI::writeRegister(const uint32_t n, const uint64_t data1, const uint64_t data2)
+{
+	// [TODO] support 128bit
+	return writeRegister(n, data1);
+}
+
+errno_t ADIv5TI::readGenericRegisters(std::vector<uint32_t>* array)
+{
+	TRACE_SPAN(span, "ti", "readGenericRegisters");
+
+	ASSERT_RELEASE(array != nullptr);
+
+	// r0-r15, cpsr をまとめて読む
+	auto dif = getRegisterDIF();
+	if (dif)
+	{
+		std::vector<uint32_t> regs;
+		errno_t ret = dif->getRegs(&regs);
+		if (ret != OK)
+			return ret;
+		array->insert(array->end(), regs.begin(), regs.end());
+		return OK;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		uint32_t value;
+		errno_t ret = readRegister(i, &value);
+		if (ret != OK)
+			return ret;
+		array->push_back(value);
+	}
+	return OK;
+}
+
+errno_t ADIv5TI::writeGenericRegisters(const std::vector<uint32_t>& array)
+{
+	TRACE_SPAN(span, "ti", "writeGenericRegisters");
+
+	auto dif = getRegisterDIF();
+	if (dif)
+	{
+		if (array.size() < 16 || array.size() > ARMv7ARDIF::CORE_REG_COUNT)
+			return EINVAL;
+
+		for (uint32_t i = 0; i < array.size(); i++)
+		{
+			errno_t ret = dif->setReg(i, array[i]);
+			if (ret != OK)
+				return ret;
+		}
+		return OK;
+	}
+
+	if (array.size() != 16)
+		return EINVAL;
+
+	for (int i = 0; i < 16; i++)
+	{
+		errno_t ret = writeRegister(i, array[i]);
+		if (ret != OK)
+			return ret;
+	}
+	return OK;
+}
+
+std::shared_ptr<ARMv7ARDIF> ADIv5TI::getMemoryDIF()
+{
+	if (v7dif.size() == 0)
+		return nullptr;
+	if (mem && !coreMemory)
+		return nullptr;
+	return getRegisterDIF();
+}
+
+errno_t ADIv5TI::readMemoryThroughCore(std::shared_ptr<ARMv7ARDIF> dif, uint64_t addr, uint32_t len, std::vector<uint8_t>* array)
+{
+	if (len == 0)
+		return OK;
+
+	if (addr + len > 0x100000000ULL)
+		return EINVAL;
+
+	// LDC はワード単位なので, 前後を含めたワードを読んで切り出す
+	uint32_t start = (uint32_t)addr & ~3u;
+	uint32_t count = (uint32_t)((addr + len + 3 - start) / 4);
+	std::vector<uint32_t> buffer(count);
+	errno_t ret = dif->readMemory(start, count, buffer.data());
+	if (ret != OK)
+		return ret;
+
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+	uint32_t offset = (uint32_t)addr - start;
+	array->insert(array->end(), bytes + offset, bytes + offset + len);
+	return OK;
+}
+
+errno_t ADIv5TI::writeMemoryThroughCore(std::shared_ptr<ARMv7ARDIF> dif, uint64_t addr, uint32_t len, const std::vector<uint8_t>& array)
+{
+	if (len == 0)
+		return OK;
+
+	if (addr + len > 0x100000000ULL)
+		return EINVAL;
+
+	uint32_t start = (uint32_t)addr & ~3u;
+	uint32_t count = (uint32_t)((addr + len + 3 - start) / 4);
+	uint32_t offset = (uint32_t)addr - start;
+	std::vector<uint32_t> buffer(count);
+
+	// 端数のあるワードは読んでから書き換える
+	errno_t ret;
+	if (offset != 0 || (len & 3) != 0)
+	{
+		ret = dif->readMemory(start, 1, &buffer[0]);
+		if (ret == OK && count > 1)
+			ret = dif->readMemory(start + (count - 1) * 4, 1, &buffer[count - 1]);
+		if (ret != OK)
+			return ret;
+	}
+
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(buffer.data());
+	memcpy(bytes + offset, array.data(), len);
+	return dif->writeMemory(start, count, buffer.data());
+}
+
+errno_t ADIv5TI::readMemory(uint64_t addr, uint32_t len, std::vector<uint8_t>* array)
+{
+	TRACE_SPAN(span, "ti", "readMemory");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "len", len);
+
+	ASSERT_RELEASE(array != nullptr);
+
+	auto dif = getMemoryDIF();
+	if (dif)
+		return readMemoryThroughCore(dif, addr, len, array);
+
+	if (!mem)
+		return ENODEV;
+
+	int32_t ret;
+	uint32_t i = 0;
+	if ((addr & 0x3) == 0 && len >= 4)
+	{
+		std::vector<uint32_t> buffer(len / 4);
+		ret = mem->readBlock((uint32_t)addr, (uint32_t)buffer.size(), buffer.data());
+		if (ret != OK)
+			return ret;
+		array->reserve(array->size() + len);
+		for (auto data : buffer)
+		{
+			array->push_back(data & 0xFF);
+			array->push_back((data >> 8) & 0xFF);
+			array->push_back((data >> 16) & 0xFF);
+			array->push_back((data >> 24) & 0xFF);
+		}
+		i = len / 4;
+		addr += i * 4;
+	}
+	for (; i < len / 4; i++)
+	{
+		uint32_t data;
+		ret = mem->read((uint32_t)addr, &data);
+		if (ret != OK)
+			return ret;
+		//_DBGPRT("readMemory 0x%08x 0x%08x\n", (uint32_t)addr, data);
+		array->push_back(data & 0xFF);
+		array->push_back((data >> 8) & 0xFF);
+		array->push_back((data >> 16) & 0xFF);
+		array->push_back((data >> 24) & 0xFF);
+		addr += 4;
+	}
+
+	len -= i * 4;
+	if (len > 0)
+	{
+		uint32_t data;
+		ret = mem->read((uint32_t)addr, &data);
+		if (ret != OK)
+			return ret;
+		if (len > 0) { array->push_back((data >> 0) & 0xFF); len--; }
+		if (len > 0) { array->push_back((data >> 8) & 0xFF); len--; }
+		if (len > 0) { array->push_back((data >> 16) & 0xFF); len--; }
+		ASSERT_RELEASE(len == 0);
+	}
+	return OK;
+}
+
+errno_t ADIv5TI::readMemory(uint64_t addr, uint32_t len, std::vector<uint32_t>* array)
+{
+	TRACE_SPAN(span, "ti", "readMemory");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "len", len);
+
+	ASSERT_RELEASE(array != nullptr);
+
+	auto dif = getMemoryDIF();
+	if (!mem && !dif)
+		return ENODEV;
+
+	if ((addr & 0x3) != 0 || (len % 4) != 0)
+		return EINVAL;
+
+	if (len == 0)
+		return OK;
+
+	size_t offset = array->size();
+	array->resize(offset + len / 4);
+	int32_t ret = dif ? dif->readMemory((uint32_t)addr, len / 4, array->data() + offset) :
+		mem->readBlock((uint32_t)addr, len / 4, array->data() + offset);
+	if (ret != OK)
+	{
+		array->resize(offset);
+		return ret;
+	}
+	return OK;
+}
+
+errno_t ADIv5TI::writeMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& array)
+{
+	TRACE_SPAN(span, "ti", "writeMemory");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "len", len);
+
+	if (array.size() < len)
+		return EINVAL;
+
+	auto dif = getMemoryDIF();
+	if (dif)
+		return writeMemoryThroughCore(dif, addr, len, array);
+
+	if (!mem)
+		return ENODEV;
+
+	errno_t ret;
+
+	// 先頭がワード境界に揃っていなければ 8/16bit で書いて揃え, 残りをブロック転送で書く
+	if ((addr & 0x3) != 0 && len > 0)
+	{
+		uint32_t head = 0;
+		while ((addr & 0x3) != 0 && head < len)
+		{
+			if ((addr & 0x1) == 0 && len - head >= 2)
+			{
+				ret = mem->write((uint32_t)addr, (uint16_t)((array[head + 1] << 8) | array[head]));
+				addr += 2;
+				head += 2;
+			}
+			else
+			{
+				ret = mem->write((uint32_t)addr, array[head]);
+				addr += 1;
+				head += 1;
+			}
+			if (ret != OK)
+				return ret;
+		}
+		if (head == len)
+			return OK;
+		return writeMemory(addr, len - head, std::vector<uint8_t>(array.begin() + head, array.begin() + len));
+	}
+
+	uint32_t i = 0;
+	if ((addr & 0x3) == 0 && len >= 4)
+	{
+		std::vector<uint32_t> buffer(len / 4);
+		for (uint32_t j = 0; j < buffer.size(); j++)
+			buffer[j] = (array[j * 4 + 3] << 24) | (array[j * 4 + 2] << 16) | (array[j * 4 + 1] << 8) | array[j * 4];
+		ret = mem->writeBlock((uint32_t)addr, (uint32_t)buffer.size(), buffer.data());
+		if (ret != OK)
+			return ret;
+		i = len / 4;
+		addr += i * 4;
+	}
+	for (; i < len / 4; i++)
+	{
+		uint32_t data = (array[i * 4 + 3] << 24) | (array[i * 4 + 2] << 16) | (array[i * 4 + 1] << 8) | array[i * 4];
+		ret = mem->write((uint32_t)addr, data);
+		if (ret != OK)
+			return ret;
+		addr += 4;
+	}
+
+	len -= i * 4;
+	if (len > 0)
+	{
+#if 0
+		_DBGPRT("[WARNING] Unalighned write may cause unexpected result. 0x%08x 0x%08x\n", (uint32_t)addr, len);
+
+		uint32_t data;
+		ret = mem->read((uint32_t)addr, &data);
+		if (ret != OK)
+			return ret;
+		if (len > 0) { data = (data & 0xFFFFFF00) | array[i * 4]; len--; }
+		if (len > 0) { data = (data & 0xFFFF00FF) | (array[i * 4 + 1] << 8); len--; }
+		if (len > 0) { data = (data & 0xFF00FFFF) | (array[i * 4 + 2] << 16); len--; }
+		ASSERT_RELEASE(len == 0);
+
+		ret = mem->write((uint32_t)addr, data);
+		if (ret != OK)
+			return ret;
+#else
+		uint32_t offset = 0;
+		if (len >= 2)
+		{
+			ret = mem->write((uint32_t)addr, (uint16_t)((array[i * 4 + 1] << 8) | array[i * 4]));
+			if (ret != OK)
+				return ret;
+			len -= 2;
+			offset += 2;
+			addr += 2;
+		}
+		if (len > 0)
+		{
+			ret = mem->write((uint32_t)addr, array[i * 4 + offset]);
+			if (ret != OK)
+				return ret;
+			len--;
+		}
+		ASSERT_RELEASE(len == 0);
+#endif
+	}
+	return OK;
 }
 
-errno_t ADIv5TI::writeRegister(const uint32_t n, const uint64_t data)
+errno_t ADIv5TI::calcCRC32(uint64_t addr, uint32_t len, uint32_t* crc)
 {
-	// [TODO] support 64bit
-	return writeRegister(n, static_cast<uint32_t>(data));
-}
+	TRACE_SPAN(span, "ti", "calcCRC32");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "len", len);
 
-errno_t ADIv5TI::writeRegister(const uint32_t n, const uint64_t data1, const uint64_t data2)
-{
-	// [TODO] support 128bit
-	return writeRegister(n, data1);
+	ASSERT_RELEASE(crc != nullptr);
+
+	if (!mem)
+		return ENODEV;
+
+	if (workArea.size > 0)
+	{
+		errno_t ret = calcCRC32OnTarget(addr, len, crc);
+		if (ret == OK)
+			return OK;
+		_DBGPRT("CRC on target failed (0x%08x). fallback to host.\n", ret);
+	}
+	return calcCRC32OnHost(addr, len, crc);
 }
 
-errno_t ADIv5TI::readGenericRegisters(std::vector<uint32_t>* array)
+errno_t ADIv5TI::calcCRC32OnHost(uint64_t addr, uint32_t len, uint32_t* crc)
 {
-	ASSERT_RELEASE(array != nullptr);
+	const uint32_t CHUNK_SIZE = 0x1000;
 
-	for (int i = 0; i < 16; i++)
+	uint32_t value = CRC32::INITIAL_VALUE;
+	std::vector<uint8_t> buffer;
+	buffer.reserve(CHUNK_SIZE);
+	while (len > 0)
 	{
-		uint32_t value;
-		errno_t ret = readRegister(i, &value);
+		uint32_t n = len < CHUNK_SIZE ? len : CHUNK_SIZE;
+		buffer.clear();
+		errno_t ret = readMemory(addr, n, &buffer);
 		if (ret != OK)
 			return ret;
-		array->push_back(value);
+		value = CRC32::calc(buffer.data(), buffer.size(), value);
+		addr += n;
+		len -= n;
 	}
+	*crc = value;
 	return OK;
 }
 
-errno_t ADIv5TI::writeGenericRegisters(const std::vector<uint32_t>& array)
+errno_t ADIv5TI::calcCRC32OnTarget(uint64_t addr, uint32_t len, uint32_t* crc)
 {
-	if (array.size() != 16)
+	// r0: addr, r1: len, r2: crc, r3: table
+	static const uint16_t code[] = {
+		0x2900,		// loop: cmp   r1, #0
+		0xD009,		//       beq   done
+		0x7804,		//       ldrb  r4, [r0]
+		0x3001,		//       adds  r0, #1
+		0x0E15,		//       lsrs  r5, r2, #24
+		0x4065,		//       eors  r5, r4
+		0x00AD,		//       lsls  r5, r5, #2
+		0x595D,		//       ldr   r5, [r3, r5]
+		0x0212,		//       lsls  r2, r2, #8
+		0x406A,		//       eors  r2, r5
+		0x3901,		//       subs  r1, #1
+		0xE7F3,		//       b     loop
+		0xBE00,		// done: bkpt  #0
+		0xBF00,		//       nop
+		0xBF00,		//       nop
+		0xBF00,		//       nop
+	};
+	const uint32_t CODE_SIZE = sizeof(code);
+	const uint32_t BKPT_OFFSET = 24;
+	const uint32_t TABLE_SIZE = 256 * 4;
+
+	if (workArea.size < CODE_SIZE + TABLE_SIZE)
+		return ENOMEM;
+
+	if (addr + len > 0x100000000ULL)
 		return EINVAL;
 
-	for (int i = 0; i < 16; i++)
+	uint32_t base = (uint32_t)workArea.addr;
+	std::vector<uint32_t> image;
+	image.reserve((CODE_SIZE + TABLE_SIZE) / 4);
+	for (size_t i = 0; i < sizeof(code) / sizeof(code[0]); i += 2)
+		image.push_back(code[i] | (code[i + 1] << 16));
+	const uint32_t* table = CRC32::table();
+	image.insert(image.end(), table, table + 256);
+
+	return runOnTarget(image, {
+		{ ARMv6MSCS::R0, (uint32_t)addr },
+		{ ARMv6MSCS::R1, len },
+		{ ARMv6MSCS::R2, CRC32::INITIAL_VALUE },
+		{ ARMv6MSCS::R3, base + CODE_SIZE } },
+		BKPT_OFFSET, 1000 + len / 256, ARMv6MSCS::R2, crc);
+}
+
+errno_t ADIv5TI::calcPageCRC32(uint64_t addr, uint32_t len, uint32_t pageSize, std::vector<uint32_t>* crcs)
+{
+	ASSERT_RELEASE(crcs != nullptr);
+
+	// r0: addr, r1: len, r3: table, r6: 結果の書き込み先, r8: pageSize
+	static const uint16_t code[] = {
+		0x2900,		// outer: cmp   r1, #0
+		0xD012,		//        beq   done
+		0x4647,		//        mov   r7, r8
+		0x428F,		//        cmp   r7, r1
+		0xD900,		//        bls   1f
+		0x000F,		//        movs  r7, r1
+		0x2200,		// 1:     movs  r2, #0
+		0x43D2,		//        mvns  r2, r2
+		0x1BC9,		//        subs  r1, r1, r7
+		0x7804,		// inner: ldrb  r4, [r0]
+		0x3001,		//        adds  r0, #1
+		0x0E15,		//        lsrs  r5, r2, #24
+		0x4065,		//        eors  r5, r4
+		0x00AD,		//        lsls  r5, r5, #2
+		0x595D,		//        ldr   r5, [r3, r5]
+		0x0212,		//        lsls  r2, r2, #8
+		0x406A,		//        eors  r2, r5
+		0x3F01,		//        subs  r7, #1
+		0xD1F5,		//        bne   inner
+		0xC604,		//        stmia r6!, {r2}
+		0xE7EA,		//        b     outer
+		0xBE00,		// done:  bkpt  #0
+		0xBF00,		//        nop
+		0xBF00,		//        nop
+	};
+	const uint32_t CODE_SIZE = sizeof(code);
+	const uint32_t BKPT_OFFSET = 42;
+	const uint32_t TABLE_SIZE = 256 * 4;
+
+	if (pageSize == 0)
+		return EINVAL;
+
+	if (workArea.size < CODE_SIZE + TABLE_SIZE + 4)
+		return ENOMEM;
+
+	if (addr + len > 0x100000000ULL)
+		return EINVAL;
+
+	uint32_t base = (uint32_t)workArea.addr;
+	uint32_t out = base + CODE_SIZE + TABLE_SIZE;
+	uint32_t maxPages = (workArea.size - CODE_SIZE - TABLE_SIZE) / 4;
+
+	std::vector<uint32_t> image;
+	image.reserve((CODE_SIZE + TABLE_SIZE) / 4);
+	for (size_t i = 0; i < sizeof(code) / sizeof(code[0]); i += 2)
+		image.push_back(code[i] | (code[i + 1] << 16));
+	const uint32_t* table = CRC32::table();
+	image.insert(image.end(), table, table + 256);
+
+	crcs->clear();
+	while (len > 0)
 	{
-		errno_t ret = writeRegister(i, array[i]);
+		// 結果が workarea に収まるページ数ずつ計算する. stub は最初の 1 回だけ書き込む
+		uint64_t pages = ((uint64_t)len + pageSize - 1) / pageSize;
+		if (pages > maxPages)
+			pages = maxPages;
+		uint32_t n = (uint32_t)(pages * pageSize < len ? pages * pageSize : len);
+
+		uint32_t end;
+		errno_t ret = runOnTarget(crcs->empty() ? image : std::vector<uint32_t>(), {
+			{ ARMv6MSCS::R0, (uint32_t)addr },
+			{ ARMv6MSCS::R1, n },
+			{ ARMv6MSCS::R3, base + CODE_SIZE },
+			{ ARMv6MSCS::R6, out },
+			{ ARMv6MSCS::R8, pageSize } },
+			BKPT_OFFSET, 1000 + n / 256, ARMv6MSCS::R6, &end);
+		if (ret != OK)
+			return ret;
+		if (end != out + (uint32_t)pages * 4)
+			return EFAULT;
+
+		size_t offset = crcs->size();
+		crcs->resize(offset + (size_t)pages);
+		ret = mem->readBlock(out, (uint32_t)pages, crcs->data() + offset);
 		if (ret != OK)
 			return ret;
+
+		addr += n;
+		len -= n;
 	}
 	return OK;
 }
 
-errno_t ADIv5TI::readMemory(uint64_t addr, uint32_t len, std::vector<uint8_t>* array)
+errno_t ADIv5TI::runOnTarget(const std::vector<uint32_t>& image, const std::vector<std::pair<ARMv6MSCS::REGSEL, uint32_t>>& args,
+	uint32_t bkptOffset, uint32_t timeoutMs, ARMv6MSCS::REGSEL resultReg, uint32_t* result)
 {
-	ASSERT_RELEASE(array != nullptr);
+	ASSERT_RELEASE(result != nullptr);
 
-	if (!mem)
+	if (!scs)
 		return ENODEV;
 
-	int32_t ret;
-	uint32_t i = 0;
-	for (; i < len / 4; i++)
+	bool halt;
+	errno_t ret = scs->isHalt(&halt);
+	if (ret != OK)
+		return ret;
+	if (!halt)
+		return EBUSY;
+
+	const std::vector<ARMv6MSCS::REGSEL> regs = {
+		ARMv6MSCS::R0, ARMv6MSCS::R1, ARMv6MSCS::R2, ARMv6MSCS::R3, ARMv6MSCS::R4, ARMv6MSCS::R5,
+		ARMv6MSCS::R6, ARMv6MSCS::R7, ARMv6MSCS::R8, ARMv6MSCS::DebugReturnAddress, ARMv6MSCS::xPSR
+	};
+	std::vector<uint32_t> saved;
+	ret = scs->readRegs(regs, &saved);
+	if (ret != OK)
+		return ret;
+
+	ARMv6MSCS::DFSR dfsrBefore;
+	ret = scs->readDFSR(&dfsrBefore);
+	if (ret != OK)
+		return ret;
+
+	auto restore = [&]()
 	{
-		uint32_t data;
-		ret = mem->read((uint32_t)addr, &data);
+		// stub の BKPT で立った DFSR のビットだけクリアする
+		ARMv6MSCS::DFSR dfsr;
+		if (scs->readDFSR(&dfsr) == OK)
+		{
+			dfsr.raw &= ~dfsrBefore.raw;
+			if (dfsr.raw != 0)
+				scs->writeDFSR(dfsr);
+		}
+
+		errno_t ret = OK;
+		for (size_t i = 0; i < saved.size(); i++)
+		{
+			errno_t r = scs->writeReg(regs[i], saved[i]);
+			if (r != OK && ret == OK)
+				ret = r;
+		}
+		return ret;
+	};
+
+	uint32_t base = (uint32_t)workArea.addr;
+	if (!image.empty())
+	{
+		ret = mem->writeBlock(base, (uint32_t)image.size(), image.data());
 		if (ret != OK)
 			return ret;
-		//_DBGPRT("readMemory 0x%08x 0x%08x\n", (uint32_t)addr, data);
-		array->push_back(data & 0xFF);
-		array->push_back((data >> 8) & 0xFF);
-		array->push_back((data >> 16) & 0xFF);
-		array->push_back((data >> 24) & 0xFF);
-		addr += 4;
 	}
 
-	len -= i * 4;
-	if (len > 0)
+	for (auto& arg : args)
 	{
-		uint32_t data;
-		ret = mem->read((uint32_t)addr, &data);
+		ret = scs->writeReg(arg.first, arg.second);
 		if (ret != OK)
-			return ret;
-		if (len > 0) { array->push_back((data >> 0) & 0xFF); len--; }
-		if (len > 0) { array->push_back((data >> 8) & 0xFF); len--; }
-		if (len > 0) { array->push_back((data >> 16) & 0xFF); len--; }
-		ASSERT_RELEASE(len == 0);
+			break;
+	}
+	if (ret == OK) ret = scs->writeReg(ARMv6MSCS::DebugReturnAddress, base);
+	if (ret == OK) ret = scs->writeReg(ARMv6MSCS::xPSR, 0x01000000);	// Thumb
+	if (ret != OK)
+	{
+		restore();
+		return ret;
+	}
+
+	// 割り込みはマスクして実行する
+	ret = scs->run(true);
+	if (ret != OK)
+	{
+		scs->halt();
+		restore();
+		return ret;
+	}
+
+	auto timeout = std::chrono::milliseconds(timeoutMs);
+	auto start = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		ret = scs->isHalt(&halt);
+		if (ret != OK || halt)
+			break;
+		if (std::chrono::steady_clock::now() - start > timeout)
+		{
+			ret = ETIMEDOUT;
+			break;
+		}
+	}
+	if (ret != OK)
+	{
+		scs->halt();
+		restore();
+		return ret;
 	}
+
+	uint32_t pc, value;
+	ret = scs->readReg(ARMv6MSCS::DebugReturnAddress, &pc);
+	if (ret == OK && pc != base + bkptOffset)
+		ret = EFAULT;
+	if (ret == OK)
+		ret = scs->readReg(resultReg, &value);
+
+	errno_t r = restore();
+	if (ret != OK)
+		return ret;
+	if (r != OK)
+		return r;
+
+	*result = value;
 	return OK;
 }
 
-errno_t ADIv5TI::readMemory(uint64_t addr, uint32_t len, std::vector<uint32_t>* array)
+// 先頭バイトの検索は memchr (libc の SIMD 実装) に任せ、候補位置だけ memcmp で比較する
+static const uint8_t* findPattern(const uint8_t* data, size_t size, const uint8_t* pattern, size_t length)
 {
-	ASSERT_RELEASE(array != nullptr);
+	if (length == 0 || size < length)
+		return nullptr;
+
+	const uint8_t* p = data;
+	const uint8_t* last = data + size - length;
+	while (p <= last)
+	{
+		p = static_cast<const uint8_t*>(memchr(p, pattern[0], last - p + 1));
+		if (p == nullptr)
+			return nullptr;
+		if (memcmp(p + 1, pattern + 1, length - 1) == 0)
+			return p;
+		p++;
+	}
+	return nullptr;
+}
+
+errno_t ADIv5TI::searchMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& pattern, bool* found, uint64_t* foundAddr)
+{
+	TRACE_SPAN(span, "ti", "searchMemory");
+	TRACE_ARG(span, "addr", addr);
+	TRACE_ARG(span, "len", len);
+
+	ASSERT_RELEASE(found != nullptr && foundAddr != nullptr);
+
+	const uint32_t CHUNK_SIZE = 0x10000;
 
 	if (!mem)
 		return ENODEV;
 
-	if ((addr & 0x3) != 0 || (len % 4) != 0)
+	if (pattern.size() == 0)
 		return EINVAL;
 
-	int32_t ret;
-	uint32_t i = 0;
-	for (; i < len / 4; i++)
+	*found = false;
+	if (pattern.size() > len)
+		return OK;
+
+	// ブロック転送が使えるよう 4byte 境界から読む
+	uint64_t cur = addr & ~0x3ULL;
+	uint64_t end = addr + len;
+	size_t skip = (size_t)(addr - cur);
+
+	// chunk の境界をまたぐパターンのため、前回の末尾 (pattern.size() - 1 byte) を残しておく
+	std::vector<uint8_t> buffer;
+	buffer.reserve(CHUNK_SIZE + pattern.size());
+	uint64_t bufferAddr = addr;
+
+	while (cur < end)
 	{
-		uint32_t data;
-		ret = mem->read((uint32_t)addr, &data);
+		uint32_t n = (end - cur) < CHUNK_SIZE ? (uint32_t)(end - cur) : CHUNK_SIZE;
+		size_t offset = buffer.size();
+		errno_t ret = readMemory(cur, n, &buffer);
 		if (ret != OK)
 			return ret;
-		array->push_back(data);
-		addr += 4;
+		if (skip > 0)
+		{
+			buffer.erase(buffer.begin() + offset, buffer.begin() + offset + skip);
+			skip = 0;
+		}
+		cur += n;
+
+		const uint8_t* p = findPattern(buffer.data(), buffer.size(), pattern.data(), pattern.size());
+		if (p != nullptr)
+		{
+			*found = true;
+			*foundAddr = bufferAddr + (p - buffer.data());
+			return OK;
+		}
+
+		size_t keep = buffer.size() < pattern.size() - 1 ? buffer.size() : pattern.size() - 1;
+		bufferAddr += buffer.size() - keep;
+		buffer.erase(buffer.begin(), buffer.end() - keep);
 	}
 	return OK;
 }
 
-errno_t ADIv5TI::writeMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& array)
+errno_t ADIv5TI::monitor(const std::string command, std::string* output)
 {
-	if (!mem)
-		return ENODEV;
+	ASSERT_RELEASE(output != nullptr);
 
-	errno_t ret;
-	uint32_t i = 0;
-	for (; i < len / 4; i++)
+	_DBGPRT("monitor [%s]\n", command.c_str());
+
+	std::istringstream stream(command);
+	std::string name;
+	stream >> name;
+
+	if (name == "workarea")
 	{
-		uint32_t data = (array[i * 4 + 3] << 24) | (array[i * 4 + 2] << 16) | (array[i * 4 + 1] << 8) | array[i * 4];
-		ret = mem->write((uint32_t)addr, data);
-		if (ret != OK)
-			return ret;
-		addr += 4;
+		std::string addrStr, sizeStr;
+		stream >> addrStr >> sizeStr;
+		if (!addrStr.empty())
+		{
+			char* end;
+			uint64_t addr = strtoull(addrStr.c_str(), &end, 0);
+			if (*end != '\0')
+				return EINVAL;
+			uint64_t size = sizeStr.empty() ? 0 : strtoull(sizeStr.c_str(), &end, 0);
+			if (*end != '\0' || size > 0xFFFFFFFF)
+				return EINVAL;
+			workArea.addr = addr;
+			workArea.size = (uint32_t)size;
+		}
+
+		char buf[64];
+		snprintf(buf, sizeof(buf), "workarea: 0x%08llx, %u bytes\n",
+			(unsigned long long)workArea.addr, workArea.size);
+		*output = buf;
+		return OK;
 	}
 
-	len -= i * 4;
-	if (len > 0)
+	if (name == "memap")
 	{
-#if 0
-		_DBGPRT("[WARNING] Unalighned write may cause unexpected result. 0x%08x 0x%08x\n", (uint32_t)addr, len);
+		// memap [<start> <size> <ap>] | memap default <ap> | memap clear
+		if (!mem)
+			return ENODEV;
 
-		uint32_t data;
-		ret = mem->read((uint32_t)addr, &data);
-		if (ret != OK)
-			return ret;
-		if (len > 0) { data = (data & 0xFFFFFF00) | array[i * 4]; len--; }
-		if (len > 0) { data = (data & 0xFFFF00FF) | (array[i * 4 + 1] << 8); len--; }
-		if (len > 0) { data = (data & 0xFF00FFFF) | (array[i * 4 + 2] << 16); len--; }
-		ASSERT_RELEASE(len == 0);
+		std::string arg;
+		stream >> arg;
+		auto findAP = [&](const std::string& str) -> std::shared_ptr<ADIv5::MEM_AP>
+		{
+			char* end;
+			uint32_t index = strtoul(str.c_str(), &end, 0);
+			if (str.empty() || *end != '\0')
+				return nullptr;
+			for (auto ap : adi->findMemAPs())
+			{
+				if (ap->getIndex() == index)
+					return ap;
+			}
+			return nullptr;
+		};
 
-		ret = mem->write((uint32_t)addr, data);
+		if (arg == "clear")
+		{
+			mem->clearRoutes();
+		}
+		else if (arg == "default")
+		{
+			std::string apStr;
+			stream >> apStr;
+			auto ap = findAP(apStr);
+			if (!ap)
+				return EINVAL;
+			mem->setDefault(ap);
+		}
+		else if (!arg.empty())
+		{
+			std::string sizeStr, apStr;
+			stream >> sizeStr >> apStr;
+			char* end;
+			uint64_t start = strtoull(arg.c_str(), &end, 0);
+			if (*end != '\0')
+				return EINVAL;
+			uint64_t size = strtoull(sizeStr.c_str(), &end, 0);
+			if (sizeStr.empty() || *end != '\0' || size == 0 || start + size > 0x100000000ULL)
+				return EINVAL;
+			auto ap = findAP(apStr);
+			if (!ap)
+				return EINVAL;
+			mem->addRoute(start, size, ap);
+		}
+
+		std::ostringstream ss;
+		auto def = mem->getDefault();
+		ss << "default: AP-" << def->getIndex() << " (" << ADIv5::MEM_AP::getBusTypeName(def->getBusType()) << ")\n";
+		for (auto& r : mem->getRoutes())
+		{
+			char buf[96];
+			snprintf(buf, sizeof(buf), "0x%08llx - 0x%08llx: AP-%u (%s)\n", (unsigned long long)r.start, (unsigned long long)(r.end - 1),
+				r.ap->getIndex(), ADIv5::MEM_AP::getBusTypeName(r.ap->getBusType()));
+			ss << buf;
+		}
+		*output = ss.str();
+		return OK;
+	}
+
+	if (name == "coremem")
+	{
+		std::string arg;
+		stream >> arg;
+		if (arg == "enable")
+			coreMemory = true;
+		else if (arg == "disable")
+			coreMemory = false;
+		else if (!arg.empty())
+			return EINVAL;
+
+		if (coreMemory && v7dif.size() == 0)
+		{
+			coreMemory = false;
+			return ENODEV;
+		}
+
+		*output = getMemoryDIF() ? "coremem: enabled\n" : "coremem: disabled\n";
+		return OK;
+	}
+
+	if (name == "semihosting")
+	{
+		std::string arg;
+		stream >> arg;
+		if (arg == "enable")
+			semihostingEnabled = true;
+		else if (arg == "disable")
+			semihostingEnabled = false;
+		else if (!arg.empty())
+			return EINVAL;
+
+		*output = semihostingEnabled ? "semihosting: enabled\n" : "semihosting: disabled\n";
+		return OK;
+	}
+
+	if (name == "snapshot")
+	{
+		// snapshot <file> <start>:<size>[,<start>:<size>...]
+		std::string file, regionStr;
+		stream >> file >> regionStr;
+		std::vector<CoreDump::Region> regions;
+		if (file.empty() || !CoreDump::parseRegions(regionStr, &regions))
+			return EINVAL;
+
+		// RSP の要求は executor のスレッドで処理されているので, そのまま読む
+		CoreDump dump(*this);
+		CoreDump::Result result;
+		errno_t ret = dump.save(file, regions, &result);
 		if (ret != OK)
 			return ret;
-#else
-		uint32_t offset = 0;
-		if (len >= 2)
+
+		char buf[160];
+		snprintf(buf, sizeof(buf), "snapshot: %u threads, %u regions, %llu bytes (%llu unreadable) in %llu ms\n",
+			result.threads, result.regions, (unsigned long long)result.bytes, (unsigned long long)result.failed,
+			(unsigned long long)(result.elapsedUs / 1000));
+		*output = buf;
+		return OK;
+	}
+
+	if (name == "log")
+	{
+		// log [<level> | <subsystem>=<level>,...]
+		std::string spec;
+		stream >> spec;
+		if (!spec.empty())
 		{
-			ret = mem->write((uint32_t)addr, (uint16_t)((array[i * 4 + 1] << 8) | array[i * 4]));
+			errno_t ret = Log::configure(spec);
 			if (ret != OK)
 				return ret;
-			len -= 2;
-			offset += 2;
-			addr += 2;
 		}
-		if (len > 0)
+
+		*output = Log::toString();
+		return OK;
+	}
+
+	if (name == "trace")
+	{
+		// trace [start | stop | clear | dump <file>]
+		std::string arg;
+		stream >> arg;
+		if (arg == "start")
+			Trace::start();
+		else if (arg == "stop")
+			Trace::stop();
+		else if (arg == "clear")
+			Trace::clear();
+		else if (arg == "dump")
 		{
-			ret = mem->write((uint32_t)addr, array[i * 4 + offset]);
-			if (ret != OK)
-				return ret;
-			len--;
+			std::string file;
+			stream >> file;
+			if (file.empty())
+				return EINVAL;
+
+			std::ofstream out(file);
+			if (!out.is_open())
+				return ENOENT;
+			Trace::dump(out);
 		}
-		ASSERT_RELEASE(len == 0);
-#endif
+		else if (!arg.empty())
+			return EINVAL;
+
+		uint64_t recorded, dropped;
+		Trace::getStatus(&recorded, &dropped);
+		char buf[96];
+		snprintf(buf, sizeof(buf), "trace: %s, %llu events (%llu dropped)\n", Trace::isEnabled() ? "enabled" : "disabled",
+			(unsigned long long)recorded, (unsigned long long)dropped);
+		*output = buf;
+		return OK;
 	}
-	return OK;
+
+	// TODO
+	return 0;
 }
 
-errno_t ADIv5TI::monitor(const std::string command, std::string* output)
+void ADIv5TI::getSymbolRequests(std::vector<std::string>* names)
 {
-	ASSERT_RELEASE(output != nullptr);
+	ASSERT_RELEASE(names != nullptr);
 
-	printf("monitor [%s]\n", command.c_str());
+	std::lock_guard<std::mutex> lock(symbolMutex);
+	*names = symbolRequests;
+}
 
-	// TODO
-	(void)command;
-	(void)output;
-	return 0;
+void ADIv5TI::setSymbolValue(const std::string& name, bool found, uint64_t value)
+{
+	std::lock_guard<std::mutex> lock(symbolMutex);
+	if (found)
+		symbols[name] = value;
+	else
+		symbols.erase(name);
+}
+
+void ADIv5TI::addSymbolRequest(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(symbolMutex);
+	if (std::find(symbolRequests.begin(), symbolRequests.end(), name) == symbolRequests.end())
+		symbolRequests.push_back(name);
+}
+
+bool ADIv5TI::getSymbolValue(const std::string& name, uint64_t* value)
+{
+	ASSERT_RELEASE(value != nullptr);
+
+	std::lock_guard<std::mutex> lock(symbolMutex);
+	auto it = symbols.find(name);
+	if (it == symbols.end())
+		return false;
+
+	*value = it->second;
+	return true;
 }
 
 std::string ADIv5TI::targetXml(uint32_t offset, uint32_t length)
@@ -597,6 +2209,34 @@ std::string ADIv5TI::createTargetXml()
 {
 	std::string out = R"(<?xml version="1.0"?><!DOCTYPE target SYSTEM "gdb-target.dtd">)";
 	out.append(R"(<target version="1.0">)");
+	if (v7dif.size() > 0)
+	{
+		out.append(R"(<feature name="org.gnu.gdb.arm.core">)");
+		{
+			for (uint32_t i = 0; i < 13; i++)
+				out.append(R"(<reg name="r)" + std::to_string(i) + R"(" bitsize="32" regnum=")" + std::to_string(i) + R"(" type="int" group="general"/>)");
+			out.append(R"(<reg name="sp" bitsize="32" regnum="13" type="data_ptr" group="general"/>)");
+			out.append(R"(<reg name="lr" bitsize="32" regnum="14" type="int" group="general"/>)");
+			out.append(R"(<reg name="pc" bitsize="32" regnum="15" type="code_ptr" group="general"/>)");
+			out.append(R"(<reg name="cpsr" bitsize="32" regnum="16" type="int" group="general"/>)");
+		}
+		out.append(R"(</feature>)");
+
+		// VFP を確認するにはコアが止まっている必要がある
+		uint32_t count = 0;
+		auto dif = getRegisterDIF();
+		if (dif->getVFPRegCount(&count) == OK && count > 0)
+		{
+			out.append(R"(<feature name="org.gnu.gdb.arm.vfp">)");
+			{
+				for (uint32_t i = 0; i < count; i++)
+					out.append(R"(<reg name="d)" + std::to_string(i) + R"(" bitsize="64" regnum=")" + std::to_string(V7AR_REG_D0 + i) + R"(" type="ieee_double" group="float"/>)");
+				out.append(R"(<reg name="fpscr" bitsize="32" regnum=")" + std::to_string(V7AR_REG_FPSCR) + R"(" type="int" group="float"/>)");
+			}
+			out.append(R"(</feature>)");
+		}
+	}
+	else
 	{
 		out.append(R"(<feature name="org.gnu.gdb.arm.m-profile">)");
 		{
@@ -4,12 +4,17 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <string>
 #include "ADIv5.h"
 #include "ARMv7ARDIF.h"
 #include "ARMv6MSCS.h"
 #include "ARMv6MDWT.h"
 #include "ARMv6MBPU.h"
 #include "ARMv7MFPB.h"
+#include "MemoryRouter.h"
+#include "Semihosting.h"
 #include "TargetInterface.h"
 
 class ADIv5TI : public TargetInterface
@@ -21,7 +26,44 @@ private:
 	std::shared_ptr<ARMv6MDWT> dwt;
 	std::shared_ptr<ARMv6MBPU> bpu;
 	std::shared_ptr<ARMv7MFPB> fpb;
-	std::shared_ptr<ADIv5::MEM_AP> mem;
+	std::shared_ptr<MemoryRouter> mem;	// アドレスに応じて sysmem の MEM-AP を選ぶ
+
+	// ターゲット上でコードを実行する際に使う RAM 領域 (monitor workarea で設定)
+	struct WorkArea
+	{
+		uint64_t addr;
+		uint32_t size;
+	};
+	WorkArea workArea = { 0, 0 };
+
+	// ARMv7-A/R のコアがあれば各コアを、無ければ ARMv6-M/v7-M のコアを 1 スレッドとして扱う
+	int32_t registerThreadId = 1;
+	int32_t executionThreadId = -1;
+	// 最後の continue で動かしたコア. 動かしていないコアが止まっていても停止として扱わない
+	std::vector<bool> resumedThreads;
+
+	// 停止時に DWT から読んだ watchpoint の情報 (MATCHED は読み出しでクリアされるため保持する)
+	struct StopWatchPoint
+	{
+		bool valid;
+		bool hit;
+		WatchPointType type;
+		uint64_t addr;
+	};
+	StopWatchPoint stopWatchPoint = { false, false, ACCESS, 0 };
+
+	// qSymbol で解決するシンボル (RSP のスレッドと各サービスから参照される)
+	std::mutex symbolMutex;
+	std::vector<std::string> symbolRequests;
+	std::map<std::string, uint64_t> symbols;
+
+	// ARMv7-A/R でコア (DCC) 経由でメモリにアクセスする (monitor coremem で切り替え)
+	// システムメモリの MEM-AP が無い場合は常にコア経由
+	bool coreMemory = false;
+
+	// BKPT 0xAB で止まった場合はホスト側で処理して再開する (monitor semihosting で切り替え)
+	bool semihostingEnabled = false;
+	Semihosting semihosting;
 
 public:
 	ADIv5TI(std::shared_ptr<ADIv5> _adi);
@@ -29,19 +71,24 @@ public:
 	virtual int32_t attach();
 	virtual void detach();
 
-	virtual void setTargetThreadId();
+	virtual void getThreadIds(std::vector<int32_t>* ids);
+	virtual int32_t getCurrentThreadId();
+	virtual errno_t setTargetThreadId(char op, int32_t threadId);
 	virtual void setCurrentPC(const uint64_t addr);
 
 	virtual void resume();
 	virtual int32_t step(uint8_t* signal);
 	virtual int32_t interrupt(uint8_t* signal);
 	virtual errno_t isRunning(bool* running, uint8_t* signal);
+	virtual errno_t resume(const std::map<int32_t, ResumeAction>& actions, bool* stopped, uint8_t* signal);
+	virtual errno_t rangeStep(int32_t threadId, uint64_t start, uint64_t end, uint32_t maxSteps, bool* done, uint8_t* signal);
 
 	virtual int32_t setBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind);
 	virtual int32_t unsetBreakPoint(BreakPointType type, uint64_t addr, BreakPointKind kind);
 
 	virtual int32_t setWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind);
 	virtual int32_t unsetWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind);
+	virtual errno_t getStopWatchPoint(bool* hit, WatchPointType* type, uint64_t* addr);
 
 	virtual errno_t readRegister(const uint32_t n, uint32_t* out);
 	virtual errno_t readRegister(const uint32_t n, uint64_t* out);
@@ -49,23 +96,49 @@ public:
 	virtual errno_t writeRegister(const uint32_t n, const uint32_t data);
 	virtual errno_t writeRegister(const uint32_t n, const uint64_t data);
 	virtual errno_t writeRegister(const uint32_t n, const uint64_t data1, const uint64_t data2); // 128-bit
+	virtual uint32_t getRegisterSize(const uint32_t n);
 	virtual errno_t readGenericRegisters(std::vector<uint32_t>* array);
 	virtual errno_t writeGenericRegisters(const std::vector<uint32_t>& array);
 
 	virtual errno_t readMemory(uint64_t addr, uint32_t len, std::vector<uint8_t>* array);
 	virtual errno_t readMemory(uint64_t addr, uint32_t len, std::vector<uint32_t>* array);
 	virtual errno_t writeMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& array);
+	virtual errno_t calcCRC32(uint64_t addr, uint32_t len, uint32_t* crc);
+	virtual errno_t searchMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& pattern, bool* found, uint64_t* foundAddr);
 
 	virtual errno_t monitor(const std::string command, std::string* output);
 
+	virtual void getSymbolRequests(std::vector<std::string>* names);
+	virtual void setSymbolValue(const std::string& name, bool found, uint64_t value);
+
 	virtual std::string targetXml(uint32_t offset, uint32_t length);
 
 public:
 	errno_t testHaltAndRun();
 
+	// pageSize ごとの CRC32 を workarea の stub で計算する (差分書き込み用)
+	errno_t calcPageCRC32(uint64_t addr, uint32_t len, uint32_t pageSize, std::vector<uint32_t>* crcs);
+
+	void addSymbolRequest(const std::string& name);
+	bool getSymbolValue(const std::string& name, uint64_t* value);
+
 	std::shared_ptr<ARMv6MSCS> getARMv6MSCS() { return scs; }
+	std::shared_ptr<ARMv6MDWT> getARMv6MDWT() { return dwt; }
 	std::vector<std::shared_ptr<ARMv7ARDIF>> getARMv7ARDIF() { return v7dif; }
 
 private:
 	std::string createTargetXml();
+	int32_t getThreadCount();
+	std::shared_ptr<ARMv7ARDIF> getRegisterDIF();
+	std::vector<std::shared_ptr<ARMv7ARDIF>> selectDIFs(int32_t threadId);
+	void setResumedThreads(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs);
+	std::shared_ptr<ARMv7ARDIF> getMemoryDIF();
+	errno_t readMemoryThroughCore(std::shared_ptr<ARMv7ARDIF> dif, uint64_t addr, uint32_t len, std::vector<uint8_t>* array);
+	errno_t writeMemoryThroughCore(std::shared_ptr<ARMv7ARDIF> dif, uint64_t addr, uint32_t len, const std::vector<uint8_t>& array);
+	errno_t calcCRC32OnTarget(uint64_t addr, uint32_t len, uint32_t* crc);
+	errno_t calcCRC32OnHost(uint64_t addr, uint32_t len, uint32_t* crc);
+	errno_t runOnTarget(const std::vector<uint32_t>& image, const std::vector<std::pair<ARMv6MSCS::REGSEL, uint32_t>>& args,
+		uint32_t bkptOffset, uint32_t timeoutMs, ARMv6MSCS::REGSEL resultReg, uint32_t* result);
+	errno_t handleSemihosting(bool* resumed);
+	errno_t readString(uint64_t addr, uint32_t len, std::string* str);
 };
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include "stdafx.h"
 #include "ARMv6MBPU.h"
 
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_CORE
+
 // v6-M
 #define REG_BP_CTRL			(base + 0x000)
 #define REG_BP_COMP0		(base + 0x008)
@@ -2,7 +2,8 @@
 #include "stdafx.h"
 #include "ARMv6MDWT.h"
 
-#define _DBGPRT printf
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_CORE
 
 // v6-M, v7-M
 #define REG_DWT_CTRL		(base + 0x000)
@@ -10,6 +11,7 @@
 #define REG_DWT_COMP0		(base + 0x020)
 #define REG_DWT_MASK0		(base + 0x024)
 #define REG_DWT_FUNCTION0	(base + 0x028)
+#define DWT_COMP_STRIDE		0x10
 
 // v7-M
 #define REG_DWT_CYCCNT		(base + 0x004)
@@ -60,6 +62,207 @@ union DWT_CTRL_V7M
 };
 static_assert(CONFIRM_UINT32(DWT_CTRL_V7M));
 
+union DWT_FUNCTION
+{
+	struct
+	{
+		uint32_t FUNCTION		: 4;
+		uint32_t Reserved0		: 1;
+		uint32_t EMITRANGE		: 1;	// v7-M
+		uint32_t Reserved1		: 1;
+		uint32_t CYCMATCH		: 1;	// v7-M
+		uint32_t DATAVMATCH		: 1;	// v7-M
+		uint32_t LNK1ENA		: 1;	// v7-M
+		uint32_t DATAVSIZE		: 2;	// v7-M
+		uint32_t DATAVADDR0		: 4;	// v7-M
+		uint32_t DATAVADDR1		: 4;	// v7-M
+		uint32_t Reserved2		: 4;
+		uint32_t MATCHED		: 1;
+		uint32_t Reserved3		: 7;
+	};
+	uint32_t raw;
+};
+static_assert(CONFIRM_UINT32(DWT_FUNCTION));
+
+errno_t ARMv6MDWT::init()
+{
+	DWT_CTRL_V6M ctrl;
+	errno_t ret = ap.read(REG_DWT_CTRL, &ctrl.raw);
+	if (ret != OK)
+		return ret;
+
+	compList = std::vector<Comparator>(ctrl.NUMCOMP, Comparator{ false, WATCH_ACCESS, 0, 0 });
+
+	if (ctrl.NUMCOMP > 0)
+	{
+		// 対応する MASK の最大値は実装依存なので全ビットを書いて読み戻す
+		uint32_t mask;
+		ret = ap.read(REG_DWT_MASK0, &mask);
+		if (ret != OK)
+			return ret;
+		ret = ap.write(REG_DWT_MASK0, (uint32_t)0x1F);
+		if (ret != OK)
+			return ret;
+		ret = ap.read(REG_DWT_MASK0, &maxMask);
+		if (ret != OK)
+			return ret;
+		ret = ap.write(REG_DWT_MASK0, mask);
+		if (ret != OK)
+			return ret;
+	}
+
+	// 有効な comparator は使用中として扱う
+	for (uint32_t i = 0; i < compList.size(); i++)
+	{
+		DWT_FUNCTION function;
+		ret = ap.read(REG_DWT_FUNCTION0 + i * DWT_COMP_STRIDE, &function.raw);
+		if (ret != OK)
+			return ret;
+		compList[i].used = function.FUNCTION != 0;
+	}
+
+	initialized = true;
+	return OK;
+}
+
+int32_t ARMv6MDWT::findWatchPoint(WatchType type, uint32_t addr, uint32_t len)
+{
+	for (uint32_t i = 0; i < compList.size(); i++)
+	{
+		auto& c = compList[i];
+		if (c.used && c.type == type && c.addr == addr && c.len == len)
+			return i;
+	}
+	return -1;
+}
+
+int32_t ARMv6MDWT::findEmpty()
+{
+	for (uint32_t i = 0; i < compList.size(); i++)
+	{
+		if (!compList[i].used)
+			return i;
+	}
+	return -1;
+}
+
+errno_t ARMv6MDWT::calcMask(uint32_t addr, uint32_t len, uint32_t* mask)
+{
+	// [addr, addr + len) を含む最小の 2^mask アラインメント領域
+	uint32_t last = addr + (len > 0 ? len - 1 : 0);
+	uint32_t m = 0;
+	while (m < 32 && (addr >> m) != (last >> m))
+		m++;
+
+	if (m > maxMask)
+		return EINVAL;
+
+	*mask = m;
+	return OK;
+}
+
+errno_t ARMv6MDWT::addWatchPoint(WatchType type, uint32_t addr, uint32_t len)
+{
+	if (!initialized)
+		return EPERM;
+
+	if (findWatchPoint(type, addr, len) >= 0)
+		return OK;	// already exist
+
+	int32_t index = findEmpty();
+	if (index < 0)
+		return EFAULT;
+
+	return setWatchPoint(true, index, type, addr, len);
+}
+
+errno_t ARMv6MDWT::delWatchPoint(WatchType type, uint32_t addr, uint32_t len)
+{
+	if (!initialized)
+		return EPERM;
+
+	int32_t index = findWatchPoint(type, addr, len);
+	if (index < 0)
+		return OK;	// not exist
+
+	return setWatchPoint(false, index, type, addr, len);
+}
+
+errno_t ARMv6MDWT::setWatchPoint(bool enable, uint32_t index, WatchType type, uint32_t addr, uint32_t len)
+{
+	if (!initialized)
+		return EPERM;
+
+	if (index >= compList.size())
+		return EINVAL;
+
+	uint32_t offset = index * DWT_COMP_STRIDE;
+	DWT_FUNCTION function;
+	function.raw = 0;
+
+	if (!enable)
+	{
+		errno_t ret = ap.write(REG_DWT_FUNCTION0 + offset, function.raw);
+		if (ret == OK)
+			compList[index].used = false;
+		return ret;
+	}
+
+	uint32_t mask;
+	errno_t ret = calcMask(addr, len, &mask);
+	if (ret != OK)
+		return ret;
+
+	// FUNCTION を無効にしてから COMP, MASK を設定する
+	function.FUNCTION = type;
+	ret = ap.transfer({
+		{ false, REG_DWT_FUNCTION0 + offset, 0, nullptr },
+		{ false, REG_DWT_COMP0 + offset, addr & ~((1u << mask) - 1), nullptr },
+		{ false, REG_DWT_MASK0 + offset, mask, nullptr },
+		{ false, REG_DWT_FUNCTION0 + offset, function.raw, nullptr },
+	});
+	if (ret != OK)
+		return ret;
+
+	compList[index] = Comparator{ true, type, addr, len };
+	return OK;
+}
+
+errno_t ARMv6MDWT::findHit(bool* hit, WatchType* type, uint32_t* addr)
+{
+	ASSERT_RELEASE(hit != nullptr && type != nullptr && addr != nullptr);
+
+	*hit = false;
+	if (!initialized)
+		return EPERM;
+
+	std::vector<DWT_FUNCTION> functions(compList.size());
+	std::vector<ADIv5::MEM_AP::Access> accesses;
+	for (uint32_t i = 0; i < compList.size(); i++)
+	{
+		if (compList[i].used)
+			accesses.push_back({ true, REG_DWT_FUNCTION0 + i * DWT_COMP_STRIDE, 0, &functions[i].raw });
+	}
+	if (accesses.size() == 0)
+		return OK;
+
+	errno_t ret = ap.transfer(accesses);
+	if (ret != OK)
+		return ret;
+
+	for (uint32_t i = 0; i < compList.size(); i++)
+	{
+		if (compList[i].used && functions[i].MATCHED)
+		{
+			*hit = true;
+			*type = compList[i].type;
+			*addr = compList[i].addr;
+			return OK;
+		}
+	}
+	return OK;
+}
+
 int32_t ARMv6MDWT::getPC(uint32_t* pc)
 {
 	if (pc == nullptr)
@@ -72,6 +275,11 @@ int32_t ARMv6MDWT::getPC(uint32_t* pc)
 	return OK;
 }
 
+uint32_t ARMv6MDWT::getPCSRAddress()
+{
+	return REG_DWT_PCSR;
+}
+
 void ARMv6MDWT::printPC()
 {
 	uint32_t pc;
@@ -93,6 +301,46 @@ void ARMv6MDWT::printCtrl()
 	_DBGPRT("      NUMCOMP: %x\n", data.NUMCOMP);
 }
 
+errno_t ARMv7MDWT::enableCounters(bool enable)
+{
+	DWT_CTRL_V7M ctrl;
+	errno_t ret = ap.read(REG_DWT_CTRL, &ctrl.raw);
+	if (ret != OK)
+		return ret;
+
+	uint32_t value = enable ? 1 : 0;
+	if (!ctrl.NOCYCCNT)
+		ctrl.CYCCNTENA = value;
+	if (!ctrl.NOPRFCNT)
+	{
+		ctrl.CPIEVTENA = value;
+		ctrl.EXCEVTENA = value;
+		ctrl.SLEEPEVTENA = value;
+		ctrl.LSUEVTENA = value;
+		ctrl.FOLDEVTENA = value;
+	}
+	return ap.write(REG_DWT_CTRL, ctrl.raw);
+}
+
+errno_t ARMv7MDWT::readCounters(Counters* counters)
+{
+	ASSERT_RELEASE(counters != nullptr);
+
+	// CYCCNT - FOLDCNT は連続しているので block read で読む
+	uint32_t data[6];
+	errno_t ret = ap.readBlock(REG_DWT_CYCCNT, 6, data);
+	if (ret != OK)
+		return ret;
+
+	counters->cyc = data[0];
+	counters->cpi = data[1] & 0xFF;
+	counters->exc = data[2] & 0xFF;
+	counters->sleep = data[3] & 0xFF;
+	counters->lsu = data[4] & 0xFF;
+	counters->fold = data[5] & 0xFF;
+	return OK;
+}
+
 void ARMv7MDWT::printCtrl()
 {
 	DWT_CTRL_V7M data;
@@ -2,15 +2,51 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
+#include <errno.h>
 #include "ADIv5.h"
 
 class ARMv6MDWT : public ADIv5::Memory
 {
 public:
-	ARMv6MDWT(const Memory& memory) : Memory(memory) {}
+	// DWT_FUNCTION の設定値 (v6-M, v7-M 共通)
+	enum WatchType
+	{
+		WATCH_READ		= 0x5,
+		WATCH_WRITE		= 0x6,
+		WATCH_ACCESS	= 0x7
+	};
+
+private:
+	struct Comparator
+	{
+		bool used;
+		WatchType type;
+		uint32_t addr;		// 要求されたアドレスと長さ
+		uint32_t len;
+	};
+
+	bool initialized;
+	uint32_t maxMask;
+	std::vector<Comparator> compList;
+
+	int32_t findWatchPoint(WatchType type, uint32_t addr, uint32_t len);
+	int32_t findEmpty();
+	errno_t calcMask(uint32_t addr, uint32_t len, uint32_t* mask);
+
+public:
+	ARMv6MDWT(const Memory& memory) : Memory(memory), initialized(false), maxMask(0) {}
 	virtual ~ARMv6MDWT() {}
 
+	errno_t init();
+	errno_t addWatchPoint(WatchType type, uint32_t addr, uint32_t len);
+	errno_t delWatchPoint(WatchType type, uint32_t addr, uint32_t len);
+	errno_t setWatchPoint(bool enable, uint32_t index, WatchType type, uint32_t addr, uint32_t len);
+	// MATCHED ビットが立っている comparator を探す (MATCHED は読み出しでクリアされる)
+	errno_t findHit(bool* hit, WatchType* type, uint32_t* addr);
+
 	int32_t getPC(uint32_t* pc);
+	uint32_t getPCSRAddress();
 	void printPC();
 	virtual void printCtrl();
 };
@@ -18,7 +54,21 @@ public:
 class ARMv7MDWT : public ARMv6MDWT
 {
 public:
+	// CYCCNT は 32bit, それ以外は 8bit のカウンタ
+	struct Counters
+	{
+		uint32_t cyc;
+		uint32_t cpi;
+		uint32_t exc;
+		uint32_t sleep;
+		uint32_t lsu;
+		uint32_t fold;
+	};
+
 	ARMv7MDWT(Memory& memory) : ARMv6MDWT(memory) {}
 
+	errno_t enableCounters(bool enable = true);
+	errno_t readCounters(Counters* counters);	// 1 回の転送で全カウンタを読む
+
 	virtual void printCtrl();
 };
\ No newline at end of file
@@ -5,7 +5,8 @@
 #include <thread>
 #include <chrono>
 
-#define _DBGPRT printf
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_CORE
 
 #define REG_ACTLR	(base + 0x008)
 #define REG_CPUID	(base + 0xD00)
@@ -145,6 +146,12 @@ errno_t ARMv6MSCS::readDFSR(DFSR* dfsr)
 	return OK;
 }
 
+errno_t ARMv6MSCS::writeDFSR(DFSR& dfsr)
+{
+	// write-one-to-clear
+	return ap.write(REG_DFSR, dfsr.raw);
+}
+
 void ARMv6MSCS::DFSR::print()
 {
 	_DBGPRT("    DFSR           : 0x%08x (%s%s%s%s%s%s)\n", raw,
@@ -332,6 +339,21 @@ errno_t ARMv6MSCS::isHalt(bool* halt)
 	return OK;
 }
 
+errno_t ARMv6MSCS::readHaltStatus(bool* halt, DFSR* dfsr)
+{
+	ASSERT_RELEASE(halt != nullptr && dfsr != nullptr);
+
+	DHCSR_R d;
+	errno_t ret = ap.transfer({
+		{ true, REG_DHCSR, 0, &d.raw },
+		{ true, REG_DFSR, 0, &dfsr->raw } });
+	if (ret != OK)
+		return ret;
+
+	*halt = d.S_HALT ? true : false;
+	return OK;
+}
+
 int32_t ARMv6MSCS::halt(bool maskIntr)
 {
 	int32_t ret;
@@ -348,7 +370,7 @@ int32_t ARMv6MSCS::halt(bool maskIntr)
 	if (ret != OK)
 		return ret;
 
-	_DBGPRT("halt success\n");
+	LOG_TRACE(LOG_SUBSYSTEM, "halt success\n");
 	return OK;
 }
 
@@ -378,7 +400,7 @@ int32_t ARMv6MSCS::run(bool maskIntr)
 	if (ret != OK)
 		return ret;
 
-	_DBGPRT("run success\n");
+	LOG_TRACE(LOG_SUBSYSTEM, "run success\n");
 	return OK;
 }
 
@@ -409,6 +431,176 @@ int32_t ARMv6MSCS::step(bool maskIntr)
 	if (ret != OK)
 		return ret;
 
-	_DBGPRT("step success\n");
+	LOG_TRACE(LOG_SUBSYSTEM, "step success\n");
 	return OK;
+}
+
+errno_t ARMv6MSCS::stepAndReadPC(uint32_t* pc, DFSR* dfsr, bool maskIntr)
+{
+	ASSERT_RELEASE(pc != nullptr && dfsr != nullptr);
+
+	DFSR clear;
+	clear.raw = 0;
+	clear.HALTED = 1;
+	clear.BKPT = 1;
+	clear.DWTTRAP = 1;
+	clear.VCATCH = 1;
+	clear.EXTERNAL = 1;
+
+	DHCSR_W w;
+	w.raw = 0;
+	w.DBGKEY = 0xA05F;
+	w.C_DEBUGEN = 1;
+	w.C_STEP = 1;
+	w.C_MASKINTS = maskIntr ? 1 : 0;
+
+	DCRSR dcrsr;
+	dcrsr.raw = 0;
+	dcrsr.REGSEL = DebugReturnAddress;
+
+	// DCRSR は停止中にしか書けないので, S_HALT を確認してから PC を読む
+	// 1 命令の実行は SWD の 1 転送よりも十分短いので, 通常は最初の転送で停止を確認できる
+	DHCSR_R halted;
+	errno_t ret = ap.transfer({
+		{ false, REG_DFSR, clear.raw, nullptr },
+		{ false, REG_DHCSR, w.raw, nullptr },
+		{ true, REG_DHCSR, 0, &halted.raw },
+		{ true, REG_DFSR, 0, &dfsr->raw } });
+	if (ret != OK)
+		return ret;
+
+	// WFI でクロックが止まっている場合やロックアップした場合は止まらない
+	bool halt = halted.S_HALT ? true : false;
+	uint32_t counter = 0;
+	while (!halt)
+	{
+		counter++;
+		if (counter >= 100)
+		{
+			_DBGPRT("Failed to step. (DHCSR: 0x%08x)\n", halted.raw);
+			return ETIMEDOUT;
+		}
+
+		ret = readHaltStatus(&halt, dfsr);
+		if (ret != OK)
+			return ret;
+	}
+
+	DHCSR_R ready;
+	ret = ap.transfer({
+		{ false, REG_DCRSR, dcrsr.raw, nullptr },
+		{ true, REG_DHCSR, 0, &ready.raw },
+		{ true, REG_DCRDR, 0, pc } });
+	if (ret != OK)
+		return ret;
+
+	if (!ready.S_REGRDY)
+		return readReg(DebugReturnAddress, pc);
+
+	return OK;
+}
+
+errno_t ARMv6MSCS::readRegs(const std::vector<REGSEL>& regs, std::vector<uint32_t>* data)
+{
+	ASSERT_RELEASE(data != nullptr);
+
+	for (auto reg : regs)
+	{
+		if (reg == 19 || reg > 20)
+			return CMSISDAP_ERR_INVALID_ARGUMENT;
+	}
+
+	// レジスタの転送は SWD の 1 転送よりも十分短いので, DCRSR の書き込み直後に DCRDR を読む.
+	// S_REGRDY を確認できなかったレジスタだけ個別に読み直す
+	data->resize(regs.size());
+	std::vector<uint32_t> status(regs.size());
+	std::vector<ADIv5::MEM_AP::Access> accesses;
+	for (size_t i = 0; i < regs.size(); i++)
+	{
+		DCRSR dcrsr;
+		dcrsr.raw = 0;
+		dcrsr.REGSEL = regs[i];
+		accesses.push_back({ false, REG_DCRSR, dcrsr.raw, nullptr });
+		accesses.push_back({ true, REG_DHCSR, 0, &status[i] });
+		accesses.push_back({ true, REG_DCRDR, 0, &(*data)[i] });
+	}
+
+	errno_t ret = ap.transfer(accesses);
+	if (ret != OK)
+		return ret;
+
+	for (size_t i = 0; i < regs.size(); i++)
+	{
+		DHCSR_R d;
+		d.raw = status[i];
+		if (!d.S_REGRDY)
+		{
+			ret = readReg(regs[i], &(*data)[i]);
+			if (ret != OK)
+				return ret;
+		}
+	}
+	return OK;
+}
+
+errno_t ARMv6MSCS::writeRegsAndRun(const std::vector<std::pair<REGSEL, uint32_t>>& regs, bool maskIntr)
+{
+	for (auto& reg : regs)
+	{
+		if (reg.first == 19 || reg.first > 20)
+			return CMSISDAP_ERR_INVALID_ARGUMENT;
+	}
+
+	std::vector<uint32_t> status(regs.size());
+	std::vector<ADIv5::MEM_AP::Access> accesses;
+	for (size_t i = 0; i < regs.size(); i++)
+	{
+		DCRSR dcrsr;
+		dcrsr.raw = 0;
+		dcrsr.REGSEL = regs[i].first;
+		dcrsr.REGWnR = 1;
+		accesses.push_back({ false, REG_DCRDR, regs[i].second, nullptr });
+		accesses.push_back({ false, REG_DCRSR, dcrsr.raw, nullptr });
+		accesses.push_back({ true, REG_DHCSR, 0, &status[i] });
+	}
+
+	errno_t ret = ap.transfer(accesses);
+	if (ret != OK)
+		return ret;
+
+	// 書き込みが完了していなかった場合は次の DCRDR の書き込みと競合しているので, 全て書き直す
+	for (size_t i = 0; i < regs.size(); i++)
+	{
+		DHCSR_R d;
+		d.raw = status[i];
+		if (!d.S_REGRDY)
+		{
+			for (auto& reg : regs)
+			{
+				ret = writeReg(reg.first, reg.second);
+				if (ret != OK)
+					return ret;
+			}
+			break;
+		}
+	}
+
+	// 停止要因をクリアしてから再開する
+	DFSR clear;
+	clear.raw = 0;
+	clear.HALTED = 1;
+	clear.BKPT = 1;
+	clear.DWTTRAP = 1;
+	clear.VCATCH = 1;
+	clear.EXTERNAL = 1;
+
+	DHCSR_W w;
+	w.raw = 0;
+	w.DBGKEY = 0xA05F;
+	w.C_DEBUGEN = 1;
+	w.C_MASKINTS = maskIntr ? 1 : 0;
+
+	return ap.transfer({
+		{ false, REG_DFSR, clear.raw, nullptr },
+		{ false, REG_DHCSR, w.raw, nullptr } });
 }
\ No newline at end of file
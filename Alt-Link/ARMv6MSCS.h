@@ -2,6 +2,8 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
+#include <utility>
 #include "ADIv5.h"
 
 class ARMv6MSCS : public ADIv5::Memory
@@ -116,6 +118,7 @@ public:
 
 	errno_t readCPUID(CPUID* cpuid);
 	errno_t readDFSR(DFSR* dfsr);
+	errno_t writeDFSR(DFSR& dfsr);
 	errno_t readDEMCR(DEMCR* demcr);
 	errno_t writeDEMCR(DEMCR& demcr);
 	errno_t readReg(REGSEL reg, uint32_t* data);
@@ -124,10 +127,16 @@ public:
 	void printDHCSR();
 
 	errno_t isHalt(bool* halt);
+	errno_t readHaltStatus(bool* halt, DFSR* dfsr);	// DHCSR と DFSR を 1 回の転送で読む
 
 	int32_t halt(bool maskIntr = false);
 	int32_t run(bool maskIntr = false);
 	int32_t step(bool maskIntr = false);
+	// 停止中のコアを 1 命令 step し, DFSR と PC を同じ転送で読む (range step 用)
+	errno_t stepAndReadPC(uint32_t* pc, DFSR* dfsr, bool maskIntr = false);
+	// 停止中のコアのレジスタをまとめて読み書きする (semihosting 用)
+	errno_t readRegs(const std::vector<REGSEL>& regs, std::vector<uint32_t>* data);
+	errno_t writeRegsAndRun(const std::vector<std::pair<REGSEL, uint32_t>>& regs, bool maskIntr = false);
 
 private:
 	int32_t waitForRegReady();
@@ -1,7 +1,11 @@
 #include "stdafx.h"
 #include "ARMv7ARDIF.h"
 
-#define _DBGPRT printf
+#include <map>
+#include <cstring>
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_CORE
 
 #define REG_DBGDIDR		(base + 0x000)
 #define REG_DBGDTRRX	(base + 0x080)	/* 32 */
@@ -12,6 +16,10 @@
 #define REG_DBGDRCR		(base + 0x090)
 #define REG_DBGPCSR_40	(base + 0x0A0)	/* 40 */
 #define REG_DBGCIDSR	(base + 0x0A4)	/* 41 */
+#define REG_DBGBVR(n)	(base + 0x100 + (n) * 4)
+#define REG_DBGBCR(n)	(base + 0x140 + (n) * 4)
+#define REG_DBGWVR(n)	(base + 0x180 + (n) * 4)
+#define REG_DBGWCR(n)	(base + 0x1C0 + (n) * 4)
 #define REG_DBGPRSR		(base + 0x314)
 #define REG_MIDR		(base + 0xD00)
 #define REG_MPIDR		(base + 0xD14)
@@ -20,6 +28,12 @@
 
 union DBGDSCR
 {
+	enum
+	{
+		MOE_ASYNC_WATCHPOINT	= 2,
+		MOE_SYNC_WATCHPOINT		= 10
+	};
+
 	struct
 	{
 		uint32_t HALTED			: 1;
@@ -82,6 +96,74 @@ union DBGPCSR
 };
 static_assert(CONFIRM_UINT32(DBGPCSR));
 
+union DBGBCR
+{
+	enum
+	{
+		MATCH		= 0,	// unlinked instruction address match
+		MISMATCH	= 4		// unlinked instruction address mismatch
+	};
+
+	struct
+	{
+		uint32_t E		: 1;
+		uint32_t PMC	: 2;	// 0b11: PL0, PL1, PL2
+		uint32_t SBZ0	: 2;
+		uint32_t BAS	: 4;	// byte address select
+		uint32_t SBZ1	: 4;
+		uint32_t HMC	: 1;
+		uint32_t SSC	: 2;
+		uint32_t LBN	: 4;
+		uint32_t BT		: 3;
+		uint32_t SBZ2	: 1;
+		uint32_t MASK	: 5;
+		uint32_t SBZ3	: 3;
+	};
+	uint32_t raw;
+};
+static_assert(CONFIRM_UINT32(DBGBCR));
+
+union DBGWCR
+{
+	struct
+	{
+		uint32_t E		: 1;
+		uint32_t PAC	: 2;	// 0b11: PL0, PL1
+		uint32_t LSC	: 2;	// 0b01: load, 0b10: store, 0b11: both (WatchType)
+		uint32_t BAS	: 8;	// byte address select (ワード内の 4bit だけ使う)
+		uint32_t HMC	: 1;
+		uint32_t SSC	: 2;
+		uint32_t LBN	: 4;
+		uint32_t WT		: 1;
+		uint32_t SBZ0	: 3;
+		uint32_t MASK	: 5;	// 2^MASK byte の範囲を対象にする. 1, 2 は reserved
+		uint32_t SBZ1	: 3;
+	};
+	uint32_t raw;
+};
+static_assert(CONFIRM_UINT32(DBGWCR));
+
+// ITR に書く命令 (ARM state)
+static uint32_t MCR_DTRTX(uint32_t reg) { return 0xEE000E15 + (reg << 12); }	// MCR p14, 0, Rd, c0, c5, 0
+static uint32_t MRC_DTRRX(uint32_t reg) { return 0xEE100E15 + (reg << 12); }	// MRC p14, 0, Rd, c0, c5, 0
+static const uint32_t MOV_R0_PC			= 0xE1A0000F;
+static const uint32_t MOV_PC_R0			= 0xE1A0F000;
+static const uint32_t MRS_R0_CPSR		= 0xE10F0000;
+static const uint32_t MSR_CPSR_R0		= 0xE12FF000;	// MSR CPSR_fsxc, r0
+static const uint32_t ISB				= 0xEE070F95;	// MCR p15, 0, r0, c7, c5, 4
+static const uint32_t VMRS_R0_FPSCR		= 0xEEF10A10;
+static const uint32_t VMRS_R0_MVFR0		= 0xEEF70A10;
+static const uint32_t VMRS_R0_FPEXC		= 0xEEF80A10;
+static const uint32_t MRC_R0_CPACR		= 0xEE110F50;	// MRC p15, 0, r0, c1, c0, 2
+static const uint32_t VMSR_FPSCR_R0		= 0xEEE10A10;
+static uint32_t VMOV_R0_R1_D(uint32_t n) { return 0xEC510B10 | ((n & 0x10) << 1) | (n & 0xF); }	// VMOV r0, r1, Dn
+static uint32_t VMOV_D_R0_R1(uint32_t n) { return 0xEC410B10 | ((n & 0x10) << 1) | (n & 0xF); }	// VMOV Dn, r0, r1
+
+static const uint32_t CPSR_T = (1 << 5);
+static const uint32_t CPSR_MODE_MASK = 0x1F;
+static const uint32_t CPSR_MODE_USR = 0x10;
+static const uint32_t FPEXC_EN = (1 << 30);
+
 void DBGDSCR::print()
 {
 	_DBGPRT("  DSCR           : 0x%08x\n", raw);
@@ -262,16 +344,41 @@ errno_t ARMv7ARDIF::getPC(uint32_t *pc)
 	return OK;
 }
 
-errno_t ARMv7ARDIF::getPCSR(uint32_t *pc)
+errno_t ARMv7ARDIF::getPCSRAddress(uint32_t* addr)
 {
-	if (pc == nullptr)
+	if (addr == nullptr)
 		return EINVAL;
 
-	errno_t ret;
-	bool found = false;
-	bool offset = true;
+	// try to read from reg40
+	if (didr.DEVID_Exists() && devid.PCSR_Exists())
+	{
+		*addr = REG_DBGPCSR_40;
+		return OK;
+	}
+
+	// try to read from reg33 if reg40 is not found
+	if (didr.PCSR_imp)
+	{
+		*addr = REG_DBGPCSR_33;
+		return OK;
+	}
+	return ENODATA;
+}
+
+bool ARMv7ARDIF::decodePCSR(uint32_t raw, uint32_t* pc)
+{
+	ASSERT_RELEASE(pc != nullptr);
+
 	DBGPCSR pcsr;
+	pcsr.raw = raw;
 
+	if (pcsr.raw == 0xFFFFFFFF)
+	{
+		*pc = pcsr.raw;
+		return false;
+	}
+
+	bool offset = true;
 	if (PART == ADIv5::Component::ARM_PART_DEBUG_IF_A9)
 	{
 		offset = false;
@@ -287,39 +394,6 @@ errno_t ARMv7ARDIF::getPCSR(uint32_t *pc)
 		}
 	}
 
-	// try to read from reg40
-	if (didr.DEVID_Exists())
-	{
-		if (devid.PCSR_Exists())
-		{
-			ret = ap.read(REG_DBGPCSR_40, &pcsr.raw);
-			if (ret != OK)
-				return ret;
-			found = true;
-		}
-	}
-
-	// try to read from reg33 if reg40 is not found
-	if (found == false)
-	{
-		if (didr.PCSR_imp)
-		{
-			ret = ap.read(REG_DBGPCSR_33, &pcsr.raw);
-			if (ret != OK)
-				return ret;
-			found = true;
-		}
-	}
-
-	if (found == false)
-		return ENODATA;
-
-	if (pcsr.raw == 0xFFFFFFFF)
-	{
-		*pc = pcsr.raw;
-		return OK;
-	}
-
 	// warn not supported format
 	if (pcsr.T == 0 && pcsr.PCS & 1)
 	{
@@ -345,6 +419,25 @@ errno_t ARMv7ARDIF::getPCSR(uint32_t *pc)
 		else
 			*pc = (pcsr.PCS << 1);
 	}
+	return true;
+}
+
+errno_t ARMv7ARDIF::getPCSR(uint32_t *pc)
+{
+	if (pc == nullptr)
+		return EINVAL;
+
+	uint32_t addr;
+	errno_t ret = getPCSRAddress(&addr);
+	if (ret != OK)
+		return ret;
+
+	uint32_t raw;
+	ret = ap.read(addr, &raw);
+	if (ret != OK)
+		return ret;
+
+	decodePCSR(raw, pc);
 	return OK;
 }
 
@@ -413,6 +506,12 @@ errno_t ARMv7ARDIF::halt()
 	if (ret != OK)
 		return ret;
 
+	return waitForHalt();
+}
+
+errno_t ARMv7ARDIF::waitForHalt()
+{
+	DBGDSCR dscr;
 	uint32_t counter = 0;
 	while (1)
 	{
@@ -457,6 +556,11 @@ errno_t ARMv7ARDIF::run()
 	if (dscr.HALTED == 0)
 		return OK;
 
+	ret = flushRegs();
+	if (ret != OK)
+		return ret;
+	invalidateRegs();
+
 	if (dscr.ITRen)
 	{
 		dscr.ITRen = 0;
@@ -471,6 +575,12 @@ errno_t ARMv7ARDIF::run()
 	if (ret != OK)
 		return ret;
 
+	return waitForRestart();
+}
+
+errno_t ARMv7ARDIF::waitForRestart()
+{
+	DBGDSCR dscr;
 	uint32_t counter = 0;
 	while (1)
 	{
@@ -492,6 +602,126 @@ errno_t ARMv7ARDIF::run()
 	return OK;
 }
 
+errno_t ARMv7ARDIF::isHalted(bool* halted)
+{
+	if (halted == nullptr)
+		return EINVAL;
+
+	DBGDSCR dscr;
+	errno_t ret = readDSCR(&dscr);
+	if (ret != OK)
+		return ret;
+
+	*halted = dscr.HALTED ? true : false;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::haltAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs)
+{
+	// 同じ MEM-AP 上にあるコアへの停止要求は 1 回の転送にまとめて、なるべく同時に止める
+	std::map<ADIv5::MEM_AP*, std::vector<ADIv5::MEM_AP::Access>> requests;
+	for (auto& dif : difs)
+	{
+		uint32_t base = dif->base;
+		DBGDRCR drcr = { };
+		drcr.HRQ = 1;
+		requests[&dif->ap].push_back({ false, REG_DBGDRCR, drcr.raw, nullptr });
+	}
+
+	for (auto& request : requests)
+	{
+		errno_t ret = request.first->transfer(request.second);
+		if (ret != OK)
+			return ret;
+	}
+
+	errno_t result = OK;
+	for (auto& dif : difs)
+	{
+		errno_t ret = dif->waitForHalt();
+		if (ret != OK && result == OK)
+			result = ret;
+	}
+	return result;
+}
+
+errno_t ARMv7ARDIF::runAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs)
+{
+	std::vector<std::shared_ptr<ARMv7ARDIF>> halted;
+	std::map<ADIv5::MEM_AP*, std::vector<ADIv5::MEM_AP::Access>> requests;
+	for (auto& dif : difs)
+	{
+		uint32_t base = dif->base;
+		DBGDSCR dscr;
+		errno_t ret = dif->readDSCR(&dscr);
+		if (ret != OK)
+			return ret;
+
+		if (dscr.HALTED == 0)
+			continue;
+
+		ret = dif->flushRegs();
+		if (ret != OK)
+			return ret;
+		dif->invalidateRegs();
+
+		if (dscr.ITRen)
+		{
+			dscr.ITRen = 0;
+			ret = dif->ap.write(REG_DBGDSCR, dscr.raw);
+			if (ret != OK)
+				return ret;
+		}
+
+		DBGDRCR drcr = { };
+		drcr.RRQ = 1;
+		requests[&dif->ap].push_back({ false, REG_DBGDRCR, drcr.raw, nullptr });
+		halted.push_back(dif);
+	}
+
+	for (auto& request : requests)
+	{
+		errno_t ret = request.first->transfer(request.second);
+		if (ret != OK)
+			return ret;
+	}
+
+	errno_t result = OK;
+	for (auto& dif : halted)
+	{
+		errno_t ret = dif->waitForRestart();
+		if (ret != OK && result == OK)
+			result = ret;
+	}
+	return result;
+}
+
+errno_t ARMv7ARDIF::isHaltedAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs, std::vector<bool>* halted)
+{
+	if (halted == nullptr)
+		return EINVAL;
+
+	std::vector<DBGDSCR> dscr(difs.size());
+	std::map<ADIv5::MEM_AP*, std::vector<ADIv5::MEM_AP::Access>> requests;
+	for (size_t i = 0; i < difs.size(); i++)
+	{
+		uint32_t base = difs[i]->base;
+		requests[&difs[i]->ap].push_back({ true, REG_DBGDSCR, 0, &dscr[i].raw });
+	}
+
+	for (auto& request : requests)
+	{
+		errno_t ret = request.first->transfer(request.second);
+		if (ret != OK)
+			return ret;
+	}
+
+	halted->clear();
+	for (auto& d : dscr)
+		halted->push_back(d.HALTED ? true : false);
+	return OK;
+}
+
 errno_t ARMv7ARDIF::readDCC(uint32_t* val)
 {
 	if (val == nullptr)
@@ -555,29 +785,693 @@ errno_t ARMv7ARDIF::writeDCC(uint32_t val)
 }
 
 errno_t ARMv7ARDIF::writeITR(uint32_t val)
+{
+	DBGDSCR dscr;
+	errno_t ret = waitForInstrCompl(&dscr);
+	if (ret != OK)
+		return ret;
+
+	ret = ap.write(REG_DBGITR, val);
+	if (ret != OK)
+		return ret;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::waitForInstrCompl(DBGDSCR* dscr)
 {
 	uint32_t counter = 0;
 	while (1)
 	{
-		DBGDSCR dscr;
-		errno_t ret = ap.read(REG_DBGDSCR, &dscr.raw);
+		errno_t ret = ap.read(REG_DBGDSCR, &dscr->raw);
 		if (ret != OK)
 			return ret;
 
-		if (dscr.InstrCompl_l)
+		if (dscr->InstrCompl_l)
 			break;
 
 		counter++;
 		if (counter >= 100)
 		{
-			_DBGPRT("InstrCompl_l is 0. (DSCR: 0x%08x)\n", dscr.raw);
-			dscr.printIfNotSame();
+			_DBGPRT("InstrCompl_l is 0. (DSCR: 0x%08x)\n", dscr->raw);
+			dscr->printIfNotSame();
 			return EFAULT;
 		}
 	}
+	return OK;
+}
+
+errno_t ARMv7ARDIF::setDCCMode(DCCMode mode)
+{
+	DBGDSCR dscr;
+	errno_t ret = readDSCR(&dscr);
+	if (ret != OK)
+		return ret;
+
+	if (dscr.ExtDCCmode == (uint32_t)mode)
+		return OK;
+
+	dscr.ExtDCCmode = mode;
+	return ap.write(REG_DBGDSCR, dscr.raw);
+}
+
+errno_t ARMv7ARDIF::checkAbort(const DBGDSCR& dscr)
+{
+	if (dscr.SDABORT_l == 0 && dscr.ADABORT_l == 0 && dscr.UND_l == 0)
+		return OK;
+
+	_DBGPRT("Memory access through the core aborted. (DSCR: 0x%08x)\n", dscr.raw);
+
+	// Debug state でも未定義命令は Undefined mode に切り替わるので, 再開時に CPSR と r13, r14 を書き戻す
+	if (cache.valid)
+		cache.dirty |= (1 << REG_CPSR) | (1 << 13) | (1 << 14);
+
+	// sticky なフラグが立っている間は ITR に書いた命令が無視されるのでクリアしておく
+	DBGDRCR drcr = { };
+	drcr.CSE = 1;
+	errno_t ret = ap.write(REG_DBGDRCR, drcr.raw);
+	if (ret != OK)
+		return ret;
+	return EFAULT;
+}
+
+errno_t ARMv7ARDIF::readMemory(uint32_t addr, uint32_t count, uint32_t* data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	if ((addr & 3) != 0)
+		return EINVAL;
+
+	if (count == 0)
+		return OK;
+
+	// LDC p14, c5, [r0], #4
+	const uint32_t LDC = 0xECB05E01;
+
+	uint32_t r0;
+	errno_t ret = readReg(0, &r0);
+	if (ret != OK)
+		return ret;
+
+	ret = writeReg(0, addr);
+	if (ret != OK)
+		return ret;
+
+	// 1 word 目は通常通り実行して DTRTX に置く
+	ret = writeITR(LDC);
+	if (ret == OK && count > 1)
+	{
+		// fast mode では DTRTX を読むたびに ITR の命令が再発行されるので,
+		// DSCR をポーリングせずにブロック転送で count - 1 word を読める
+		ret = setDCCMode(DCC_FAST);
+		if (ret == OK)
+			ret = ap.write(REG_DBGITR, LDC);
+		if (ret == OK)
+			ret = ap.readRepeat(REG_DBGDTRTX, count - 1, data);
+	}
+
+	errno_t r = setDCCMode(DCC_NON_BLOCKING);
+	if (ret == OK)
+		ret = r;
+
+	DBGDSCR dscr;
+	if (ret == OK)
+		ret = waitForInstrCompl(&dscr);
+	if (ret == OK)
+		ret = checkAbort(dscr);
+
+	// 最後の LDC が読んだ word
+	if (ret == OK)
+		ret = readDCC(&data[count - 1]);
+
+	r = writeReg(0, r0);
+	if (ret != OK)
+		return ret;
+	return r;
+}
+
+errno_t ARMv7ARDIF::writeMemory(uint32_t addr, uint32_t count, const uint32_t* data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	if ((addr & 3) != 0)
+		return EINVAL;
+
+	if (count == 0)
+		return OK;
+
+	// STC p14, c5, [r0], #4
+	const uint32_t STC = 0xECA05E01;
+
+	uint32_t r0;
+	errno_t ret = readReg(0, &r0);
+	if (ret != OK)
+		return ret;
+
+	ret = writeReg(0, addr);
+	if (ret != OK)
+		return ret;
+
+	DBGDSCR dscr;
+	ret = waitForInstrCompl(&dscr);
+	if (ret != OK)
+		return ret;
+
+	// fast mode では DTRRX に書くたびに ITR の命令が発行される
+	ret = setDCCMode(DCC_FAST);
+	if (ret == OK)
+		ret = ap.write(REG_DBGITR, STC);
+	if (ret == OK)
+		ret = ap.writeRepeat(REG_DBGDTRRX, count, data);
+
+	errno_t r = setDCCMode(DCC_NON_BLOCKING);
+	if (ret == OK)
+		ret = r;
+
+	if (ret == OK)
+		ret = waitForInstrCompl(&dscr);
+	if (ret == OK)
+		ret = checkAbort(dscr);
+
+	r = writeReg(0, r0);
+	if (ret != OK)
+		return ret;
+	return r;
+}
+
+errno_t ARMv7ARDIF::transferStalled(const std::vector<ADIv5::MEM_AP::Access>& accesses)
+{
+	// stall mode では ITR への書き込みは前の命令の完了を, DTRTX の読み出しは TXfull を,
+	// DTRRX への書き込みは RXfull のクリアを AP の WAIT で待つので, DSCR をポーリングせずに 1 回の転送に積める
+	errno_t ret = setDCCMode(DCC_STALL);
+	if (ret == OK)
+		ret = ap.transfer(accesses);
+
+	errno_t r = setDCCMode(DCC_NON_BLOCKING);
+	if (ret == OK)
+		ret = r;
+
+	DBGDSCR dscr;
+	if (ret == OK)
+		ret = waitForInstrCompl(&dscr);
+	if (ret == OK)
+		ret = checkAbort(dscr);
+	return ret;
+}
+
+errno_t ARMv7ARDIF::loadRegs()
+{
+	if (cache.valid)
+		return OK;
+
+	uint32_t r[CORE_REG_COUNT];
+	std::vector<ADIv5::MEM_AP::Access> accesses;
+	for (uint32_t reg = 0; reg < 15; reg++)
+	{
+		accesses.push_back({ false, REG_DBGITR, MCR_DTRTX(reg), nullptr });
+		accesses.push_back({ true, REG_DBGDTRTX, 0, &r[reg] });
+	}
+	// r0 は読み終わっているので PC, CPSR の読み出しに使う
+	accesses.push_back({ false, REG_DBGITR, MOV_R0_PC, nullptr });
+	accesses.push_back({ false, REG_DBGITR, MCR_DTRTX(0), nullptr });
+	accesses.push_back({ true, REG_DBGDTRTX, 0, &r[REG_PC] });
+	accesses.push_back({ false, REG_DBGITR, MRS_R0_CPSR, nullptr });
+	accesses.push_back({ false, REG_DBGITR, MCR_DTRTX(0), nullptr });
+	accesses.push_back({ true, REG_DBGDTRTX, 0, &r[REG_CPSR] });
+
+	errno_t ret = transferStalled(accesses);
+	if (ret != OK)
+		return ret;
+
+	// Debug state で読んだ PC は停止したアドレス + 8 (ARM) / + 4 (Thumb)
+	r[REG_PC] -= (r[REG_CPSR] & CPSR_T) ? 4 : 8;
+
+	memcpy(cache.r, r, sizeof(r));
+	cache.valid = true;
+	cache.dirty = 1 << 0;	// r0
+	return OK;
+}
+
+errno_t ARMv7ARDIF::flushRegs()
+{
+	if (!cache.valid || cache.dirty == 0)
+		return OK;
+
+	std::vector<ADIv5::MEM_AP::Access> accesses;
+	auto write = [&](uint32_t reg, uint32_t value)
+	{
+		accesses.push_back({ false, REG_DBGDTRRX, value, nullptr });
+		accesses.push_back({ false, REG_DBGITR, MRC_DTRRX(reg), nullptr });
+	};
+
+	// CPSR でモードが変わるとバンクされた r13, r14 が変わるので先に書く
+	if (cache.dirty & (1 << REG_CPSR))
+	{
+		write(0, cache.r[REG_CPSR]);
+		accesses.push_back({ false, REG_DBGITR, MSR_CPSR_R0, nullptr });
+		accesses.push_back({ false, REG_DBGITR, ISB, nullptr });
+	}
+	if (cache.dirty & (1 << REG_PC))
+	{
+		write(0, cache.r[REG_PC]);
+		accesses.push_back({ false, REG_DBGITR, MOV_PC_R0, nullptr });
+	}
+	for (uint32_t reg = 1; reg < 15; reg++)
+	{
+		if (cache.dirty & (1 << reg))
+			write(reg, cache.r[reg]);
+	}
+	if (cache.dirty & ((1 << 0) | (1 << REG_PC) | (1 << REG_CPSR)))
+		write(0, cache.r[0]);
+
+	errno_t ret = transferStalled(accesses);
+	if (ret != OK)
+		return ret;
+
+	cache.dirty = 0;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::getReg(uint32_t reg, uint32_t* value)
+{
+	if (value == nullptr)
+		return EINVAL;
+
+	if (reg >= CORE_REG_COUNT)
+		return EINVAL;
+
+	errno_t ret = loadRegs();
+	if (ret != OK)
+		return ret;
+
+	*value = cache.r[reg];
+	return OK;
+}
+
+errno_t ARMv7ARDIF::setReg(uint32_t reg, uint32_t value)
+{
+	if (reg >= CORE_REG_COUNT)
+		return EINVAL;
+
+	errno_t ret = loadRegs();
+	if (ret != OK)
+		return ret;
+
+	cache.r[reg] = value;
+	cache.dirty |= 1 << reg;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::getRegs(std::vector<uint32_t>* regs)
+{
+	if (regs == nullptr)
+		return EINVAL;
+
+	errno_t ret = loadRegs();
+	if (ret != OK)
+		return ret;
+
+	regs->assign(cache.r, cache.r + CORE_REG_COUNT);
+	return OK;
+}
+
+errno_t ARMv7ARDIF::isVFPEnabled(bool* enabled)
+{
+	errno_t ret = loadRegs();
+	if (ret != OK)
+		return ret;
+
+	// CPACR は VFP が無くても読める. CP10, CP11 が現在のモードで使えなければ FPEXC も読めない
+	uint32_t cpacr;
+	ret = transferStalled({
+		{ false, REG_DBGITR, MRC_R0_CPACR, nullptr },
+		{ false, REG_DBGITR, MCR_DTRTX(0), nullptr },
+		{ true, REG_DBGDTRTX, 0, &cpacr } });
+	cache.dirty |= 1 << 0;
+	if (ret != OK)
+		return ret;
+
+	uint32_t cp10 = (cpacr >> 20) & 0x3;
+	uint32_t cp11 = (cpacr >> 22) & 0x3;
+	bool user = (cache.r[REG_CPSR] & CPSR_MODE_MASK) == CPSR_MODE_USR;
+	if (cp10 != cp11 || cp10 == 0 || cp10 == 2 || (cp10 == 1 && user))
+	{
+		*enabled = false;
+		return OK;
+	}
+
+	uint32_t fpexc;
+	ret = transferStalled({
+		{ false, REG_DBGITR, VMRS_R0_FPEXC, nullptr },
+		{ false, REG_DBGITR, MCR_DTRTX(0), nullptr },
+		{ true, REG_DBGDTRTX, 0, &fpexc } });
+	if (ret != OK)
+		return ret;
+
+	*enabled = (fpexc & FPEXC_EN) ? true : false;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::getVFPRegCount(uint32_t* count)
+{
+	if (count == nullptr)
+		return EINVAL;
+
+	// 無効な状態で VFP の命令を実行すると Undefined mode に入るので, 毎回先に確認する
+	// 後から有効になる場合があるので, 無効だった結果は保持しない
+	bool enabled;
+	errno_t ret = isVFPEnabled(&enabled);
+	if (ret != OK)
+		return ret;
+	if (!enabled)
+	{
+		*count = 0;
+		return OK;
+	}
+
+	if (vfpRegCount >= 0)
+	{
+		*count = vfpRegCount;
+		return OK;
+	}
+
+	uint32_t mvfr0;
+	ret = transferStalled({
+		{ false, REG_DBGITR, VMRS_R0_MVFR0, nullptr },
+		{ false, REG_DBGITR, MCR_DTRTX(0), nullptr },
+		{ true, REG_DBGDTRTX, 0, &mvfr0 } });
+	if (ret != OK)
+		return ret;
+
+	// MVFR0.A_SIMD registers: 1: 16 x 64bit, 2: 32 x 64bit
+	uint32_t simd = mvfr0 & 0xF;
+	vfpRegCount = simd == 2 ? 32 : simd == 1 ? 16 : 0;
+	*count = vfpRegCount;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::readVFPReg(uint32_t n, uint64_t* value)
+{
+	if (value == nullptr)
+		return EINVAL;
+
+	uint32_t count;
+	errno_t ret = getVFPRegCount(&count);
+	if (ret != OK)
+		return ret;
+	if (n >= count)
+		return EINVAL;
+
+	uint32_t lo, hi;
+	ret = transferStalled({
+		{ false, REG_DBGITR, VMOV_R0_R1_D(n), nullptr },
+		{ false, REG_DBGITR, MCR_DTRTX(0), nullptr },
+		{ true, REG_DBGDTRTX, 0, &lo },
+		{ false, REG_DBGITR, MCR_DTRTX(1), nullptr },
+		{ true, REG_DBGDTRTX, 0, &hi } });
+	cache.dirty |= (1 << 0) | (1 << 1);
+	if (ret != OK)
+		return ret;
+
+	*value = ((uint64_t)hi << 32) | lo;
+	return OK;
+}
+
+errno_t ARMv7ARDIF::writeVFPReg(uint32_t n, uint64_t value)
+{
+	uint32_t count;
+	errno_t ret = getVFPRegCount(&count);
+	if (ret != OK)
+		return ret;
+	if (n >= count)
+		return EINVAL;
+
+	ret = transferStalled({
+		{ false, REG_DBGDTRRX, (uint32_t)value, nullptr },
+		{ false, REG_DBGITR, MRC_DTRRX(0), nullptr },
+		{ false, REG_DBGDTRRX, (uint32_t)(value >> 32), nullptr },
+		{ false, REG_DBGITR, MRC_DTRRX(1), nullptr },
+		{ false, REG_DBGITR, VMOV_D_R0_R1(n), nullptr } });
+	cache.dirty |= (1 << 0) | (1 << 1);
+	return ret;
+}
+
+errno_t ARMv7ARDIF::readFPSCR(uint32_t* value)
+{
+	if (value == nullptr)
+		return EINVAL;
+
+	uint32_t count;
+	errno_t ret = getVFPRegCount(&count);
+	if (ret != OK)
+		return ret;
+	if (count == 0)
+		return ENODEV;
+
+	ret = transferStalled({
+		{ false, REG_DBGITR, VMRS_R0_FPSCR, nullptr },
+		{ false, REG_DBGITR, MCR_DTRTX(0), nullptr },
+		{ true, REG_DBGDTRTX, 0, value } });
+	cache.dirty |= 1 << 0;
+	return ret;
+}
+
+errno_t ARMv7ARDIF::writeFPSCR(uint32_t value)
+{
+	uint32_t count;
+	errno_t ret = getVFPRegCount(&count);
+	if (ret != OK)
+		return ret;
+	if (count == 0)
+		return ENODEV;
+
+	ret = transferStalled({
+		{ false, REG_DBGDTRRX, value, nullptr },
+		{ false, REG_DBGITR, MRC_DTRRX(0), nullptr },
+		{ false, REG_DBGITR, VMSR_FPSCR_R0, nullptr } });
+	cache.dirty |= 1 << 0;
+	return ret;
+}
+
+errno_t ARMv7ARDIF::setBreakPoint(uint32_t index, uint32_t addr, uint32_t kind, bool mismatch)
+{
+	DBGBCR bcr = { };
+	bcr.E = 1;
+	bcr.PMC = 3;
+	bcr.BT = mismatch ? DBGBCR::MISMATCH : DBGBCR::MATCH;
+	if (kind == 4)
+		bcr.BAS = 0xF;
+	else
+		bcr.BAS = (addr & 2) ? 0xC : 0x3;
+
+	// 無効にしてからアドレスを変更する
+	return ap.transfer({
+		{ false, REG_DBGBCR(index), 0, nullptr },
+		{ false, REG_DBGBVR(index), addr & ~3u, nullptr },
+		{ false, REG_DBGBCR(index), bcr.raw, nullptr } });
+}
+
+errno_t ARMv7ARDIF::clearBreakPoint(uint32_t index)
+{
+	return ap.write(REG_DBGBCR(index), (uint32_t)0);
+}
+
+errno_t ARMv7ARDIF::addBreakPoint(uint32_t addr, uint32_t kind)
+{
+	if (kind != 2 && kind != 3 && kind != 4)
+		return EINVAL;
+
+	uint32_t count = getBreakPointCount() - 1;
+	if (bpUsed.size() != count)
+	{
+		bpUsed.assign(count, false);
+		bpAddr.assign(count, 0);
+	}
 
-	errno_t ret = ap.write(REG_DBGITR, val);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (bpUsed[i] && bpAddr[i] == addr)
+			return OK;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (bpUsed[i])
+			continue;
+
+		errno_t ret = setBreakPoint(i, addr, kind, false);
+		if (ret != OK)
+			return ret;
+
+		bpUsed[i] = true;
+		bpAddr[i] = addr;
+		return OK;
+	}
+	return ENOMEM;
+}
+
+errno_t ARMv7ARDIF::delBreakPoint(uint32_t addr)
+{
+	for (uint32_t i = 0; i < bpUsed.size(); i++)
+	{
+		if (!bpUsed[i] || bpAddr[i] != addr)
+			continue;
+
+		errno_t ret = clearBreakPoint(i);
+		if (ret != OK)
+			return ret;
+
+		bpUsed[i] = false;
+		return OK;
+	}
+	return ENOENT;
+}
+
+bool ARMv7ARDIF::hasBreakPoint(uint32_t addr)
+{
+	for (uint32_t i = 0; i < bpUsed.size(); i++)
+	{
+		if (bpUsed[i] && bpAddr[i] == addr)
+			return true;
+	}
+	return false;
+}
+
+errno_t ARMv7ARDIF::setWatchPoint(uint32_t index, WatchType type, uint32_t addr, uint32_t len)
+{
+	DBGWCR wcr = { };
+	wcr.E = 1;
+	wcr.PAC = 3;
+	wcr.LSC = type;
+	if (len <= 4)
+	{
+		// ワードをまたがないこと
+		if ((len != 1 && len != 2 && len != 4) || (addr & (len - 1)) != 0)
+			return EINVAL;
+		wcr.BAS = ((1 << len) - 1) << (addr & 3);
+	}
+	else
+	{
+		// 2 のべき乗の大きさで整列した範囲は MASK で指定する
+		if ((len & (len - 1)) != 0 || (addr & (len - 1)) != 0)
+			return EINVAL;
+		uint32_t mask = 0;
+		while ((1u << mask) < len)
+			mask++;
+		wcr.MASK = mask;
+		wcr.BAS = 0xF;
+	}
+
+	// 無効にしてからアドレスを変更する
+	return ap.transfer({
+		{ false, REG_DBGWCR(index), 0, nullptr },
+		{ false, REG_DBGWVR(index), addr & ~3u, nullptr },
+		{ false, REG_DBGWCR(index), wcr.raw, nullptr } });
+}
+
+errno_t ARMv7ARDIF::addWatchPoint(WatchType type, uint32_t addr, uint32_t len)
+{
+	if (wpList.size() != getWatchPointCount())
+		wpList.assign(getWatchPointCount(), WatchPoint());
+
+	for (auto& wp : wpList)
+	{
+		if (wp.used && wp.type == type && wp.addr == addr && wp.len == len)
+			return OK;	// already exist
+	}
+
+	for (uint32_t i = 0; i < wpList.size(); i++)
+	{
+		if (wpList[i].used)
+			continue;
+
+		errno_t ret = setWatchPoint(i, type, addr, len);
+		if (ret != OK)
+			return ret;
+
+		wpList[i] = { true, type, addr, len };
+		return OK;
+	}
+	return ENOMEM;
+}
+
+errno_t ARMv7ARDIF::delWatchPoint(WatchType type, uint32_t addr, uint32_t len)
+{
+	for (uint32_t i = 0; i < wpList.size(); i++)
+	{
+		auto& wp = wpList[i];
+		if (!wp.used || wp.type != type || wp.addr != addr || wp.len != len)
+			continue;
+
+		errno_t ret = ap.write(REG_DBGWCR(i), (uint32_t)0);
+		if (ret != OK)
+			return ret;
+
+		wp.used = false;
+		return OK;
+	}
+	return OK;	// not exist
+}
+
+errno_t ARMv7ARDIF::findHit(bool* hit, WatchType* type, uint32_t* addr)
+{
+	ASSERT_RELEASE(hit != nullptr && type != nullptr && addr != nullptr);
+
+	*hit = false;
+	DBGDSCR dscr;
+	errno_t ret = readDSCR(&dscr);
 	if (ret != OK)
 		return ret;
+
+	if (!dscr.HALTED || (dscr.MOE != DBGDSCR::MOE_ASYNC_WATCHPOINT && dscr.MOE != DBGDSCR::MOE_SYNC_WATCHPOINT))
+		return OK;
+
+	// どの WRP が一致したかはレジスタに残らないので, 使用中の最初のものを返す
+	for (auto& wp : wpList)
+	{
+		if (wp.used)
+		{
+			*hit = true;
+			*type = wp.type;
+			*addr = wp.addr;
+			return OK;
+		}
+	}
 	return OK;
+}
+
+errno_t ARMv7ARDIF::step()
+{
+	uint32_t pc, cpsr;
+	errno_t ret = getReg(REG_PC, &pc);
+	if (ret == OK)
+		ret = getReg(REG_CPSR, &cpsr);
+	if (ret != OK)
+		return ret;
+
+	// 現在の命令以外のアドレスで止まる mismatch breakpoint を張って再開する
+	uint32_t index = getBreakPointCount() - 1;
+	ret = setBreakPoint(index, pc, (cpsr & CPSR_T) ? 2 : 4, true);
+	if (ret != OK)
+		return ret;
+
+	ret = run();
+	if (ret == OK)
+	{
+		ret = waitForHalt();
+		if (ret != OK)
+		{
+			// WFI などで止まらなかった場合は止めておく
+			DBGDRCR drcr = { };
+			drcr.HRQ = 1;
+			if (ap.write(REG_DBGDRCR, drcr.raw) == OK)
+				waitForHalt();
+		}
+	}
+
+	errno_t r = clearBreakPoint(index);
+	if (ret != OK)
+		return ret;
+	return r;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
+#include <memory>
 #include "ADIv5.h"
 
 union DBGDIDR;
@@ -19,14 +21,67 @@ public:
 	errno_t readReg(uint32_t reg, uint32_t* data);	// reg: 0-14
 	errno_t writeReg(uint32_t reg, uint32_t data);	// reg: 0-14
 
+	// 停止中のコアのレジスタ. 最初のアクセスで r0-r15, CPSR をまとめて読んでキャッシュし,
+	// 変更したレジスタは run/step の前にまとめて書き戻す
+	enum
+	{
+		REG_PC			= 15,
+		REG_CPSR		= 16,
+		CORE_REG_COUNT	= 17
+	};
+	errno_t getReg(uint32_t reg, uint32_t* value);	// reg: 0-16
+	errno_t setReg(uint32_t reg, uint32_t value);
+	errno_t getRegs(std::vector<uint32_t>* regs);	// r0-r15, CPSR
+	errno_t flushRegs();
+	void invalidateRegs() { cache.valid = false; cache.dirty = 0; }
+
+	// VFP (d0-d15/d31, FPSCR). r0, r1 を使うので, 値はキャッシュから書き戻される
+	// CPACR で CP10/CP11 が使えない場合や FPEXC.EN が 0 の場合は VFP が無いものとして扱う
+	errno_t getVFPRegCount(uint32_t* count);	// VFP が無ければ 0
+	errno_t readVFPReg(uint32_t n, uint64_t* value);
+	errno_t writeVFPReg(uint32_t n, uint64_t value);
+	errno_t readFPSCR(uint32_t* value);
+	errno_t writeFPSCR(uint32_t value);
+
+	// BRP による breakpoint. 最後の BRP は step (address mismatch) 用に空けておく
+	uint32_t getBreakPointCount() { return didr.BRPs + 1; }
+	errno_t addBreakPoint(uint32_t addr, uint32_t kind);	// kind: 2, 3 (Thumb), 4 (ARM)
+	errno_t delBreakPoint(uint32_t addr);
+	bool hasBreakPoint(uint32_t addr);
+	errno_t step();
+
+	// WRP による watchpoint. len は 1, 2, 4 (ワード内) か, 2 のべき乗で整列した 8 以上
+	enum WatchType
+	{
+		WATCH_READ		= 1,	// DBGWCR.LSC
+		WATCH_WRITE		= 2,
+		WATCH_ACCESS	= 3
+	};
+	uint32_t getWatchPointCount() { return didr.WRPs + 1; }
+	errno_t addWatchPoint(WatchType type, uint32_t addr, uint32_t len);
+	errno_t delWatchPoint(WatchType type, uint32_t addr, uint32_t len);
+	// 停止要因が watchpoint なら hit = true. 複数使用中の場合はどれが一致したか区別できない
+	errno_t findHit(bool* hit, WatchType* type, uint32_t* addr);
+
 	errno_t getPC(uint32_t* pc);
 	errno_t getPCSR(uint32_t* pc);
+	errno_t getPCSRAddress(uint32_t* addr);
+	bool decodePCSR(uint32_t raw, uint32_t* pc);	// サンプルできなかった場合 (0xFFFFFFFF) は false
 	errno_t getCIDSR(uint32_t* cid);
 	errno_t halt();
 	errno_t run();
+	errno_t waitForHalt();
+	errno_t isHalted(bool* halted);
+	static errno_t haltAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs);
+	static errno_t runAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs);
+	static errno_t isHaltedAll(const std::vector<std::shared_ptr<ARMv7ARDIF>>& difs, std::vector<bool>* halted);
 	errno_t writeITR(uint32_t val);
 	errno_t readDCC(uint32_t* val);
 	errno_t writeDCC(uint32_t val);
+	// コア (LDC/STC) 経由のメモリアクセス. 停止中のみ. addr は 4byte 境界, count は word 数
+	// キャッシュ/MMU を通したコアから見えるメモリにアクセスする. r0 は保存して戻す
+	errno_t readMemory(uint32_t addr, uint32_t count, uint32_t* data);
+	errno_t writeMemory(uint32_t addr, uint32_t count, const uint32_t* data);
 	void printDSCR();
 	void printPRSR();
 
@@ -129,5 +184,43 @@ private:
 	DBGDEVID devid;
 	DBGDEVID1 devid1;
 
+	enum DCCMode
+	{
+		DCC_NON_BLOCKING	= 0,
+		DCC_STALL			= 1,
+		DCC_FAST			= 2
+	};
+
+	struct RegisterCache
+	{
+		bool valid;
+		uint32_t dirty;		// bit n: r[n] を書き戻す
+		uint32_t r[CORE_REG_COUNT];
+	};
+	RegisterCache cache = { };
+	int32_t vfpRegCount = -1;	// -1: 未確認
+
+	std::vector<bool> bpUsed;
+	std::vector<uint32_t> bpAddr;
+
+	struct WatchPoint
+	{
+		bool used;
+		WatchType type;
+		uint32_t addr;
+		uint32_t len;
+	};
+	std::vector<WatchPoint> wpList;
+
 	errno_t readDSCR(DBGDSCR* dscr);
+	errno_t setDCCMode(DCCMode mode);
+	errno_t waitForInstrCompl(DBGDSCR* dscr);
+	errno_t checkAbort(const DBGDSCR& dscr);
+	errno_t isVFPEnabled(bool* enabled);
+	errno_t transferStalled(const std::vector<ADIv5::MEM_AP::Access>& accesses);
+	errno_t loadRegs();
+	errno_t setBreakPoint(uint32_t index, uint32_t addr, uint32_t kind, bool mismatch);
+	errno_t clearBreakPoint(uint32_t index);
+	errno_t setWatchPoint(uint32_t index, WatchType type, uint32_t addr, uint32_t len);
+	errno_t waitForRestart();
 };
\ No newline at end of file
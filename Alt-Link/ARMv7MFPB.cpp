@@ -2,6 +2,9 @@
 #include "stdafx.h"
 #include "ARMv7MFPB.h"
 
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_CORE
+
 // v7-M
 #define REG_FP_CTRL			(base + 0x000)
 #define REG_FP_REMAP		(base + 0x004)
@@ -4,17 +4,37 @@
 #include "ADIv5.h"
 #include "ADIv5TI.h"
 #include "HIDDevice.h"
+#include "Executor.h"
+#include "Profiler.h"
+#include "CounterMonitor.h"
+#include "RTT.h"
+#include "Watch.h"
+
+#include <functional>
+#include <mutex>
+#include <thread>
 
 class AltLink {
 public:
+	// プローブごとに別のハンドルを持てるよう, HID デバイスはデバイスごとに生成する
+	typedef std::function<std::shared_ptr<HIDDevice>()> HIDDeviceFactory;
+
 	class Device {
 		HIDDevice::Info info;
 		CMSISDAP::ConnectionType connectionType;
 		bool opened;
 		bool scanned;
+		HIDDeviceFactory factory;
+		std::shared_ptr<HIDDevice> hid;	// dap より先に破棄されないよう前に置く
 		std::shared_ptr<CMSISDAP> dap;
 		std::shared_ptr<ADIv5> adi;
 		std::shared_ptr<ADIv5TI> ti;
+		std::shared_ptr<Executor> executor;	// プローブへのアクセスはすべてこのスレッドで行う
+		std::shared_ptr<Profiler> profiler;
+		std::shared_ptr<CounterMonitor> counterMonitor;
+		std::shared_ptr<RTT> rtt;
+		std::shared_ptr<Watch> watch;
+		std::mutex serviceMutex;	// 上のサービスの生成と差し替え
 
 		struct DeviceFlags
 		{
@@ -26,6 +46,17 @@ public:
 		} flags;
 
 	private:
+		// 古いサービスのスレッドは executor の処理を待っている場合があるので, executor のスレッドでは止まるのを待たない
+		template <class Service>
+		void retire(std::shared_ptr<Service> service) {
+			if (service == nullptr)
+				return;
+			if (executor->isExecutorThread())
+				std::thread([service]() { service->stop(); }).detach();
+			else
+				service->stop();
+		}
+
 		errno_t scanAPs() {
 			errno_t ret;
 
@@ -93,9 +124,19 @@ public:
 		}
 
 	public:
-		Device(HIDDevice::Info _info)
-			: info(_info), opened(false), scanned(false), adi(nullptr), dap(nullptr), ti(nullptr),
-			connectionType(CMSISDAP::SWJ_SWD) {}
+		Device(HIDDevice::Info _info, HIDDeviceFactory _factory = nullptr)
+			: info(_info), connectionType(CMSISDAP::SWJ_SWD), opened(false), scanned(false), factory(_factory), dap(nullptr), adi(nullptr), ti(nullptr),
+			executor(std::make_shared<Executor>()) {}
+
+		// factory で生成した HID デバイスで開く
+		errno_t open() {
+			if (factory == nullptr)
+				return ENODEV;
+
+			dap = nullptr;
+			hid = factory();
+			return open(hid.get());
+		}
 
 		errno_t open(HIDDevice* hid_device) {
 			dap = std::make_shared<CMSISDAP>(hid_device, info);
@@ -226,15 +267,115 @@ public:
 			return ti;
 		}
 
+		// rescan で TI が作り直された場合はサービスも作り直す
+		std::shared_ptr<Profiler> getProfiler() {
+			std::shared_ptr<Profiler> current, old;
+			{
+				std::lock_guard<std::mutex> lock(serviceMutex);
+				auto _ti = getTI();
+				if (_ti == nullptr)
+					return nullptr;
+
+				if (profiler == nullptr || profiler->getTI() != _ti)
+				{
+					old = profiler;
+					profiler = std::make_shared<Profiler>(_ti, executor);
+				}
+				current = profiler;
+			}
+			retire(old);
+			return current;
+		}
+
+		std::shared_ptr<CounterMonitor> getCounterMonitor() {
+			std::shared_ptr<CounterMonitor> current, old;
+			{
+				std::lock_guard<std::mutex> lock(serviceMutex);
+				auto _ti = getTI();
+				if (_ti == nullptr)
+					return nullptr;
+
+				if (counterMonitor == nullptr || counterMonitor->getTI() != _ti)
+				{
+					old = counterMonitor;
+					counterMonitor = std::make_shared<CounterMonitor>(_ti, executor);
+				}
+				current = counterMonitor;
+			}
+			retire(old);
+			return current;
+		}
+
+		std::shared_ptr<RTT> getRTT() {
+			std::shared_ptr<RTT> current, old;
+			{
+				std::lock_guard<std::mutex> lock(serviceMutex);
+				auto _ti = getTI();
+				if (_ti == nullptr)
+					return nullptr;
+
+				if (rtt == nullptr || rtt->getTI() != _ti)
+				{
+					old = rtt;
+					rtt = std::make_shared<RTT>(_ti, executor);
+				}
+				current = rtt;
+			}
+			bool running = old != nullptr && old->isRunning();
+			retire(old);
+			if (running)
+				current->start();
+			return current;
+		}
+
+		std::shared_ptr<Watch> getWatch() {
+			std::shared_ptr<Watch> current, old;
+			{
+				std::lock_guard<std::mutex> lock(serviceMutex);
+				auto _ti = getTI();
+				if (_ti == nullptr)
+					return nullptr;
+
+				if (watch == nullptr || watch->getTI() != _ti)
+				{
+					old = watch;
+					watch = std::make_shared<Watch>(_ti, executor);
+				}
+				current = watch;
+			}
+			retire(old);
+			return current;
+		}
+
+		// executor のタスクの中でサービスを作り直さずに済むよう, 先に作っておく (batch の前など)
+		void resolveServices() {
+			getProfiler();
+			getCounterMonitor();
+			getRTT();
+			getWatch();
+		}
+
 		std::shared_ptr<CMSISDAP> getDAP() { return dap; }
 		std::shared_ptr<ADIv5> getADI() { return adi; }
+		std::shared_ptr<Executor> getExecutor() { return executor; }
 		HIDDevice::Info& getDeviceInfo() { return info; }
 	};
 
 private:
 	std::vector<std::shared_ptr<Device>> devices;
+	HIDDeviceFactory factory;
 
 public:
+	void setHIDDeviceFactory(HIDDeviceFactory _factory) { factory = _factory; }
+
+	errno_t enumerate() {
+		if (factory == nullptr)
+			return ENODEV;
+
+		auto hid_device = factory();
+		return enumerate(hid_device.get());
+	}
+
 	errno_t enumerate(HIDDevice* hid_device) {
 		// close all opened devices
 		devices.clear();
@@ -247,7 +388,7 @@ public:
 		}
 
 		for (auto i : info)
-			devices.push_back(std::make_shared<Device>(i));
+			devices.push_back(std::make_shared<Device>(i, factory));
 
 		return OK;
 	}
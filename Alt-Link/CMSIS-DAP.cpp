@@ -3,10 +3,15 @@
 
 #include <locale>
 #include <codecvt>
+#include <algorithm>
 
 #include "CMSIS-DAP.h"
 #include "ADIv5.h"
 #include "JEP106.h"
+#include "Trace.h"
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_DAP
 
 #define USE_USB_TX_DBG 0
 
@@ -98,6 +103,7 @@ CMSISDAP::CMSISDAP(HIDDevice* _hid_device, const HIDDevice::Info& info)
 		_DBGPRT("hid_open failed.\n");
 	}
 	dapInfo.packetMaxSize = _CMSISDAP_DEFAULT_PACKET_SIZE;
+	dapInfo.packetMaxCount = 1;
 }
 
 CMSISDAP::~CMSISDAP()
@@ -128,6 +134,10 @@ CMSISDAP::~CMSISDAP()
 
 int32_t CMSISDAP::usbTx(const TxPacket& packet)
 {
+	TRACE_SPAN(span, "usb", "usbTx");
+	TRACE_ARG(span, "command", packet.length() > 1 ? packet.data()[1] : 0);	// [0] は report ID
+	TRACE_ARG(span, "bytes", packet.length());
+
 	int ret = hid_device->write(packet.data(), packet.length());
 	if (ret == -1)
 		return CMSISDAP_ERR_USBHID_WRITE;
@@ -140,9 +150,11 @@ int32_t CMSISDAP::usbRx(RxPacket* rx)
 	if (rx == nullptr)
 		return CMSISDAP_ERR_INVALID_ARGUMENT;
 
+	TRACE_SPAN(span, "usb", "usbRx");
 	int ret = hid_device->read(rx->data(), rx->length());
 	if (ret == -1 || ret == 0)
 		return CMSISDAP_ERR_USBHID_TIMEOUT;
+	TRACE_ARG(span, "bytes", ret);
 
 	rx->length(ret);
 	return OK;
@@ -150,6 +162,7 @@ int32_t CMSISDAP::usbRx(RxPacket* rx)
 
 int32_t CMSISDAP::usbTxRx(const TxPacket& tx, RxPacket* rx)
 {
+	TRACE_SPAN(span, "usb", "usbTxRx");
 	int ret;
 	ret = usbTx(tx);
 	if (ret != OK)
@@ -1306,3 +1319,198 @@ int32_t CMSISDAP::dpapWrite(bool dp, uint32_t reg, uint32_t data)
 	return OK;
 }
 
+
+
+int32_t CMSISDAP::transfer(const std::vector<Transfer>& transfers)
+{
+	const uint32_t size = std::min<uint32_t>(dapInfo.packetMaxSize, _CMSISDAP_DEFAULT_PACKET_SIZE);
+
+	size_t index = 0;
+	while (index < transfers.size())
+	{
+		// Tx: report id, command, DAP index, transfer count, (request, [data])...
+		// Rx: command, transfer count, transfer response, [data]...
+		size_t n = 0;
+		uint32_t txSize = 4;
+		uint32_t rxSize = 3;
+		while (index + n < transfers.size() && n < 255)
+		{
+			const Transfer& t = transfers[index + n];
+			uint32_t tx = t.read ? 1 : 5;
+			uint32_t rx = t.read ? 4 : 0;
+			if (txSize + tx > size || rxSize + rx > size - 1)
+				break;
+			txSize += tx;
+			rxSize += rx;
+			n++;
+		}
+
+		TxPacket tx;
+		tx.write(_USB_HID_REPORT_NUM);
+		tx.write(CMD_TX);
+		tx.write(dapIndex);	/* DAP Index, ignored in the swd. */
+		tx.write((uint8_t)n);
+		for (size_t i = 0; i < n; i++)
+		{
+			const Transfer& t = transfers[index + i];
+
+			TransferRequest req = { };
+			if (t.read)
+				req.setRead();
+			else
+				req.setWrite();
+			if (t.ap)
+				req.setAP();
+			else
+				req.setDP();
+			req.setRegister(t.reg);
+
+			tx.write(req.raw[0]);
+			if (!t.read)
+				tx.write32(t.value);
+		}
+
+		RxPacket rx;
+		int ret = usbTxRx(tx, &rx);
+		if (ret != OK)
+			return ret;
+
+		uint8_t* rxdata = rx.data();
+		switch (rxdata[2] & TX_ACK_MASK)
+		{
+		case TX_ACK_NO_ACK:
+			return CMSISDAP_ERR_NO_ACK;
+		case TX_ACK_FAULT:
+			return CMSISDAP_ERR_ACKFAULT;
+		case TX_ACK_WAIT:
+			return CMSISDAP_ERR_ACKWAIT;
+		}
+		if (rxdata[1] != n)
+			return CMSISDAP_ERR_DAP_RES;
+
+		uint32_t offset = 3;
+		for (size_t i = 0; i < n; i++)
+		{
+			const Transfer& t = transfers[index + i];
+			if (!t.read)
+				continue;
+			if (t.data != nullptr)
+				*t.data = buf2LE32(&rxdata[offset]);
+			offset += 4;
+		}
+		index += n;
+	}
+	return OK;
+}
+
+uint32_t CMSISDAP::getBlockTransferCount(bool read)
+{
+	uint32_t size = std::min<uint32_t>(dapInfo.packetMaxSize, _CMSISDAP_DEFAULT_PACKET_SIZE);
+
+	// Tx: report id, command, DAP index, transfer count (2), transfer request
+	// Rx: command, transfer count (2), transfer response
+	return read ? (size - 1 - 4) / 4 : (size - 6) / 4;
+}
+
+int32_t CMSISDAP::apReadBlock(uint32_t reg, uint32_t count, uint32_t *data)
+{
+	if (data == nullptr)
+		return CMSISDAP_ERR_INVALID_ARGUMENT;
+
+	return apTransferBlock(true, reg, count, data, nullptr);
+}
+
+int32_t CMSISDAP::apWriteBlock(uint32_t reg, uint32_t count, const uint32_t *data)
+{
+	if (data == nullptr)
+		return CMSISDAP_ERR_INVALID_ARGUMENT;
+
+	return apTransferBlock(false, reg, count, nullptr, data);
+}
+
+int32_t CMSISDAP::apTransferBlock(bool read, uint32_t reg, uint32_t count, uint32_t *rdata, const uint32_t *wdata)
+{
+	TransferRequest req = { };
+
+	if (read)
+		req.setRead();
+	else
+		req.setWrite();
+	req.setAP();
+	req.setRegister(reg);
+
+	const uint32_t maxCount = getBlockTransferCount(read);
+	const uint32_t maxPackets = std::max<uint32_t>(dapInfo.packetMaxCount, 1);
+
+	int32_t result = OK;
+	while (count > 0 && result == OK)
+	{
+		// DAP_TransferBlock コマンドを packetMaxCount 個まで先に送り、後から応答をまとめて受け取る
+		std::vector<uint32_t> queued;
+		while (count > 0 && queued.size() < maxPackets)
+		{
+			uint32_t n = std::min(count, maxCount);
+
+			TxPacket tx;
+			tx.write(_USB_HID_REPORT_NUM);
+			tx.write(CMD_TX_BLOCK);
+			tx.write(dapIndex);	/* DAP Index, ignored in the swd. */
+			tx.write16((uint16_t)n);
+			tx.write(req.raw[0]);
+			if (!read)
+			{
+				for (uint32_t i = 0; i < n; i++)
+					tx.write32(*wdata++);
+			}
+
+			int ret = usbTx(tx);
+			if (ret != OK)
+			{
+				result = ret;
+				break;
+			}
+			queued.push_back(n);
+			count -= n;
+		}
+
+		// 途中でエラーになっても送信済みのコマンドの応答はすべて読み捨てる
+		for (auto n : queued)
+		{
+			RxPacket rx;
+			int ret = usbRx(&rx);
+			if (ret != OK)
+			{
+				if (result == OK)
+					result = ret;
+				continue;
+			}
+
+			uint8_t* rxdata = rx.data();
+			uint32_t done = rxdata[1] | (rxdata[2] << 8);
+			if (result == OK)
+			{
+				switch (rxdata[3] & TX_ACK_MASK)
+				{
+				case TX_ACK_NO_ACK:
+					result = CMSISDAP_ERR_NO_ACK;
+					break;
+				case TX_ACK_FAULT:
+					result = CMSISDAP_ERR_ACKFAULT;
+					break;
+				case TX_ACK_WAIT:
+					result = CMSISDAP_ERR_ACKWAIT;
+					break;
+				}
+			}
+			if (result == OK && done != n)
+				result = CMSISDAP_ERR_DAP_RES;
+
+			if (read && result == OK)
+			{
+				for (uint32_t i = 0; i < n; i++)
+					*rdata++ = buf2LE32(&rxdata[4 + i * 4]);
+			}
+		}
+	}
+	return result;
+}
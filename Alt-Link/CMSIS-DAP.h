@@ -25,6 +25,9 @@ public:
 	virtual int32_t dpWrite(uint32_t reg, uint32_t val);
 	virtual int32_t apRead(uint32_t reg, uint32_t *data);
 	virtual int32_t apWrite(uint32_t reg, uint32_t val);
+	virtual int32_t apReadBlock(uint32_t reg, uint32_t count, uint32_t *data);
+	virtual int32_t apWriteBlock(uint32_t reg, uint32_t count, const uint32_t *data);
+	virtual int32_t transfer(const std::vector<Transfer>& transfers);
 	virtual int32_t setConnectionType(ConnectionType type);
 
 public:
@@ -224,6 +227,8 @@ private:
 	int32_t cmdSwjPins(uint8_t value, uint8_t pin, uint32_t delay, PIN* input);
 	int32_t dpapRead(bool dp, uint32_t reg, uint32_t *data);
 	int32_t dpapWrite(bool dp, uint32_t reg, uint32_t val);
+	int32_t apTransferBlock(bool read, uint32_t reg, uint32_t count, uint32_t *rdata, const uint32_t *wdata);
+	uint32_t getBlockTransferCount(bool read);
 	int32_t getInfo(uint32_t type, RxPacket* rx);
 
 	// SWD
@@ -0,0 +1,31 @@
+#include "stdafx.h"
+#include "CRC32.h"
+
+#include <array>
+
+static std::array<uint32_t, 256> createTable()
+{
+	std::array<uint32_t, 256> table;
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i << 24;
+		for (uint32_t j = 0; j < 8; j++)
+			c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : (c << 1);
+		table[i] = c;
+	}
+	return table;
+}
+
+const uint32_t* CRC32::table()
+{
+	static const std::array<uint32_t, 256> t = createTable();
+	return t.data();
+}
+
+uint32_t CRC32::calc(const uint8_t* data, size_t len, uint32_t crc)
+{
+	const uint32_t* t = table();
+	for (size_t i = 0; i < len; i++)
+		crc = (crc << 8) ^ t[((crc >> 24) ^ data[i]) & 0xFF];
+	return crc;
+}
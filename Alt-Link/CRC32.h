@@ -0,0 +1,16 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// gdb (libiberty xcrc32) 互換の CRC32
+// 多項式 0x04C11DB7, MSB first, 反転なし, 最終 XOR なし
+class CRC32
+{
+public:
+	static const uint32_t INITIAL_VALUE = 0xFFFFFFFF;
+
+	static uint32_t calc(const uint8_t* data, size_t len, uint32_t crc = INITIAL_VALUE);
+	static const uint32_t* table();
+};
@@ -3,7 +3,8 @@
 #include "ADIv5.h"
 #include "JEP106.h"
 
-#define _DBGPRT printf
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_ADI
 
 int32_t ADIv5::Component::readCid()
 {
@@ -241,7 +242,7 @@ void ADIv5::Component::print()
 
 void ADIv5::Component::PID::print()
 {
-	_DBGPRT("    PID                 : 0x%016llx\n", raw);
+	_DBGPRT("    PID                 : 0x%016llx\n", (unsigned long long)raw);
 	_DBGPRT("      Part number       : %x\n", PART);
 	if (JEDEC)
 	{
@@ -1,6 +1,20 @@
 
 #include "stdafx.h"
 
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CONVERTER_USE_AVX2
+#define CONVERTER_USE_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONVERTER_USE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERTER_USE_NEON
+#endif
+
 #include "Converter.h"
 
 void Converter::put(std::stringstream& stream, uint32_t data)
@@ -16,35 +30,49 @@ void Converter::put(std::stringstream& stream, uint8_t data)
 	stream << std::setfill('0') << std::setw(2) << std::hex << (unsigned)data;
 }
 
-template <typename T>
-static void toArray(const std::string& hex, T* output)
+std::string Converter::toHex(const std::vector<uint8_t>& array)
 {
-	std::stringstream stream;
+	std::string hex(array.size() * 2, '\0');
+	if (array.size() > 0)
+		encodeHex(array.data(), array.size(), &hex[0]);
+	return hex;
+}
 
-	uint32_t offset = 0;
-	const uint32_t value_length = sizeof(typename T::value_type) * 2;
-	while (offset < hex.length())
+std::string Converter::toHex(const std::vector<uint32_t>& array)
+{
+	// put(uint32_t) と同じく little endian のバイト順
+	std::vector<uint8_t> bytes;
+	bytes.reserve(array.size() * 4);
+	for (uint32_t data : array)
 	{
-		uint64_t data;
-		stream << std::hex << hex.substr(offset, value_length);
-		stream >> std::hex >> data;
-		stream.clear();
-		output->push_back(static_cast<typename T::value_type>(data));
-		offset += value_length;
+		bytes.push_back((uint8_t)(data & 0xFF));
+		bytes.push_back((uint8_t)((data >> 8) & 0xFF));
+		bytes.push_back((uint8_t)((data >> 16) & 0xFF));
+		bytes.push_back((uint8_t)((data >> 24) & 0xFF));
 	}
+	return toHex(bytes);
 }
 
 std::vector<uint8_t> Converter::toByteArray(const std::string& hex)
 {
-	std::vector<uint8_t> array;
-	toArray(hex, &array);
+	std::vector<uint8_t> array(hex.length() / 2);
+	if (array.size() > 0 && !decodeHex(hex.data(), array.size(), array.data()))
+		array.clear();
 	return array;
 }
 
 std::vector<uint32_t> Converter::toUInt32Array(const std::string& hex)
 {
+	// toHex(std::vector<uint32_t>) の逆変換 (little endian)
+	std::vector<uint8_t> bytes = toByteArray(hex);
+
 	std::vector<uint32_t> array;
-	toArray(hex, &array);
+	array.reserve(bytes.size() / 4);
+	for (size_t i = 0; i + 4 <= bytes.size(); i += 4)
+	{
+		array.push_back((uint32_t)bytes[i] | ((uint32_t)bytes[i + 1] << 8) |
+			((uint32_t)bytes[i + 2] << 16) | ((uint32_t)bytes[i + 3] << 24));
+	}
 	return array;
 }
 
@@ -82,4 +110,347 @@ std::string::size_type Converter::extract(const std::string& str, size_t offset,
 		*out = str.substr(offset);
 	}
 	return delimiterPos;
-}
\ No newline at end of file
+}
+namespace
+{
+	const char HEX_DIGITS[] = "0123456789abcdef";
+
+	// 0xFF は 16 進数以外
+	struct DecodeTable
+	{
+		uint8_t value[256];
+
+		DecodeTable()
+		{
+			memset(value, 0xFF, sizeof(value));
+			for (int i = 0; i < 10; i++)
+				value['0' + i] = (uint8_t)i;
+			for (int i = 0; i < 6; i++)
+			{
+				value['a' + i] = (uint8_t)(10 + i);
+				value['A' + i] = (uint8_t)(10 + i);
+			}
+		}
+	};
+	const DecodeTable decodeTable;
+
+	inline bool needsEscape(char c)
+	{
+		return c == '#' || c == '$' || c == '}' || c == '*';
+	}
+
+#if defined(CONVERTER_USE_SSE2)
+	// nibble (0-15) -> ASCII
+	inline __m128i nibbleToAscii(__m128i n)
+	{
+		__m128i gt9 = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+		__m128i ascii = _mm_add_epi8(n, _mm_set1_epi8('0'));
+		return _mm_add_epi8(ascii, _mm_and_si128(gt9, _mm_set1_epi8('a' - '0' - 10)));
+	}
+
+	// ASCII 16 文字 -> nibble, 16 進数以外の文字があれば valid = false
+	inline __m128i asciiToNibble(__m128i c, bool* valid)
+	{
+		__m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+		__m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+		__m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		__m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+		*valid = _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) == 0xFFFF;
+		alpha = _mm_add_epi8(alpha, _mm_set1_epi8(10));
+		return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_andnot_si128(isDigit, alpha));
+	}
+
+	// [hi, lo, hi, lo, ...] の nibble 列を 16bit 単位でバイトにまとめる (下位 8bit に格納)
+	inline __m128i combineNibbles(__m128i n)
+	{
+		__m128i hi = _mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0x00F0));
+		__m128i lo = _mm_srli_epi16(n, 8);
+		return _mm_or_si128(hi, lo);
+	}
+
+	inline __m128i matchEscape(__m128i v)
+	{
+		__m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8('#'));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+		return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+	}
+#endif
+
+#if defined(CONVERTER_USE_AVX2)
+	inline __m256i nibbleToAscii(__m256i n)
+	{
+		__m256i gt9 = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+		__m256i ascii = _mm256_add_epi8(n, _mm256_set1_epi8('0'));
+		return _mm256_add_epi8(ascii, _mm256_and_si256(gt9, _mm256_set1_epi8('a' - '0' - 10)));
+	}
+
+	inline __m256i asciiToNibble(__m256i c, bool* valid)
+	{
+		__m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+		__m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+		__m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+		__m256i isAlpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+		*valid = _mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) == -1;
+		alpha = _mm256_add_epi8(alpha, _mm256_set1_epi8(10));
+		return _mm256_or_si256(_mm256_and_si256(isDigit, digit), _mm256_andnot_si256(isDigit, alpha));
+	}
+
+	inline __m256i combineNibbles(__m256i n)
+	{
+		__m256i hi = _mm256_and_si256(_mm256_slli_epi16(n, 4), _mm256_set1_epi16(0x00F0));
+		__m256i lo = _mm256_srli_epi16(n, 8);
+		return _mm256_or_si256(hi, lo);
+	}
+#endif
+
+#if defined(CONVERTER_USE_NEON)
+	inline uint8x16_t nibbleToAscii(uint8x16_t n)
+	{
+		uint8x16_t gt9 = vcgtq_u8(n, vdupq_n_u8(9));
+		uint8x16_t ascii = vaddq_u8(n, vdupq_n_u8('0'));
+		return vaddq_u8(ascii, vandq_u8(gt9, vdupq_n_u8('a' - '0' - 10)));
+	}
+
+	inline bool isZero(uint8x16_t v)
+	{
+		uint64x2_t v64 = vreinterpretq_u64_u8(v);
+		return (vgetq_lane_u64(v64, 0) | vgetq_lane_u64(v64, 1)) == 0;
+	}
+
+	inline uint8x16_t asciiToNibble(uint8x16_t c, bool* valid)
+	{
+		uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+		uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+		uint8x16_t alpha = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+		uint8x16_t isAlpha = vcleq_u8(alpha, vdupq_n_u8(5));
+		*valid = isZero(vmvnq_u8(vorrq_u8(isDigit, isAlpha)));
+		return vbslq_u8(isDigit, digit, vaddq_u8(alpha, vdupq_n_u8(10)));
+	}
+
+	inline uint8x16_t matchEscape(uint8x16_t v)
+	{
+		uint8x16_t m = vceqq_u8(v, vdupq_n_u8('#'));
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('$')));
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('}')));
+		return vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('*')));
+	}
+#endif
+}
+
+void Converter::encodeHex(const uint8_t* src, size_t len, char* dst)
+{
+	size_t i = 0;
+
+#if defined(CONVERTER_USE_AVX2)
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		__m256i hi = nibbleToAscii(_mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F)));
+		__m256i lo = nibbleToAscii(_mm256_and_si256(v, _mm256_set1_epi8(0x0F)));
+		// unpack は 128bit lane 単位なので lane を並べ直す
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+#endif
+#if defined(CONVERTER_USE_SSE2)
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i hi = nibbleToAscii(_mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F)));
+		__m128i lo = nibbleToAscii(_mm_and_si128(v, _mm_set1_epi8(0x0F)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+#elif defined(CONVERTER_USE_NEON)
+	for (; i + 16 <= len; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(src + i);
+		uint8x16x2_t out;
+		out.val[0] = nibbleToAscii(vshrq_n_u8(v, 4));
+		out.val[1] = nibbleToAscii(vandq_u8(v, vdupq_n_u8(0x0F)));
+		vst2q_u8(reinterpret_cast<uint8_t*>(dst + i * 2), out);
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		dst[i * 2] = HEX_DIGITS[src[i] >> 4];
+		dst[i * 2 + 1] = HEX_DIGITS[src[i] & 0x0F];
+	}
+}
+
+bool Converter::decodeHex(const char* src, size_t len, uint8_t* dst)
+{
+	size_t i = 0;
+
+#if defined(CONVERTER_USE_AVX2)
+	for (; i + 32 <= len; i += 32)
+	{
+		bool valid0, valid1;
+		__m256i n0 = asciiToNibble(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2)), &valid0);
+		__m256i n1 = asciiToNibble(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2 + 32)), &valid1);
+		if (!valid0 || !valid1)
+			return false;
+		// packus は 128bit lane 単位なので 64bit 単位で並べ直す
+		__m256i packed = _mm256_packus_epi16(combineNibbles(n0), combineNibbles(n1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+#endif
+#if defined(CONVERTER_USE_SSE2)
+	for (; i + 16 <= len; i += 16)
+	{
+		bool valid0, valid1;
+		__m128i n0 = asciiToNibble(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), &valid0);
+		__m128i n1 = asciiToNibble(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16)), &valid1);
+		if (!valid0 || !valid1)
+			return false;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(combineNibbles(n0), combineNibbles(n1)));
+	}
+#elif defined(CONVERTER_USE_NEON)
+	for (; i + 16 <= len; i += 16)
+	{
+		// vld2q で上位/下位 nibble の文字を分離して読む
+		uint8x16x2_t c = vld2q_u8(reinterpret_cast<const uint8_t*>(src + i * 2));
+		bool valid0, valid1;
+		uint8x16_t hi = asciiToNibble(c.val[0], &valid0);
+		uint8x16_t lo = asciiToNibble(c.val[1], &valid1);
+		if (!valid0 || !valid1)
+			return false;
+		vst1q_u8(dst + i, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		uint8_t hi = decodeTable.value[(uint8_t)src[i * 2]];
+		uint8_t lo = decodeTable.value[(uint8_t)src[i * 2 + 1]];
+		if ((hi | lo) & 0xF0)
+			return false;
+		dst[i] = (uint8_t)((hi << 4) | lo);
+	}
+	return true;
+}
+
+uint8_t Converter::checksum(const char* data, size_t len)
+{
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+	uint64_t sum = 0;
+	size_t i = 0;
+
+#if defined(CONVERTER_USE_AVX2)
+	__m256i acc256 = _mm256_setzero_si256();
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+		acc256 = _mm256_add_epi64(acc256, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+	}
+	uint64_t lanes256[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes256), acc256);
+	sum += lanes256[0] + lanes256[1] + lanes256[2] + lanes256[3];
+#endif
+#if defined(CONVERTER_USE_SSE2)
+	// psadbw で 8 バイトずつ水平加算する
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+	sum += lanes[0] + lanes[1];
+#elif defined(CONVERTER_USE_NEON)
+	uint32x4_t acc = vdupq_n_u32(0);
+	for (; i + 16 <= len; i += 16)
+	{
+		acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p + i)));
+	}
+	sum += (uint64_t)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+
+	for (; i < len; i++)
+	{
+		sum += p[i];
+	}
+	return (uint8_t)(sum & 0xFF);
+}
+
+void Converter::escape(const std::string& data, std::string* out)
+{
+	ASSERT_RELEASE(out != nullptr);
+
+	out->clear();
+	out->reserve(data.length() + data.length() / 8);
+
+	const char* p = data.data();
+	const size_t len = data.length();
+	size_t i = 0;
+
+	while (i < len)
+	{
+#if defined(CONVERTER_USE_SSE2)
+		// エスケープ対象が無い 16 バイトはまとめてコピーする
+		size_t start = i;
+		while (i + 16 <= len)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			if (_mm_movemask_epi8(matchEscape(v)) != 0)
+				break;
+			i += 16;
+		}
+		out->append(p + start, i - start);
+#elif defined(CONVERTER_USE_NEON)
+		size_t start = i;
+		while (i + 16 <= len)
+		{
+			if (!isZero(matchEscape(vld1q_u8(reinterpret_cast<const uint8_t*>(p + i)))))
+				break;
+			i += 16;
+		}
+		out->append(p + start, i - start);
+#endif
+
+		size_t end = (i + 16 <= len) ? i + 16 : len;
+		for (; i < end; i++)
+		{
+			if (needsEscape(p[i]))
+			{
+				out->push_back('}');
+				out->push_back(p[i] ^ 0x20);
+			}
+			else
+			{
+				out->push_back(p[i]);
+			}
+		}
+	}
+}
+
+void Converter::unescape(const std::string& data, std::string* out)
+{
+	ASSERT_RELEASE(out != nullptr);
+
+	out->clear();
+	out->reserve(data.length());
+
+	const char* p = data.data();
+	const char* end = p + data.length();
+
+	while (p < end)
+	{
+		// memchr は libc 側でベクトル化されている
+		const char* found = static_cast<const char*>(memchr(p, '}', end - p));
+		if (found == nullptr)
+		{
+			out->append(p, end - p);
+			break;
+		}
+		out->append(p, found - p);
+		if (found + 1 < end)
+			out->push_back(found[1] ^ 0x20);
+		p = found + 2;
+	}
+}
@@ -28,6 +28,9 @@ public:
 		return stream.str();
 	}
 
+	static std::string toHex(const std::vector<uint8_t>& array);
+	static std::string toHex(const std::vector<uint32_t>& array);
+
 	static std::vector<uint8_t> toByteArray(const std::string& hex);
 	static std::vector<uint32_t> toUInt32Array(const std::string& hex);
 	
@@ -50,6 +53,16 @@ public:
 		return delimiterPos;
 	}
 
+	// RSP 用の低レベル kernel (SSE2/AVX2/NEON があれば使用する)
+	// dst は len * 2 文字分の領域が必要
+	static void encodeHex(const uint8_t* src, size_t len, char* dst);
+	// src は len * 2 文字, 16 進数以外の文字を含む場合は false
+	static bool decodeHex(const char* src, size_t len, uint8_t* dst);
+	static uint8_t checksum(const char* data, size_t len);
+	// '#', '$', '}', '*' を '}' + (c ^ 0x20) に変換する
+	static void escape(const std::string& data, std::string* out);
+	static void unescape(const std::string& data, std::string* out);
+
 private:
 	static void put(std::stringstream& stream, uint32_t data);
 	static void put(std::stringstream& stream, uint8_t data);
@@ -0,0 +1,396 @@
+#include "stdafx.h"
+#include "CoreDump.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+	// 渡された順にファイルへ書き出すスレッド
+	class FileWriter
+	{
+	public:
+		explicit FileWriter(uint32_t _maxQueued) : maxQueued(_maxQueued), done(false), failed(false) {}
+		~FileWriter() { close(); }
+
+		errno_t open(const std::string& path)
+		{
+			file.open(path, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return ENOENT;
+
+			thread = std::thread([this]() { run(); });
+			return OK;
+		}
+
+		// 書き込みに失敗していれば false
+		bool push(std::vector<uint8_t>&& data)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this]() { return queue.size() < maxQueued || failed; });
+			if (failed)
+				return false;
+
+			queue.push_back(std::move(data));
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// 残りを書き終えるまで待つ
+		errno_t close()
+		{
+			if (!thread.joinable())
+				return failed ? EIO : OK;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done = true;
+			}
+			notEmpty.notify_one();
+			thread.join();
+
+			file.close();
+			return failed || file.fail() ? EIO : OK;
+		}
+
+	private:
+		uint32_t maxQueued;
+		std::ofstream file;
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+		std::deque<std::vector<uint8_t>> queue;
+		bool done;
+		bool failed;
+
+		void run()
+		{
+			while (1)
+			{
+				std::vector<uint8_t> data;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					notEmpty.wait(lock, [this]() { return !queue.empty() || done; });
+					if (queue.empty())
+						return;
+
+					data = std::move(queue.front());
+					queue.pop_front();
+					notFull.notify_one();
+				}
+
+				if (!file.write((const char*)data.data(), data.size()))
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					failed = true;
+					queue.clear();
+					notFull.notify_one();
+					return;
+				}
+			}
+		}
+	};
+
+	void put16(std::vector<uint8_t>& out, uint32_t value)
+	{
+		out.push_back((uint8_t)value);
+		out.push_back((uint8_t)(value >> 8));
+	}
+
+	void put32(std::vector<uint8_t>& out, uint32_t value)
+	{
+		put16(out, value);
+		put16(out, value >> 16);
+	}
+}
+
+CoreDump::CoreDump(ADIv5TI& _ti, std::shared_ptr<Executor> _executor) : ti(_ti), executor(_executor)
+{
+}
+
+bool CoreDump::parseRegions(const std::string& str, std::vector<Region>* regions)
+{
+	ASSERT_RELEASE(regions != nullptr);
+
+	std::istringstream stream(str);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		size_t pos = item.find(':');
+		if (pos == std::string::npos)
+			return false;
+
+		std::string addrStr = item.substr(0, pos);
+		std::string sizeStr = item.substr(pos + 1);
+		char* end;
+		uint64_t addr = strtoull(addrStr.c_str(), &end, 0);
+		if (addrStr.empty() || *end != '\0')
+			return false;
+		uint64_t size = strtoull(sizeStr.c_str(), &end, 0);
+		if (sizeStr.empty() || *end != '\0' || size == 0 || addr + size > 0x100000000ULL)
+			return false;
+
+		regions->push_back({ addr, (uint32_t)size });
+	}
+	return regions->size() > 0;
+}
+
+errno_t CoreDump::getRunning(std::vector<bool>* running)
+{
+	auto difs = ti.getARMv7ARDIF();
+	if (difs.size() > 0)
+	{
+		std::vector<bool> halted;
+		errno_t ret = ARMv7ARDIF::isHaltedAll(difs, &halted);
+		if (ret != OK)
+			return ret;
+		for (auto h : halted)
+			running->push_back(!h);
+		return OK;
+	}
+
+	auto scs = ti.getARMv6MSCS();
+	if (!scs)
+		return ENODEV;
+
+	bool halt;
+	errno_t ret = scs->isHalt(&halt);
+	if (ret != OK)
+		return ret;
+	running->push_back(!halt);
+	return OK;
+}
+
+errno_t CoreDump::resume(const std::vector<bool>& running)
+{
+	auto difs = ti.getARMv7ARDIF();
+	if (difs.size() > 0)
+	{
+		std::vector<std::shared_ptr<ARMv7ARDIF>> resumes;
+		for (size_t i = 0; i < difs.size() && i < running.size(); i++)
+		{
+			if (running[i])
+				resumes.push_back(difs[i]);
+		}
+		return resumes.size() > 0 ? ARMv7ARDIF::runAll(resumes) : OK;
+	}
+
+	auto scs = ti.getARMv6MSCS();
+	if (scs && running.size() > 0 && running[0])
+		return scs->run();
+	return OK;
+}
+
+errno_t CoreDump::readRegisters(std::vector<std::vector<uint32_t>>* threads)
+{
+	auto difs = ti.getARMv7ARDIF();
+	if (difs.size() > 0)
+	{
+		for (auto dif : difs)
+		{
+			std::vector<uint32_t> regs;
+			errno_t ret = dif->getRegs(&regs);	// r0-r15, cpsr
+			if (ret != OK)
+				return ret;
+			threads->push_back(regs);
+		}
+		return OK;
+	}
+
+	auto scs = ti.getARMv6MSCS();
+	if (!scs)
+		return ENODEV;
+
+	// r0-r12, sp, lr, pc, xPSR を 1 回の転送で読む
+	std::vector<ARMv6MSCS::REGSEL> regsels;
+	for (uint32_t i = ARMv6MSCS::R0; i <= ARMv6MSCS::xPSR; i++)
+		regsels.push_back((ARMv6MSCS::REGSEL)i);
+
+	std::vector<uint32_t> regs;
+	errno_t ret = scs->readRegs(regsels, &regs);
+	if (ret != OK)
+		return ret;
+	threads->push_back(regs);
+	return OK;
+}
+
+std::vector<uint8_t> CoreDump::makeHeader(const std::vector<Region>& regions, const std::vector<std::vector<uint32_t>>& threads)
+{
+	static const uint32_t EHDR_SIZE = 52;
+	static const uint32_t PHDR_SIZE = 32;
+	static const uint32_t NOTE_NAME_SIZE = 8;		// "CORE\0" を 4 byte 境界まで
+	static const uint32_t NOTE_SIZE = 12 + NOTE_NAME_SIZE + PRSTATUS_SIZE;
+	static const uint32_t ET_CORE = 4;
+	static const uint32_t EM_ARM = 40;
+	static const uint32_t PT_LOAD = 1;
+	static const uint32_t PT_NOTE = 4;
+	static const uint32_t PF_W = 2;
+	static const uint32_t PF_R = 4;
+	static const uint32_t NT_PRSTATUS = 1;
+	static const uint32_t SIGTRAP = 5;
+
+	uint32_t phnum = (uint32_t)regions.size() + 1;
+	uint32_t noteOffset = EHDR_SIZE + PHDR_SIZE * phnum;
+	uint32_t noteSize = NOTE_SIZE * (uint32_t)threads.size();
+
+	std::vector<uint8_t> out;
+	out.reserve(noteOffset + noteSize);
+
+	// ELF header (ELF32, little endian)
+	const uint8_t ident[16] = { 0x7F, 'E', 'L', 'F', 1 /* ELFCLASS32 */, 1 /* ELFDATA2LSB */, 1 /* EV_CURRENT */ };
+	out.insert(out.end(), ident, ident + sizeof(ident));
+	put16(out, ET_CORE);
+	put16(out, EM_ARM);
+	put32(out, 1);			// e_version
+	put32(out, 0);			// e_entry
+	put32(out, EHDR_SIZE);	// e_phoff
+	put32(out, 0);			// e_shoff
+	put32(out, 0);			// e_flags
+	put16(out, EHDR_SIZE);
+	put16(out, PHDR_SIZE);
+	put16(out, phnum);
+	put16(out, 0);			// e_shentsize
+	put16(out, 0);			// e_shnum
+	put16(out, 0);			// e_shstrndx
+
+	// PT_NOTE, PT_LOAD の順. メモリの内容は note の後ろに region の順で並べる
+	put32(out, PT_NOTE);
+	put32(out, noteOffset);
+	put32(out, 0);
+	put32(out, 0);
+	put32(out, noteSize);
+	put32(out, 0);
+	put32(out, 0);
+	put32(out, 4);
+
+	uint32_t offset = noteOffset + noteSize;
+	for (auto& region : regions)
+	{
+		put32(out, PT_LOAD);
+		put32(out, offset);
+		put32(out, (uint32_t)region.addr);	// p_vaddr
+		put32(out, (uint32_t)region.addr);	// p_paddr
+		put32(out, region.size);			// p_filesz
+		put32(out, region.size);			// p_memsz
+		put32(out, PF_R | PF_W);
+		put32(out, 1);
+		offset += region.size;
+	}
+
+	// コアごとの NT_PRSTATUS. pid をスレッド ID (1 から) にする
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		put32(out, 5);	// namesz
+		put32(out, PRSTATUS_SIZE);
+		put32(out, NT_PRSTATUS);
+		const char name[NOTE_NAME_SIZE] = "CORE";
+		out.insert(out.end(), name, name + NOTE_NAME_SIZE);
+
+		std::vector<uint8_t> prstatus(PRSTATUS_SIZE, 0);
+		prstatus[12] = SIGTRAP;						// pr_cursig
+		prstatus[24] = (uint8_t)(i + 1);			// pr_pid
+		for (uint32_t r = 0; r < PRSTATUS_REG_COUNT; r++)
+		{
+			uint32_t value = r < threads[i].size() ? threads[i][r] : 0;
+			for (uint32_t b = 0; b < 4; b++)
+				prstatus[PRSTATUS_REG_OFFSET + r * 4 + b] = (uint8_t)(value >> (b * 8));
+		}
+		out.insert(out.end(), prstatus.begin(), prstatus.end());
+	}
+	return out;
+}
+
+errno_t CoreDump::save(const std::string& path, const std::vector<Region>& regions, Result* result)
+{
+	ASSERT_RELEASE(result != nullptr);
+
+	if (regions.size() == 0)
+		return EINVAL;
+	for (auto& region : regions)
+	{
+		// readMemory は先頭がワード境界の場合にだけブロック転送で正しく読める
+		if (region.size == 0 || (region.addr & 3) != 0 || region.addr + region.size > 0x100000000ULL)
+			return EINVAL;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	*result = {};
+
+	FileWriter writer(MAX_QUEUED);
+	errno_t ret = writer.open(path);
+	if (ret != OK)
+		return ret;
+
+	// 止めてから読み終わるまで, 他の要求 (gdb の continue など) を挟まない
+	auto capture = [&]() -> errno_t
+	{
+		std::vector<std::vector<uint32_t>> threads;
+		ret = readRegisters(&threads);
+		if (ret != OK)
+			return ret;
+		result->threads = (uint32_t)threads.size();
+
+		if (!writer.push(makeHeader(regions, threads)))
+			return EIO;
+
+		for (auto& region : regions)
+		{
+			for (uint32_t offset = 0; offset < region.size; offset += CHUNK_SIZE)
+			{
+				uint32_t len = region.size - offset < CHUNK_SIZE ? region.size - offset : CHUNK_SIZE;
+				uint64_t addr = region.addr + offset;
+
+				// 読めない範囲があっても残りは保存する
+				std::vector<uint8_t> data;
+				data.reserve(len);
+				ret = ti.readMemory(addr, len, &data);
+				if (ret != OK || data.size() != len)
+				{
+					_ERRPRT("Failed to read 0x%08x - 0x%08x. (0x%08x)\n", (uint32_t)addr, (uint32_t)(addr + len), ret);
+					data.assign(len, 0);
+					result->failed += len;
+				}
+				result->bytes += len;
+
+				if (!writer.push(std::move(data)))
+					return EIO;
+			}
+			result->regions++;
+		}
+		return (errno_t)OK;
+	};
+
+	auto captureAndResume = [&]() -> errno_t
+	{
+		std::vector<bool> running;
+		errno_t ret = getRunning(&running);
+		if (ret != OK)
+			return ret;
+
+		ret = ti.attach();
+		if (ret == OK)
+			ret = capture();
+
+		// 失敗した場合も, 止めたコアは元に戻す
+		errno_t r = resume(running);
+		return ret != OK ? ret : r;
+	};
+
+	ret = executor ? executor->execute(Executor::PRIORITY_RUN_CONTROL, captureAndResume) : captureAndResume();
+	errno_t closed = writer.close();
+	if (ret == OK)
+		ret = closed;
+	if (ret != OK)
+		std::remove(path.c_str());
+
+	result->elapsedUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	return ret;
+}
@@ -0,0 +1,64 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+#include "ADIv5TI.h"
+#include "Executor.h"
+
+// 全コアを止めてレジスタと RAM を ELF core file (ET_CORE, EM_ARM) に保存する
+// コアごとに NT_PRSTATUS を置くので gdb <elf> <core> でオフラインに開ける
+// ファイルへの書き込みは別スレッドで行い, USB からの読み出しがディスクを待たないようにする
+// 保存前に動いていたコアは保存後に再開する
+class CoreDump
+{
+public:
+	struct Region
+	{
+		uint64_t addr;
+		uint32_t size;
+	};
+
+	struct Result
+	{
+		uint32_t threads;
+		uint32_t regions;
+		uint64_t bytes;
+		uint64_t failed;	// 読めずに 0 で埋めたバイト数
+		uint64_t elapsedUs;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(threads), CEREAL_NVP(regions), CEREAL_NVP(bytes), CEREAL_NVP(failed), CEREAL_NVP(elapsedUs));
+		}
+	};
+
+	// executor が無い場合 (executor のスレッドから呼ぶ場合) はその場で読む
+	CoreDump(ADIv5TI& _ti, std::shared_ptr<Executor> _executor = nullptr);
+
+	errno_t save(const std::string& path, const std::vector<Region>& regions, Result* result);
+
+	// "<start>:<size>,<start>:<size>,..."
+	static bool parseRegions(const std::string& str, std::vector<Region>* regions);
+
+private:
+	// 1 回の readMemory で読む大きさ. 読めた分から順に書き込みスレッドに渡す
+	static const uint32_t CHUNK_SIZE = 0x10000;
+	// 書き込みスレッドに溜めておく chunk の上限 (ディスクが遅い場合のメモリ使用量を抑える)
+	static const uint32_t MAX_QUEUED = 64;
+
+	static const uint32_t PRSTATUS_SIZE = 148;	// struct elf_prstatus (ARM)
+	static const uint32_t PRSTATUS_REG_OFFSET = 72;
+	static const uint32_t PRSTATUS_REG_COUNT = 18;	// r0-r15, cpsr, orig_r0
+
+	ADIv5TI& ti;
+	std::shared_ptr<Executor> executor;
+
+	errno_t getRunning(std::vector<bool>* running);
+	errno_t resume(const std::vector<bool>& running);
+	errno_t readRegisters(std::vector<std::vector<uint32_t>>* threads);
+	std::vector<uint8_t> makeHeader(const std::vector<Region>& regions, const std::vector<std::vector<uint32_t>>& threads);
+};
@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "CounterMonitor.h"
+
+CounterMonitor::CounterMonitor(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), intervalUs(1000), initial(), totals(), recordingListenerId(0)
+{
+	dwt = std::dynamic_pointer_cast<ARMv7MDWT>(ti->getARMv6MDWT());
+}
+
+CounterMonitor::~CounterMonitor()
+{
+	stop();
+	stopRecording();
+}
+
+errno_t CounterMonitor::enable(ARMv7MDWT::Counters* initial)
+{
+	// DWT を使うには DEMCR.TRCENA が必要
+	auto scs = ti->getARMv6MSCS();
+	if (scs)
+	{
+		ARMv6MSCS::DEMCR demcr;
+		errno_t ret = scs->readDEMCR(&demcr);
+		if (ret != OK)
+			return ret;
+
+		if (!demcr.DWTENA)
+		{
+			demcr.DWTENA = 1;
+			ret = scs->writeDEMCR(demcr);
+			if (ret != OK)
+				return ret;
+		}
+	}
+
+	errno_t ret = dwt->enableCounters();
+	if (ret != OK)
+		return ret;
+
+	return dwt->readCounters(initial);
+}
+
+errno_t CounterMonitor::start(uint32_t _intervalUs)
+{
+	if (!dwt)
+		return ENODEV;
+
+	return startThread([this, _intervalUs]()
+	{
+		intervalUs = _intervalUs < MIN_INTERVAL_US ? MIN_INTERVAL_US : _intervalUs;
+		return executor->execute(Executor::PRIORITY_BACKGROUND, [this]() { return enable(&initial); });
+	}, [this]() { run(initial); });
+}
+
+CounterMonitor::Totals CounterMonitor::getTotals()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return totals;
+}
+
+uint32_t CounterMonitor::subscribe(Listener listener)
+{
+	return listeners.add(listener);
+}
+
+void CounterMonitor::unsubscribe(uint32_t id)
+{
+	listeners.remove(id);
+}
+
+errno_t CounterMonitor::startRecording(const std::string& path)
+{
+	stopRecording();
+
+	auto file = std::make_shared<std::ofstream>(path);
+	if (!file->is_open())
+		return ENOENT;
+
+	*file << "timeUs,cyc,cpi,exc,sleep,lsu,fold,valid\n";
+
+	uint32_t id = subscribe([file](const Sample& s)
+	{
+		*file << s.timeUs << "," << s.cyc << "," << s.cpi << "," << s.exc << ","
+			<< s.sleep << "," << s.lsu << "," << s.fold << "," << (s.valid ? 1 : 0) << "\n";
+	});
+
+	std::lock_guard<std::mutex> lock(mutex);
+	recording = file;
+	recordingListenerId = id;
+	return OK;
+}
+
+void CounterMonitor::stopRecording()
+{
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (recording == nullptr)
+			return;
+		id = recordingListenerId;
+		recording = nullptr;
+	}
+	// ファイルは listener が持っている参照が消えた時点で閉じられる
+	unsubscribe(id);
+}
+
+void CounterMonitor::run(ARMv7MDWT::Counters prev)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	auto next = startTime;
+
+	while (running.load())
+	{
+		next += std::chrono::microseconds(intervalUs);
+		std::this_thread::sleep_until(next);
+
+		ARMv7MDWT::Counters cur;
+		errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]() { return dwt->readCounters(&cur); });
+		if (ret != OK)
+		{
+			_ERRPRT("Failed to read DWT counters. (0x%08x)\n", ret);
+			running = false;
+			break;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		Sample sample;
+		sample.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(now - startTime).count();
+		sample.cyc = cur.cyc - prev.cyc;
+		sample.cpi = (cur.cpi - prev.cpi) & 0xFF;
+		sample.exc = (cur.exc - prev.exc) & 0xFF;
+		sample.sleep = (cur.sleep - prev.sleep) & 0xFF;
+		sample.lsu = (cur.lsu - prev.lsu) & 0xFF;
+		sample.fold = (cur.fold - prev.fold) & 0xFF;
+		sample.valid = sample.cyc < COUNTER_RANGE;
+		prev = cur;
+
+		// 転送が間に合わなかった周期は読み飛ばす
+		if (now > next)
+			next = now;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		totals.samples++;
+		totals.cyc += sample.cyc;
+		if (sample.valid)
+		{
+			totals.cpi += sample.cpi;
+			totals.exc += sample.exc;
+			totals.sleep += sample.sleep;
+			totals.lsu += sample.lsu;
+			totals.fold += sample.fold;
+		}
+		else
+		{
+			// 何回 wrap したか分からない値は合計に入れない
+			totals.invalid++;
+		}
+
+		listeners.notify(sample);
+	}
+}
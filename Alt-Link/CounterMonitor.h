@@ -0,0 +1,98 @@
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <string>
+#include "ADIv5TI.h"
+#include "Executor.h"
+#include "PollingService.h"
+
+// ARMv7-M DWT のパフォーマンスカウンタを一定間隔で読み, 差分を購読者に配信する
+// CYCCNT は 32bit なので差分は常に正しい
+// CPI/EXC/SLEEP/LSU/FOLD は 8bit で 1 サイクルに高々 1 しか増えないため, CYCCNT の差分が 256 未満の周期しか差分が確定しない
+// SWD でのポーリングは 1 回に数十 us かかるので, 数 MHz を超えるコアではほぼすべての周期で 8bit カウンタの wrap 回数が分からない
+// そうした周期は valid = false として配信し, 8bit カウンタの合計には含めない. interval を短くしても解決しない
+class CounterMonitor : public PollingService
+{
+public:
+	struct Sample
+	{
+		uint64_t timeUs;	// start() からの経過時間
+		uint32_t cyc;		// 以下は前回のサンプルからの差分
+		uint32_t cpi;
+		uint32_t exc;
+		uint32_t sleep;
+		uint32_t lsu;
+		uint32_t fold;
+		bool valid;			// false なら cpi 以下は wrap 回数が分からず不正確 (cyc は正しい)
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(timeUs), CEREAL_NVP(cyc), CEREAL_NVP(cpi), CEREAL_NVP(exc),
+				CEREAL_NVP(sleep), CEREAL_NVP(lsu), CEREAL_NVP(fold), CEREAL_NVP(valid));
+		}
+	};
+
+	struct Totals
+	{
+		uint64_t samples;
+		uint64_t invalid;	// 8bit カウンタを合計から除いたサンプル
+		uint64_t cyc;		// すべてのサンプルの合計
+		// 以下は valid なサンプルだけの合計
+		uint64_t cpi;
+		uint64_t exc;
+		uint64_t sleep;
+		uint64_t lsu;
+		uint64_t fold;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(samples), CEREAL_NVP(invalid), CEREAL_NVP(cyc), CEREAL_NVP(cpi), CEREAL_NVP(exc),
+				CEREAL_NVP(sleep), CEREAL_NVP(lsu), CEREAL_NVP(fold));
+		}
+	};
+
+	typedef std::function<void(const Sample&)> Listener;
+
+	static const uint32_t MIN_INTERVAL_US = 100;
+	static const uint32_t COUNTER_RANGE = 0x100;	// 8bit カウンタ
+
+	CounterMonitor(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~CounterMonitor();
+
+	errno_t start(uint32_t intervalUs);
+
+	Totals getTotals();
+	std::shared_ptr<ADIv5TI> getTI() const { return ti; }
+
+	uint32_t subscribe(Listener listener);
+	void unsubscribe(uint32_t id);
+
+	// CSV でファイルに記録する
+	errno_t startRecording(const std::string& path);
+	void stopRecording();
+
+private:
+	std::shared_ptr<ADIv5TI> ti;
+	std::shared_ptr<Executor> executor;
+	std::shared_ptr<ARMv7MDWT> dwt;
+	uint32_t intervalUs;
+	ARMv7MDWT::Counters initial;	// start() で読んだ値. run() の最初の差分の基準
+	ListenerMap<Listener> listeners;
+
+	std::mutex mutex;	// totals, recording
+	Totals totals;
+	std::shared_ptr<std::ofstream> recording;
+	uint32_t recordingListenerId;
+
+	errno_t enable(ARMv7MDWT::Counters* initial);
+	void run(ARMv7MDWT::Counters prev);
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 class DAP
 {
 public:
@@ -7,6 +9,19 @@ public:
 	virtual int32_t dpWrite(uint32_t reg, uint32_t val)		= 0;
 	virtual int32_t apRead(uint32_t reg, uint32_t *data)	= 0;
 	virtual int32_t apWrite(uint32_t reg, uint32_t val)		= 0;
+	virtual int32_t apReadBlock(uint32_t reg, uint32_t count, uint32_t *data)			= 0;
+	virtual int32_t apWriteBlock(uint32_t reg, uint32_t count, const uint32_t *data)	= 0;
+
+	// DP/AP アクセスを混在させてまとめて転送する
+	struct Transfer
+	{
+		bool ap;
+		bool read;
+		uint32_t reg;
+		uint32_t value;		// write data
+		uint32_t *data;		// read data (nullptr: discard)
+	};
+	virtual int32_t transfer(const std::vector<Transfer>& transfers)	= 0;
 
 	enum ConnectionType
 	{
@@ -0,0 +1,86 @@
+#include "stdafx.h"
+#include "Executor.h"
+#include "Trace.h"
+
+Executor::Executor() : pending(0), sleeping(false), quit(false)
+{
+}
+
+Executor::~Executor()
+{
+	stop();
+}
+
+void Executor::stop()
+{
+	if (!thread.joinable())
+		return;
+
+	quit = true;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+	}
+	cond.notify_one();
+	thread.join();
+
+	// 実行されなかった要求は破棄する (future 側には broken_promise が返る)
+	Node* node;
+	while ((node = pop()) != nullptr)
+		delete node;
+}
+
+void Executor::push(Priority priority, std::function<void()> func)
+{
+	std::call_once(started, [this]() { thread = std::thread(&Executor::run, this); });
+
+	Node* node = new Node;
+	node->func = std::move(func);
+	queues[priority].push(node);
+
+	pending.fetch_add(1);
+	if (sleeping.load())
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cond.notify_one();
+	}
+}
+
+Executor::Node* Executor::pop()
+{
+	for (auto& queue : queues)
+	{
+		Node* node = queue.pop();
+		if (node != nullptr)
+			return node;
+	}
+	return nullptr;
+}
+
+void Executor::run()
+{
+	Trace::setThreadName("executor");
+
+	while (!quit)
+	{
+		Node* node = pop();
+		if (node != nullptr)
+		{
+			pending.fetch_sub(1);
+			node->func();
+			delete node;
+			continue;
+		}
+
+		if (pending.load() > 0)
+		{
+			// push の途中なので少し待つ
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		sleeping = true;
+		cond.wait(lock, [this]() { return pending.load() > 0 || quit.load(); });
+		sleeping = false;
+	}
+}
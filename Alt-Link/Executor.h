@@ -0,0 +1,71 @@
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "MPSCQueue.h"
+
+// プローブを占有する 1 本のスレッドで、複数のクライアントからの要求を優先度順に実行する
+class Executor
+{
+public:
+	enum Priority
+	{
+		PRIORITY_INTERRUPT		= 0,
+		PRIORITY_RUN_CONTROL	= 1,
+		PRIORITY_MEMORY			= 2,
+		PRIORITY_BACKGROUND		= 3,
+		PRIORITY_NUM
+	};
+
+	Executor();
+	virtual ~Executor();
+
+	void stop();
+	bool isExecutorThread() const { return std::this_thread::get_id() == thread.get_id(); }
+
+	template <typename F>
+	auto submit(Priority priority, F func) -> std::future<decltype(func())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(func())()>>(func);
+		auto future = task->get_future();
+		push(priority, [task]() { (*task)(); });
+		return future;
+	}
+
+	// 完了まで待つ。executor のスレッドから呼ばれた場合はその場で実行する
+	template <typename F>
+	auto execute(Priority priority, F func) -> decltype(func())
+	{
+		if (isExecutorThread())
+			return func();
+		return submit(priority, func).get();
+	}
+
+private:
+	struct Node
+	{
+		std::atomic<Node*> next;
+		std::function<void()> func;
+	};
+
+	std::array<MPSCQueue<Node>, PRIORITY_NUM> queues;
+	std::thread thread;
+	std::once_flag started;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::atomic<uint32_t> pending;
+	std::atomic<bool> sleeping;
+	std::atomic<bool> quit;
+
+	void push(Priority priority, std::function<void()> func);
+	Node* pop();
+	void run();
+};
@@ -0,0 +1,540 @@
+#include "stdafx.h"
+#include "ImageLoader.h"
+#include "Converter.h"
+#include "CRC32.h"
+
+#include <chrono>
+#include <cstring>
+#include <future>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+ImageLoader::ImageLoader(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), image(nullptr), imageSize(0),
+#if defined(_WIN32)
+	file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#else
+	fd(-1)
+#endif
+{
+}
+
+ImageLoader::~ImageLoader()
+{
+	close();
+}
+
+bool ImageLoader::parseFormat(const std::string& name, Format* format)
+{
+	ASSERT_RELEASE(format != nullptr);
+
+	if (name == "auto")
+		*format = FORMAT_AUTO;
+	else if (name == "elf")
+		*format = FORMAT_ELF;
+	else if (name == "hex")
+		*format = FORMAT_HEX;
+	else if (name == "bin")
+		*format = FORMAT_BIN;
+	else
+		return false;
+	return true;
+}
+
+bool ImageLoader::parseVerify(const std::string& name, Verify* verify)
+{
+	ASSERT_RELEASE(verify != nullptr);
+
+	if (name == "none")
+		*verify = VERIFY_NONE;
+	else if (name == "read")
+		*verify = VERIFY_READ;
+	else if (name == "crc")
+		*verify = VERIFY_CRC;
+	else
+		return false;
+	return true;
+}
+
+errno_t ImageLoader::map(const std::string& path)
+{
+#if defined(_WIN32)
+	HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return ENOENT;
+	file = f;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(f, &size) || size.QuadPart == 0)
+		return EINVAL;
+
+	HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m == nullptr)
+		return EIO;
+	mapping = m;
+
+	image = (const uint8_t*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	if (image == nullptr)
+		return EIO;
+	imageSize = (size_t)size.QuadPart;
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return ENOENT;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+		return EINVAL;
+
+	void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		return EIO;
+	image = (const uint8_t*)p;
+	imageSize = (size_t)st.st_size;
+#endif
+	return OK;
+}
+
+void ImageLoader::unmap()
+{
+#if defined(_WIN32)
+	if (image != nullptr)
+		UnmapViewOfFile(image);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (image != nullptr)
+		munmap((void*)image, imageSize);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	image = nullptr;
+	imageSize = 0;
+}
+
+errno_t ImageLoader::open(const std::string& path, Format format, uint64_t baseAddress)
+{
+	close();
+
+	errno_t ret = map(path);
+	if (ret != OK)
+	{
+		close();
+		return ret;
+	}
+
+	if (format == FORMAT_AUTO)
+	{
+		if (imageSize >= 4 && memcmp(image, "\x7F" "ELF", 4) == 0)
+			format = FORMAT_ELF;
+		else if (image[0] == ':' && path.size() >= 4 &&
+			(path.compare(path.size() - 4, 4, ".hex") == 0 || path.compare(path.size() - 4, 4, ".ihx") == 0))
+			format = FORMAT_HEX;
+		else
+			format = FORMAT_BIN;
+	}
+
+	switch (format)
+	{
+	case FORMAT_ELF:
+		ret = parseELF();
+		break;
+	case FORMAT_HEX:
+		ret = parseHEX();
+		break;
+	default:
+		if (imageSize > 0xFFFFFFFF)
+		{
+			ret = EINVAL;
+			break;
+		}
+		segments.push_back({ baseAddress, image, (uint32_t)imageSize });
+		ret = OK;
+		break;
+	}
+
+	if (ret != OK)
+		close();
+	return ret;
+}
+
+void ImageLoader::close()
+{
+	segments.clear();
+	decoded.clear();
+	unmap();
+}
+
+errno_t ImageLoader::parseELF()
+{
+	// ELF32 little endian のみ
+	static const uint32_t EHDR_SIZE = 52;
+	static const uint32_t PT_LOAD = 1;
+
+	if (imageSize < EHDR_SIZE || image[4] != 1 /* ELFCLASS32 */ || image[5] != 1 /* ELFDATA2LSB */)
+		return EINVAL;
+
+	auto u16 = [&](size_t offset) { return (uint32_t)(image[offset] | (image[offset + 1] << 8)); };
+	auto u32 = [&](size_t offset) { return (uint32_t)image[offset] | ((uint32_t)image[offset + 1] << 8) |
+		((uint32_t)image[offset + 2] << 16) | ((uint32_t)image[offset + 3] << 24); };
+
+	uint32_t phoff = u32(28);
+	uint32_t phentsize = u16(42);
+	uint32_t phnum = u16(44);
+	if (phentsize < 32 || (uint64_t)phoff + (uint64_t)phentsize * phnum > imageSize)
+		return EINVAL;
+
+	for (uint32_t i = 0; i < phnum; i++)
+	{
+		size_t ph = phoff + i * phentsize;
+		uint32_t type = u32(ph);
+		uint32_t offset = u32(ph + 4);
+		uint32_t paddr = u32(ph + 12);
+		uint32_t filesz = u32(ph + 16);
+
+		// .bss など, ファイルに中身の無い部分は書かない
+		if (type != PT_LOAD || filesz == 0)
+			continue;
+		if ((uint64_t)offset + filesz > imageSize)
+			return EINVAL;
+
+		// 書き込み先はロードアドレス (LMA)
+		segments.push_back({ paddr, image + offset, filesz });
+	}
+
+	return segments.size() > 0 ? OK : ENOENT;
+}
+
+errno_t ImageLoader::parseHEX()
+{
+	std::vector<std::pair<uint64_t, std::vector<uint8_t>>> blocks;
+	uint64_t base = 0;
+	uint8_t record[256 + 5];
+
+	size_t pos = 0;
+	while (pos < imageSize)
+	{
+		// 行頭の ':' を探す (改行コードは問わない)
+		if (image[pos] != ':')
+		{
+			pos++;
+			continue;
+		}
+		pos++;
+
+		if (pos + 2 > imageSize || !Converter::decodeHex((const char*)image + pos, 1, record))
+			return EINVAL;
+		uint32_t len = record[0];
+		if (pos + (len + 5) * 2 > imageSize || !Converter::decodeHex((const char*)image + pos, len + 5, record))
+			return EINVAL;
+		pos += (len + 5) * 2;
+
+		uint8_t sum = 0;
+		for (uint32_t i = 0; i < len + 5; i++)
+			sum += record[i];
+		if (sum != 0)
+			return EINVAL;
+
+		uint32_t offset = (record[1] << 8) | record[2];
+		uint8_t type = record[3];
+		const uint8_t* data = &record[4];
+
+		if (type == 0x00)	// data
+		{
+			uint64_t addr = base + offset;
+			if (blocks.empty() || blocks.back().first + blocks.back().second.size() != addr)
+				blocks.push_back({ addr, std::vector<uint8_t>() });
+			blocks.back().second.insert(blocks.back().second.end(), data, data + len);
+		}
+		else if (type == 0x01)	// end of file
+		{
+			break;
+		}
+		else if (type == 0x02 && len == 2)	// extended segment address
+		{
+			base = (uint64_t)((data[0] << 8) | data[1]) << 4;
+		}
+		else if (type == 0x04 && len == 2)	// extended linear address
+		{
+			base = (uint64_t)((data[0] << 8) | data[1]) << 16;
+		}
+		// 0x03, 0x05 (開始アドレス) は使わない
+	}
+
+	for (auto& block : blocks)
+	{
+		decoded.push_back(std::move(block.second));
+		auto& data = decoded.back();
+		segments.push_back({ block.first, data.data(), (uint32_t)data.size() });
+	}
+
+	return segments.size() > 0 ? OK : ENOENT;
+}
+
+errno_t ImageLoader::write(const Segment& segment)
+{
+	auto _ti = ti;
+	auto writeChunk = [_ti](uint64_t addr, const uint8_t* data, uint32_t len)
+	{
+		return _ti->writeMemory(addr, len, std::vector<uint8_t>(data, data + len));
+	};
+
+	// 前のチャンクの完了を待つ前に次のチャンクを積み, executor が空かないようにする
+	std::future<errno_t> pending;
+	for (uint32_t offset = 0; offset < segment.size;)
+	{
+		uint32_t len = segment.size - offset < CHUNK_SIZE ? segment.size - offset : CHUNK_SIZE;
+		uint64_t addr = segment.addr + offset;
+		const uint8_t* data = segment.data + offset;
+		auto next = executor->submit(Executor::PRIORITY_MEMORY, [=]() { return writeChunk(addr, data, len); });
+
+		if (pending.valid())
+		{
+			errno_t ret = pending.get();
+			if (ret != OK)
+			{
+				next.wait();
+				return ret;
+			}
+		}
+		pending = std::move(next);
+		offset += len;
+	}
+
+	return pending.valid() ? pending.get() : OK;
+}
+
+errno_t ImageLoader::verifyRead(const Segment& segment, bool* match)
+{
+	auto _ti = ti;
+	auto read = [&](uint64_t addr, uint32_t len)
+	{
+		return executor->submit(Executor::PRIORITY_MEMORY, [_ti, addr, len]()
+		{
+			std::vector<uint8_t> data;
+			errno_t ret = _ti->readMemory(addr, len, &data);
+			return std::make_pair(ret, data);
+		});
+	};
+
+	*match = true;
+
+	uint32_t len = segment.size < CHUNK_SIZE ? segment.size : CHUNK_SIZE;
+	auto pending = read(segment.addr, len);
+	for (uint32_t offset = 0; offset < segment.size;)
+	{
+		auto result = pending.get();
+
+		// 比較している間に次のチャンクを読む
+		uint32_t nextOffset = offset + len;
+		uint32_t nextLen = segment.size - nextOffset < CHUNK_SIZE ? segment.size - nextOffset : CHUNK_SIZE;
+		if (nextLen > 0)
+			pending = read(segment.addr + nextOffset, nextLen);
+
+		if (result.first != OK || result.second.size() < len || memcmp(result.second.data(), segment.data + offset, len) != 0)
+		{
+			if (nextLen > 0)
+				pending.wait();
+			if (result.first != OK)
+				return result.first;
+
+			_ERRPRT("Verify failed at 0x%08x.\n", (uint32_t)(segment.addr + offset));
+			*match = false;
+			return OK;
+		}
+
+		offset = nextOffset;
+		len = nextLen;
+	}
+	return OK;
+}
+
+errno_t ImageLoader::verifyCRC(const Segment& segment, bool* match)
+{
+	uint32_t crc;
+	errno_t ret = executor->execute(Executor::PRIORITY_MEMORY, [&]() { return ti->calcCRC32(segment.addr, segment.size, &crc); });
+	if (ret != OK)
+		return ret;
+
+	*match = crc == CRC32::calc(segment.data, segment.size);
+	if (!*match)
+		_ERRPRT("Verify failed at 0x%08x - 0x%08x.\n", (uint32_t)segment.addr, (uint32_t)(segment.addr + segment.size));
+	return OK;
+}
+
+errno_t ImageLoader::diffCRC(const Segment& segment, std::vector<bool>* changed)
+{
+	// ターゲット上でページごとの CRC を計算し, 結果だけを読む
+	std::vector<uint32_t> crcs;
+	errno_t ret = executor->execute(Executor::PRIORITY_MEMORY, [&]() { return ti->calcPageCRC32(segment.addr, segment.size, PAGE_SIZE, &crcs); });
+	if (ret != OK)
+		return ret;
+
+	if (crcs.size() != changed->size())
+		return EFAULT;
+
+	for (size_t i = 0; i < crcs.size(); i++)
+	{
+		uint32_t offset = (uint32_t)i * PAGE_SIZE;
+		uint32_t len = segment.size - offset < PAGE_SIZE ? segment.size - offset : PAGE_SIZE;
+		(*changed)[i] = crcs[i] != CRC32::calc(segment.data + offset, len);
+	}
+	return OK;
+}
+
+errno_t ImageLoader::diffRead(const Segment& segment, std::vector<bool>* changed)
+{
+	auto _ti = ti;
+	auto read = [&](uint64_t addr, uint32_t len)
+	{
+		return executor->submit(Executor::PRIORITY_MEMORY, [_ti, addr, len]()
+		{
+			std::vector<uint8_t> data;
+			errno_t ret = _ti->readMemory(addr, len, &data);
+			return std::make_pair(ret, data);
+		});
+	};
+
+	uint32_t len = segment.size < CHUNK_SIZE ? segment.size : CHUNK_SIZE;
+	auto pending = read(segment.addr, len);
+	for (uint32_t offset = 0; offset < segment.size;)
+	{
+		auto result = pending.get();
+
+		// 比較している間に次のチャンクを読む
+		uint32_t nextOffset = offset + len;
+		uint32_t nextLen = segment.size - nextOffset < CHUNK_SIZE ? segment.size - nextOffset : CHUNK_SIZE;
+		if (nextLen > 0)
+			pending = read(segment.addr + nextOffset, nextLen);
+
+		if (result.first != OK || result.second.size() < len)
+		{
+			if (nextLen > 0)
+				pending.wait();
+			return result.first != OK ? result.first : EIO;
+		}
+
+		for (uint32_t page = 0; page < len; page += PAGE_SIZE)
+		{
+			uint32_t n = len - page < PAGE_SIZE ? len - page : PAGE_SIZE;
+			(*changed)[(offset + page) / PAGE_SIZE] = memcmp(result.second.data() + page, segment.data + offset + page, n) != 0;
+		}
+
+		offset = nextOffset;
+		len = nextLen;
+	}
+	return OK;
+}
+
+errno_t ImageLoader::diff(const Segment& segment, std::vector<Range>* dirty)
+{
+	std::vector<bool> changed((segment.size + PAGE_SIZE - 1) / PAGE_SIZE, true);
+
+	// workarea が無い, コアが動いているなどで stub を使えない場合は読み出して比較する
+	errno_t ret = diffCRC(segment, &changed);
+	if (ret != OK)
+	{
+		_DBGPRT("page CRC is not available (0x%08x). compare by reading.\n", ret);
+		ret = diffRead(segment, &changed);
+		if (ret != OK)
+			return ret;
+	}
+
+	// 連続する変化したページはまとめて書く
+	dirty->clear();
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		if (!changed[i])
+			continue;
+
+		uint32_t offset = (uint32_t)i * PAGE_SIZE;
+		uint32_t len = segment.size - offset < PAGE_SIZE ? segment.size - offset : PAGE_SIZE;
+		if (dirty->size() > 0 && dirty->back().offset + dirty->back().size == offset)
+			dirty->back().size += len;
+		else
+			dirty->push_back({ offset, len });
+	}
+	return OK;
+}
+
+errno_t ImageLoader::load(Verify verify, Result* result, bool sync)
+{
+	ASSERT_RELEASE(result != nullptr);
+
+	if (segments.size() == 0)
+		return ENOENT;
+
+	auto start = std::chrono::steady_clock::now();
+
+	result->segments = (uint32_t)segments.size();
+	result->bytes = 0;
+	result->written = 0;
+	result->verified = false;
+
+	// 書き込む範囲. stub が workarea を上書きするので, 比較は書き込みより先に全て済ませる
+	std::vector<Segment> writes;
+	for (auto& segment : segments)
+	{
+		result->bytes += segment.size;
+		if (!sync)
+		{
+			writes.push_back(segment);
+			continue;
+		}
+
+		std::vector<Range> dirty;
+		errno_t ret = diff(segment, &dirty);
+		if (ret != OK)
+		{
+			_ERRPRT("Failed to compare 0x%08x. (0x%08x)\n", (uint32_t)segment.addr, ret);
+			return ret;
+		}
+		for (auto& range : dirty)
+			writes.push_back({ segment.addr + range.offset, segment.data + range.offset, range.size });
+	}
+
+	for (auto& segment : writes)
+	{
+		_DBGPRT("load 0x%08x - 0x%08x\n", (uint32_t)segment.addr, (uint32_t)(segment.addr + segment.size));
+
+		errno_t ret = write(segment);
+		if (ret != OK)
+		{
+			_ERRPRT("Failed to write 0x%08x. (0x%08x)\n", (uint32_t)segment.addr, ret);
+			return ret;
+		}
+		result->written += segment.size;
+	}
+
+	if (verify != VERIFY_NONE)
+	{
+		for (auto& segment : segments)
+		{
+			bool match;
+			errno_t ret = verify == VERIFY_READ ? verifyRead(segment, &match) : verifyCRC(segment, &match);
+			if (ret != OK)
+				return ret;
+			if (!match)
+				return EIO;
+		}
+		result->verified = true;
+	}
+
+	result->elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	_DBGPRT("loaded %llu bytes (%llu bytes written) in %llu us (%.1f KB/s)\n", (unsigned long long)result->bytes,
+		(unsigned long long)result->written, (unsigned long long)result->elapsedUs,
+		result->elapsedUs > 0 ? result->bytes * 1000000.0 / 1024.0 / result->elapsedUs : 0.0);
+	return OK;
+}
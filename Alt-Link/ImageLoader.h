@@ -0,0 +1,104 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+#include "ADIv5TI.h"
+#include "Executor.h"
+
+// ELF (PT_LOAD), Intel HEX, バイナリのイメージをターゲットのメモリに書き込む
+// ファイルは mmap して, チャンク単位で executor に積みながらブロック転送で書く
+class ImageLoader
+{
+public:
+	enum Format
+	{
+		FORMAT_AUTO,
+		FORMAT_ELF,
+		FORMAT_HEX,
+		FORMAT_BIN
+	};
+
+	enum Verify
+	{
+		VERIFY_NONE,
+		VERIFY_READ,	// 読み戻して比較する
+		VERIFY_CRC		// CRC32 を比較する (workarea があればターゲット上で計算する)
+	};
+
+	struct Segment
+	{
+		uint64_t addr;
+		const uint8_t* data;
+		uint32_t size;
+	};
+
+	struct Result
+	{
+		uint32_t segments;
+		uint64_t bytes;
+		uint64_t written;	// 実際に書き込んだバイト数 (sync の場合は変化したページだけ)
+		uint64_t elapsedUs;
+		bool verified;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(segments), CEREAL_NVP(bytes), CEREAL_NVP(written), CEREAL_NVP(elapsedUs), CEREAL_NVP(verified));
+		}
+	};
+
+	ImageLoader(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~ImageLoader();
+
+	// FORMAT_BIN の場合は baseAddress に置く
+	errno_t open(const std::string& path, Format format = FORMAT_AUTO, uint64_t baseAddress = 0);
+	void close();
+	const std::vector<Segment>& getSegments() const { return segments; }
+
+	// sync: ページごとにターゲットの内容と比較し, 異なるページだけを書き込む
+	errno_t load(Verify verify, Result* result, bool sync = false);
+
+	static bool parseFormat(const std::string& name, Format* format);
+	static bool parseVerify(const std::string& name, Verify* verify);
+
+private:
+	// 1 回に executor に積む転送の大きさ. 間に RSP の要求が割り込める
+	static const uint32_t CHUNK_SIZE = 0x4000;
+	// sync で比較する単位 (CHUNK_SIZE の約数)
+	static const uint32_t PAGE_SIZE = 0x400;
+
+	struct Range
+	{
+		uint32_t offset;	// segment の先頭から
+		uint32_t size;
+	};
+
+	std::shared_ptr<ADIv5TI> ti;
+	std::shared_ptr<Executor> executor;
+
+	const uint8_t* image;
+	size_t imageSize;
+#if defined(_WIN32)
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+
+	std::vector<std::vector<uint8_t>> decoded;	// HEX をデコードしたデータ
+	std::vector<Segment> segments;
+
+	errno_t map(const std::string& path);
+	void unmap();
+	errno_t parseELF();
+	errno_t parseHEX();
+	errno_t write(const Segment& segment);
+	errno_t verifyRead(const Segment& segment, bool* match);
+	errno_t verifyCRC(const Segment& segment, bool* match);
+	errno_t diff(const Segment& segment, std::vector<Range>* dirty);
+	errno_t diffCRC(const Segment& segment, std::vector<bool>* changed);
+	errno_t diffRead(const Segment& segment, std::vector<bool>* changed);
+};
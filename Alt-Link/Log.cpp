@@ -0,0 +1,263 @@
+#include "stdafx.h"
+#include "Log.h"
+#include "MPSCQueue.h"
+
+#include <cstdarg>
+#include <cstdlib>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+std::atomic<uint8_t> Log::levels[SUBSYSTEM_NUM] = {
+	{ LEVEL_DEBUG }, { LEVEL_DEBUG }, { LEVEL_DEBUG }, { LEVEL_DEBUG }, { LEVEL_DEBUG }, { LEVEL_DEBUG }, { LEVEL_DEBUG }
+};
+static_assert(Log::SUBSYSTEM_NUM == 7, "update the initial levels");
+
+static const char* LEVEL_NAMES[Log::LEVEL_NUM] = { "none", "error", "warn", "info", "debug", "trace" };
+static const char* SUBSYSTEM_NAMES[Log::SUBSYSTEM_NUM] = { "general", "dap", "adi", "core", "target", "rsp", "server" };
+
+namespace
+{
+	struct Node
+	{
+		std::atomic<Node*> next;
+		Log::Subsystem subsystem;
+		Log::Level level;
+		std::string text;
+	};
+
+	// 書き出しを 1 本のスレッドにまとめる. 呼び出し元は queue に積むだけで stdout を待たない
+	// スレッドを使えない環境 (pthread なしの Emscripten など) では呼び出し元でそのまま書き出す
+	class Writer
+	{
+	public:
+		Writer() : threaded(false), pending(0), sleeping(false), lineStart(true)
+		{
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+			try
+			{
+				thread = std::thread(&Writer::run, this);
+				thread.detach();
+				threaded = true;
+			}
+			catch (const std::system_error&)
+			{
+			}
+#endif
+			atexit([]() { Log::flush(); });
+		}
+
+		void push(Log::Subsystem subsystem, Log::Level level, std::string&& text)
+		{
+			if (!threaded)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				write(subsystem, level, text);
+				return;
+			}
+
+			Node* node = new Node;
+			node->subsystem = subsystem;
+			node->level = level;
+			node->text = std::move(text);
+			queue.push(node);
+
+			pending.fetch_add(1);
+			if (sleeping.load())
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cond.notify_one();
+			}
+		}
+
+		void flush()
+		{
+			if (!threaded)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				fflush(stdout);
+				return;
+			}
+
+			// 書き出しが止まっている場合に終了できなくならないよう上限を設ける
+			auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+			while (pending.load() > 0 && std::chrono::steady_clock::now() < end)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			fflush(stdout);
+		}
+
+	private:
+		bool threaded;		// false なら push() の中で書き出す
+		MPSCQueue<Node> queue;
+		std::thread thread;
+		std::mutex mutex;	// threaded なら cond 用, そうでなければ書き出しを直列にする
+		std::condition_variable cond;
+		std::atomic<uint32_t> pending;
+		std::atomic<bool> sleeping;
+		bool lineStart;		// 書き出しスレッド (threaded でなければ mutex を持つ呼び出し元) だけが触る
+
+		// 行の先頭に [level][subsystem] を付ける. 改行で終わらない出力は次の出力の続きとして扱う
+		void write(Log::Subsystem subsystem, Log::Level level, const std::string& text)
+		{
+			size_t pos = 0;
+			while (pos < text.size())
+			{
+				if (lineStart)
+					fprintf(stdout, "[%s][%s] ", Log::getLevelName(level), Log::getSubsystemName(subsystem));
+
+				size_t nl = text.find('\n', pos);
+				size_t end = nl == std::string::npos ? text.size() : nl + 1;
+				fwrite(text.data() + pos, 1, end - pos, stdout);
+				lineStart = nl != std::string::npos;
+				pos = end;
+			}
+		}
+
+		void run()
+		{
+			while (1)
+			{
+				Node* node = queue.pop();
+				if (node != nullptr)
+				{
+					write(node->subsystem, node->level, node->text);
+					delete node;
+					pending.fetch_sub(1);
+					continue;
+				}
+
+				if (pending.load() > 0)
+				{
+					// push の途中なので少し待つ
+					std::this_thread::yield();
+					continue;
+				}
+
+				fflush(stdout);
+
+				std::unique_lock<std::mutex> lock(mutex);
+				sleeping = true;
+				cond.wait(lock, [this]() { return pending.load() > 0; });
+				sleeping = false;
+			}
+		}
+	};
+
+	// 終了処理中のログでも使えるよう破棄しない
+	Writer& getWriter()
+	{
+		static Writer* writer = new Writer;
+		return *writer;
+	}
+}
+
+void Log::write(Subsystem subsystem, Level level, const char* format, ...)
+{
+	char buf[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (len < 0)
+		return;
+
+	std::string text;
+	if ((size_t)len < sizeof(buf))
+	{
+		text.assign(buf, len);
+	}
+	else
+	{
+		text.resize(len + 1);
+		va_start(args, format);
+		vsnprintf(&text[0], text.size(), format, args);
+		va_end(args);
+		text.resize(len);
+	}
+
+	getWriter().push(subsystem, level, std::move(text));
+}
+
+void Log::flush()
+{
+	getWriter().flush();
+}
+
+const char* Log::getLevelName(Level level)
+{
+	return level < LEVEL_NUM ? LEVEL_NAMES[level] : "unknown";
+}
+
+const char* Log::getSubsystemName(Subsystem subsystem)
+{
+	return subsystem < SUBSYSTEM_NUM ? SUBSYSTEM_NAMES[subsystem] : "unknown";
+}
+
+errno_t Log::configure(const std::string& spec)
+{
+	auto parseLevel = [](const std::string& str, Level* level)
+	{
+		for (uint32_t i = 0; i < LEVEL_NUM; i++)
+		{
+			if (str == LEVEL_NAMES[i])
+			{
+				*level = (Level)i;
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// 途中で失敗した場合に一部だけ反映されないよう, 先に全部解釈する
+	uint8_t next[SUBSYSTEM_NUM];
+	for (uint32_t i = 0; i < SUBSYSTEM_NUM; i++)
+		next[i] = levels[i].load();
+
+	std::istringstream stream(spec);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (item.empty())
+			continue;
+
+		Level level;
+		size_t pos = item.find('=');
+		if (pos == std::string::npos)
+		{
+			if (!parseLevel(item, &level))
+				return EINVAL;
+			for (auto& n : next)
+				n = (uint8_t)level;
+			continue;
+		}
+
+		std::string name = item.substr(0, pos);
+		if (!parseLevel(item.substr(pos + 1), &level))
+			return EINVAL;
+
+		uint32_t i;
+		for (i = 0; i < SUBSYSTEM_NUM; i++)
+		{
+			if (name == SUBSYSTEM_NAMES[i])
+				break;
+		}
+		if (i == SUBSYSTEM_NUM)
+			return EINVAL;
+		next[i] = (uint8_t)level;
+	}
+
+	for (uint32_t i = 0; i < SUBSYSTEM_NUM; i++)
+		levels[i].store(next[i]);
+	return OK;
+}
+
+std::string Log::toString()
+{
+	std::string str;
+	for (uint32_t i = 0; i < SUBSYSTEM_NUM; i++)
+		str += std::string(SUBSYSTEM_NAMES[i]) + ": " + getLevelName(getLevel((Subsystem)i)) + "\n";
+	return str;
+}
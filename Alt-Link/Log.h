@@ -0,0 +1,80 @@
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+// これより詳細なレベルのログはコンパイル時に消える (1: ERROR 〜 5: TRACE)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 5
+#endif
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define LOG_PRINTF_FORMAT(fmt, args)
+#endif
+
+// サブシステムごとにレベルを変えられるログ
+// 整形は呼び出し元でレベルを確認してから行い, 出力はバックグラウンドのスレッドがまとめて書き出す
+class Log
+{
+public:
+	enum Level
+	{
+		LEVEL_NONE	= 0,
+		LEVEL_ERROR	= 1,
+		LEVEL_WARN	= 2,
+		LEVEL_INFO	= 3,
+		LEVEL_DEBUG	= 4,
+		LEVEL_TRACE	= 5,	// パケットごとなど頻度の高いもの
+		LEVEL_NUM
+	};
+
+	enum Subsystem
+	{
+		SUBSYSTEM_GENERAL,
+		SUBSYSTEM_DAP,		// CMSIS-DAP
+		SUBSYSTEM_ADI,		// DP, AP, ROM table
+		SUBSYSTEM_CORE,		// SCS, DWT, FPB, debug interface
+		SUBSYSTEM_TARGET,	// ADIv5TI
+		SUBSYSTEM_RSP,
+		SUBSYSTEM_SERVER,
+		SUBSYSTEM_NUM
+	};
+
+	static bool isEnabled(Subsystem subsystem, Level level)
+	{
+		return (uint32_t)level <= levels[subsystem].load(std::memory_order_relaxed);
+	}
+	static Level getLevel(Subsystem subsystem) { return (Level)levels[subsystem].load(std::memory_order_relaxed); }
+	static void setLevel(Subsystem subsystem, Level level) { levels[subsystem].store((uint8_t)level, std::memory_order_relaxed); }
+
+	// "<level>" (全サブシステム) か "<subsystem>=<level>" を ',' で区切って並べる. 例: "info,rsp=trace"
+	static errno_t configure(const std::string& spec);
+	static std::string toString();
+
+	static const char* getLevelName(Level level);
+	static const char* getSubsystemName(Subsystem subsystem);
+
+	static void write(Subsystem subsystem, Level level, const char* format, ...) LOG_PRINTF_FORMAT(3, 4);
+	// キューに残っているものを書き出し終わるまで待つ
+	static void flush();
+
+private:
+	static std::atomic<uint8_t> levels[SUBSYSTEM_NUM];
+};
+
+#define LOG(subsystem, level, ...) \
+	do { if ((level) <= LOG_COMPILE_LEVEL && Log::isEnabled(subsystem, level)) Log::write(subsystem, level, __VA_ARGS__); } while (0)
+
+#define LOG_ERROR(subsystem, ...)	LOG(subsystem, Log::LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(subsystem, ...)	LOG(subsystem, Log::LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(subsystem, ...)	LOG(subsystem, Log::LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(subsystem, ...)	LOG(subsystem, Log::LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(subsystem, ...)	LOG(subsystem, Log::LEVEL_TRACE, __VA_ARGS__)
+
+// _DBGPRT / _ERRPRT はファイルごとの LOG_SUBSYSTEM に出す
+// 変える場合は #include の後で #undef してから定義し直す
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_GENERAL
@@ -0,0 +1,64 @@
+
+#pragma once
+
+#include <atomic>
+
+// intrusive MPSC queue (Dmitry Vyukov)
+// push は複数スレッドから lock-free で呼べる。pop は 1 つのスレッドのみ
+// Node は std::atomic<Node*> next を持つこと
+template <typename Node>
+class MPSCQueue
+{
+public:
+	MPSCQueue() : head(&stub), tail(&stub)
+	{
+		stub.next.store(nullptr, std::memory_order_relaxed);
+	}
+
+	void push(Node* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		Node* prev = head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	Node* pop()
+	{
+		Node* t = tail;
+		Node* next = t->next.load(std::memory_order_acquire);
+
+		if (t == &stub)
+		{
+			if (next == nullptr)
+				return nullptr;
+			tail = next;
+			t = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr)
+		{
+			tail = next;
+			return t;
+		}
+
+		// push の途中 (head は更新済みで next がまだ繋がっていない)
+		if (t != head.load(std::memory_order_acquire))
+			return nullptr;
+
+		push(&stub);
+
+		next = t->next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			tail = next;
+			return t;
+		}
+		return nullptr;
+	}
+
+private:
+	std::atomic<Node*> head;
+	Node* tail;
+	Node stub;
+};
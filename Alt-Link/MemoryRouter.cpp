@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "MemoryRouter.h"
+
+void MemoryRouter::addRoute(uint64_t start, uint64_t size, std::shared_ptr<ADIv5::MEM_AP> ap)
+{
+	routes.push_back({ start, start + size, ap });
+}
+
+ADIv5::MEM_AP* MemoryRouter::route(uint32_t addr)
+{
+	for (auto it = routes.rbegin(); it != routes.rend(); ++it)
+	{
+		if (it->start <= addr && addr < it->end)
+			return it->ap.get();
+	}
+	return defaultAp.get();
+}
+
+uint32_t MemoryRouter::getRunLength(uint32_t addr, uint32_t count)
+{
+	// 次に経路が変わる可能性のある境界まで
+	uint64_t end = (uint64_t)addr + (uint64_t)count * 4;
+	for (auto& r : routes)
+	{
+		if (r.start > addr && r.start < end)
+			end = r.start;
+		if (r.end > addr && r.end < end)
+			end = r.end;
+	}
+	uint32_t n = (uint32_t)((end - addr + 3) / 4);
+	return n > 0 ? n : 1;
+}
+
+errno_t MemoryRouter::read(uint32_t addr, uint32_t *data)
+{
+	return route(addr)->read(addr, data);
+}
+
+errno_t MemoryRouter::write(uint32_t addr, uint32_t val)
+{
+	return route(addr)->write(addr, val);
+}
+
+errno_t MemoryRouter::write(uint32_t addr, uint16_t val)
+{
+	return route(addr)->write(addr, val);
+}
+
+errno_t MemoryRouter::write(uint32_t addr, uint8_t val)
+{
+	return route(addr)->write(addr, val);
+}
+
+errno_t MemoryRouter::readBlock(uint32_t addr, uint32_t count, uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	while (count > 0)
+	{
+		uint32_t n = getRunLength(addr, count);
+		errno_t ret = route(addr)->readBlock(addr, n, data);
+		if (ret != OK)
+			return ret;
+
+		addr += n * 4;
+		data += n;
+		count -= n;
+	}
+	return OK;
+}
+
+errno_t MemoryRouter::writeBlock(uint32_t addr, uint32_t count, const uint32_t *data)
+{
+	if (data == nullptr)
+		return EINVAL;
+
+	while (count > 0)
+	{
+		uint32_t n = getRunLength(addr, count);
+		errno_t ret = route(addr)->writeBlock(addr, n, data);
+		if (ret != OK)
+			return ret;
+
+		addr += n * 4;
+		data += n;
+		count -= n;
+	}
+	return OK;
+}
+
+errno_t MemoryRouter::transfer(const std::vector<ADIv5::MEM_AP::Access>& accesses)
+{
+	if (routes.size() == 0)
+		return defaultAp->transfer(accesses);
+
+	// AP の数は少ないので線形に探す
+	std::vector<std::pair<ADIv5::MEM_AP*, std::vector<ADIv5::MEM_AP::Access>>> groups;
+	for (auto& a : accesses)
+	{
+		ADIv5::MEM_AP* ap = route(a.addr);
+		auto it = groups.begin();
+		for (; it != groups.end(); ++it)
+		{
+			if (it->first == ap)
+				break;
+		}
+		if (it == groups.end())
+		{
+			groups.push_back(std::make_pair(ap, std::vector<ADIv5::MEM_AP::Access>()));
+			it = groups.end() - 1;
+		}
+		it->second.push_back(a);
+	}
+
+	for (auto& group : groups)
+	{
+		errno_t ret = group.first->transfer(group.second);
+		if (ret != OK)
+			return ret;
+	}
+	return OK;
+}
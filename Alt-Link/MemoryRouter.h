@@ -0,0 +1,51 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "ADIv5.h"
+
+// アドレス範囲ごとに MEM-AP を選んでアクセスする
+// (DDR は AXI-AP, SRAM は AHB-AP のように, 同じアドレスでも AP によって速度や見え方が異なるため)
+// CSW/TAR のキャッシュは MEM_AP ごと, SELECT のキャッシュは AP が持つ
+class MemoryRouter
+{
+public:
+	struct Route
+	{
+		uint64_t start;
+		uint64_t end;	// 含まない
+		std::shared_ptr<ADIv5::MEM_AP> ap;
+	};
+
+	explicit MemoryRouter(std::shared_ptr<ADIv5::MEM_AP> _defaultAp) : defaultAp(_defaultAp) {}
+
+	// 後から追加した範囲が優先される
+	void addRoute(uint64_t start, uint64_t size, std::shared_ptr<ADIv5::MEM_AP> ap);
+	void clearRoutes() { routes.clear(); }
+	const std::vector<Route>& getRoutes() const { return routes; }
+
+	std::shared_ptr<ADIv5::MEM_AP> getDefault() const { return defaultAp; }
+	void setDefault(std::shared_ptr<ADIv5::MEM_AP> ap) { defaultAp = ap; }
+
+	ADIv5::MEM_AP* route(uint32_t addr);
+
+	errno_t read(uint32_t addr, uint32_t *data);
+	errno_t write(uint32_t addr, uint32_t val);
+	errno_t write(uint32_t addr, uint16_t val);
+	errno_t write(uint32_t addr, uint8_t val);
+	errno_t readBlock(uint32_t addr, uint32_t count, uint32_t *data);	// count: number of 32-bit words
+	errno_t writeBlock(uint32_t addr, uint32_t count, const uint32_t *data);
+
+	// AP ごとにまとめて転送し, SELECT の切り替えを減らす
+	// 同じ AP へのアクセスの順序は保たれるが, 異なる AP の間の順序は保たれない
+	errno_t transfer(const std::vector<ADIv5::MEM_AP::Access>& accesses);
+
+private:
+	std::shared_ptr<ADIv5::MEM_AP> defaultAp;
+	std::vector<Route> routes;
+
+	// addr と同じ AP に送れるワード数 (最大 count)
+	uint32_t getRunLength(uint32_t addr, uint32_t count);
+};
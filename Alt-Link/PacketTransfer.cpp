@@ -8,17 +8,14 @@
 #include "PacketTransfer.h"
 #include "Converter.h"
 
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_RSP
+
 class {
 public:
 	static uint8_t get(const std::string& data)
 	{
-		uint32_t sum = 0;
-		for (uint32_t i = 0; i < data.length(); i++)
-		{
-			sum += data[i];
-			sum = sum % 256;
-		}
-		return sum;
+		return Converter::checksum(data.data(), data.length());
 	}
 
 	static bool compare(const std::string& data, const std::string& hexCheckSum)
@@ -42,20 +39,20 @@ void PacketTransfer::push(std::string& data)
 		{
 			buffer = buffer.substr(1);
 
-			printf("received plus!\n");
+			LOG_TRACE(LOG_SUBSYSTEM, "received plus!\n");
 		}
 		else if (buffer[0] == '-')
 		{
 			buffer = buffer.substr(1);
 
-			printf("request resend received!\n");
+			LOG_DEBUG(LOG_SUBSYSTEM, "request resend received!\n");
 			requestResend();
 		}
 		else if (buffer[0] == 0x03)
 		{
 			buffer = buffer.substr(1);
 
-			printf("interrupt received!\n");
+			LOG_DEBUG(LOG_SUBSYSTEM, "interrupt received!\n");
 			interruptReceived();
 		}
 		else if (std::regex_search(buffer, match, rePacket))
@@ -67,12 +64,12 @@ void PacketTransfer::push(std::string& data)
 
 			if (!checkSum.compare(payload, hexCheckSum))
 			{
-				printf("checkSum error!\n");
+				LOG_WARN(LOG_SUBSYSTEM, "checkSum error!\n");
 				errorPacketReceived();
 			}
 			else
 			{
-				printf("packet received! (%s)\n", [payload]() -> std::string
+				LOG_TRACE(LOG_SUBSYSTEM, "packet received! (%s)\n", [payload]() -> std::string
 				{
 					if (std::regex_search(payload, std::regex("[^[:print:]]")))
 						return std::string(1, payload[0]) + " [BINARY]";
@@ -99,44 +96,13 @@ PacketTransfer::Packet PacketTransfer::makePacket(const std::string& payload)
 std::string PacketTransfer::escape(const std::string data)
 {
 	std::string escaped;
-
-	for (char c : data)
-	{
-		if (c == '{' || c == '$' || c == '#')
-		{
-			escaped.append(1, c ^ 0x20);
-		}
-		else
-		{
-			escaped.append(1, c);
-		}
-	}
+	Converter::escape(data, &escaped);
 	return escaped;
 }
 
 std::string PacketTransfer::unescape(const std::string data)
 {
 	std::string unescaped;
-	bool escaped = false;
-
-	for (char c : data)
-	{
-		if (escaped)
-		{
-			unescaped.append(1, c ^ 0x20);
-			escaped = false;
-		}
-		else
-		{
-			if (c == '}')
-			{
-				escaped = true;
-			}
-			else
-			{
-				unescaped.append(1, c);
-			}
-		}
-	}
+	Converter::unescape(data, &unescaped);
 	return unescaped;
 }
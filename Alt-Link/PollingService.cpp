@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "PollingService.h"
+
+PollingService::~PollingService()
+{
+	stopThread();
+}
+
+errno_t PollingService::startThread(std::function<errno_t()> prepare, std::function<void()> body)
+{
+	if (running.load())
+		return OK;	// already running
+
+	// 転送エラーで停止したスレッドが残っていれば回収する
+	if (thread.joinable())
+		thread.join();
+
+	errno_t ret = prepare();
+	if (ret != OK)
+		return ret;
+
+	running = true;
+	thread = std::thread(body);
+	return OK;
+}
+
+void PollingService::stop()
+{
+	stopThread();
+}
+
+bool PollingService::stopThread()
+{
+	running = false;
+
+	if (!thread.joinable())
+		return false;
+	thread.join();
+	return true;
+}
@@ -0,0 +1,69 @@
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+// ターゲットをコアを止めずに専用スレッドで読み続けるサービス (Profiler, CounterMonitor, RTT, Watch) の共通部分
+// 派生クラスのデストラクタでは, メンバが破棄される前に stop() を呼ぶこと
+class PollingService
+{
+public:
+	virtual ~PollingService();
+
+	virtual void stop();
+	bool isRunning() const { return running.load(); }
+
+protected:
+	PollingService() : running(false) {}
+
+	// 動いていなければ prepare() の後に body をスレッドで実行する
+	// body は running が false になるまで続け, 転送エラーで止まる場合は自分で running を false にする
+	errno_t startThread(std::function<errno_t()> prepare, std::function<void()> body);
+	// スレッドを回収した場合は true
+	bool stopThread();
+
+	std::atomic<bool> running;
+
+private:
+	std::thread thread;
+};
+
+// 購読者の登録と配信. notify() はサービスのスレッドから呼ぶ
+template <class Listener>
+class ListenerMap
+{
+public:
+	ListenerMap() : nextId(1) {}
+
+	uint32_t add(Listener listener)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		uint32_t id = nextId++;
+		listeners[id] = listener;
+		return id;
+	}
+
+	void remove(uint32_t id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		listeners.erase(id);
+	}
+
+	template <class... Args>
+	void notify(const Args&... args)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& l : listeners)
+			l.second(args...);
+	}
+
+private:
+	std::mutex mutex;
+	std::map<uint32_t, Listener> listeners;
+	uint32_t nextId;
+};
@@ -0,0 +1,305 @@
+#include "stdafx.h"
+#include "Profiler.h"
+
+#include <map>
+#include <sstream>
+
+PCHistogram::PCHistogram(uint32_t capacity) : dropped(0)
+{
+	// 2 のべき乗に切り上げる
+	uint32_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	slots = std::unique_ptr<Slot[]>(new Slot[size]);
+	mask = size - 1;
+	clear();
+}
+
+void PCHistogram::add(uint32_t core, uint32_t pc)
+{
+	uint64_t key = (((uint64_t)core << 32) | pc) + 1;
+
+	// open addressing (linear probing)
+	uint32_t hash = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+	for (uint32_t i = 0; i <= mask; i++)
+	{
+		Slot& slot = slots[(hash + i) & mask];
+
+		uint64_t current = slot.key.load(std::memory_order_acquire);
+		if (current == 0)
+		{
+			uint64_t expected = 0;
+			if (slot.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel))
+				current = key;
+			else
+				current = expected;
+		}
+		if (current == key)
+		{
+			slot.count.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PCHistogram::clear()
+{
+	for (uint32_t i = 0; i <= mask; i++)
+	{
+		slots[i].count.store(0, std::memory_order_relaxed);
+		slots[i].key.store(0, std::memory_order_release);
+	}
+	dropped.store(0, std::memory_order_relaxed);
+}
+
+std::vector<PCHistogram::Entry> PCHistogram::snapshot() const
+{
+	std::vector<Entry> entries;
+	for (uint32_t i = 0; i <= mask; i++)
+	{
+		uint64_t key = slots[i].key.load(std::memory_order_acquire);
+		if (key == 0)
+			continue;
+
+		uint64_t count = slots[i].count.load(std::memory_order_relaxed);
+		if (count == 0)
+			continue;
+
+		key -= 1;
+		entries.push_back({ (uint32_t)(key >> 32), (uint32_t)key, count });
+	}
+	return entries;
+}
+
+Profiler::Profiler(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), samples(0), idle(0), accumulatedNs(0)
+{
+	findSources();
+}
+
+Profiler::~Profiler()
+{
+	stop();
+}
+
+void Profiler::findSources()
+{
+	// ARMv7-A/R のコアがあれば各コアの DBGPCSR, 無ければ DWT_PCSR
+	for (auto dif : ti->getARMv7ARDIF())
+	{
+		uint32_t addr;
+		if (dif->getPCSRAddress(&addr) == OK)
+			sources.push_back({ &dif->ap, addr, dif });
+	}
+
+	auto dwt = ti->getARMv6MDWT();
+	if (sources.size() == 0 && dwt)
+		sources.push_back({ &dwt->ap, dwt->getPCSRAddress(), nullptr });
+}
+
+errno_t Profiler::start()
+{
+	if (sources.size() == 0)
+		return ENODEV;
+
+	return startThread([this]()
+	{
+		startTime = std::chrono::steady_clock::now();
+		return (errno_t)OK;
+	}, [this]() { run(); });
+}
+
+void Profiler::stop()
+{
+	if (!stopThread())
+		return;
+
+	auto elapsed = std::chrono::steady_clock::now() - startTime;
+	accumulatedNs += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void Profiler::clear()
+{
+	histogram.clear();
+	samples = 0;
+	idle = 0;
+	accumulatedNs = 0;
+	startTime = std::chrono::steady_clock::now();
+}
+
+uint64_t Profiler::getDurationNs() const
+{
+	uint64_t ns = accumulatedNs.load();
+	if (running.load())
+	{
+		auto elapsed = std::chrono::steady_clock::now() - startTime;
+		ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	}
+	return ns;
+}
+
+void Profiler::run()
+{
+	typedef std::vector<std::vector<uint32_t>> Batch;
+
+	// 各コアの PCSR を BATCH_SIZE 回ずつ DAP_TransferBlock で読む
+	auto read = [this]() -> std::pair<errno_t, Batch>
+	{
+		Batch batch(sources.size(), std::vector<uint32_t>(BATCH_SIZE));
+		for (uint32_t i = 0; i < sources.size(); i++)
+		{
+			errno_t ret = sources[i].ap->readRepeat(sources[i].addr, BATCH_SIZE, batch[i].data());
+			if (ret != OK)
+				return std::make_pair(ret, Batch());
+		}
+		return std::make_pair((errno_t)OK, batch);
+	};
+
+	// 次のバッチを executor に積んでから前のバッチを集計する
+	// バッチの間に RSP などの優先度の高い要求が割り込める
+	auto pending = executor->submit(Executor::PRIORITY_BACKGROUND, read);
+	while (running.load())
+	{
+		auto result = pending.get();
+		if (result.first != OK)
+		{
+			_ERRPRT("Failed to sample PC. (0x%08x)\n", result.first);
+			running = false;
+			break;
+		}
+		pending = executor->submit(Executor::PRIORITY_BACKGROUND, read);
+
+		for (uint32_t core = 0; core < result.second.size(); core++)
+		{
+			for (uint32_t raw : result.second[core])
+			{
+				uint32_t pc = raw;
+				bool valid = sources[core].dif ? sources[core].dif->decodePCSR(raw, &pc) : raw != 0xFFFFFFFF;
+
+				// 停止中, スリープ中は 0xFFFFFFFF が読める
+				if (valid)
+					histogram.add(core, pc);
+				else
+					idle++;
+				samples++;
+			}
+		}
+	}
+	if (pending.valid())
+		pending.wait();
+}
+
+std::string Profiler::toFolded() const
+{
+	std::stringstream stream;
+	for (auto& e : histogram.snapshot())
+	{
+		stream << "core" << std::dec << e.core << ";0x" << std::hex << e.pc << " " << std::dec << e.count << "\n";
+	}
+	return stream.str();
+}
+
+namespace
+{
+	// profile.proto のエンコード用
+	class ProtoWriter
+	{
+	public:
+		void varint(uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				data.push_back((char)((value & 0x7F) | 0x80));
+				value >>= 7;
+			}
+			data.push_back((char)value);
+		}
+		void tag(uint32_t field, uint32_t wireType) { varint((field << 3) | wireType); }
+		void uint64(uint32_t field, uint64_t value) { tag(field, 0); varint(value); }
+		void bytes(uint32_t field, const std::string& value)
+		{
+			tag(field, 2);
+			varint(value.size());
+			data += value;
+		}
+		void packed(uint32_t field, const std::vector<uint64_t>& values)
+		{
+			ProtoWriter inner;
+			for (auto v : values)
+				inner.varint(v);
+			bytes(field, inner.data);
+		}
+
+		std::string data;
+	};
+}
+
+std::string Profiler::toPprof() const
+{
+	auto entries = histogram.snapshot();
+
+	std::vector<std::string> strings = { "", "samples", "count", "cpu", "nanoseconds", "core" };
+	enum { STR_SAMPLES = 1, STR_COUNT, STR_CPU, STR_NANOSECONDS, STR_CORE };
+
+	ProtoWriter profile;
+
+	// sample_type = 1
+	ProtoWriter sampleType;
+	sampleType.uint64(1, STR_SAMPLES);
+	sampleType.uint64(2, STR_COUNT);
+	profile.bytes(1, sampleType.data);
+
+	// location は PC ごとに 1 つ
+	std::map<uint32_t, uint64_t> locations;
+	for (auto& e : entries)
+	{
+		if (locations.find(e.pc) == locations.end())
+		{
+			uint64_t id = locations.size() + 1;
+			locations[e.pc] = id;
+		}
+	}
+
+	// sample = 2
+	for (auto& e : entries)
+	{
+		ProtoWriter label;
+		label.uint64(1, STR_CORE);
+		label.uint64(3, e.core);
+
+		ProtoWriter sample;
+		sample.packed(1, { locations[e.pc] });
+		sample.packed(2, { e.count });
+		sample.bytes(3, label.data);
+		profile.bytes(2, sample.data);
+	}
+
+	// location = 4
+	for (auto& l : locations)
+	{
+		ProtoWriter location;
+		location.uint64(1, l.second);
+		location.uint64(3, l.first);
+		profile.bytes(4, location.data);
+	}
+
+	// string_table = 6
+	for (auto& s : strings)
+		profile.bytes(6, s);
+
+	// duration_nanos = 10
+	profile.uint64(10, getDurationNs());
+
+	// period_type = 11, period = 12
+	ProtoWriter periodType;
+	periodType.uint64(1, STR_CPU);
+	periodType.uint64(2, STR_NANOSECONDS);
+	profile.bytes(11, periodType.data);
+
+	uint64_t count = samples.load();
+	profile.uint64(12, count > 0 ? getDurationNs() / count : 0);
+
+	return profile.data;
+}
@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include "ADIv5.h"
+#include "ADIv5TI.h"
+#include "Executor.h"
+#include "PollingService.h"
+
+// (コア, PC) ごとのサンプル数. 挿入は lock-free で, 読み出しと並行して行える
+class PCHistogram
+{
+public:
+	struct Entry
+	{
+		uint32_t core;
+		uint32_t pc;
+		uint64_t count;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(core), CEREAL_NVP(pc), CEREAL_NVP(count));
+		}
+	};
+
+	explicit PCHistogram(uint32_t capacity = 65536);
+
+	void add(uint32_t core, uint32_t pc);
+	void clear();
+	std::vector<Entry> snapshot() const;
+	uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> key;	// 0: 空き, それ以外: ((core << 32) | pc) + 1
+		std::atomic<uint64_t> count;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	uint32_t mask;
+	std::atomic<uint64_t> dropped;
+};
+
+// DWT_PCSR / DBGPCSR をターゲットを止めずに連続で読み出すサンプリングプロファイラ
+class Profiler : public PollingService
+{
+public:
+	Profiler(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~Profiler();
+
+	errno_t start();
+	virtual void stop();
+	void clear();
+
+	std::shared_ptr<ADIv5TI> getTI() const { return ti; }
+	uint32_t getCoreCount() const { return (uint32_t)sources.size(); }
+	uint64_t getSampleCount() const { return samples.load(); }
+	uint64_t getIdleCount() const { return idle.load(); }
+	uint64_t getDurationNs() const;
+	std::vector<PCHistogram::Entry> getHistogram() const { return histogram.snapshot(); }
+
+	template <class Archive>
+	void save(Archive & archive) const
+	{
+		uint64_t samples = getSampleCount();
+		uint64_t idle = getIdleCount();
+		uint64_t dropped = histogram.getDropped();
+		uint64_t durationNs = getDurationNs();
+		bool running = isRunning();
+		auto histogram = getHistogram();
+		archive(CEREAL_NVP(running), CEREAL_NVP(samples), CEREAL_NVP(idle), CEREAL_NVP(dropped),
+			CEREAL_NVP(durationNs), CEREAL_NVP(histogram));
+	}
+
+	// flame graph 用の folded stack ("core1;0x08000123 42")
+	std::string toFolded() const;
+	// pprof の profile.proto (非圧縮)
+	std::string toPprof() const;
+
+private:
+	// 1 回の転送で同じ PCSR を読む回数
+	static const uint32_t BATCH_SIZE = 256;
+
+	struct Source
+	{
+		ADIv5::MEM_AP* ap;
+		uint32_t addr;
+		std::shared_ptr<ARMv7ARDIF> dif;	// nullptr の場合は DWT_PCSR (変換不要)
+	};
+
+	std::shared_ptr<ADIv5TI> ti;
+	std::shared_ptr<Executor> executor;
+	std::vector<Source> sources;
+	PCHistogram histogram;
+
+	std::atomic<uint64_t> samples;
+	std::atomic<uint64_t> idle;
+	std::chrono::steady_clock::time_point startTime;
+	std::atomic<uint64_t> accumulatedNs;
+
+	void findSources();
+	void run();
+};
@@ -0,0 +1,346 @@
+#include "stdafx.h"
+#include "RTT.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+const char RTT::SIGNATURE[] = "SEGGER RTT\0\0\0\0\0";
+// milliseconds() が参照で受け取るので定義が要る
+const uint32_t RTT::FIND_INTERVAL_MS;
+
+static const char* SYMBOL_NAME = "_SEGGER_RTT";
+
+static std::vector<uint8_t> toBytes(uint32_t value)
+{
+	return { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+}
+
+RTT::RTT(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), found(false), intervalMs(DEFAULT_INTERVAL_MS),
+	address(0), addressValid(false), searchStart(0), searchSize(0), numUp(0), numDown(0)
+{
+	ti->addSymbolRequest(SYMBOL_NAME);
+}
+
+RTT::~RTT()
+{
+	stop();
+}
+
+void RTT::setAddress(uint64_t addr)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	address = addr;
+	addressValid = true;
+	found = false;
+}
+
+void RTT::setSearchRange(uint64_t start, uint32_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	searchStart = start;
+	searchSize = size;
+	found = false;
+}
+
+errno_t RTT::start(uint32_t _intervalMs)
+{
+	return startThread([this, _intervalMs]()
+	{
+		intervalMs = _intervalMs > 0 ? _intervalMs : 1;
+		return (errno_t)OK;
+	}, [this]() { run(); });
+}
+
+std::vector<RTT::Channel> RTT::getChannels()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return channels;
+}
+
+uint32_t RTT::subscribe(Listener listener)
+{
+	return listeners.add(listener);
+}
+
+void RTT::unsubscribe(uint32_t id)
+{
+	listeners.remove(id);
+}
+
+errno_t RTT::write(uint32_t channel, const std::vector<uint8_t>& data)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& queue = downQueue[channel];
+	if (queue.size() + data.size() > MAX_DOWN_QUEUE)
+		return ENOSPC;
+	queue.insert(queue.end(), data.begin(), data.end());
+	return OK;
+}
+
+uint32_t RTT::getWriteSpace(uint32_t channel)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = downQueue.find(channel);
+	if (it == downQueue.end())
+		return MAX_DOWN_QUEUE;
+	return it->second.size() < MAX_DOWN_QUEUE ? MAX_DOWN_QUEUE - (uint32_t)it->second.size() : 0;
+}
+
+errno_t RTT::find()
+{
+	uint64_t addr = 0;
+	bool valid = false;
+	uint64_t start, size;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (addressValid)
+		{
+			addr = address;
+			valid = true;
+		}
+		start = searchStart;
+		size = searchSize;
+	}
+
+	// gdb から qSymbol で教えてもらったアドレス
+	if (!valid)
+		valid = ti->getSymbolValue(SYMBOL_NAME, &addr);
+
+	if (!valid && size > 0)
+	{
+		// RSP の要求を待たせないよう 64KB ずつ検索する
+		const uint32_t CHUNK_SIZE = 0x10000;
+		std::vector<uint8_t> pattern(SIGNATURE, SIGNATURE + SIGNATURE_SIZE);
+
+		for (uint64_t cur = start; cur < start + size && running.load(); cur += CHUNK_SIZE)
+		{
+			uint64_t remain = start + size - cur;
+			uint32_t len = (uint32_t)(remain < CHUNK_SIZE + SIGNATURE_SIZE - 1 ? remain : CHUNK_SIZE + SIGNATURE_SIZE - 1);
+
+			bool hit = false;
+			errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]() { return ti->searchMemory(cur, len, pattern, &hit, &addr); });
+			if (ret != OK)
+				return ret;
+			if (hit)
+			{
+				valid = true;
+				break;
+			}
+		}
+	}
+
+	if (!valid)
+		return ENOENT;
+
+	return executor->execute(Executor::PRIORITY_BACKGROUND, [&]() { return readControlBlock(addr); });
+}
+
+errno_t RTT::readControlBlock(uint64_t addr)
+{
+	std::vector<uint8_t> header;
+	errno_t ret = ti->readMemory(addr, HEADER_SIZE, &header);
+	if (ret != OK)
+		return ret;
+
+	if (header.size() < HEADER_SIZE || memcmp(header.data(), SIGNATURE, SIGNATURE_SIZE) != 0)
+		return ENOENT;
+
+	uint32_t up, down;
+	memcpy(&up, &header[16], 4);
+	memcpy(&down, &header[20], 4);
+	if (up > MAX_CHANNELS || down > MAX_CHANNELS)
+		return EINVAL;
+
+	std::vector<uint32_t> descs;
+	ret = ti->readMemory(addr + HEADER_SIZE, (up + down) * DESC_SIZE, &descs);
+	if (ret != OK)
+		return ret;
+
+	std::vector<Channel> _channels;
+	for (uint32_t i = 0; i < up + down; i++)
+	{
+		Channel channel;
+		channel.up = i < up;
+		channel.index = channel.up ? i : i - up;
+		channel.size = descs[i * 6 + 2];
+
+		// sName は NUL 終端の文字列
+		uint32_t namePtr = descs[i * 6];
+		if (namePtr != 0)
+		{
+			std::vector<uint8_t> name;
+			if (ti->readMemory(namePtr, 32, &name) == OK)
+			{
+				auto end = std::find(name.begin(), name.end(), 0);
+				channel.name = std::string(name.begin(), end);
+			}
+		}
+		_channels.push_back(channel);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	address = addr;
+	addressValid = true;
+	numUp = up;
+	numDown = down;
+	channels = _channels;
+	found = true;
+
+	_DBGPRT("RTT control block found at 0x%08x (up: %d, down: %d)\n", (uint32_t)addr, up, down);
+	return OK;
+}
+
+errno_t RTT::readUp(uint64_t descAddr, uint32_t index, Desc& desc, bool* active)
+{
+	if (desc.size == 0 || desc.wrOff >= desc.size || desc.rdOff >= desc.size || desc.wrOff == desc.rdOff)
+		return OK;
+
+	// リングバッファの末尾で折り返す場合は 2 回に分ける
+	uint32_t end = desc.wrOff > desc.rdOff ? desc.wrOff : desc.size;
+	uint32_t len = end - desc.rdOff;
+	if (len > MAX_CHUNK)
+		len = MAX_CHUNK;
+
+	std::vector<uint8_t> data;
+	errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]()
+	{
+		errno_t ret = ti->readMemory(desc.buffer + desc.rdOff, len, &data);
+		if (ret != OK)
+			return ret;
+
+		uint32_t rdOff = (desc.rdOff + len) % desc.size;
+		ret = ti->writeMemory(descAddr + 16, 4, toBytes(rdOff));
+		if (ret != OK)
+			return ret;
+
+		desc.rdOff = rdOff;
+		return (errno_t)OK;
+	});
+	if (ret != OK)
+		return ret;
+
+	*active = true;
+
+	listeners.notify(index, data);
+	return OK;
+}
+
+errno_t RTT::writeDown(uint64_t descAddr, uint32_t index, Desc& desc, bool* active)
+{
+	if (desc.size == 0 || desc.wrOff >= desc.size || desc.rdOff >= desc.size)
+		return OK;
+
+	// 1 byte は空けておく (WrOff == RdOff は空)
+	uint32_t free = (desc.rdOff + desc.size - desc.wrOff - 1) % desc.size;
+	uint32_t end = desc.rdOff > desc.wrOff ? desc.rdOff - 1 : (desc.rdOff == 0 ? desc.size - 1 : desc.size);
+	uint32_t len = end - desc.wrOff;
+	if (len > free)
+		len = free;
+	if (len > MAX_CHUNK)
+		len = MAX_CHUNK;
+
+	std::vector<uint8_t> data;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = downQueue.find(index);
+		if (it == downQueue.end() || it->second.size() == 0)
+			return OK;
+
+		if (len > it->second.size())
+			len = (uint32_t)it->second.size();
+		data.assign(it->second.begin(), it->second.begin() + len);
+	}
+	if (len == 0)
+		return OK;
+
+	errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]()
+	{
+		errno_t ret = ti->writeMemory(desc.buffer + desc.wrOff, len, data);
+		if (ret != OK)
+			return ret;
+
+		uint32_t wrOff = (desc.wrOff + len) % desc.size;
+		ret = ti->writeMemory(descAddr + 12, 4, toBytes(wrOff));
+		if (ret != OK)
+			return ret;
+
+		desc.wrOff = wrOff;
+		return (errno_t)OK;
+	});
+	if (ret != OK)
+		return ret;
+
+	*active = true;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& queue = downQueue[index];
+	queue.erase(queue.begin(), queue.begin() + (len < queue.size() ? len : queue.size()));
+	return OK;
+}
+
+errno_t RTT::poll(bool* active)
+{
+	uint64_t addr;
+	uint32_t up, down;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		addr = address;
+		up = numUp;
+		down = numDown;
+	}
+
+	// 全チャネルのディスクリプタを 1 回のブロック転送で読む
+	std::vector<uint32_t> raw;
+	errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]()
+	{
+		return ti->readMemory(addr + HEADER_SIZE, (up + down) * DESC_SIZE, &raw);
+	});
+	if (ret != OK)
+		return ret;
+
+	for (uint32_t i = 0; i < up + down; i++)
+	{
+		Desc desc = { raw[i * 6], raw[i * 6 + 1], raw[i * 6 + 2], raw[i * 6 + 3], raw[i * 6 + 4], raw[i * 6 + 5] };
+		uint64_t descAddr = addr + HEADER_SIZE + i * DESC_SIZE;
+
+		if (i < up)
+			ret = readUp(descAddr, i, desc, active);
+		else
+			ret = writeDown(descAddr, i - up, desc, active);
+		if (ret != OK)
+			return ret;
+	}
+	return OK;
+}
+
+void RTT::run()
+{
+	while (running.load())
+	{
+		if (!found.load())
+		{
+			if (find() != OK)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(FIND_INTERVAL_MS));
+				continue;
+			}
+		}
+
+		bool active = false;
+		errno_t ret = poll(&active);
+		if (ret != OK)
+		{
+			// ターゲットのリセットなどで control block が無くなった場合は探し直す
+			_ERRPRT("Failed to poll RTT. (0x%08x)\n", ret);
+			found = false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(FIND_INTERVAL_MS));
+			continue;
+		}
+
+		// データが流れている間は間隔を空けずに続けて読む
+		if (!active)
+			std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+	}
+}
@@ -0,0 +1,102 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <string>
+#include "ADIv5TI.h"
+#include "Executor.h"
+#include "PollingService.h"
+
+// ターゲット RAM 上のリングバッファ (SEGGER RTT 互換の control block) を介したチャネル
+// control block は qSymbol で得た _SEGGER_RTT のアドレスか, 指定範囲のシグネチャ検索で見つける
+class RTT : public PollingService
+{
+public:
+	struct Channel
+	{
+		bool up;			// up: target -> host, down: host -> target
+		uint32_t index;
+		std::string name;
+		uint32_t size;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(up), CEREAL_NVP(index), CEREAL_NVP(name), CEREAL_NVP(size));
+		}
+	};
+
+	typedef std::function<void(uint32_t channel, const std::vector<uint8_t>& data)> Listener;
+
+	RTT(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~RTT();
+
+	void setAddress(uint64_t addr);
+	void setSearchRange(uint64_t start, uint32_t size);
+
+	errno_t start(uint32_t intervalMs = DEFAULT_INTERVAL_MS);
+	bool isFound() const { return found.load(); }
+
+	std::vector<Channel> getChannels();
+	std::shared_ptr<ADIv5TI> getTI() const { return ti; }
+
+	uint32_t subscribe(Listener listener);
+	void unsubscribe(uint32_t id);
+	// down チャネルに送る. ターゲットのバッファが空くまで保持する
+	// 保持できるのはチャネルごとに MAX_DOWN_QUEUE byte まで. 収まらない場合は何もせず ENOSPC
+	errno_t write(uint32_t channel, const std::vector<uint8_t>& data);
+	// write() で追加できるバイト数
+	uint32_t getWriteSpace(uint32_t channel);
+
+	static const uint32_t DEFAULT_INTERVAL_MS = 10;
+	static const uint32_t MAX_DOWN_QUEUE = 64 * 1024;
+
+private:
+	static const char SIGNATURE[];
+	static const uint32_t SIGNATURE_SIZE = 16;
+	static const uint32_t HEADER_SIZE = 24;		// signature, MaxNumUpBuffers, MaxNumDownBuffers
+	static const uint32_t DESC_SIZE = 24;		// sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags
+	static const uint32_t MAX_CHANNELS = 16;
+	static const uint32_t MAX_CHUNK = 1024;		// 1 回の転送で移すバイト数 (RSP の要求を待たせないため)
+	static const uint32_t FIND_INTERVAL_MS = 1000;
+
+	struct Desc
+	{
+		uint32_t name;
+		uint32_t buffer;
+		uint32_t size;
+		uint32_t wrOff;
+		uint32_t rdOff;
+		uint32_t flags;
+	};
+
+	std::shared_ptr<ADIv5TI> ti;
+	std::shared_ptr<Executor> executor;
+	std::atomic<bool> found;
+	uint32_t intervalMs;
+	ListenerMap<Listener> listeners;
+
+	std::mutex mutex;	// 以下を保護する
+	uint64_t address;
+	bool addressValid;
+	uint64_t searchStart;
+	uint32_t searchSize;
+	uint32_t numUp;
+	uint32_t numDown;
+	std::vector<Channel> channels;
+	std::map<uint32_t, std::deque<uint8_t>> downQueue;
+
+	errno_t find();
+	errno_t readControlBlock(uint64_t addr);
+	errno_t poll(bool* active);
+	errno_t readUp(uint64_t descAddr, uint32_t index, Desc& desc, bool* active);
+	errno_t writeDown(uint64_t descAddr, uint32_t index, Desc& desc, bool* active);
+	void run();
+};
@@ -2,9 +2,43 @@
 #include "stdafx.h"
 #include "RemoteSerialProtocol.h"
 #include "Converter.h"
+#include "Trace.h"
 
 #include <sstream>
 #include <iterator>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM Log::SUBSYSTEM_RSP
+
+// 受信したパケット中の 16 進数. 空, 範囲外, 余分な文字を含む場合は false (例外は投げない)
+static bool parseHex(const std::string& str, int32_t* out)
+{
+	if (str.empty())
+		return false;
+	char* end;
+	errno = 0;
+	long value = strtol(str.c_str(), &end, 16);
+	if (errno != 0 || end != str.c_str() + str.size() || value < INT32_MIN || value > INT32_MAX)
+		return false;
+	*out = (int32_t)value;
+	return true;
+}
+
+static bool parseHex(const std::string& str, uint64_t* out)
+{
+	if (str.empty() || str[0] == '-')
+		return false;
+	char* end;
+	errno = 0;
+	unsigned long long value = strtoull(str.c_str(), &end, 16);
+	if (errno != 0 || end != str.c_str() + str.size())
+		return false;
+	*out = value;
+	return true;
+}
 
 void RemoteSerialProtocol::processQuery(const std::string& payload)
 {
@@ -38,11 +72,29 @@ void RemoteSerialProtocol::processQuery(const std::string& payload)
 	}
 	else if (payload.find("qSymbol:") == 0)
 	{
-		sendOK();
+		processSymbol(payload);
 	}
 	else if (payload == "qC")
 	{
-		sendPacket(makePacket("QC-1"));
+		std::stringstream stream;
+		stream << "QC" << std::hex << targetInterface.getCurrentThreadId();
+		sendPacket(makePacket(stream.str()));
+	}
+	else if (payload == "qfThreadInfo")
+	{
+		std::vector<int32_t> ids;
+		targetInterface.getThreadIds(&ids);
+
+		std::stringstream stream;
+		stream << "m" << std::hex;
+		for (size_t i = 0; i < ids.size(); i++)
+			stream << (i == 0 ? "" : ",") << ids[i];
+		sendPacket(makePacket(ids.size() > 0 ? stream.str() : "l"));
+	}
+	else if (payload == "qsThreadInfo")
+	{
+		// qfThreadInfo ですべてのスレッドを返している
+		sendPacket(makePacket("l"));
 	}
 	else if (payload.find("qAttached") == 0)
 	{
@@ -64,7 +116,8 @@ void RemoteSerialProtocol::processQuery(const std::string& payload)
 			}
 			else
 			{
-				sendPacket(makePacket(output));
+				std::vector<uint8_t> bytes(output.begin(), output.end());
+				sendPacket(makePacket(Converter::toHex(bytes)));
 			}
 		}
 		else
@@ -72,6 +125,65 @@ void RemoteSerialProtocol::processQuery(const std::string& payload)
 			sendError(result);
 		}
 	}
+	else if (payload.find("qCRC:") == 0)
+	{
+		uint64_t addr;
+		uint32_t len;
+		auto delimiter = Converter::extract(payload, 5, ',', false, &addr);
+		if (delimiter == payload.npos)
+		{
+			sendError();
+			return;
+		}
+		Converter::extract(payload, delimiter + 1, ',', true, &len);
+
+		uint32_t crc;
+		errno_t result = targetInterface.calcCRC32(addr, len, &crc);
+		if (result == OK)
+		{
+			std::vector<uint8_t> bytes = {
+				(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+			sendPacket(makePacket("C" + Converter::toHex(bytes)));
+		}
+		else
+		{
+			sendError(result);
+		}
+	}
+	else if (payload.find("qSearch:memory:") == 0)
+	{
+		// qSearch:memory:address;length;search-pattern
+		uint64_t addr;
+		uint32_t len;
+		auto delimiter1 = Converter::extract(payload, 15, ';', false, &addr);
+		if (delimiter1 == payload.npos)
+		{
+			sendError();
+			return;
+		}
+		auto delimiter2 = Converter::extract(payload, delimiter1 + 1, ';', false, &len);
+		if (delimiter2 == payload.npos)
+		{
+			sendError();
+			return;
+		}
+		std::string data = payload.substr(delimiter2 + 1);
+		std::vector<uint8_t> pattern(data.begin(), data.end());
+
+		bool found;
+		uint64_t foundAddr;
+		errno_t result = targetInterface.searchMemory(addr, len, pattern, &found, &foundAddr);
+		if (result != OK)
+			sendError(result);
+		else if (found)
+		{
+			std::stringstream stream;
+			stream << "1," << std::hex << foundAddr;
+			sendPacket(makePacket(stream.str()));
+		}
+		else
+			sendPacket(makePacket("0"));
+	}
 	else if (payload.find("qXfer:features:read:target.xml:0,") == 0)
 	{
 		// [TODO] fix offset, length
@@ -95,6 +207,47 @@ void RemoteSerialProtocol::processQuery(const std::string& payload)
 	}
 }
 
+void RemoteSerialProtocol::processSymbol(const std::string& payload)
+{
+	std::vector<std::string> names;
+	targetInterface.getSymbolRequests(&names);
+
+	if (payload == "qSymbol::")
+	{
+		// gdb がシンボルの問い合わせを受け付けられるようになった
+		symbolIndex = 0;
+	}
+	else
+	{
+		// qSymbol:<value>:<name>
+		auto delimiter = payload.find(':', 8);
+		if (delimiter == payload.npos)
+		{
+			sendError();
+			return;
+		}
+
+		std::string value = payload.substr(8, delimiter - 8);
+		std::vector<uint8_t> name = Converter::toByteArray(payload.substr(delimiter + 1));
+
+		uint64_t addr = 0;
+		if (value.size() > 0)
+			Converter::toInteger(value, &addr);
+		targetInterface.setSymbolValue(std::string(name.begin(), name.end()), value.size() > 0, addr);
+		symbolIndex++;
+	}
+
+	if (symbolIndex < names.size())
+	{
+		std::vector<uint8_t> name(names[symbolIndex].begin(), names[symbolIndex].end());
+		sendPacket(makePacket("qSymbol:" + Converter::toHex(name)));
+	}
+	else
+	{
+		sendOK();
+	}
+}
+
 void RemoteSerialProtocol::processBreakWatchPoint(const std::string& payload)
 {
 	if (payload[2] != ',')
@@ -109,6 +262,7 @@ void RemoteSerialProtocol::processBreakWatchPoint(const std::string& payload)
 	if (delimiter1 == payload.npos)
 	{
 		sendError();
+		return;
 	}
 
 	int32_t kind;
@@ -166,7 +320,7 @@ void RemoteSerialProtocol::processBreakWatchPoint(const std::string& payload)
 		}
 		else
 		{
-			sendOKorError(targetInterface.setWatchPoint(type, addr, kind));
+			sendOKorError(targetInterface.unsetWatchPoint(type, addr, kind));
 		}
 		break;
 	}
@@ -175,6 +329,126 @@ void RemoteSerialProtocol::processBreakWatchPoint(const std::string& payload)
 	}
 }
 
+void RemoteSerialProtocol::processVCont(const std::string& payload)
+{
+	if (payload == "vCont?")
+	{
+		sendPacket(makePacket("vCont;c;C;s;S;t;r"));
+		return;
+	}
+	if (payload.find("vCont;") != 0)
+	{
+		// vMustReplyEmpty など
+		sendNotSupported();
+		return;
+	}
+
+	std::vector<int32_t> ids;
+	targetInterface.getThreadIds(&ids);
+
+	// 各スレッドには最初に一致したアクションを適用する
+	std::map<int32_t, TargetInterface::ResumeAction> actions;
+	int32_t rangeThreadId = 0;
+	uint64_t rangeStart = 0, rangeEnd = 0;
+	std::stringstream stream(payload.substr(6));
+	std::string item;
+	while (std::getline(stream, item, ';'))
+	{
+		if (item.empty())
+			continue;
+
+		TargetInterface::ResumeAction action;
+		switch (item[0])
+		{
+		case 'c':
+		case 'C':
+			action = TargetInterface::ACTION_CONTINUE;
+			break;
+		case 's':
+		case 'S':
+			action = TargetInterface::ACTION_STEP;
+			break;
+		case 't':
+			action = TargetInterface::ACTION_STOP;
+			break;
+		case 'r':	// range step: r<start>,<end>
+			action = TargetInterface::ACTION_STEP;
+			break;
+		default:
+			sendError();
+			return;
+		}
+
+		int32_t id = -1;
+		auto delimiter = item.find(':');
+		if (delimiter != item.npos && !parseHex(item.substr(delimiter + 1), &id))
+		{
+			sendError();
+			return;
+		}
+
+		for (auto tid : ids)
+		{
+			if ((id <= 0 || id == tid) && actions.find(tid) == actions.end())
+			{
+				actions[tid] = action;
+				if (item[0] == 'r' && rangeThreadId == 0)
+				{
+					std::string range = item.substr(1, delimiter == item.npos ? item.npos : delimiter - 1);
+					auto comma = range.find(',');
+					if (comma == range.npos || !parseHex(range.substr(0, comma), &rangeStart) ||
+						!parseHex(range.substr(comma + 1), &rangeEnd))
+					{
+						sendError();
+						return;
+					}
+					rangeThreadId = tid;
+				}
+			}
+		}
+	}
+
+	if (actions.size() == 0)
+	{
+		sendError();
+		return;
+	}
+
+	uint8_t signal;
+
+	// all-stop mode: range step するスレッドがあれば他のスレッドは動かさない
+	if (rangeThreadId > 0)
+	{
+		range.active = true;
+		range.threadId = rangeThreadId;
+		range.start = rangeStart;
+		range.end = rangeEnd;
+		range.steps = 0;
+		interruptRequested = false;
+		interruptHandled = false;
+		continueRangeStep();
+		return;
+	}
+
+	bool stopped;
+	errno_t result = targetInterface.resume(actions, &stopped, &signal);
+	if (result != OK)
+	{
+		sendError(result);
+		return;
+	}
+
+	if (stopped)
+	{
+		sendStopReply(signal);
+	}
+	else
+	{
+		running = true;
+		targetResumed();
+	}
+}
+
 void RemoteSerialProtocol::processWriteMemory(const std::string& payload, bool isBinary)
 {
 	uint64_t addr;
@@ -210,23 +484,84 @@ void RemoteSerialProtocol::processWriteMemory(const std::string& payload, bool i
 	return;
 }
 
+void RemoteSerialProtocol::continueRangeStep()
+{
+	while (range.active)
+	{
+		// 区切りでは止まっているので, 0x03 を受信していればそのまま SIGINT で返す
+		if (interruptRequested.exchange(false))
+		{
+			range.active = false;
+			interruptHandled = true;
+			sendStopReply(0x02);	// SIGINT
+			return;
+		}
+
+		uint32_t count = MAX_RANGE_STEPS - range.steps < RANGE_STEP_CHUNK ? MAX_RANGE_STEPS - range.steps : RANGE_STEP_CHUNK;
+		bool done;
+		uint8_t signal;
+		errno_t result = targetInterface.rangeStep(range.threadId, range.start, range.end, count, &done, &signal);
+		range.steps += count;
+		if (result != OK)
+		{
+			range.active = false;
+			sendError(result);
+			return;
+		}
+
+		if (done || range.steps >= MAX_RANGE_STEPS)
+		{
+			range.active = false;
+			sendStopReply(signal);
+			return;
+		}
+
+		if (scheduleRangeStep())
+			return;
+	}
+}
+
 void RemoteSerialProtocol::interruptReceived()
 {
 	//sendAck();
 
+	// range step が既に止めて応答している
+	if (interruptHandled)
+	{
+		interruptHandled = false;
+		return;
+	}
+	interruptRequested = false;
+	range.active = false;
+
 	uint8_t signal;
 	int32_t result = targetInterface.interrupt(&signal);
 
 	if (result == 0)
 	{
 		//"T050B:EC3D0040;0D:E03D0040;0F:D8070040;"
-		sendPacket(makePacket("S" + Converter::toHex(signal)));
+		sendStopReply(signal);
 		running = false;
+		targetHalted();
 	}
 }
 
+// trace に出す名前. q, Q, v は区切りまでのコマンド名 (qSupported, vCont など), それ以外は先頭の 1 文字
+static std::string getTraceName(const std::string& payload)
+{
+	if (payload.empty())
+		return "";
+	if (payload[0] == 'q' || payload[0] == 'Q' || payload[0] == 'v')
+		return payload.substr(0, payload.find_first_of(":,;"));
+	return payload.substr(0, 1);
+}
+
 void RemoteSerialProtocol::packetReceived(const std::string& payload)
 {
+	// 記録していない間は名前を作らない
+	TRACE_SPAN(span, "rsp", Trace::isEnabled() ? getTraceName(payload) : std::string());
+	TRACE_ARG(span, "bytes", payload.size());
+
 	sendAck();
 
 	switch (payload[0])
@@ -238,7 +573,7 @@ void RemoteSerialProtocol::packetReceived(const std::string& payload)
 	}
 	case '?':
 	{
-		sendPacket(makePacket("S05"));
+		sendStopReply(0x05);
 		break;
 	}
 	case 'c':
@@ -249,6 +584,7 @@ void RemoteSerialProtocol::packetReceived(const std::string& payload)
 		}
 		targetInterface.resume();
 		running = true;
+		targetResumed();
 		break;
 	}
 	case 's':
@@ -260,13 +596,39 @@ void RemoteSerialProtocol::packetReceived(const std::string& payload)
 		uint8_t signal;
 		uint8_t result = targetInterface.step(&signal);
 		(void) result;
-		sendPacket(makePacket("S" + Converter::toHex(signal)));
+		sendStopReply(signal);
 		break;
 	}
 	case 'H':
 	{
-		threadId[payload[1]] = std::stoi(payload.substr(2), nullptr, 16);
-		sendOK();
+		int32_t id;
+		if (payload.length() < 3 || !parseHex(payload.substr(2), &id))
+		{
+			sendError();
+			break;
+		}
+		sendOKorError(targetInterface.setTargetThreadId(payload[1], id));
+		break;
+	}
+	case 'T':	// thread alive
+	{
+		int32_t id;
+		if (!parseHex(payload.substr(1), &id))
+		{
+			sendError();
+			break;
+		}
+		std::vector<int32_t> ids;
+		targetInterface.getThreadIds(&ids);
+		if (std::find(ids.begin(), ids.end(), id) != ids.end())
+			sendOK();
+		else
+			sendError();
+		break;
+	}
+	case 'v':
+	{
+		processVCont(payload);
 		break;
 	}
 	case 'g':	// read general registers
@@ -293,6 +655,16 @@ void RemoteSerialProtocol::packetReceived(const std::string& payload)
 	{
 		uint32_t n;
 		Converter::toInteger(payload.substr(1), &n);
+		if (targetInterface.getRegisterSize(n) == 8)
+		{
+			uint64_t value;
+			if (targetInterface.readRegister(n, &value) == OK)
+				sendPacket(makePacket(Converter::toHex(std::vector<uint32_t>({ (uint32_t)value, (uint32_t)(value >> 32) }))));
+			else
+				sendError();
+			break;
+		}
+
 		uint32_t value;
 		if (targetInterface.readRegister(n, &value) == OK)
 		{
@@ -309,6 +681,22 @@ void RemoteSerialProtocol::packetReceived(const std::string& payload)
 		// TODO 複数レジスタを指定されるとおかしくなる
 		uint32_t n;
 		auto delimiter = Converter::extract(payload, 1, '=', false, &n);
+		if (targetInterface.getRegisterSize(n) == 8)
+		{
+			// ターゲットのバイト順 (little endian) の 16 進数
+			auto bytes = Converter::toByteArray(payload.substr(delimiter + 1));
+			if (bytes.size() != 8)
+			{
+				sendError();
+				break;
+			}
+			uint64_t value = 0;
+			for (size_t i = 0; i < bytes.size(); i++)
+				value |= (uint64_t)bytes[i] << (i * 8);
+			sendOKorError(targetInterface.writeRegister(n, value));
+			break;
+		}
+
 		uint32_t value = std::stoi(payload.substr(delimiter + 1), nullptr, 16);
 
 		sendOKorError(targetInterface.writeRegister(n, value));
@@ -418,6 +806,22 @@ int32_t RemoteSerialProtocol::sendOKorError(errno_t error)
 	return sendPacket(packet);
 }
 
+int32_t RemoteSerialProtocol::sendStopReply(uint8_t signal)
+{
+	std::stringstream stream;
+	stream << "T" << Converter::toHex(signal) << "thread:" << std::hex << targetInterface.getCurrentThreadId() << ";";
+
+	bool hit;
+	TargetInterface::WatchPointType type;
+	uint64_t addr;
+	if (targetInterface.getStopWatchPoint(&hit, &type, &addr) == OK && hit)
+	{
+		stream << (type == TargetInterface::WRITE ? "watch" : type == TargetInterface::READ ? "rwatch" : "awatch")
+			<< ":" << std::hex << addr << ";";
+	}
+	return sendPacket(makePacket(stream.str()));
+}
+
 int32_t RemoteSerialProtocol::resend()
 {
 	return sendPacket(lastPacket);
@@ -429,6 +833,15 @@ int32_t RemoteSerialProtocol::sendPacket(const PacketTransfer::Packet& packet)
 	return send(packet.toString());
 }
 
+void RemoteSerialProtocol::stopDetected(uint8_t signal)
+{
+	if (running)
+	{
+		sendStopReply(signal);
+		running = false;
+	}
+}
+
 void RemoteSerialProtocol::idle()
 {
 	if (running)
@@ -439,7 +852,7 @@ void RemoteSerialProtocol::idle()
 		auto ret = targetInterface.isRunning(&_running, &signal);
 		if (ret == OK && _running == false)
 		{
-			sendPacket(makePacket("S" + Converter::toHex(signal)));
+			sendStopReply(signal);
 			running = false;
 		}
 	}
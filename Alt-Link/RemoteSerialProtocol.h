@@ -5,13 +5,22 @@
 #include "TargetInterface.h"
 
 #include <map>
+#include <atomic>
 
 class RemoteSerialProtocol : public PacketTransfer
 {
 public:
-	explicit RemoteSerialProtocol(TargetInterface& interface) : targetInterface(interface), attached(false) {}
+	explicit RemoteSerialProtocol(TargetInterface& interface)
+		: targetInterface(interface), attached(false), running(false), symbolIndex(0), range(), interruptRequested(false), interruptHandled(false) {}
 
 	void idle();
+	void stopDetected(uint8_t signal);	// 停止検出を外部で行う場合に idle() の代わりに使う
+	bool isTargetRunning() const { return running; }
+
+	// 受信側のスレッドから 0x03 を受信したことを知らせる. 実行中の range step は次の区切りで止まる
+	void requestInterrupt() { interruptRequested = true; }
+	// scheduleRangeStep() で後回しにした range step の続きを行う
+	void continueRangeStep();
 
 private:
 	virtual void requestResend();
@@ -21,7 +30,9 @@ private:
 
 	void processQuery(const std::string& payload);
 	void processBreakWatchPoint(const std::string& payload);
+	void processSymbol(const std::string& payload);
 	void processWriteMemory(const std::string& payload, bool isBinary = false);
+	void processVCont(const std::string& payload);
 
 	int32_t sendAck();
 	int32_t sendNack();
@@ -29,15 +40,37 @@ private:
 	int32_t sendError(errno_t error = EPERM);
 	int32_t sendOKorError(errno_t error);
 	int32_t sendNotSupported();
+	int32_t sendStopReply(uint8_t signal);
 	int32_t resend();
 	int32_t sendPacket(const PacketTransfer::Packet& packet);
 
 	PacketTransfer::Packet lastPacket;
 	TargetInterface& targetInterface;
-	std::map<char, int32_t> threadId;
 	bool attached;
 	bool running;
+	size_t symbolIndex;	// qSymbol で次に問い合わせるシンボル
+
+	// vCont;r は RANGE_STEP_CHUNK 回ずつに分けて step し, 間に他の要求を処理できるようにする
+	static const uint32_t RANGE_STEP_CHUNK = 128;
+	// 範囲内で無限ループしている場合にも gdb に制御を戻すための上限
+	static const uint32_t MAX_RANGE_STEPS = 100000;
+
+	struct RangeStep
+	{
+		bool active;
+		int32_t threadId;
+		uint64_t start;
+		uint64_t end;
+		uint32_t steps;
+	} range;
+	std::atomic<bool> interruptRequested;
+	bool interruptHandled;	// range step が 0x03 に対する停止を返した
 
 protected:
 	virtual int32_t send(const std::string& data) = 0;
+	virtual void targetResumed() {}
+	// RSP の要求でターゲットを止めた
+	virtual void targetHalted() {}
+	// range step の続きを後で continueRangeStep() で行う場合は true を返す. false ならその場で続ける
+	virtual bool scheduleRangeStep() { return false; }
 };
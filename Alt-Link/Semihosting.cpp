@@ -0,0 +1,225 @@
+#include "stdafx.h"
+#include "Semihosting.h"
+
+#include <cerrno>
+#include <ctime>
+
+Semihosting::Semihosting() : nextHandle(1), lastErrno(0), startTime(std::chrono::steady_clock::now())
+{
+}
+
+Semihosting::~Semihosting()
+{
+	closeAll();
+}
+
+uint32_t Semihosting::getParamCount(uint32_t op)
+{
+	switch (op)
+	{
+	case SYS_OPEN:			return 3;	// name, mode, name length
+	case SYS_CLOSE:			return 1;	// handle
+	case SYS_WRITE:			return 3;	// handle, buffer, length
+	case SYS_READ:			return 3;	// handle, buffer, length
+	case SYS_ISTTY:			return 1;	// handle
+	case SYS_SEEK:			return 2;	// handle, position
+	case SYS_FLEN:			return 1;	// handle
+	case SYS_REMOVE:		return 2;	// name, name length
+	case SYS_RENAME:		return 4;	// from, from length, to, to length
+	case SYS_GET_CMDLINE:	return 2;	// buffer, length
+	case SYS_HEAPINFO:		return 1;	// block
+	case SYS_EXIT_EXTENDED:	return 2;	// reason, subcode
+	default:				return 0;
+	}
+}
+
+Semihosting::File* Semihosting::find(int32_t handle)
+{
+	auto it = files.find(handle);
+	if (it == files.end())
+	{
+		lastErrno = EBADF;
+		return nullptr;
+	}
+	return &it->second;
+}
+
+int32_t Semihosting::open(const std::string& name, uint32_t mode)
+{
+	static const char* MODES[] = { "r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b" };
+	if (mode >= sizeof(MODES) / sizeof(MODES[0]))
+	{
+		lastErrno = EINVAL;
+		return -1;
+	}
+
+	File file;
+	if (name == ":tt")
+	{
+		// 読み込みは stdin, 書き込みは stdout, 追記は stderr
+		file.fp = mode < 4 ? stdin : (mode < 8 ? stdout : stderr);
+		file.tty = true;
+	}
+	else
+	{
+		file.fp = fopen(name.c_str(), MODES[mode]);
+		file.tty = false;
+		if (file.fp == nullptr)
+		{
+			lastErrno = errno;
+			return -1;
+		}
+	}
+
+	int32_t handle = nextHandle++;
+	files[handle] = file;
+	return handle;
+}
+
+int32_t Semihosting::close(int32_t handle)
+{
+	File* file = find(handle);
+	if (file == nullptr)
+		return -1;
+
+	if (!file->tty)
+		fclose(file->fp);
+	else
+		fflush(file->fp);
+	files.erase(handle);
+	return 0;
+}
+
+int32_t Semihosting::write(int32_t handle, const uint8_t* data, uint32_t len)
+{
+	File* file = find(handle);
+	if (file == nullptr)
+		return (int32_t)len;
+
+	size_t n = fwrite(data, 1, len, file->fp);
+	if (n < len)
+		lastErrno = errno;
+	if (file->tty)
+		fflush(file->fp);
+	return (int32_t)(len - n);
+}
+
+int32_t Semihosting::read(int32_t handle, uint8_t* data, uint32_t len, uint32_t* actual)
+{
+	*actual = 0;
+
+	File* file = find(handle);
+	if (file == nullptr)
+		return -1;
+
+	// tty は 1 行ずつ返す
+	size_t n = 0;
+	if (file->tty)
+	{
+		while (n < len)
+		{
+			int c = fgetc(file->fp);
+			if (c == EOF)
+				break;
+			data[n++] = (uint8_t)c;
+			if (c == '\n')
+				break;
+		}
+	}
+	else
+	{
+		n = fread(data, 1, len, file->fp);
+	}
+
+	if (n < len && ferror(file->fp))
+		lastErrno = errno;
+	*actual = (uint32_t)n;
+	return (int32_t)(len - n);
+}
+
+int32_t Semihosting::isTTY(int32_t handle)
+{
+	File* file = find(handle);
+	if (file == nullptr)
+		return -1;
+	return file->tty ? 1 : 0;
+}
+
+int32_t Semihosting::seek(int32_t handle, uint32_t pos)
+{
+	File* file = find(handle);
+	if (file == nullptr)
+		return -1;
+
+	if (fseek(file->fp, (long)pos, SEEK_SET) != 0)
+	{
+		lastErrno = errno;
+		return -1;
+	}
+	return 0;
+}
+
+int32_t Semihosting::getLength(int32_t handle)
+{
+	File* file = find(handle);
+	if (file == nullptr || file->tty)
+		return -1;
+
+	long cur = ftell(file->fp);
+	if (cur < 0 || fseek(file->fp, 0, SEEK_END) != 0)
+	{
+		lastErrno = errno;
+		return -1;
+	}
+	long len = ftell(file->fp);
+	fseek(file->fp, cur, SEEK_SET);
+	return (int32_t)len;
+}
+
+int32_t Semihosting::remove(const std::string& name)
+{
+	if (::remove(name.c_str()) != 0)
+	{
+		lastErrno = errno;
+		return -1;
+	}
+	return 0;
+}
+
+int32_t Semihosting::rename(const std::string& from, const std::string& to)
+{
+	if (::rename(from.c_str(), to.c_str()) != 0)
+	{
+		lastErrno = errno;
+		return -1;
+	}
+	return 0;
+}
+
+int32_t Semihosting::getClock()
+{
+	// 1/100 秒単位
+	auto elapsed = std::chrono::steady_clock::now() - startTime;
+	return (int32_t)(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 10);
+}
+
+int32_t Semihosting::getTime()
+{
+	return (int32_t)time(nullptr);
+}
+
+void Semihosting::writeConsole(const uint8_t* data, uint32_t len)
+{
+	fwrite(data, 1, len, stdout);
+	fflush(stdout);
+}
+
+void Semihosting::closeAll()
+{
+	for (auto& f : files)
+	{
+		if (!f.second.tty)
+			fclose(f.second.fp);
+	}
+	files.clear();
+}
@@ -0,0 +1,83 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <chrono>
+
+// ARM semihosting のホスト側の処理 (ファイルハンドルの管理と各操作の実行)
+// ターゲットとの転送は ADIv5TI が行い, ここではホストのファイルを操作するだけ
+class Semihosting
+{
+public:
+	enum Operation : uint32_t
+	{
+		SYS_OPEN			= 0x01,
+		SYS_CLOSE			= 0x02,
+		SYS_WRITEC			= 0x03,
+		SYS_WRITE0			= 0x04,
+		SYS_WRITE			= 0x05,
+		SYS_READ			= 0x06,
+		SYS_READC			= 0x07,
+		SYS_ISERROR			= 0x08,
+		SYS_ISTTY			= 0x09,
+		SYS_SEEK			= 0x0A,
+		SYS_FLEN			= 0x0C,
+		SYS_TMPNAM			= 0x0D,
+		SYS_REMOVE			= 0x0E,
+		SYS_RENAME			= 0x0F,
+		SYS_CLOCK			= 0x10,
+		SYS_TIME			= 0x11,
+		SYS_SYSTEM			= 0x12,
+		SYS_ERRNO			= 0x13,
+		SYS_GET_CMDLINE		= 0x15,
+		SYS_HEAPINFO		= 0x16,
+		SYS_EXIT			= 0x18,
+		SYS_EXIT_EXTENDED	= 0x20,
+		SYS_ELAPSED			= 0x30,
+		SYS_TICKFREQ		= 0x31
+	};
+
+	static const uint16_t BKPT_INSTRUCTION = 0xBEAB;	// BKPT 0xAB (Thumb)
+
+	Semihosting();
+	virtual ~Semihosting();
+
+	// R1 が指すパラメータブロックのワード数
+	static uint32_t getParamCount(uint32_t op);
+
+	// 戻り値は R0 に返す値
+	int32_t open(const std::string& name, uint32_t mode);
+	int32_t close(int32_t handle);
+	int32_t write(int32_t handle, const uint8_t* data, uint32_t len);	// 書けなかったバイト数
+	int32_t read(int32_t handle, uint8_t* data, uint32_t len, uint32_t* actual);	// 読めなかったバイト数
+	int32_t isTTY(int32_t handle);
+	int32_t seek(int32_t handle, uint32_t pos);
+	int32_t getLength(int32_t handle);
+	int32_t remove(const std::string& name);
+	int32_t rename(const std::string& from, const std::string& to);
+	int32_t getClock();
+	int32_t getTime();
+	int32_t getErrno() const { return lastErrno; }
+
+	// SYS_WRITEC, SYS_WRITE0 の出力先
+	void writeConsole(const uint8_t* data, uint32_t len);
+
+	void closeAll();
+
+private:
+	struct File
+	{
+		FILE* fp;
+		bool tty;
+	};
+
+	std::map<int32_t, File> files;
+	int32_t nextHandle;
+	int32_t lastErrno;
+	std::chrono::steady_clock::time_point startTime;
+
+	File* find(int32_t handle);
+};
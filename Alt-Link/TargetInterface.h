@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <vector>
+#include <map>
+#include <string>
 #include <errno.h>
 
 class TargetInterface
@@ -11,7 +13,10 @@ public:
 	virtual int32_t attach() = 0;
 	virtual void detach() = 0;
 
-	virtual void setTargetThreadId() = 0;
+	// thread id: 1 - N, 0: any thread, -1: all threads
+	virtual void getThreadIds(std::vector<int32_t>* ids) = 0;
+	virtual int32_t getCurrentThreadId() = 0;
+	virtual errno_t setTargetThreadId(char op, int32_t threadId) = 0;	// op: 'g' (register), 'c' (step, continue)
 	virtual void setCurrentPC(const uint64_t addr) = 0;
 
 	virtual void resume() = 0;
@@ -19,6 +24,19 @@ public:
 	virtual int32_t interrupt(uint8_t* signal) = 0;
 	virtual errno_t isRunning(bool* running, uint8_t* signal) = 0;
 
+	enum ResumeAction
+	{
+		ACTION_NONE,
+		ACTION_CONTINUE,
+		ACTION_STEP,
+		ACTION_STOP
+	};
+	// stopped が true になった場合は getCurrentThreadId() が停止したスレッドを返す
+	virtual errno_t resume(const std::map<int32_t, ResumeAction>& actions, bool* stopped, uint8_t* signal) = 0;
+	// PC が [start, end) の範囲にある間 step を続け, 範囲外に出るか停止要因があった時点で done = true で戻る
+	// maxSteps 回 step しても範囲内にある場合は done = false で戻る. 続ける場合は再度呼ぶ
+	virtual errno_t rangeStep(int32_t threadId, uint64_t start, uint64_t end, uint32_t maxSteps, bool* done, uint8_t* signal) = 0;
+
 	enum BreakPointType
 	{
 		MEMORY = 0,
@@ -41,6 +59,8 @@ public:
 	};
 	virtual int32_t setWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind) = 0;
 	virtual int32_t unsetWatchPoint(WatchPointType type, uint64_t addr, uint32_t kind) = 0;
+	// 直前の停止が watchpoint によるものなら hit = true
+	virtual errno_t getStopWatchPoint(bool* hit, WatchPointType* type, uint64_t* addr) = 0;
 
 	virtual errno_t readRegister(const uint32_t n, uint32_t* out) = 0;
 	virtual errno_t readRegister(const uint32_t n, uint64_t* out) = 0;
@@ -48,14 +68,21 @@ public:
 	virtual errno_t writeRegister(const uint32_t n, const uint32_t data) = 0;
 	virtual errno_t writeRegister(const uint32_t n, const uint64_t data) = 0;
 	virtual errno_t writeRegister(const uint32_t n, const uint64_t data1, const uint64_t data2) = 0; // 128-bit
+	virtual uint32_t getRegisterSize(const uint32_t n) = 0;	// byte
 	virtual errno_t readGenericRegisters(std::vector<uint32_t>* array) = 0;
 	virtual errno_t writeGenericRegisters(const std::vector<uint32_t>& array) = 0;
 
 	virtual errno_t readMemory(uint64_t addr, uint32_t len, std::vector<uint8_t>* array) = 0;
 	virtual errno_t readMemory(uint64_t addr, uint32_t len, std::vector<uint32_t>* array) = 0;
 	virtual errno_t writeMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& array) = 0;
+	virtual errno_t calcCRC32(uint64_t addr, uint32_t len, uint32_t* crc) = 0;
+	virtual errno_t searchMemory(uint64_t addr, uint32_t len, const std::vector<uint8_t>& pattern, bool* found, uint64_t* foundAddr) = 0;
 
 	virtual errno_t monitor(const std::string command, std::string* output) = 0;
 
+	// qSymbol で gdb に問い合わせるシンボル
+	virtual void getSymbolRequests(std::vector<std::string>* names) = 0;
+	virtual void setSymbolValue(const std::string& name, bool found, uint64_t value) = 0;
+
 	virtual std::string targetXml(uint32_t offset, uint32_t length) = 0;
 };
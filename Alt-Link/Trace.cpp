@@ -0,0 +1,213 @@
+#include "stdafx.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::enabled(false);
+
+namespace
+{
+	struct Buffer
+	{
+		std::mutex mutex;		// 記録するスレッドと dump が取り合うだけなので, ほぼ競合しない
+		std::vector<Trace::Event> events;
+		uint64_t count = 0;
+		uint32_t tid = 0;
+		std::string threadName;
+	};
+
+	// スレッドが終わっても dump できるよう, バッファは一覧で保持する
+	std::mutex registryMutex;
+	std::vector<std::shared_ptr<Buffer>> registry;
+	uint32_t nextTid = 1;
+
+	thread_local std::shared_ptr<Buffer> local;
+
+	Buffer& getBuffer()
+	{
+		if (!local)
+		{
+			local = std::make_shared<Buffer>();
+			std::lock_guard<std::mutex> lock(registryMutex);
+			local->tid = nextTid++;
+			registry.push_back(local);
+		}
+		return *local;
+	}
+
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+	struct Record
+	{
+		const Trace::Event* event;
+		uint32_t tid;
+
+		template <class Archive>
+		void save(Archive & archive) const
+		{
+			std::string name = event->name;
+			std::string cat = event->category;
+			std::string ph = "X";
+			double ts = event->start / 1000.0;		// us
+			double dur = event->duration / 1000.0;
+			uint32_t pid = 1;
+			archive(CEREAL_NVP(name), CEREAL_NVP(cat), CEREAL_NVP(ph), CEREAL_NVP(ts), CEREAL_NVP(dur), CEREAL_NVP(pid), CEREAL_NVP(tid));
+
+			archive.setNextName("args");
+			archive.startNode();
+			for (uint32_t i = 0; i < event->argCount; i++)
+				archive(::cereal::make_nvp(event->argNames[i], event->argValues[i]));
+			archive.finishNode();
+		}
+	};
+
+	// スレッド名のメタデータ
+	struct ThreadName
+	{
+		std::string threadName;
+		uint32_t tid;
+
+		template <class Archive>
+		void save(Archive & archive) const
+		{
+			std::string name = "thread_name";
+			std::string ph = "M";
+			uint32_t pid = 1;
+			archive(CEREAL_NVP(name), CEREAL_NVP(ph), CEREAL_NVP(pid), CEREAL_NVP(tid));
+
+			archive.setNextName("args");
+			archive.startNode();
+			archive(::cereal::make_nvp("name", threadName));
+			archive.finishNode();
+		}
+	};
+}
+
+Trace::Span::Span(const char* category, const char* name) : active(isEnabled())
+{
+	if (!active)
+		return;
+
+	event.category = category;
+	strncpy(event.name, name, NAME_SIZE - 1);
+	event.name[NAME_SIZE - 1] = '\0';
+	event.argCount = 0;
+	event.start = now();
+}
+
+Trace::Span::~Span()
+{
+	if (!active)
+		return;
+
+	event.duration = now() - event.start;
+	record(event);
+}
+
+void Trace::Span::arg(const char* name, uint64_t value)
+{
+	if (!active || event.argCount >= MAX_ARGS)
+		return;
+
+	event.argNames[event.argCount] = name;
+	event.argValues[event.argCount] = value;
+	event.argCount++;
+}
+
+uint64_t Trace::now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Trace::record(const Event& event)
+{
+	Buffer& buffer = getBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	if (buffer.events.size() < BUFFER_SIZE)
+		buffer.events.push_back(event);
+	else
+		buffer.events[buffer.count % BUFFER_SIZE] = event;
+	buffer.count++;
+}
+
+void Trace::clear()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	// 終了したスレッドのバッファは捨てる
+	registry.erase(std::remove_if(registry.begin(), registry.end(),
+		[](const std::shared_ptr<Buffer>& buffer) { return buffer.use_count() == 1; }), registry.end());
+
+	for (auto& buffer : registry)
+	{
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		buffer->events.clear();
+		buffer->events.shrink_to_fit();
+		buffer->count = 0;
+	}
+}
+
+void Trace::setThreadName(const std::string& name)
+{
+	Buffer& buffer = getBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.threadName = name;
+}
+
+void Trace::getStatus(uint64_t* recorded, uint64_t* dropped)
+{
+	ASSERT_RELEASE(recorded != nullptr && dropped != nullptr);
+
+	*recorded = 0;
+	*dropped = 0;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	for (auto& buffer : registry)
+	{
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		*recorded += buffer->count;
+		if (buffer->count > BUFFER_SIZE)
+			*dropped += buffer->count - BUFFER_SIZE;
+	}
+}
+
+void Trace::dump(std::ostream& out)
+{
+	// 書き出しの間も記録を止めないよう, 先にコピーする
+	std::vector<Event> events;
+	std::vector<Record> records;
+	std::vector<ThreadName> threads;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		for (auto& buffer : registry)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			size_t size = buffer->events.size();
+			size_t oldest = buffer->count > size ? (size_t)(buffer->count % size) : 0;
+			for (size_t i = 0; i < size; i++)
+				events.push_back(buffer->events[(oldest + i) % size]);
+			records.resize(events.size(), { nullptr, buffer->tid });
+
+			if (!buffer->threadName.empty())
+				threads.push_back({ buffer->threadName, buffer->tid });
+		}
+	}
+	for (size_t i = 0; i < records.size(); i++)
+		records[i].event = &events[i];
+
+	cereal::JSONOutputArchive archive(out, cereal::JSONOutputArchive::Options::NoIndent());
+	archive.setNextName("traceEvents");
+	archive.startNode();
+	archive.makeArray();
+	for (auto& t : threads)
+		archive(t);
+	for (auto& r : records)
+		archive(r);
+	archive.finishNode();
+	archive(::cereal::make_nvp("displayTimeUnit", std::string("ns")));
+}
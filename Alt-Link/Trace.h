@@ -0,0 +1,76 @@
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <ostream>
+#include <string>
+
+// 0 にすると TRACE_SPAN / TRACE_ARG は空になり, 計測のコードは一切残らない
+#ifndef USE_TRACE
+#define USE_TRACE 1
+#endif
+
+// 処理の区間 (span) をスレッドごとのリングバッファに記録し, Chrome trace 形式 (Perfetto でも読める) で出力する
+// 記録は start() から stop() まで. バッファが一杯になると古いものから上書きする
+class Trace
+{
+public:
+	static const uint32_t MAX_ARGS = 3;
+	static const uint32_t NAME_SIZE = 24;
+	static const uint32_t BUFFER_SIZE = 8192;	// スレッドごとの event 数
+
+	struct Event
+	{
+		const char* category;		// 文字列リテラルのみ
+		char name[NAME_SIZE];
+		uint64_t start;				// ns
+		uint64_t duration;			// ns
+		uint32_t argCount;
+		const char* argNames[MAX_ARGS];	// 文字列リテラルのみ
+		uint64_t argValues[MAX_ARGS];
+	};
+
+	class Span
+	{
+	public:
+		Span(const char* category, const char* name);
+		Span(const char* category, const std::string& name) : Span(category, name.c_str()) {}
+		~Span();
+
+		void arg(const char* name, uint64_t value);
+
+	private:
+		bool active;
+		Event event;
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+	};
+
+	static void start() { enabled.store(true, std::memory_order_relaxed); }
+	static void stop() { enabled.store(false, std::memory_order_relaxed); }
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+	static void clear();
+
+	// 以降このスレッドの event に付けるスレッド名
+	static void setThreadName(const std::string& name);
+
+	// recorded: 記録した数, dropped: 上書きで失った数
+	static void getStatus(uint64_t* recorded, uint64_t* dropped);
+	static void dump(std::ostream& out);
+
+private:
+	static std::atomic<bool> enabled;
+
+	static uint64_t now();
+	static void record(const Event& event);
+};
+
+#if USE_TRACE
+#define TRACE_SPAN(var, category, name) Trace::Span var(category, name)
+#define TRACE_ARG(var, name, value) var.arg(name, (uint64_t)(value))
+#else
+#define TRACE_SPAN(var, category, name)
+#define TRACE_ARG(var, name, value)
+#endif
@@ -0,0 +1,235 @@
+#include "stdafx.h"
+#include "Watch.h"
+
+#include <algorithm>
+
+Watch::Watch(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor)
+	: ti(_ti), executor(_executor), intervalUs(MIN_INTERVAL_US), nextId(1), blockBytes(0), status()
+{
+}
+
+Watch::~Watch()
+{
+	stop();
+}
+
+std::vector<Watch::Block> Watch::coalesce(const std::map<uint32_t, Entry>& entries, uint32_t* bytes)
+{
+	// 各変数を含むワードの範囲をアドレス順に並べ, 重なるものと隙間が MAX_GAP 以下のものをつなげる
+	std::vector<Block> ranges;
+	for (auto& e : entries)
+	{
+		uint64_t start = e.second.var.addr & ~3ULL;
+		uint64_t end = (e.second.var.addr + e.second.var.size + 3) & ~3ULL;
+		ranges.push_back({ start, (uint32_t)(end - start) });
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const Block& a, const Block& b) { return a.addr < b.addr; });
+
+	std::vector<Block> blocks;
+	*bytes = 0;
+	for (auto& r : ranges)
+	{
+		if (blocks.size() > 0)
+		{
+			Block& last = blocks.back();
+			uint64_t lastEnd = last.addr + last.size;
+			if (r.addr <= lastEnd + MAX_GAP)
+			{
+				uint64_t end = std::max(lastEnd, r.addr + r.size);
+				*bytes += (uint32_t)(end - lastEnd);
+				last.size = (uint32_t)(end - last.addr);
+				continue;
+			}
+		}
+		blocks.push_back(r);
+		*bytes += r.size;
+	}
+	return blocks;
+}
+
+errno_t Watch::add(uint64_t addr, uint32_t size, uint32_t* id)
+{
+	ASSERT_RELEASE(id != nullptr);
+
+	if ((size != 1 && size != 2 && size != 4) || addr + size > 0x100000000ULL)
+		return EINVAL;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto next = entries;
+	next[nextId] = { { nextId, addr, size }, false, 0 };
+
+	uint32_t bytes;
+	auto nextBlocks = coalesce(next, &bytes);
+	if (bytes > MAX_SAMPLE_BYTES)
+		return ENOSPC;
+
+	*id = nextId++;
+	entries.swap(next);
+	blocks.swap(nextBlocks);
+	blockBytes = bytes;
+	return OK;
+}
+
+errno_t Watch::remove(uint32_t id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (entries.erase(id) == 0)
+		return ENOENT;
+
+	blocks = coalesce(entries, &blockBytes);
+	return OK;
+}
+
+void Watch::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	blocks.clear();
+	blockBytes = 0;
+}
+
+std::vector<Watch::Variable> Watch::getVariables()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Variable> vars;
+	for (auto& e : entries)
+		vars.push_back(e.second.var);
+	return vars;
+}
+
+std::vector<Watch::Value> Watch::getValues()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Value> values;
+	for (auto& e : entries)
+	{
+		if (e.second.valid)
+			values.push_back({ e.first, e.second.value });
+	}
+	return values;
+}
+
+errno_t Watch::start(uint32_t _intervalUs)
+{
+	return startThread([this, _intervalUs]()
+	{
+		intervalUs = _intervalUs < MIN_INTERVAL_US ? MIN_INTERVAL_US : _intervalUs;
+		return (errno_t)OK;
+	}, [this]() { run(); });
+}
+
+Watch::Status Watch::getStatus()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Status s = status;
+	s.running = running.load();
+	s.intervalUs = intervalUs;
+	s.variables = (uint32_t)entries.size();
+	s.blocks = (uint32_t)blocks.size();
+	s.bytes = blockBytes;
+	return s;
+}
+
+uint32_t Watch::subscribe(Listener listener)
+{
+	return listeners.add(listener);
+}
+
+void Watch::unsubscribe(uint32_t id)
+{
+	listeners.remove(id);
+}
+
+void Watch::run()
+{
+	auto startTime = std::chrono::steady_clock::now();
+	auto next = startTime;
+	auto interval = std::chrono::microseconds(intervalUs);
+	bool failing = false;
+
+	while (running.load())
+	{
+		next += interval;
+		std::this_thread::sleep_until(next);
+
+		std::vector<Block> plan;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			plan = blocks;
+		}
+		if (plan.size() == 0)
+			continue;
+
+		// 全ブロックを 1 つのタスクで読む. RSP の要求は前後に入る
+		auto sampleStart = std::chrono::steady_clock::now();
+		std::vector<std::vector<uint8_t>> data(plan.size());
+		errno_t ret = executor->execute(Executor::PRIORITY_BACKGROUND, [&]()
+		{
+			for (size_t i = 0; i < plan.size(); i++)
+			{
+				data[i].reserve(plan[i].size);
+				errno_t ret = ti->readMemory(plan[i].addr, plan[i].size, &data[i]);
+				if (ret != OK)
+					return ret;
+				if (data[i].size() != plan[i].size)
+					return EIO;
+			}
+			return (errno_t)OK;
+		});
+		auto now = std::chrono::steady_clock::now();
+
+		// 転送が間に合わなかった周期は読み飛ばし, 転送に使う時間が周期の半分以下になるよう次を遅らせる
+		auto earliest = now + (now - sampleStart);
+		bool late = next + interval < earliest;
+		if (late)
+			next = earliest - interval;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		status.lastSampleUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - sampleStart).count();
+		if (late)
+			status.skipped++;
+
+		if (ret != OK)
+		{
+			// 止まらずに次の周期で読み直す. エラーの表示は続いている間 1 回だけにする
+			if (!failing)
+				_ERRPRT("Failed to read watch variables. (0x%08x)\n", ret);
+			failing = true;
+			status.errors++;
+			continue;
+		}
+		failing = false;
+		status.samples++;
+
+		Sample sample;
+		sample.timeUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - startTime).count();
+		for (auto& e : entries)
+		{
+			// 読んでいる間に追加されたものは次の周期で読む
+			const Variable& var = e.second.var;
+			auto it = std::upper_bound(plan.begin(), plan.end(), var.addr, [](uint64_t addr, const Block& b) { return addr < b.addr; });
+			if (it == plan.begin())
+				continue;
+			--it;
+			if (var.addr + var.size > it->addr + it->size)
+				continue;
+
+			const uint8_t* p = data[it - plan.begin()].data() + (var.addr - it->addr);
+			uint32_t value = 0;
+			for (uint32_t b = 0; b < var.size; b++)
+				value |= (uint32_t)p[b] << (b * 8);
+
+			if (!e.second.valid || e.second.value != value)
+			{
+				e.second.valid = true;
+				e.second.value = value;
+				sample.values.push_back({ e.first, value });
+			}
+		}
+
+		if (sample.values.size() == 0)
+			continue;
+
+		listeners.notify(sample);
+	}
+}
@@ -0,0 +1,125 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include "ADIv5TI.h"
+#include "Executor.h"
+#include "PollingService.h"
+
+// 登録した変数をコアを止めずに (MEM-AP 経由で) 一定間隔で読み, 値が変わったものだけを購読者に配信する
+// 散らばったアドレスはワード境界に揃えてまとめ, 近いものは間も含めて 1 回のブロック転送で読む
+// 1 回に読むバイト数と間隔に上限を設け, 転送に使う時間が周期の半分を超えないよう間隔を延ばす
+class Watch : public PollingService
+{
+public:
+	struct Variable
+	{
+		uint32_t id;
+		uint64_t addr;
+		uint32_t size;		// 1, 2, 4
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(id), CEREAL_NVP(addr), CEREAL_NVP(size));
+		}
+	};
+
+	struct Value
+	{
+		uint32_t id;
+		uint32_t value;
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(id), CEREAL_NVP(value));
+		}
+	};
+
+	struct Sample
+	{
+		uint64_t timeUs;	// start() からの経過時間
+		std::vector<Value> values;	// 前回から変わったもの (初回はすべて)
+	};
+
+	struct Status
+	{
+		bool running;
+		uint32_t intervalUs;
+		uint32_t variables;
+		uint32_t blocks;		// 1 回のサンプルで行うブロック転送の数
+		uint32_t bytes;			// 1 回のサンプルで読むバイト数
+		uint64_t samples;
+		uint64_t skipped;		// 転送が間に合わずに飛ばした周期
+		uint64_t errors;
+		uint64_t lastSampleUs;	// 最後のサンプルの転送時間
+
+		template <class Archive>
+		void serialize(Archive & archive)
+		{
+			archive(CEREAL_NVP(running), CEREAL_NVP(intervalUs), CEREAL_NVP(variables), CEREAL_NVP(blocks),
+				CEREAL_NVP(bytes), CEREAL_NVP(samples), CEREAL_NVP(skipped), CEREAL_NVP(errors), CEREAL_NVP(lastSampleUs));
+		}
+	};
+
+	typedef std::function<void(const Sample&)> Listener;
+
+	static const uint32_t MIN_INTERVAL_US = 10000;	// 100 Hz
+	static const uint32_t MAX_SAMPLE_BYTES = 2048;	// 1 回のサンプルで読むバイト数の上限
+	static const uint32_t MAX_GAP = 32;				// これ以下の隙間は間も読んで 1 つのブロックにまとめる
+
+	Watch(std::shared_ptr<ADIv5TI> _ti, std::shared_ptr<Executor> _executor);
+	virtual ~Watch();
+
+	// 読むバイト数が MAX_SAMPLE_BYTES を超える場合は ENOSPC
+	errno_t add(uint64_t addr, uint32_t size, uint32_t* id);
+	errno_t remove(uint32_t id);
+	void clear();
+	std::vector<Variable> getVariables();
+	// 最後に読めた値 (まだ読んでいないものは含まない)
+	std::vector<Value> getValues();
+
+	errno_t start(uint32_t intervalUs);
+
+	Status getStatus();
+	std::shared_ptr<ADIv5TI> getTI() const { return ti; }
+
+	uint32_t subscribe(Listener listener);
+	void unsubscribe(uint32_t id);
+
+private:
+	struct Block
+	{
+		uint64_t addr;
+		uint32_t size;
+	};
+
+	struct Entry
+	{
+		Variable var;
+		bool valid;		// value を一度でも読めたか
+		uint32_t value;
+	};
+
+	std::shared_ptr<ADIv5TI> ti;
+	std::shared_ptr<Executor> executor;
+	uint32_t intervalUs;
+	ListenerMap<Listener> listeners;
+
+	std::mutex mutex;	// 以下を保護する
+	std::map<uint32_t, Entry> entries;
+	uint32_t nextId;
+	std::vector<Block> blocks;
+	uint32_t blockBytes;
+	Status status;
+
+	static std::vector<Block> coalesce(const std::map<uint32_t, Entry>& entries, uint32_t* bytes);
+	void run();
+};
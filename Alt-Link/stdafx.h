@@ -21,7 +21,9 @@
 
 #define POCO_STATIC
 
-#define _DBGPRT printf
-#define _ERRPRT printf
-
 typedef int errno_t;
+
+#include "Log.h"
+
+#define _DBGPRT(...) LOG_DEBUG(LOG_SUBSYSTEM, __VA_ARGS__)
+#define _ERRPRT(...) LOG_ERROR(LOG_SUBSYSTEM, __VA_ARGS__)